@@ -0,0 +1,1340 @@
+/*
+ *  consistencytest.cpp
+ *  BEAGLE
+ *
+ *  Checks library features against the plain calls they stand in for or speed up, mostly by
+ *  comparing log likelihoods on a small simulated data set.
+ *
+ *  Running all checks, or only some of them:
+ *      consistencytest [async ...]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/VectorLog.h"
+
+#define TIP_COUNT       8
+#define NODE_COUNT      (2 * TIP_COUNT - 1)
+#define ROOT_INDEX      (NODE_COUNT - 1)
+#define PATTERN_COUNT   2048
+#define STATE_COUNT     4
+#define CATEGORY_COUNT  4
+
+// balanced tree, node i is partials buffer i and the edge above it uses matrix i
+static const int parentIndices[NODE_COUNT] = {
+    8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13, 14, 14, BEAGLE_OP_NONE
+};
+
+static const double edgeLengths[NODE_COUNT - 1] = {
+    0.05, 0.12, 0.08, 0.21, 0.03, 0.17, 0.09, 0.11, 0.04, 0.06, 0.15, 0.02, 0.07, 0.10
+};
+
+// the scale factors of internal node i go to scale buffer i - TIP_COUNT
+static const int cumulativeScaleIndex = TIP_COUNT - 1;
+
+static int failureCount = 0;
+
+// the path of this program, run again in a child process by the checks that need a fresh library
+static const char* programPath = NULL;
+
+static unsigned int randomSeed = 1;
+
+int nextRandom(int n) {
+    randomSeed = randomSeed * 1103515245 + 12345;
+    return (int) ((randomSeed / 65536) % 32768) % n;
+}
+
+/// simulated states, with a few gaps, for TIP_COUNT tips
+std::vector<int> getStates() {
+    randomSeed = 1;
+    std::vector<int> states(TIP_COUNT * PATTERN_COUNT);
+    for (int k = 0; k < PATTERN_COUNT; k++) {
+        const int common = nextRandom(STATE_COUNT);
+        for (int i = 0; i < TIP_COUNT; i++) {
+            int state = (nextRandom(3) == 0 ? nextRandom(STATE_COUNT) : common);
+            if (nextRandom(20) == 0)
+                state = STATE_COUNT;
+            states[i * PATTERN_COUNT + k] = state;
+        }
+    }
+    return states;
+}
+
+int createInstance(int categoryCount,
+                   long preferenceFlags,
+                   long requirementFlags,
+                   BeagleInstanceDetails* details) {
+    return beagleCreateInstance(TIP_COUNT,                      // tipCount
+                                NODE_COUNT + 1,                 // partialsBufferCount
+                                TIP_COUNT,                      // compactBufferCount
+                                STATE_COUNT,                    // stateCount
+                                PATTERN_COUNT,                  // patternCount
+                                1,                              // eigenBufferCount
+                                NODE_COUNT + 4,                 // matrixBufferCount
+                                categoryCount,                  // categoryCount
+                                TIP_COUNT,                      // scaleBufferCount
+                                NULL,                           // resourceList
+                                0,                              // resourceCount
+                                BEAGLE_FLAG_SCALING_MANUAL | preferenceFlags,
+                                requirementFlags,
+                                details);
+}
+
+/// sets the JC69 model with gamma rate categories; categories past CATEGORY_COUNT have rate zero.
+/// The eigen decomposition, frequencies and weights go to each of the first eigenBufferCount buffers
+void setModel(int instance, int categoryCount, int eigenBufferCount = 1) {
+    // an eigen decomposition for the JC69 model
+    double evec[4 * 4] = {
+        1.0,  2.0,  0.0,  0.5,
+        1.0,  -2.0,  0.5,  0.0,
+        1.0,  2.0, 0.0,  -0.5,
+        1.0,  -2.0,  -0.5,  0.0
+    };
+
+    double ivec[4 * 4] = {
+        0.25,  0.25,  0.25,  0.25,
+        0.125,  -0.125,  0.125,  -0.125,
+        0.0,  1.0,  0.0,  -1.0,
+        1.0,  0.0,  -1.0,  0.0
+    };
+
+    double eval[4] = { 0.0, -1.3333333333333333, -1.3333333333333333, -1.3333333333333333 };
+
+    double freqs[4] = { 0.25, 0.25, 0.25, 0.25 };
+    double gammaRates[CATEGORY_COUNT] = { 0.03338775, 0.25191592, 0.82026848, 2.89442785 };
+    std::vector<double> rates(categoryCount, 0.0);
+    std::vector<double> weights(categoryCount, 1.0 / categoryCount);
+    std::vector<double> patternWeights(PATTERN_COUNT, 1.0);
+    for (int i = 0; i < categoryCount && i < CATEGORY_COUNT; i++)
+        rates[i] = gammaRates[i];
+
+    for (int i = 0; i < eigenBufferCount; i++) {
+        beagleSetEigenDecomposition(instance, i, evec, ivec, eval);
+        beagleSetStateFrequencies(instance, i, freqs);
+        beagleSetCategoryWeights(instance, i, &weights[0]);
+    }
+    beagleSetCategoryRates(instance, &rates[0]);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+}
+
+void setTipStates(int instance, const std::vector<int>& states) {
+    for (int i = 0; i < TIP_COUNT; i++)
+        beagleSetTipStates(instance, i, &states[i * PATTERN_COUNT]);
+}
+
+/// a CPU instance in double precision, with the model set
+int createModelInstance() {
+    BeagleInstanceDetails details;
+    int instance = createInstance(CATEGORY_COUNT, 0,
+                                  BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                  &details);
+    if (instance < 0) {
+        fprintf(stderr, "Failed to obtain BEAGLE instance: error %d\n", instance);
+        exit(1);
+    }
+
+    setModel(instance, CATEGORY_COUNT);
+    return instance;
+}
+
+/// a CPU instance in double precision, with the model and tip states set
+int createModelInstance(const std::vector<int>& states) {
+    int instance = createModelInstance();
+    setTipStates(instance, states);
+    return instance;
+}
+
+/// the operations of the whole tree in post-order, scaling at every internal node
+std::vector<BeagleOperation> getOperations() {
+    std::vector<BeagleOperation> operations;
+    for (int node = TIP_COUNT; node < NODE_COUNT; node++) {
+        BeagleOperation operation;
+        operation.destinationPartials = node;
+        operation.destinationScaleWrite = node - TIP_COUNT;
+        operation.destinationScaleRead = BEAGLE_OP_NONE;
+        operation.child1Partials = -1;
+        operation.child2Partials = -1;
+        for (int i = 0; i < node; i++) {
+            if (parentIndices[i] == node) {
+                if (operation.child1Partials < 0)
+                    operation.child1Partials = i;
+                else
+                    operation.child2Partials = i;
+            }
+        }
+        operation.child1TransitionMatrix = operation.child1Partials;
+        operation.child2TransitionMatrix = operation.child2Partials;
+        operations.push_back(operation);
+    }
+    return operations;
+}
+
+double calculateRootLogLikelihood(int instance) {
+    int rootIndex = ROOT_INDEX;
+    int weightsIndex = 0;
+    int frequenciesIndex = 0;
+    int scaleIndex = cumulativeScaleIndex;
+    double logL = 0.0;
+    int returnCode = beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex,
+                                                       &frequenciesIndex, &scaleIndex, 1, &logL);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "Failed to calculate root likelihood: error %d\n", returnCode);
+        return NAN;
+    }
+    return logL;
+}
+
+/// updates the partials of the whole tree from the current transition matrices
+double updateTreeLogLikelihood(int instance) {
+    std::vector<BeagleOperation> operations = getOperations();
+    beagleResetScaleFactors(instance, cumulativeScaleIndex);
+    beagleUpdatePartials(instance, &operations[0], (int) operations.size(), cumulativeScaleIndex);
+
+    return calculateRootLogLikelihood(instance);
+}
+
+/// updates the transition matrices and partials of the whole tree with plain calls
+double calculateTreeLogLikelihood(int instance, const double* lengths) {
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, lengths, NODE_COUNT - 1);
+
+    return updateTreeLogLikelihood(instance);
+}
+
+/// as calculateTreeLogLikelihood, with transition matrices from rate matrix 0
+double calculateTreeLogLikelihoodFromRateMatrix(int instance, const double* lengths) {
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    int returnCode = beagleUpdateTransitionMatricesFromRateMatrix(instance, 0, matrixIndices, lengths,
+                                                                  NODE_COUNT - 1);
+    if (returnCode != BEAGLE_SUCCESS) {
+        fprintf(stderr, "Failed to update transition matrices from rate matrix: error %d\n", returnCode);
+        return NAN;
+    }
+
+    return updateTreeLogLikelihood(instance);
+}
+
+/// sets rate matrix 0 to the JC69 rate matrix of the eigen decomposition set by setModel
+void setRateMatrix(int instance) {
+    double rateMatrix[STATE_COUNT * STATE_COUNT];
+    for (int i = 0; i < STATE_COUNT; i++) {
+        for (int j = 0; j < STATE_COUNT; j++)
+            rateMatrix[i * STATE_COUNT + j] = (i == j ? -1.0 : 1.0 / 3.0);
+    }
+    beagleSetRateMatrix(instance, 0, rateMatrix);
+}
+
+/// the edge lengths scaled by a factor
+std::vector<double> getScaledLengths(double factor) {
+    std::vector<double> lengths(edgeLengths, edgeLengths + NODE_COUNT - 1);
+    for (size_t i = 0; i < lengths.size(); i++)
+        lengths[i] *= factor;
+    return lengths;
+}
+
+/// simulated states of any state count, with a few gaps, for TIP_COUNT tips
+std::vector<int> getStates(int stateCount, int patternCount) {
+    randomSeed = 1;
+    std::vector<int> states(TIP_COUNT * patternCount);
+    for (int k = 0; k < patternCount; k++) {
+        const int common = nextRandom(stateCount);
+        for (int i = 0; i < TIP_COUNT; i++) {
+            int state = (nextRandom(3) == 0 ? nextRandom(stateCount) : common);
+            if (nextRandom(20) == 0)
+                state = stateCount;
+            states[i * patternCount + k] = state;
+        }
+    }
+    return states;
+}
+
+/// a CPU instance in double precision of any state count, with uniform frequencies and equal
+/// category weights; its transition matrices are set by setJukesCantorMatrices
+int createStateCountInstance(int stateCount, int patternCount, int categoryCount,
+                             BeagleInstanceDetails* details) {
+    int instance = beagleCreateInstance(TIP_COUNT, NODE_COUNT + 1, TIP_COUNT, stateCount, patternCount,
+                                        1, NODE_COUNT + 4, categoryCount, TIP_COUNT, NULL, 0,
+                                        BEAGLE_FLAG_SCALING_MANUAL,
+                                        BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                        details);
+    if (instance < 0) {
+        fprintf(stderr, "Failed to obtain BEAGLE instance of %d states: error %d\n", stateCount, instance);
+        exit(1);
+    }
+
+    std::vector<double> freqs(stateCount, 1.0 / stateCount);
+    std::vector<double> weights(categoryCount, 1.0 / categoryCount);
+    std::vector<double> patternWeights(patternCount, 1.0);
+    beagleSetStateFrequencies(instance, 0, &freqs[0]);
+    beagleSetCategoryWeights(instance, 0, &weights[0]);
+    beagleSetPatternWeights(instance, &patternWeights[0]);
+    return instance;
+}
+
+/// sets the Jukes-Cantor transition matrix of each edge in closed form, category c at rate c + 0.5,
+/// so that large state spaces need no eigen decomposition
+void setJukesCantorMatrices(int instance, int stateCount, int categoryCount) {
+    std::vector<double> matrix(stateCount * stateCount * categoryCount);
+    for (int i = 0; i < NODE_COUNT - 1; i++) {
+        for (int c = 0; c < categoryCount; c++) {
+            const double decay = exp(-(double) stateCount / (stateCount - 1) * edgeLengths[i] * (c + 0.5));
+            double* categoryMatrix = &matrix[c * stateCount * stateCount];
+            for (int j = 0; j < stateCount * stateCount; j++)
+                categoryMatrix[j] = (1.0 - decay) / stateCount;
+            for (int j = 0; j < stateCount; j++)
+                categoryMatrix[j * stateCount + j] += decay;
+        }
+        beagleSetTransitionMatrix(instance, i, &matrix[0], 1.0);
+    }
+}
+
+/// the partials of a tip given as states; missing data allows every state
+std::vector<double> getTipPartials(const int* states, int stateCount, int patternCount) {
+    std::vector<double> partials(patternCount * stateCount, 0.0);
+    for (int k = 0; k < patternCount; k++) {
+        for (int j = 0; j < stateCount; j++) {
+            if (states[k] >= stateCount || states[k] == j)
+                partials[k * stateCount + j] = 1.0;
+        }
+    }
+    return partials;
+}
+
+/// compares a log likelihood with the one of the plain calls; a tolerance of zero asks for
+/// identical values
+void check(const char* name, double logL, double expectedLogL, double tolerance) {
+    const bool passed = (tolerance == 0.0 ? logL == expectedLogL :
+                         fabs(logL - expectedLogL) <= tolerance * fabs(expectedLogL));
+    fprintf(stdout, "%-48s logL = %.10f (expected %.10f) %s\n", name, logL, expectedLogL,
+            (passed ? "ok" : "FAILED"));
+    if (!passed)
+        failureCount++;
+}
+
+/// reports a check that has no log likelihood to compare
+void checkCondition(const char* name, bool passed) {
+    fprintf(stdout, "%-48s %s\n", name, (passed ? "ok" : "FAILED"));
+    if (!passed)
+        failureCount++;
+}
+
+void checkAsyncRootLogLikelihoods() {
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+    std::vector<double> lengths = getScaledLengths(1.0);
+    std::vector<double> otherLengths = getScaledLengths(2.0);
+
+    int rootIndices[2] = { ROOT_INDEX, ROOT_INDEX };
+    int weightsIndices[2] = { 0, 0 };
+    int frequenciesIndices[2] = { 0, 0 };
+    int scaleIndices[2] = { cumulativeScaleIndex, cumulativeScaleIndex };
+    int partitionIndices[2] = { 0, 1 };
+
+    double logL = NAN;
+    checkCondition("collecting with nothing queued fails",
+                   beagleGetRootLogLikelihoodsAsync(instance, 1, NULL, &logL) == BEAGLE_ERROR_GENERAL);
+
+    // a synchronous calculation between queueing and collecting leaves the queued result alone
+    const double expectedLogL = calculateTreeLogLikelihood(instance, &lengths[0]);
+    beagleCalculateRootLogLikelihoodsAsync(instance, rootIndices, weightsIndices, frequenciesIndices,
+                                           scaleIndices, NULL, 1);
+    calculateTreeLogLikelihood(instance, &otherLengths[0]);
+    int returnCode = beagleGetRootLogLikelihoodsAsync(instance, 0, NULL, &logL);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to collect root likelihood: error %d\n", returnCode);
+    check("queued root logL vs calculated", logL, expectedLogL, 0.0);
+
+    int partitions[PATTERN_COUNT];
+    for (int k = 0; k < PATTERN_COUNT; k++)
+        partitions[k] = (k < PATTERN_COUNT / 3 ? 0 : 1);
+    beagleSetPatternPartitions(instance, 2, partitions);
+
+    calculateTreeLogLikelihood(instance, &lengths[0]);
+    double expectedLogLByPartition[2];
+    beagleCalculateRootLogLikelihoodsByPartition(instance, rootIndices, weightsIndices,
+                                                 frequenciesIndices, scaleIndices, partitionIndices,
+                                                 2, 1, expectedLogLByPartition, &logL);
+    beagleCalculateRootLogLikelihoodsAsync(instance, rootIndices, weightsIndices, frequenciesIndices,
+                                           scaleIndices, partitionIndices, 2);
+    double logLByPartition[2] = { NAN, NAN };
+    returnCode = beagleGetRootLogLikelihoodsAsync(instance, 1, logLByPartition, &logL);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to collect root likelihoods by partition: error %d\n", returnCode);
+    check("queued partition 0 logL vs calculated", logLByPartition[0], expectedLogLByPartition[0], 0.0);
+    check("queued partition 1 logL vs calculated", logLByPartition[1], expectedLogLByPartition[1], 0.0);
+    check("queued sum of partition logLs vs root logL", logL, expectedLogL, 1E-12);
+
+    beagleFinalizeInstance(instance);
+}
+
+void checkBatchedInstance() {
+    const int batchCount = 4;
+    const int patternCount = PATTERN_COUNT / batchCount;
+    const int matrixCount = NODE_COUNT - 1;
+    std::vector<int> states = getStates();
+    std::vector<BeagleOperation> operations = getOperations();
+
+    // problem k has the patterns [k * patternCount, (k + 1) * patternCount) and longer edges
+    BeagleInstanceDetails details;
+    int batched = beagleCreateBatchedInstance(batchCount, TIP_COUNT, NODE_COUNT, TIP_COUNT,
+                                              STATE_COUNT, patternCount, 1, matrixCount,
+                                              CATEGORY_COUNT, 0, NULL, 0, 0,
+                                              BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                              &details);
+    if (batched < 0) {
+        fprintf(stderr, "Failed to obtain batched BEAGLE instance: error %d\n", batched);
+        exit(1);
+    }
+    setModel(batched, CATEGORY_COUNT, batchCount);
+    setTipStates(batched, states);
+
+    std::vector<BeagleOperationByPartition> batchedOperations;
+    int rootIndices[batchCount];
+    int indices[batchCount];
+    int scaleIndices[batchCount];
+    double logL[batchCount];
+    for (int k = 0; k < batchCount; k++) {
+        std::vector<double> lengths = getScaledLengths(1.0 + 0.5 * k);
+        int matrixIndices[NODE_COUNT - 1];
+        for (int i = 0; i < matrixCount; i++)
+            matrixIndices[i] = k * matrixCount + i;
+        beagleUpdateTransitionMatrices(batched, k, matrixIndices, NULL, NULL, &lengths[0], matrixCount);
+
+        for (size_t i = 0; i < operations.size(); i++) {
+            BeagleOperationByPartition operation = {
+                operations[i].destinationPartials, BEAGLE_OP_NONE, BEAGLE_OP_NONE,
+                operations[i].child1Partials, k * matrixCount + operations[i].child1TransitionMatrix,
+                operations[i].child2Partials, k * matrixCount + operations[i].child2TransitionMatrix,
+                k, BEAGLE_OP_NONE
+            };
+            batchedOperations.push_back(operation);
+        }
+        rootIndices[k] = ROOT_INDEX;
+        indices[k] = k;
+        scaleIndices[k] = BEAGLE_OP_NONE;
+
+        // the same problem in an instance of its own
+        int instance = beagleCreateInstance(TIP_COUNT, NODE_COUNT, TIP_COUNT, STATE_COUNT,
+                                            patternCount, 1, matrixCount, CATEGORY_COUNT, 0,
+                                            NULL, 0, 0,
+                                            BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                            &details);
+        if (instance < 0) {
+            fprintf(stderr, "Failed to obtain BEAGLE instance: error %d\n", instance);
+            exit(1);
+        }
+        setModel(instance, CATEGORY_COUNT);
+        for (int i = 0; i < TIP_COUNT; i++)
+            beagleSetTipStates(instance, i, &states[i * PATTERN_COUNT + k * patternCount]);
+        for (int i = 0; i < matrixCount; i++)
+            matrixIndices[i] = i;
+        beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, &lengths[0], matrixCount);
+        std::vector<BeagleOperation> unscaledOperations = operations;
+        for (size_t i = 0; i < unscaledOperations.size(); i++)
+            unscaledOperations[i].destinationScaleWrite = BEAGLE_OP_NONE;
+        beagleUpdatePartials(instance, &unscaledOperations[0], (int) unscaledOperations.size(),
+                             BEAGLE_OP_NONE);
+        int rootIndex = ROOT_INDEX;
+        int zero = 0;
+        int scaleIndex = BEAGLE_OP_NONE;
+        beagleCalculateRootLogLikelihoods(instance, &rootIndex, &zero, &zero, &scaleIndex, 1, &logL[k]);
+        beagleFinalizeInstance(instance);
+    }
+
+    beagleUpdatePartialsByPartition(batched, &batchedOperations[0], (int) batchedOperations.size());
+    double batchedLogL[batchCount];
+    double sumLogL = 0.0;
+    int returnCode = beagleCalculateRootLogLikelihoodsByPartition(batched, rootIndices, indices, indices,
+                                                                  scaleIndices, indices, batchCount, 1,
+                                                                  batchedLogL, &sumLogL);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to calculate batched root likelihoods: error %d\n", returnCode);
+
+    for (int k = 0; k < batchCount; k++) {
+        char name[64];
+        sprintf(name, "batched problem %d vs separate instance", k);
+        check(name, batchedLogL[k], logL[k], 1E-12);
+    }
+
+    beagleFinalizeInstance(batched);
+}
+
+void checkDeviceMemoryBudget() {
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+
+    // partials are allocated on first use, so the budget is set before the tip states
+    double logL[2];
+    for (int budgeted = 0; budgeted < 2; budgeted++) {
+        BeagleInstanceDetails details;
+        int instance = createInstance(CATEGORY_COUNT, 0, BEAGLE_FLAG_PROCESSOR_GPU, &details);
+        if (instance < 0) {
+            fprintf(stdout, "%-48s skipped, no GPU resource\n", "device memory budget vs no budget");
+            return;
+        }
+        if (budgeted) {
+            int returnCode = beagleSetDeviceMemoryBudget(instance, 1);
+            if (returnCode != BEAGLE_SUCCESS)
+                fprintf(stderr, "Failed to set device memory budget: error %d\n", returnCode);
+        }
+        setModel(instance, CATEGORY_COUNT);
+        setTipStates(instance, states);
+        logL[budgeted] = calculateTreeLogLikelihood(instance, &lengths[0]);
+        beagleFinalizeInstance(instance);
+    }
+
+    // a one megabyte budget holds only a few of the partials buffers
+    check("device memory budget vs no budget", logL[1], logL[0], 1E-10);
+}
+
+/// reads the statistics of an instance until told to stop, as a monitor on another thread would
+void readInstanceStatistics(int instance, std::atomic<bool>* stop, std::atomic<int>* failures) {
+    while (!stop->load()) {
+        BeagleInstanceStatistics statistics;
+        if (beagleGetInstanceStatistics(instance, &statistics) != BEAGLE_SUCCESS)
+            failures->fetch_add(1);
+    }
+}
+
+void checkInstanceStatistics() {
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+    std::vector<double> lengths = getScaledLengths(1.0);
+    const int evaluationCount = 3;
+
+    BeagleInstanceStatistics statistics;
+    checkCondition("statistics fail before being enabled",
+                   beagleGetInstanceStatistics(instance, &statistics) == BEAGLE_ERROR_GENERAL);
+
+    beagleSetInstanceStatistics(instance, 1);
+    std::atomic<bool> stop(false);
+    std::atomic<int> failures(0);
+    std::thread reader(readInstanceStatistics, instance, &stop, &failures);
+    for (int i = 0; i < evaluationCount; i++)
+        calculateTreeLogLikelihood(instance, &lengths[0]);
+    stop.store(true);
+    reader.join();
+    checkCondition("statistics read during evaluations", failures.load() == 0);
+
+    int returnCode = beagleGetInstanceStatistics(instance, &statistics);
+    checkCondition("statistics enabled", returnCode == BEAGLE_SUCCESS);
+    checkCondition("transition matrix update count",
+                   statistics.callCount[BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES] == evaluationCount);
+    checkCondition("partials update count",
+                   statistics.callCount[BEAGLE_STATISTICS_UPDATE_PARTIALS] == evaluationCount);
+    checkCondition("root likelihood count",
+                   statistics.callCount[BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS] == evaluationCount);
+    checkCondition("uncalled entry point count",
+                   statistics.callCount[BEAGLE_STATISTICS_CALCULATE_EDGE_LOG_LIKELIHOODS] == 0);
+    checkCondition("partials update wall time",
+                   statistics.wallTime[BEAGLE_STATISTICS_UPDATE_PARTIALS] > 0.0);
+    checkCondition("pattern operations",
+                   statistics.patternOperations == (double) evaluationCount * (NODE_COUNT - TIP_COUNT) * PATTERN_COUNT);
+    checkCondition("rescale count",
+                   statistics.rescaleCount == evaluationCount * (NODE_COUNT - TIP_COUNT));
+
+    // enabling again starts from zero, disabling stops collection
+    beagleSetInstanceStatistics(instance, 1);
+    beagleGetInstanceStatistics(instance, &statistics);
+    checkCondition("statistics reset when enabled again",
+                   statistics.callCount[BEAGLE_STATISTICS_UPDATE_PARTIALS] == 0 &&
+                   statistics.patternOperations == 0.0);
+    beagleSetInstanceStatistics(instance, 0);
+    checkCondition("statistics fail once disabled",
+                   beagleGetInstanceStatistics(instance, &statistics) == BEAGLE_ERROR_GENERAL);
+
+    beagleFinalizeInstance(instance);
+}
+
+void checkCommandBuffer() {
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    std::vector<BeagleOperation> operations = getOperations();
+    int rootIndex = ROOT_INDEX;
+    int weightsIndex = 0;
+    int frequenciesIndex = 0;
+    int scaleIndex = cumulativeScaleIndex;
+
+    int commandBuffer = beagleCreateCommandBuffer(instance);
+    beagleRecordUpdateTransitionMatrices(commandBuffer, 0, matrixIndices, NULL, NULL, NODE_COUNT - 1);
+    beagleRecordResetScaleFactors(commandBuffer, cumulativeScaleIndex);
+    beagleRecordUpdatePartials(commandBuffer, &operations[0], (int) operations.size(),
+                               cumulativeScaleIndex);
+    beagleRecordCalculateRootLogLikelihoods(commandBuffer, &rootIndex, &weightsIndex,
+                                            &frequenciesIndex, &scaleIndex, 1);
+
+    // replays with other edge lengths than the last direct calls
+    for (int replay = 0; replay < 2; replay++) {
+        std::vector<double> lengths = getScaledLengths(replay + 1.0);
+        std::vector<double> otherLengths = getScaledLengths(replay + 2.0);
+        calculateTreeLogLikelihood(instance, &otherLengths[0]);
+
+        double logL = NAN;
+        int returnCode = beagleExecuteCommandBuffer(commandBuffer, &lengths[0], &logL);
+        if (returnCode != BEAGLE_SUCCESS)
+            fprintf(stderr, "Failed to execute command buffer: error %d\n", returnCode);
+
+        check("command buffer vs direct calls", logL,
+              calculateTreeLogLikelihood(instance, &lengths[0]), 0.0);
+    }
+
+    beagleFinalizeCommandBuffer(commandBuffer);
+    beagleFinalizeInstance(instance);
+}
+
+void createAndFinalizeInstances(int count, std::atomic<int>* failures) {
+    for (int i = 0; i < count; i++) {
+        BeagleInstanceDetails details;
+        int instance = createInstance(1, 0, BEAGLE_FLAG_FRAMEWORK_CPU, &details);
+        double rate = 1.0;
+        if (instance < 0 || beagleSetCategoryRates(instance, &rate) != BEAGLE_SUCCESS ||
+            beagleFinalizeInstance(instance) != BEAGLE_SUCCESS)
+            failures->fetch_add(1);
+    }
+}
+
+void checkInstanceTable() {
+    const int threadCount = 4;
+    std::atomic<int> failures(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; t++)
+        threads.push_back(std::thread(createAndFinalizeInstances, 50, &failures));
+    for (int t = 0; t < threadCount; t++)
+        threads[t].join();
+    checkCondition("concurrent create and finalize", failures.load() == 0);
+
+    // the slot of a finalized instance is reused by the next one, under a new handle
+    int instance = createModelInstance();
+    beagleFinalizeInstance(instance);
+    int reusing = createModelInstance();
+    double rate = 1.0;
+    checkCondition("finalized handle fails after slot reuse",
+                   reusing != instance &&
+                   beagleSetCategoryRates(instance, &rate) == BEAGLE_ERROR_UNINITIALIZED_INSTANCE &&
+                   beagleFinalizeInstance(instance) == BEAGLE_ERROR_UNINITIALIZED_INSTANCE);
+    checkCondition("handle reusing the slot works",
+                   beagleSetCategoryRates(reusing, &rate) == BEAGLE_SUCCESS);
+    beagleFinalizeInstance(reusing);
+}
+
+void checkSnapshotAndClone() {
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+    std::vector<double> lengths = getScaledLengths(1.0);
+    std::vector<double> otherLengths = getScaledLengths(1.5);
+
+    const double logL = calculateTreeLogLikelihood(instance, &lengths[0]);
+
+    int partialsIndices[NODE_COUNT - TIP_COUNT];
+    int scaleIndices[TIP_COUNT];
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - TIP_COUNT; i++)
+        partialsIndices[i] = TIP_COUNT + i;
+    for (int i = 0; i < TIP_COUNT; i++)
+        scaleIndices[i] = i;
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    beagleSnapshotBuffers(instance, 0, partialsIndices, NODE_COUNT - TIP_COUNT,
+                          scaleIndices, TIP_COUNT, matrixIndices, NODE_COUNT - 1);
+
+    const double otherLogL = calculateTreeLogLikelihood(instance, &otherLengths[0]);
+
+    int returnCode = beagleRestoreSnapshot(instance, 0);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to restore snapshot: error %d\n", returnCode);
+    check("restored snapshot vs before the snapshot", calculateRootLogLikelihood(instance), logL, 0.0);
+    beagleReleaseSnapshot(instance, 0);
+
+    BeagleInstanceDetails details;
+    int clone = beagleCloneInstance(instance, &details);
+    if (clone < 0) {
+        fprintf(stderr, "Failed to clone instance: error %d\n", clone);
+        exit(1);
+    }
+    check("clone vs original", calculateRootLogLikelihood(clone), logL, 0.0);
+    check("clone with other edge lengths vs original", calculateTreeLogLikelihood(clone, &otherLengths[0]),
+          otherLogL, 0.0);
+
+    beagleFinalizeInstance(clone);
+    beagleFinalizeInstance(instance);
+}
+
+void checkSaveAndLoad() {
+    const char* fileName = "consistencytest.instance";
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+
+    // the invariable sites take their share from the category weights
+    const double proportionInvariant = 0.2;
+    double weights[CATEGORY_COUNT];
+    for (int i = 0; i < CATEGORY_COUNT; i++)
+        weights[i] = (1.0 - proportionInvariant) / CATEGORY_COUNT;
+
+    int instance = createModelInstance(states);
+    beagleSetCategoryWeights(instance, 0, weights);
+    beagleSetInvariantSites(instance, proportionInvariant, 0);
+    setRateMatrix(instance);
+    const double logL = calculateTreeLogLikelihoodFromRateMatrix(instance, &lengths[0]);
+
+    int returnCode = beagleSaveInstance(instance, fileName);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to save instance: error %d\n", returnCode);
+
+    // nothing is set on the loading instance but what the file holds
+    BeagleInstanceDetails details;
+    int loaded = createInstance(CATEGORY_COUNT, 0,
+                                BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                &details);
+    returnCode = beagleLoadInstance(loaded, fileName);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to load instance: error %d\n", returnCode);
+    remove(fileName);
+
+    check("loaded instance vs saved instance", calculateRootLogLikelihood(loaded), logL, 0.0);
+
+    std::vector<double> otherLengths = getScaledLengths(1.5);
+    check("loaded rate matrix and invariable sites vs saved",
+          calculateTreeLogLikelihoodFromRateMatrix(loaded, &otherLengths[0]),
+          calculateTreeLogLikelihoodFromRateMatrix(instance, &otherLengths[0]), 0.0);
+
+    beagleFinalizeInstance(loaded);
+    beagleFinalizeInstance(instance);
+}
+
+void checkSharedTipStates() {
+    const char* fileName = "consistencytest.tips";
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+
+    int instance = createModelInstance(states);
+    const double logL = calculateTreeLogLikelihood(instance, &lengths[0]);
+    beagleFinalizeInstance(instance);
+
+    // the codes must stay allocated while the instance uses them
+    std::vector<unsigned char> codes(states.begin(), states.end());
+    int external = createModelInstance();
+    for (int i = 0; i < TIP_COUNT; i++)
+        beagleSetTipStatesExternal(external, i, &codes[i * PATTERN_COUNT]);
+    check("external tip states vs beagleSetTipStates", calculateTreeLogLikelihood(external, &lengths[0]),
+          logL, 0.0);
+    beagleFinalizeInstance(external);
+
+    int returnCode = beagleWriteTipStatesFile(fileName, TIP_COUNT, PATTERN_COUNT, STATE_COUNT, &states[0]);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to write tip states file: error %d\n", returnCode);
+    int mapped = createModelInstance();
+    returnCode = beagleMapTipStatesFile(mapped, fileName);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to map tip states file: error %d\n", returnCode);
+    check("mapped tip states vs beagleSetTipStates", calculateTreeLogLikelihood(mapped, &lengths[0]),
+          logL, 0.0);
+    beagleFinalizeInstance(mapped);
+    remove(fileName);
+}
+
+void checkPackedTipStates() {
+    const int patternCount = 64;
+    const int categoryCount = 2;
+    // one byte codes the states of the first and falls back to partials for the others
+    const int stateCounts[2] = { 254, 300 };
+
+    for (int n = 0; n < 2; n++) {
+        const int stateCount = stateCounts[n];
+        std::vector<int> states = getStates(stateCount, patternCount);
+        double logL[2];
+        for (int partials = 0; partials < 2; partials++) {
+            BeagleInstanceDetails details;
+            int instance = createStateCountInstance(stateCount, patternCount, categoryCount, &details);
+            for (int i = 0; i < TIP_COUNT; i++) {
+                if (partials) {
+                    std::vector<double> tipPartials = getTipPartials(&states[i * patternCount],
+                                                                     stateCount, patternCount);
+                    beagleSetTipPartials(instance, i, &tipPartials[0]);
+                } else {
+                    beagleSetTipStates(instance, i, &states[i * patternCount]);
+                }
+            }
+            setJukesCantorMatrices(instance, stateCount, categoryCount);
+            logL[partials] = updateTreeLogLikelihood(instance);
+            beagleFinalizeInstance(instance);
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "%d-state tip states vs tip partials", stateCount);
+        check(name, logL[0], logL[1], 1E-12);
+    }
+}
+
+/// prints the resource list, after creating a CPU instance first if lazy; run in a child process
+int printResourceList(bool lazy) {
+    if (lazy) {
+        BeagleInstanceDetails details;
+        beagleFinalizeInstance(createInstance(1, 0, BEAGLE_FLAG_FRAMEWORK_CPU, &details));
+    }
+    BeagleResourceList* resources = beagleGetResourceList();
+    for (int i = 0; resources != NULL && i < resources->length; i++)
+        fprintf(stdout, "%s\t%ld\n", resources->list[i].name, resources->list[i].supportFlags);
+    return 0;
+}
+
+/// the resource list printed by a child process with the given BEAGLE_PLUGINS allow-list
+std::string getChildResourceList(const char* allowList, bool lazy) {
+    std::string command = std::string("BEAGLE_PLUGINS='") + allowList + "' '" + programPath +
+                          "' --print-resources" + (lazy ? " lazy" : "");
+    std::string output;
+    FILE* pipe = popen(command.c_str(), "r");
+    if (pipe == NULL)
+        return output;
+    char buffer[256];
+    while (fgets(buffer, sizeof(buffer), pipe) != NULL)
+        output += buffer;
+    pclose(pipe);
+    return output;
+}
+
+void checkPluginLoading() {
+#ifdef _WIN32
+    fprintf(stdout, "%-48s skipped, no child processes\n", "plugin allow-list");
+#else
+    // plugins are only opened once per process, so each list comes from a fresh child
+    const std::string eager = getChildResourceList("", false);
+    const std::string lazy = getChildResourceList("", true);
+    checkCondition("resource list found", eager.compare(0, 4, "CPU\t") == 0);
+    checkCondition("lazily built resource list vs eager", lazy == eager);
+
+    // the plain CPU plugin alone provides no vectorized implementations
+    const std::string cpuOnly = getChildResourceList("cpu", false);
+    const long vectorFlags = BEAGLE_FLAG_VECTOR_SSE | BEAGLE_FLAG_VECTOR_AVX;
+    checkCondition("allow-list of the CPU plugin",
+                   cpuOnly.compare(0, 4, "CPU\t") == 0 && cpuOnly.find('\n') == cpuOnly.size() - 1 &&
+                   (strtol(cpuOnly.c_str() + 4, NULL, 10) & vectorFlags) == 0);
+    checkCondition("allow-list without known plugins", getChildResourceList("none", false).empty());
+#endif
+}
+
+/// the lines of a text file, without their line ends
+std::vector<std::string> readLines(const char* fileName) {
+    std::vector<std::string> lines;
+    FILE* file = fopen(fileName, "r");
+    if (file == NULL)
+        return lines;
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        std::string line(buffer);
+        if (!line.empty() && line[line.size() - 1] == '\n')
+            line.erase(line.size() - 1);
+        lines.push_back(line);
+    }
+    fclose(file);
+    return lines;
+}
+
+void writeLines(const char* fileName, const std::vector<std::string>& lines) {
+    FILE* file = fopen(fileName, "w");
+    for (size_t i = 0; i < lines.size(); i++)
+        fprintf(file, "%s\n", lines[i].c_str());
+    fclose(file);
+}
+
+/// the name of the implementation beagleCreateInstance picks for a CPU instance in double precision
+std::string getAutoselectedName(int categoryCount) {
+    BeagleInstanceDetails details;
+    int instance = createInstance(categoryCount, 0,
+                                  BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                  &details);
+    if (instance < 0)
+        return "";
+    std::string name = details.implName;
+    beagleFinalizeInstance(instance);
+    return name;
+}
+
+void checkAutoselectCache() {
+    const char* fileName = "consistencytest.autoselect";
+    remove(fileName);
+
+    beagleSetAutoselect(1, fileName);
+    const std::string benchmarked = getAutoselectedName(CATEGORY_COUNT);
+    std::vector<std::string> lines = readLines(fileName);
+    checkCondition("benchmark decision written to cache file", lines.size() == 1);
+    if (lines.size() != 1) {
+        beagleSetAutoselect(0, NULL);
+        return;
+    }
+
+    // the decision is replaced by another candidate, which only a cache hit would create; the
+    // garbage, unparsable and other-version lines around it must all be ignored
+    const std::string decision = lines[0];
+    const std::string prefix = decision.substr(0, decision.rfind('\t') + 1);
+    const std::string cached = (benchmarked == "CPU-Double" ? "CPU-4State-Double" : "CPU-Double");
+    const std::string otherVersion = "0.0.0" + decision.substr(decision.find('\t'));
+    std::string unparsable = prefix + cached;
+    unparsable.replace(unparsable.find('\t', unparsable.find('\t') + 1) + 1, 1, "x");
+    lines.clear();
+    lines.push_back("garbage");
+    lines.push_back(prefix + cached);
+    lines.push_back(otherVersion);
+    lines.push_back(unparsable);
+    lines.push_back(prefix);
+    writeLines(fileName, lines);
+
+    beagleSetAutoselect(1, fileName);
+    checkCondition("second run takes the cached decision", getAutoselectedName(CATEGORY_COUNT) == cached);
+
+    // a new shape rewrites the file with one line per decision, dropping the ignored lines
+    getAutoselectedName(1);
+    getAutoselectedName(CATEGORY_COUNT);
+    lines = readLines(fileName);
+    checkCondition("cache file rewritten without ignored lines",
+                   lines.size() == 2 && (lines[0] == prefix + cached || lines[1] == prefix + cached));
+
+    beagleSetAutoselect(0, NULL);
+    remove(fileName);
+}
+
+void checkSiteLogarithms() {
+    // the approximation against std::log over the normal range, within four units in the last place
+    double maxError = 0.0;
+    for (int exponent = -1022; exponent <= 1023; exponent += 7) {
+        for (int i = 0; i < 64; i++) {
+            const double x = ldexp(1.0 + i / 64.0 + i * 1E-7, exponent);
+            const double expected = std::log(x);
+            const double error = fabs(beagleLogNormal(x) - expected) /
+                                 (fabs(expected) > 1.0 ? fabs(expected) : 1.0);
+            maxError = (error > maxError ? error : maxError);
+        }
+    }
+    maxError = std::max(maxError, fabs(beagleLogNormal(DBL_MIN) - std::log(DBL_MIN)) / fabs(std::log(DBL_MIN)));
+    maxError = std::max(maxError, fabs(beagleLogNormal(DBL_MAX) - std::log(DBL_MAX)) / std::log(DBL_MAX));
+    checkCondition("beagleLogNormal vs std::log", maxError <= 4.0 * DBL_EPSILON);
+
+    // a single zero, subnormal or infinite value sends the whole array to std::log
+    const double edges[3] = { 0.0, DBL_MIN / 8.0, INFINITY };
+    const char* edgeNames[3] = { "zero", "subnormal", "infinity" };
+    for (int e = 0; e < 3; e++) {
+        double values[4] = { 0.3, edges[e], 1.7, 2.5E-300 };
+        bool identical = true;
+        double expected[4];
+        for (int i = 0; i < 4; i++)
+            expected[i] = std::log(values[i]);
+        beagleLogInPlace(values, 4);
+        for (int i = 0; i < 4; i++)
+            identical = identical && (values[i] == expected[i]);
+        char name[64];
+        snprintf(name, sizeof(name), "site logs with %s vs std::log", edgeNames[e]);
+        checkCondition(name, identical);
+    }
+
+    // the fused root integration against integrating the root partials here, without scaling
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+    std::vector<double> lengths = getScaledLengths(1.0);
+    int matrixIndices[NODE_COUNT - 1];
+    for (int i = 0; i < NODE_COUNT - 1; i++)
+        matrixIndices[i] = i;
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, &lengths[0], NODE_COUNT - 1);
+    std::vector<BeagleOperation> operations = getOperations();
+    for (size_t i = 0; i < operations.size(); i++)
+        operations[i].destinationScaleWrite = BEAGLE_OP_NONE;
+    beagleUpdatePartials(instance, &operations[0], (int) operations.size(), BEAGLE_OP_NONE);
+
+    int rootIndex = ROOT_INDEX;
+    int weightsIndex = 0;
+    int frequenciesIndex = 0;
+    int scaleIndex = BEAGLE_OP_NONE;
+    double logL = NAN;
+    beagleCalculateRootLogLikelihoods(instance, &rootIndex, &weightsIndex, &frequenciesIndex,
+                                      &scaleIndex, 1, &logL);
+
+    std::vector<double> partials(CATEGORY_COUNT * PATTERN_COUNT * STATE_COUNT);
+    beagleGetPartials(instance, ROOT_INDEX, BEAGLE_OP_NONE, &partials[0]);
+    double expectedLogL = 0.0;
+    for (int k = 0; k < PATTERN_COUNT; k++) {
+        double siteL = 0.0;
+        for (int c = 0; c < CATEGORY_COUNT; c++) {
+            for (int j = 0; j < STATE_COUNT; j++)
+                siteL += partials[(c * PATTERN_COUNT + k) * STATE_COUNT + j] / (CATEGORY_COUNT * STATE_COUNT);
+        }
+        expectedLogL += std::log(siteL);
+    }
+    check("root logL vs integrated root partials", logL, expectedLogL, 1E-12);
+
+    beagleFinalizeInstance(instance);
+}
+
+void checkEdgeProjection() {
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+    int instance = createModelInstance(states);
+    const double treeLogL = calculateTreeLogLikelihood(instance, &lengths[0]);
+
+    // the edge joins the two children of the root, whose scale factors are left out
+    int parentIndex = ROOT_INDEX - 2;
+    int childIndex = ROOT_INDEX - 1;
+    int matrixIndex = NODE_COUNT;
+    int weightsIndex = 0;
+    int frequenciesIndex = 0;
+    int scaleIndex = cumulativeScaleIndex;
+    int rootScaleIndex = ROOT_INDEX - TIP_COUNT;
+    beagleRemoveScaleFactors(instance, &rootScaleIndex, 1, cumulativeScaleIndex);
+
+    int returnCode = beaglePrepareEdgeProjection(instance, parentIndex, childIndex, 0, weightsIndex,
+                                                 frequenciesIndex, cumulativeScaleIndex);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to prepare edge projection: error %d\n", returnCode);
+
+    const double lengthFactors[3] = { 1.0, 0.5, 2.0 };
+    for (int i = 0; i < 3; i++) {
+        double edgeLength = (lengths[parentIndex] + lengths[childIndex]) * lengthFactors[i];
+        beagleUpdateTransitionMatrices(instance, 0, &matrixIndex, NULL, NULL, &edgeLength, 1);
+
+        double logL = NAN;
+        double projectedLogL = NAN;
+        beagleCalculateEdgeLogLikelihoods(instance, &parentIndex, &childIndex, &matrixIndex, NULL, NULL,
+                                          &weightsIndex, &frequenciesIndex, &scaleIndex, 1,
+                                          &logL, NULL, NULL);
+        beagleCalculateEdgeProjectionLogLikelihoods(instance, edgeLength, &projectedLogL, NULL, NULL);
+
+        // under a reversible model an edge as long as both root edges gives the root likelihood
+        if (i == 0)
+            check("edge log likelihood vs root log likelihood", logL, treeLogL, 1E-10);
+        check("edge projection vs edge log likelihood", projectedLogL, logL, 1E-10);
+    }
+
+    beagleFinalizeInstance(instance);
+}
+
+void checkTreePartials() {
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+    int instance = createModelInstance(states);
+    int reference = createModelInstance(states);
+
+    int matrixIndices[NODE_COUNT];
+    int scaleIndices[NODE_COUNT];
+    for (int i = 0; i < NODE_COUNT; i++) {
+        matrixIndices[i] = i;
+        scaleIndices[i] = (i < TIP_COUNT ? BEAGLE_OP_NONE : i - TIP_COUNT);
+    }
+    beagleSetTreeTopology(instance, NODE_COUNT, parentIndices, matrixIndices, scaleIndices,
+                          cumulativeScaleIndex);
+    beagleUpdateTransitionMatrices(instance, 0, matrixIndices, NULL, NULL, &lengths[0], NODE_COUNT - 1);
+
+    int operationCount = 0;
+    beagleUpdateTreePartials(instance, &operationCount);
+    check("tree partials vs operation list", calculateRootLogLikelihood(instance),
+          calculateTreeLogLikelihood(reference, &lengths[0]), 1E-12);
+
+    // one edge at a time changes, as under a branch length proposal
+    for (int node = 0; node < NODE_COUNT - 1; node += 5) {
+        lengths[node] *= 2.0;
+        beagleUpdateTransitionMatrices(instance, 0, &matrixIndices[node], NULL, NULL, &lengths[node], 1);
+        beagleInvalidateTransitionMatrices(instance, &matrixIndices[node], 1);
+        beagleUpdateTreePartials(instance, &operationCount);
+        check("tree partials after an edge change vs operations", calculateRootLogLikelihood(instance),
+              calculateTreeLogLikelihood(reference, &lengths[0]), 1E-12);
+    }
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+}
+
+void checkTransitionMatrixCache() {
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+    int reference = createModelInstance(states);
+    int returnCode = beagleSetTransitionMatrixCache(instance, 64);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to set transition matrix cache: error %d\n", returnCode);
+
+    // edges of equal length share cached matrices within a call, and the first lengths
+    // come back from the cache on the last pass
+    std::vector<double> equalLengths(NODE_COUNT - 1, 0.1);
+    const double factors[3] = { 1.0, 1.5, 1.0 };
+    for (int i = 0; i < 3; i++) {
+        std::vector<double> lengths = getScaledLengths(factors[i]);
+        check("cached transition matrices vs no cache", calculateTreeLogLikelihood(instance, &lengths[0]),
+              calculateTreeLogLikelihood(reference, &lengths[0]), 0.0);
+        check("cached equal edge lengths vs no cache", calculateTreeLogLikelihood(instance, &equalLengths[0]),
+              calculateTreeLogLikelihood(reference, &equalLengths[0]), 0.0);
+    }
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+}
+
+void checkConvolutionChains() {
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+    int instance = createModelInstance(states);
+    int reference = createModelInstance(states);
+
+    // the edges above nodes 0 and 1 cross three and two epochs, held in the spare matrices
+    int epochIndices[3] = { NODE_COUNT, NODE_COUNT + 1, NODE_COUNT + 2 };
+    double epochLengths[3] = { 0.02, 0.07, 0.04 };
+    calculateTreeLogLikelihood(instance, &lengths[0]);
+    calculateTreeLogLikelihood(reference, &lengths[0]);
+    beagleUpdateTransitionMatrices(instance, 0, epochIndices, NULL, NULL, epochLengths, 3);
+    beagleUpdateTransitionMatrices(reference, 0, epochIndices, NULL, NULL, epochLengths, 3);
+
+    int matrixIndices[5] = { epochIndices[0], epochIndices[1], epochIndices[2],
+                             epochIndices[1], epochIndices[2] };
+    int chainLengths[2] = { 3, 2 };
+    int resultIndices[2] = { 0, 1 };
+    int returnCode = beagleConvolveTransitionMatrixChains(instance, matrixIndices, chainLengths,
+                                                          resultIndices, 2);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to convolve transition matrix chains: error %d\n", returnCode);
+
+    // the same products, one pair at a time through the last spare matrix
+    int firstIndices[3] = { epochIndices[0], NODE_COUNT + 3, epochIndices[1] };
+    int secondIndices[3] = { epochIndices[1], epochIndices[2], epochIndices[2] };
+    int pairResultIndices[3] = { NODE_COUNT + 3, 0, 1 };
+    for (int i = 0; i < 3; i++)
+        beagleConvolveTransitionMatrices(reference, &firstIndices[i], &secondIndices[i],
+                                         &pairResultIndices[i], 1);
+
+    const double chainLogL = updateTreeLogLikelihood(instance);
+    check("convolution chains vs repeated convolution", chainLogL,
+          updateTreeLogLikelihood(reference), 1E-12);
+
+    // with a single model, the epochs add up to the original edges
+    lengths[0] = epochLengths[0] + epochLengths[1] + epochLengths[2];
+    lengths[1] = epochLengths[1] + epochLengths[2];
+    check("convolution chains vs summed edge lengths", chainLogL,
+          calculateTreeLogLikelihood(reference, &lengths[0]), 1E-10);
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+}
+
+void checkFixedStateCounts() {
+    const char* fileName = "consistencytest.fixedstates";
+    const int patternCount = 256;
+    const int categoryCount = 2;
+    const int stateCounts[3] = { 20, 61, 64 };
+
+    for (int n = 0; n < 3; n++) {
+        const int stateCount = stateCounts[n];
+        std::vector<int> states = getStates(stateCount, patternCount);
+
+        // the generic implementation is forced by planting it as the autoselect decision
+        remove(fileName);
+        beagleSetAutoselect(1, fileName);
+        BeagleInstanceDetails details;
+        beagleFinalizeInstance(createStateCountInstance(stateCount, patternCount, categoryCount, &details));
+        std::vector<std::string> lines = readLines(fileName);
+        for (size_t i = 0; i < lines.size(); i++)
+            lines[i] = lines[i].substr(0, lines[i].rfind('\t') + 1) + "CPU-Double";
+        writeLines(fileName, lines);
+        beagleSetAutoselect(1, fileName);
+
+        double logL[2];
+        std::string names[2];
+        for (int generic = 1; generic >= 0; generic--) {
+            if (!generic)
+                beagleSetAutoselect(0, NULL);
+            int instance = createStateCountInstance(stateCount, patternCount, categoryCount, &details);
+            names[generic] = details.implName;
+            // odd tips are partials, so the states/states, states/partials and partials/partials
+            // kernels all run
+            for (int i = 0; i < TIP_COUNT; i++) {
+                if (i % 2 == 1 && i != 3) {
+                    std::vector<double> tipPartials = getTipPartials(&states[i * patternCount],
+                                                                     stateCount, patternCount);
+                    beagleSetTipPartials(instance, i, &tipPartials[0]);
+                } else {
+                    beagleSetTipStates(instance, i, &states[i * patternCount]);
+                }
+            }
+            setJukesCantorMatrices(instance, stateCount, categoryCount);
+            logL[generic] = updateTreeLogLikelihood(instance);
+            beagleFinalizeInstance(instance);
+        }
+        remove(fileName);
+
+        char fixedName[64];
+        snprintf(fixedName, sizeof(fixedName), "CPU-%dState-Double", stateCount);
+        char name[64];
+        snprintf(name, sizeof(name), "%d-state %s vs %s", stateCount, names[0].c_str(), names[1].c_str());
+        checkCondition("fixed-state and generic implementations created",
+                       names[0] == fixedName && names[1] == "CPU-Double");
+        check(name, logL[0], logL[1], 1E-12);
+    }
+}
+
+void checkRateMatrix() {
+    std::vector<int> states = getStates();
+    int instance = createModelInstance(states);
+    setRateMatrix(instance);
+
+    // long edges need many powers of the uniformized matrix
+    const double factors[3] = { 1.0, 0.1, 10.0 };
+    for (int i = 0; i < 3; i++) {
+        std::vector<double> lengths = getScaledLengths(factors[i]);
+        check("uniformized rate matrix vs eigen decomposition",
+              calculateTreeLogLikelihoodFromRateMatrix(instance, &lengths[0]),
+              calculateTreeLogLikelihood(instance, &lengths[0]), 1E-10);
+    }
+
+    beagleFinalizeInstance(instance);
+}
+
+void checkInvariantSites() {
+    std::vector<int> states = getStates();
+    std::vector<double> lengths = getScaledLengths(1.0);
+    const double proportionInvariant = 0.2;
+
+    double weights[CATEGORY_COUNT + 1];
+    for (int i = 0; i < CATEGORY_COUNT; i++)
+        weights[i] = (1.0 - proportionInvariant) / CATEGORY_COUNT;
+    weights[CATEGORY_COUNT] = proportionInvariant;
+
+    int instance = createModelInstance(states);
+    beagleSetCategoryWeights(instance, 0, weights);
+    int returnCode = beagleSetInvariantSites(instance, proportionInvariant, 0);
+    if (returnCode != BEAGLE_SUCCESS)
+        fprintf(stderr, "Failed to set invariant sites: error %d\n", returnCode);
+
+    // the invariable sites as one more category, of rate zero
+    BeagleInstanceDetails details;
+    int reference = createInstance(CATEGORY_COUNT + 1, 0,
+                                   BEAGLE_FLAG_FRAMEWORK_CPU | BEAGLE_FLAG_PRECISION_DOUBLE,
+                                   &details);
+    if (reference < 0) {
+        fprintf(stderr, "Failed to obtain BEAGLE instance: error %d\n", reference);
+        exit(1);
+    }
+    setModel(reference, CATEGORY_COUNT + 1);
+    setTipStates(reference, states);
+    beagleSetCategoryWeights(reference, 0, weights);
+
+    check("invariable sites vs category of rate zero", calculateTreeLogLikelihood(instance, &lengths[0]),
+          calculateTreeLogLikelihood(reference, &lengths[0]), 1E-10);
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+}
+
+void checkMissingBlocks() {
+    std::vector<double> lengths = getScaledLengths(1.0);
+
+    // tips 0 and 1 miss the first half of the patterns and tips 0 to 3 a quarter of it, so
+    // that nodes 8 and 12 are missing over whole blocks of patterns
+    std::vector<int> states = getStates();
+    for (int i = 0; i < 4; i++) {
+        for (int k = 0; k < PATTERN_COUNT / 2; k++) {
+            if (i < 2 || (k >= PATTERN_COUNT / 4 && k < 3 * PATTERN_COUNT / 8))
+                states[i * PATTERN_COUNT + k] = STATE_COUNT;
+        }
+    }
+
+    // the same patterns spread out, so that no block of patterns is missing at any node
+    std::vector<int> patternOrder(PATTERN_COUNT);
+    std::vector<int> spreadStates(states.size());
+    for (int k = 0; k < PATTERN_COUNT; k++) {
+        patternOrder[k] = (k * 65) % PATTERN_COUNT;
+        for (int i = 0; i < TIP_COUNT; i++)
+            spreadStates[i * PATTERN_COUNT + k] = states[i * PATTERN_COUNT + patternOrder[k]];
+    }
+
+    int instance = createModelInstance(states);
+    int reference = createModelInstance(spreadStates);
+    calculateTreeLogLikelihood(instance, &lengths[0]);
+    calculateTreeLogLikelihood(reference, &lengths[0]);
+
+    std::vector<double> siteLogLikelihoods(PATTERN_COUNT);
+    std::vector<double> referenceSiteLogLikelihoods(PATTERN_COUNT);
+    beagleGetSiteLogLikelihoods(instance, &siteLogLikelihoods[0]);
+    beagleGetSiteLogLikelihoods(reference, &referenceSiteLogLikelihoods[0]);
+
+    // summed in the same order, so that a difference at any site shows in the sums
+    double logL = 0.0;
+    double referenceLogL = 0.0;
+    for (int k = 0; k < PATTERN_COUNT; k++) {
+        logL += siteLogLikelihoods[patternOrder[k]];
+        referenceLogL += referenceSiteLogLikelihoods[k];
+    }
+    check("skipped missing blocks vs no missing blocks", logL, referenceLogL, 0.0);
+
+    beagleFinalizeInstance(reference);
+    beagleFinalizeInstance(instance);
+}
+
+struct ConsistencyCheck {
+    const char* name;
+    void (*run)();
+};
+
+static const ConsistencyCheck consistencyChecks[] = {
+    { "async", checkAsyncRootLogLikelihoods },
+    { "batched", checkBatchedInstance },
+    { "memorybudget", checkDeviceMemoryBudget },
+    { "statistics", checkInstanceStatistics },
+    { "commandbuffer", checkCommandBuffer },
+    { "instancetable", checkInstanceTable },
+    { "snapshot", checkSnapshotAndClone },
+    { "saveload", checkSaveAndLoad },
+    { "tipstates", checkSharedTipStates },
+    { "packedtips", checkPackedTipStates },
+    { "plugins", checkPluginLoading },
+    { "autoselect", checkAutoselectCache },
+    { "sitelogs", checkSiteLogarithms },
+    { "edgeprojection", checkEdgeProjection },
+    { "treepartials", checkTreePartials },
+    { "matrixcache", checkTransitionMatrixCache },
+    { "convolution", checkConvolutionChains },
+    { "fixedstates", checkFixedStateCounts },
+    { "ratematrix", checkRateMatrix },
+    { "invariantsites", checkInvariantSites },
+    { "missingblocks", checkMissingBlocks },
+};
+
+int main(int argc, const char* argv[]) {
+    const int checkCount = (int) (sizeof(consistencyChecks) / sizeof(consistencyChecks[0]));
+
+    programPath = argv[0];
+    if (argc > 1 && strcmp(argv[1], "--print-resources") == 0)
+        return printResourceList(argc > 2 && strcmp(argv[2], "lazy") == 0);
+
+    for (int i = 1; i < argc; i++) {
+        bool found = false;
+        for (int j = 0; j < checkCount; j++)
+            found = found || strcmp(argv[i], consistencyChecks[j].name) == 0;
+        if (!found) {
+            fprintf(stderr, "Unknown check: %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    for (int j = 0; j < checkCount; j++) {
+        bool selected = (argc == 1);
+        for (int i = 1; i < argc; i++)
+            selected = selected || strcmp(argv[i], consistencyChecks[j].name) == 0;
+        if (selected)
+            consistencyChecks[j].run();
+    }
+
+    if (failureCount > 0) {
+        fprintf(stdout, "\n%d check(s) failed\n", failureCount);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1053 @@
+/*
+ *  tracereplay.cpp
+ *  BEAGLE
+ *
+ *  Re-executes a call trace recorded with the BEAGLE_TRACE environment variable, on the same
+ *  or another resource, and reports the time spent in each function of the API.
+ *
+ *  Recording a trace from a client program:
+ *      BEAGLE_TRACE=run.trace mb mcmc-dengue.nex
+ *  Replaying it:
+ *      tracereplay run.trace [--rsrc 1] [--doubleprecision]
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <chrono>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/BeagleTrace.h"
+
+/// reads the arguments of one record; arrays stay valid until the next record
+class TraceArguments {
+public:
+    void reset(const std::vector<char>& payload) {
+        data = (payload.empty() ? NULL : &payload[0]);
+        size = payload.size();
+        offset = 0;
+        intArrays.clear();
+        doubleArrays.clear();
+        byteArrays.clear();
+    }
+
+    int getInt() {
+        int32_t value = 0;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    long getLong() {
+        int64_t value = 0;
+        read(&value, sizeof(value));
+        return (long) value;
+    }
+
+    double getDouble() {
+        double value = 0.0;
+        read(&value, sizeof(value));
+        return value;
+    }
+
+    /// NULL if the recorded array was NULL
+    const int* getInts() {
+        int count = getInt();
+        if (count < 0)
+            return NULL;
+        intArrays.push_back(std::vector<int>(count > 0 ? count : 1));
+        read(&intArrays.back()[0], sizeof(int) * count);
+        return &intArrays.back()[0];
+    }
+
+    const double* getDoubles(int* outCount = NULL) {
+        int count = getInt();
+        if (outCount != NULL)
+            *outCount = (count > 0 ? count : 0);
+        if (count < 0)
+            return NULL;
+        doubleArrays.push_back(std::vector<double>(count > 0 ? count : 1));
+        read(&doubleArrays.back()[0], sizeof(double) * count);
+        return &doubleArrays.back()[0];
+    }
+
+    /// NULL-terminated, so strings can be used directly
+    const char* getBytes(size_t* outCount) {
+        int count = getInt();
+        *outCount = (count > 0 ? count : 0);
+        if (count < 0)
+            return NULL;
+        byteArrays.push_back(std::vector<char>(count + 1, '\0'));
+        read(&byteArrays.back()[0], count);
+        return &byteArrays.back()[0];
+    }
+
+    const char* getString() {
+        size_t count;
+        return getBytes(&count);
+    }
+
+    bool overrun() const { return offset > size; }
+
+private:
+    void read(void* destination, size_t count) {
+        if (offset + count <= size && count > 0)
+            memcpy(destination, data + offset, count);
+        offset += count;
+    }
+
+    const char* data;
+    size_t size;
+    size_t offset;
+    std::list<std::vector<int> > intArrays;
+    std::list<std::vector<double> > doubleArrays;
+    std::list<std::vector<char> > byteArrays;
+};
+
+/// dimensions of a replayed instance, for the buffers of calls returning arrays
+struct ReplayedInstance {
+    int stateCount;
+    int patternCount;
+    int categoryCount;
+};
+
+struct CallTimes {
+    CallTimes() : count(0), recorded(0.0), replayed(0.0) {}
+    int count;
+    double recorded;
+    double replayed;
+};
+
+struct ReplayOptions {
+    ReplayOptions() : resource(-1), precisionFlags(0), vectorFlags(0), reps(1), tolerance(-1.0), verbose(false) {}
+    int resource;
+    long precisionFlags;
+    long vectorFlags;
+    int reps;
+    double tolerance;
+    bool verbose;
+};
+
+void abort(std::string msg) {
+    std::cerr << msg << "\nAborting..." << std::endl;
+    std::exit(1);
+}
+
+class TraceReplay {
+public:
+    TraceReplay(const char* fileName, const ReplayOptions& options) : fileName(fileName), options(options),
+                                                                      mismatchCount(0), maxDifference(0.0),
+                                                                      lastLogL(0.0), announced(false) {
+        FILE* file = fopen(fileName, "rb");
+        if (file == NULL)
+            abort(std::string("Unable to open trace file ") + fileName);
+
+        beagle::TraceFileHeader header;
+        if (fread(&header, sizeof(header), 1, file) != 1 ||
+            memcmp(header.magic, "BEAGLETR", sizeof(header.magic)) != 0)
+            abort(std::string("Not a BEAGLE trace: ") + fileName);
+        if (header.byteOrder != 0x01020304)
+            abort("Trace recorded on a host with another byte order");
+        if (header.version != BEAGLE_TRACE_FILE_VERSION)
+            abort("Unsupported trace version");
+
+        beagle::TraceRecordHeader recordHeader;
+        while (fread(&recordHeader, sizeof(recordHeader), 1, file) == 1) {
+            records.push_back(recordHeader);
+            payloads.push_back(std::vector<char>(recordHeader.size));
+            if (recordHeader.size > 0 &&
+                fread(&payloads.back()[0], 1, recordHeader.size, file) != recordHeader.size) {
+                // the recording program may have stopped in the middle of a record
+                records.pop_back();
+                payloads.pop_back();
+                break;
+            }
+        }
+        fclose(file);
+    }
+
+    size_t getCallCount() const { return records.size(); }
+
+    /// replays every record once; returns false if a call could not be replayed
+    bool run() {
+        for (size_t i = 0; i < records.size(); i++) {
+            if (!replay(i))
+                return false;
+        }
+        // instances the recording program never finalized
+        for (std::map<int, int>::iterator it = instances.begin(); it != instances.end(); ++it)
+            beagleFinalizeInstance(it->second);
+        for (std::map<int, int>::iterator it = commandBuffers.begin(); it != commandBuffers.end(); ++it)
+            beagleFinalizeCommandBuffer(it->second);
+        instances.clear();
+        dimensions.clear();
+        commandBuffers.clear();
+        return true;
+    }
+
+    void clearTimes() {
+        times.clear();
+    }
+
+    void printTimes() const {
+        fprintf(stdout, "%-50s %10s %14s %14s %12s\n", "function", "calls", "recorded (s)", "replayed (s)",
+                "mean (us)");
+        double recordedTotal = 0.0;
+        double replayedTotal = 0.0;
+        for (std::map<int, CallTimes>::const_iterator it = times.begin(); it != times.end(); ++it) {
+            const CallTimes& t = it->second;
+            fprintf(stdout, "%-50s %10d %14.6f %14.6f %12.3f\n", beagle::traceCallName(it->first), t.count,
+                    t.recorded, t.replayed, 1E6 * t.replayed / t.count);
+            recordedTotal += t.recorded;
+            replayedTotal += t.replayed;
+        }
+        fprintf(stdout, "%-50s %10d %14.6f %14.6f\n", "total", (int) records.size(), recordedTotal,
+                replayedTotal);
+    }
+
+    double getReplayedTotal() const {
+        double total = 0.0;
+        for (std::map<int, CallTimes>::const_iterator it = times.begin(); it != times.end(); ++it)
+            total += it->second.replayed;
+        return total;
+    }
+
+    int getMismatchCount() const { return mismatchCount; }
+    double getMaxDifference() const { return maxDifference; }
+    double getLastLogL() const { return lastLogL; }
+
+private:
+    int mapHandle(const std::map<int, int>& handles, int recorded) const {
+        std::map<int, int>::const_iterator it = handles.find(recorded);
+        return (it != handles.end() ? it->second : -1);
+    }
+
+    const ReplayedInstance& instanceDimensions(int replayed) {
+        return dimensions[replayed];
+    }
+
+    /// compares a value returned by the replay with the recorded one
+    void compare(const double* recorded, const double* replayed, int count, bool logL) {
+        if (recorded == NULL || replayed == NULL)
+            return;
+        for (int i = 0; i < count; i++) {
+            double difference = fabs(recorded[i] - replayed[i]);
+            if (difference > maxDifference || difference != difference)
+                maxDifference = difference;
+        }
+        if (logL && count > 0)
+            lastLogL = replayed[count - 1];
+    }
+
+    bool replay(size_t index) {
+        const beagle::TraceRecordHeader& record = records[index];
+        TraceArguments args;
+        args.reset(payloads[index]);
+
+        int call = record.call;
+        int handle = -1;
+        if (call == beagle::TRACE_CREATE_INSTANCE) {
+            handle = -1;
+        } else if (call >= beagle::TRACE_RECORD_UPDATE_TRANSITION_MATRICES &&
+                   call <= beagle::TRACE_FINALIZE_COMMAND_BUFFER) {
+            handle = mapHandle(commandBuffers, record.handle);
+        } else {
+            handle = mapHandle(instances, record.handle);
+        }
+        if (handle < 0 && call != beagle::TRACE_CREATE_INSTANCE) {
+            // calls on instances that could not be created or were never valid
+            if (record.returnValue >= 0)
+                reportMismatch(index, BEAGLE_ERROR_UNINITIALIZED_INSTANCE);
+            return true;
+        }
+        const int instance = handle;
+
+        int returnValue = BEAGLE_SUCCESS;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
+#define REPLAY(expression) start = std::chrono::steady_clock::now(); \
+                           returnValue = (expression); \
+                           end = std::chrono::steady_clock::now();
+
+        switch (call) {
+            case beagle::TRACE_CREATE_INSTANCE: {
+                int tipCount = args.getInt();
+                int partialsBufferCount = args.getInt();
+                int compactBufferCount = args.getInt();
+                int stateCount = args.getInt();
+                int patternCount = args.getInt();
+                int eigenBufferCount = args.getInt();
+                int matrixBufferCount = args.getInt();
+                int categoryCount = args.getInt();
+                int scaleBufferCount = args.getInt();
+                const int* resourceList = args.getInts();
+                int resourceCount = args.getInt();
+                long preferenceFlags = args.getLong();
+                long requirementFlags = args.getLong();
+                const char* recordedImplName = args.getString();
+
+                int resource = options.resource;
+                if (resource >= 0) {
+                    resourceList = &resource;
+                    resourceCount = 1;
+                }
+                if (options.precisionFlags != 0) {
+                    long precisionMask = BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE;
+                    preferenceFlags = (preferenceFlags & ~precisionMask) | options.precisionFlags;
+                    requirementFlags = (requirementFlags & ~precisionMask) | options.precisionFlags;
+                }
+                if (options.vectorFlags != 0) {
+                    long vectorMask = BEAGLE_FLAG_VECTOR_NONE | BEAGLE_FLAG_VECTOR_SSE | BEAGLE_FLAG_VECTOR_AVX;
+                    preferenceFlags = (preferenceFlags & ~vectorMask) | options.vectorFlags;
+                    requirementFlags = (requirementFlags & ~vectorMask) | options.vectorFlags;
+                }
+
+                BeagleInstanceDetails details;
+                REPLAY(beagleCreateInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                            patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                                            scaleBufferCount, (int*) resourceList, resourceCount,
+                                            preferenceFlags, requirementFlags, &details));
+                if (returnValue >= 0) {
+                    instances[record.returnValue] = returnValue;
+                    ReplayedInstance& replayed = dimensions[returnValue];
+                    replayed.stateCount = stateCount;
+                    replayed.patternCount = patternCount;
+                    replayed.categoryCount = categoryCount;
+                    if (options.verbose || !announced) {
+                        announced = true;
+                        fprintf(stdout, "Instance %d:\n", record.returnValue);
+                        fprintf(stdout, "\tRsrc Name : %s\n", details.resourceName);
+                        fprintf(stdout, "\tImpl Name : %s (recorded on %s)\n", details.implName,
+                                (recordedImplName != NULL ? recordedImplName : "none"));
+                    }
+                } else {
+                    // also when the recording failed: nothing after it would measure anything
+                    fprintf(stderr, "Failed to create instance %d: error %d (recorded %d)\n",
+                            (int) index, returnValue, record.returnValue);
+                    return false;
+                }
+                // the handle of a successful creation differs between runs
+                if (returnValue >= 0 && record.returnValue >= 0)
+                    returnValue = record.returnValue;
+                break;
+            }
+            case beagle::TRACE_FINALIZE_INSTANCE:
+                REPLAY(beagleFinalizeInstance(instance));
+                instances.erase(record.handle);
+                dimensions.erase(instance);
+                break;
+            case beagle::TRACE_CLONE_INSTANCE: {
+                BeagleInstanceDetails details;
+                REPLAY(beagleCloneInstance(instance, &details));
+                if (returnValue >= 0) {
+                    instances[record.returnValue] = returnValue;
+                    dimensions[returnValue] = instanceDimensions(instance);
+                    if (record.returnValue >= 0)
+                        returnValue = record.returnValue;
+                }
+                break;
+            }
+            case beagle::TRACE_SET_DEVICE_MEMORY_BUDGET: {
+                int budgetMegabytes = args.getInt();
+                REPLAY(beagleSetDeviceMemoryBudget(instance, budgetMegabytes));
+                break;
+            }
+            case beagle::TRACE_SET_TRANSITION_MATRIX_CACHE: {
+                int cacheSize = args.getInt();
+                REPLAY(beagleSetTransitionMatrixCache(instance, cacheSize));
+                break;
+            }
+            case beagle::TRACE_SET_INSTANCE_STATISTICS: {
+                int enable = args.getInt();
+                REPLAY(beagleSetInstanceStatistics(instance, enable));
+                break;
+            }
+            case beagle::TRACE_GET_INSTANCE_STATISTICS: {
+                BeagleInstanceStatistics statistics;
+                REPLAY(beagleGetInstanceStatistics(instance, &statistics));
+                break;
+            }
+            case beagle::TRACE_SNAPSHOT_BUFFERS: {
+                int snapshotIndex = args.getInt();
+                const int* partialsIndices = args.getInts();
+                int partialsCount = args.getInt();
+                const int* scaleIndices = args.getInts();
+                int scaleCount = args.getInt();
+                const int* matrixIndices = args.getInts();
+                int matrixCount = args.getInt();
+                REPLAY(beagleSnapshotBuffers(instance, snapshotIndex, partialsIndices, partialsCount,
+                                             scaleIndices, scaleCount, matrixIndices, matrixCount));
+                break;
+            }
+            case beagle::TRACE_RESTORE_SNAPSHOT: {
+                int snapshotIndex = args.getInt();
+                REPLAY(beagleRestoreSnapshot(instance, snapshotIndex));
+                break;
+            }
+            case beagle::TRACE_RELEASE_SNAPSHOT: {
+                int snapshotIndex = args.getInt();
+                REPLAY(beagleReleaseSnapshot(instance, snapshotIndex));
+                break;
+            }
+            case beagle::TRACE_SAVE_INSTANCE: {
+                const char* instanceFileName = args.getString();
+                REPLAY(beagleSaveInstance(instance, instanceFileName));
+                break;
+            }
+            case beagle::TRACE_LOAD_INSTANCE: {
+                const char* instanceFileName = args.getString();
+                REPLAY(beagleLoadInstance(instance, instanceFileName));
+                break;
+            }
+            case beagle::TRACE_SET_TIP_STATES: {
+                int tipIndex = args.getInt();
+                const int* inStates = args.getInts();
+                REPLAY(beagleSetTipStates(instance, tipIndex, inStates));
+                break;
+            }
+            case beagle::TRACE_SET_TIP_STATES_EXTERNAL: {
+                int tipIndex = args.getInt();
+                size_t count;
+                const unsigned char* inStates = (const unsigned char*) args.getBytes(&count);
+                REPLAY(beagleSetTipStatesExternal(instance, tipIndex, inStates));
+                break;
+            }
+            case beagle::TRACE_MAP_TIP_STATES_FILE: {
+                // the file is mapped again by name, so it must still be there unchanged
+                const char* tipStatesFileName = args.getString();
+                long recordedSize = args.getLong();
+                FILE* file = (tipStatesFileName != NULL ? fopen(tipStatesFileName, "rb") : NULL);
+                long size = -1;
+                if (file != NULL) {
+                    fseek(file, 0, SEEK_END);
+                    size = ftell(file);
+                    fclose(file);
+                }
+                if (size != recordedSize) {
+                    fprintf(stderr, "Tip states file %s is missing or differs from the recorded one\n",
+                            (tipStatesFileName != NULL ? tipStatesFileName : "(null)"));
+                    return false;
+                }
+                REPLAY(beagleMapTipStatesFile(instance, tipStatesFileName));
+                break;
+            }
+            case beagle::TRACE_SET_TIP_PARTIALS: {
+                int tipIndex = args.getInt();
+                const double* inPartials = args.getDoubles();
+                REPLAY(beagleSetTipPartials(instance, tipIndex, inPartials));
+                break;
+            }
+            case beagle::TRACE_SET_PARTIALS: {
+                int bufferIndex = args.getInt();
+                const double* inPartials = args.getDoubles();
+                REPLAY(beagleSetPartials(instance, bufferIndex, inPartials));
+                break;
+            }
+            case beagle::TRACE_GET_PARTIALS: {
+                int bufferIndex = args.getInt();
+                int scaleIndex = args.getInt();
+                const ReplayedInstance& d = instanceDimensions(instance);
+                std::vector<double> outPartials(d.patternCount * d.stateCount * d.categoryCount);
+                REPLAY(beagleGetPartials(instance, bufferIndex, scaleIndex, &outPartials[0]));
+                break;
+            }
+            case beagle::TRACE_SET_EIGEN_DECOMPOSITION: {
+                int eigenIndex = args.getInt();
+                const double* inEigenVectors = args.getDoubles();
+                const double* inInverseEigenVectors = args.getDoubles();
+                const double* inEigenValues = args.getDoubles();
+                REPLAY(beagleSetEigenDecomposition(instance, eigenIndex, inEigenVectors, inInverseEigenVectors,
+                                                   inEigenValues));
+                break;
+            }
+            case beagle::TRACE_SET_STATE_FREQUENCIES: {
+                int stateFrequenciesIndex = args.getInt();
+                const double* inStateFrequencies = args.getDoubles();
+                REPLAY(beagleSetStateFrequencies(instance, stateFrequenciesIndex, inStateFrequencies));
+                break;
+            }
+            case beagle::TRACE_SET_INVARIANT_SITES: {
+                double proportionInvariant = args.getDouble();
+                int stateFrequenciesIndex = args.getInt();
+                REPLAY(beagleSetInvariantSites(instance, proportionInvariant, stateFrequenciesIndex));
+                break;
+            }
+            case beagle::TRACE_SET_CATEGORY_WEIGHTS: {
+                int categoryWeightsIndex = args.getInt();
+                const double* inCategoryWeights = args.getDoubles();
+                REPLAY(beagleSetCategoryWeights(instance, categoryWeightsIndex, inCategoryWeights));
+                break;
+            }
+            case beagle::TRACE_SET_CATEGORY_RATES: {
+                const double* inCategoryRates = args.getDoubles();
+                REPLAY(beagleSetCategoryRates(instance, inCategoryRates));
+                break;
+            }
+            case beagle::TRACE_SET_CATEGORY_RATES_WITH_INDEX: {
+                int categoryRatesIndex = args.getInt();
+                const double* inCategoryRates = args.getDoubles();
+                REPLAY(beagleSetCategoryRatesWithIndex(instance, categoryRatesIndex, inCategoryRates));
+                break;
+            }
+            case beagle::TRACE_SET_PATTERN_WEIGHTS: {
+                const double* inPatternWeights = args.getDoubles();
+                REPLAY(beagleSetPatternWeights(instance, inPatternWeights));
+                break;
+            }
+            case beagle::TRACE_SET_PATTERN_PARTITIONS: {
+                int partitionCount = args.getInt();
+                const int* inPatternPartitions = args.getInts();
+                REPLAY(beagleSetPatternPartitions(instance, partitionCount, inPatternPartitions));
+                break;
+            }
+            case beagle::TRACE_CONVOLVE_TRANSITION_MATRICES: {
+                const int* firstIndices = args.getInts();
+                const int* secondIndices = args.getInts();
+                const int* resultIndices = args.getInts();
+                int matrixCount = args.getInt();
+                REPLAY(beagleConvolveTransitionMatrices(instance, firstIndices, secondIndices, resultIndices,
+                                                        matrixCount));
+                break;
+            }
+            case beagle::TRACE_CONVOLVE_TRANSITION_MATRIX_CHAINS: {
+                const int* matrixIndices = args.getInts();
+                const int* chainLengths = args.getInts();
+                const int* resultIndices = args.getInts();
+                int chainCount = args.getInt();
+                REPLAY(beagleConvolveTransitionMatrixChains(instance, matrixIndices, chainLengths, resultIndices,
+                                                            chainCount));
+                break;
+            }
+            case beagle::TRACE_UPDATE_TRANSITION_MATRICES: {
+                int eigenIndex = args.getInt();
+                const int* probabilityIndices = args.getInts();
+                const int* firstDerivativeIndices = args.getInts();
+                const int* secondDerivativeIndices = args.getInts();
+                const double* edgeLengths = args.getDoubles();
+                int count = args.getInt();
+                REPLAY(beagleUpdateTransitionMatrices(instance, eigenIndex, probabilityIndices,
+                                                      firstDerivativeIndices, secondDerivativeIndices,
+                                                      edgeLengths, count));
+                break;
+            }
+            case beagle::TRACE_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS: {
+                const int* eigenIndices = args.getInts();
+                const int* categoryRateIndices = args.getInts();
+                const int* probabilityIndices = args.getInts();
+                const int* firstDerivativeIndices = args.getInts();
+                const int* secondDerivativeIndices = args.getInts();
+                const double* edgeLengths = args.getDoubles();
+                int count = args.getInt();
+                REPLAY(beagleUpdateTransitionMatricesWithMultipleModels(instance, eigenIndices,
+                                                                        categoryRateIndices, probabilityIndices,
+                                                                        firstDerivativeIndices,
+                                                                        secondDerivativeIndices, edgeLengths,
+                                                                        count));
+                break;
+            }
+            case beagle::TRACE_SET_RATE_MATRIX: {
+                int rateMatrixIndex = args.getInt();
+                const double* inRateMatrix = args.getDoubles();
+                REPLAY(beagleSetRateMatrix(instance, rateMatrixIndex, inRateMatrix));
+                break;
+            }
+            case beagle::TRACE_UPDATE_TRANSITION_MATRICES_FROM_RATE_MATRIX: {
+                int rateMatrixIndex = args.getInt();
+                const int* probabilityIndices = args.getInts();
+                const double* edgeLengths = args.getDoubles();
+                int count = args.getInt();
+                REPLAY(beagleUpdateTransitionMatricesFromRateMatrix(instance, rateMatrixIndex, probabilityIndices,
+                                                                    edgeLengths, count));
+                break;
+            }
+            case beagle::TRACE_SET_TRANSITION_MATRIX: {
+                int matrixIndex = args.getInt();
+                const double* inMatrix = args.getDoubles();
+                double paddedValue = args.getDouble();
+                REPLAY(beagleSetTransitionMatrix(instance, matrixIndex, inMatrix, paddedValue));
+                break;
+            }
+            case beagle::TRACE_GET_TRANSITION_MATRIX: {
+                int matrixIndex = args.getInt();
+                const ReplayedInstance& d = instanceDimensions(instance);
+                std::vector<double> outMatrix(d.stateCount * d.stateCount * d.categoryCount);
+                REPLAY(beagleGetTransitionMatrix(instance, matrixIndex, &outMatrix[0]));
+                break;
+            }
+            case beagle::TRACE_SET_TRANSITION_MATRICES: {
+                const int* matrixIndices = args.getInts();
+                const double* inMatrices = args.getDoubles();
+                const double* paddedValues = args.getDoubles();
+                int count = args.getInt();
+                REPLAY(beagleSetTransitionMatrices(instance, matrixIndices, inMatrices, paddedValues, count));
+                break;
+            }
+            case beagle::TRACE_UPDATE_PARTIALS: {
+                const int* operations = args.getInts();
+                int operationCount = args.getInt();
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beagleUpdatePartials(instance, (const BeagleOperation*) operations, operationCount,
+                                            cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_UPDATE_PARTIALS_BY_PARTITION: {
+                const int* operations = args.getInts();
+                int operationCount = args.getInt();
+                REPLAY(beagleUpdatePartialsByPartition(instance, (const BeagleOperationByPartition*) operations,
+                                                       operationCount));
+                break;
+            }
+            case beagle::TRACE_WAIT_FOR_PARTIALS: {
+                const int* destinationPartials = args.getInts();
+                int destinationPartialsCount = args.getInt();
+                REPLAY(beagleWaitForPartials(instance, destinationPartials, destinationPartialsCount));
+                break;
+            }
+            case beagle::TRACE_ACCUMULATE_SCALE_FACTORS:
+            case beagle::TRACE_REMOVE_SCALE_FACTORS: {
+                const int* scaleIndices = args.getInts();
+                int count = args.getInt();
+                int cumulativeScaleIndex = args.getInt();
+                if (call == beagle::TRACE_ACCUMULATE_SCALE_FACTORS) {
+                    REPLAY(beagleAccumulateScaleFactors(instance, scaleIndices, count, cumulativeScaleIndex));
+                } else {
+                    REPLAY(beagleRemoveScaleFactors(instance, scaleIndices, count, cumulativeScaleIndex));
+                }
+                break;
+            }
+            case beagle::TRACE_ACCUMULATE_SCALE_FACTORS_BY_PARTITION:
+            case beagle::TRACE_REMOVE_SCALE_FACTORS_BY_PARTITION: {
+                const int* scaleIndices = args.getInts();
+                int count = args.getInt();
+                int cumulativeScaleIndex = args.getInt();
+                int partitionIndex = args.getInt();
+                if (call == beagle::TRACE_ACCUMULATE_SCALE_FACTORS_BY_PARTITION) {
+                    REPLAY(beagleAccumulateScaleFactorsByPartition(instance, scaleIndices, count,
+                                                                   cumulativeScaleIndex, partitionIndex));
+                } else {
+                    REPLAY(beagleRemoveScaleFactorsByPartition(instance, scaleIndices, count,
+                                                               cumulativeScaleIndex, partitionIndex));
+                }
+                break;
+            }
+            case beagle::TRACE_RESET_SCALE_FACTORS: {
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beagleResetScaleFactors(instance, cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_RESET_SCALE_FACTORS_BY_PARTITION: {
+                int cumulativeScaleIndex = args.getInt();
+                int partitionIndex = args.getInt();
+                REPLAY(beagleResetScaleFactorsByPartition(instance, cumulativeScaleIndex, partitionIndex));
+                break;
+            }
+            case beagle::TRACE_COPY_SCALE_FACTORS: {
+                int destScalingIndex = args.getInt();
+                int srcScalingIndex = args.getInt();
+                REPLAY(beagleCopyScaleFactors(instance, destScalingIndex, srcScalingIndex));
+                break;
+            }
+            case beagle::TRACE_GET_SCALE_FACTORS: {
+                int srcScalingIndex = args.getInt();
+                std::vector<double> outScaleFactors(instanceDimensions(instance).patternCount);
+                REPLAY(beagleGetScaleFactors(instance, srcScalingIndex, &outScaleFactors[0]));
+                break;
+            }
+            case beagle::TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS: {
+                const int* bufferIndices = args.getInts();
+                const int* categoryWeightsIndices = args.getInts();
+                const int* stateFrequenciesIndices = args.getInts();
+                const int* cumulativeScaleIndices = args.getInts();
+                int count = args.getInt();
+                double outSumLogLikelihood = 0.0;
+                REPLAY(beagleCalculateRootLogLikelihoods(instance, bufferIndices, categoryWeightsIndices,
+                                                         stateFrequenciesIndices, cumulativeScaleIndices, count,
+                                                         &outSumLogLikelihood));
+                if (record.returnValue == BEAGLE_SUCCESS)
+                    compare(args.getDoubles(), &outSumLogLikelihood, 1, true);
+                break;
+            }
+            case beagle::TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS_BY_PARTITION: {
+                const int* bufferIndices = args.getInts();
+                const int* categoryWeightsIndices = args.getInts();
+                const int* stateFrequenciesIndices = args.getInts();
+                const int* cumulativeScaleIndices = args.getInts();
+                const int* partitionIndices = args.getInts();
+                int partitionCount = args.getInt();
+                int count = args.getInt();
+                std::vector<double> outSumLogLikelihoodByPartition(partitionCount > 0 ? partitionCount : 1);
+                double outSumLogLikelihood = 0.0;
+                REPLAY(beagleCalculateRootLogLikelihoodsByPartition(instance, bufferIndices,
+                                                                    categoryWeightsIndices,
+                                                                    stateFrequenciesIndices,
+                                                                    cumulativeScaleIndices, partitionIndices,
+                                                                    partitionCount, count,
+                                                                    &outSumLogLikelihoodByPartition[0],
+                                                                    &outSumLogLikelihood));
+                if (record.returnValue == BEAGLE_SUCCESS) {
+                    compare(args.getDoubles(), &outSumLogLikelihoodByPartition[0], partitionCount, false);
+                    compare(args.getDoubles(), &outSumLogLikelihood, 1, true);
+                }
+                break;
+            }
+            case beagle::TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS_ASYNC: {
+                const int* bufferIndices = args.getInts();
+                const int* categoryWeightsIndices = args.getInts();
+                const int* stateFrequenciesIndices = args.getInts();
+                const int* cumulativeScaleIndices = args.getInts();
+                const int* partitionIndices = args.getInts();
+                int partitionCount = args.getInt();
+                REPLAY(beagleCalculateRootLogLikelihoodsAsync(instance, bufferIndices, categoryWeightsIndices,
+                                                              stateFrequenciesIndices, cumulativeScaleIndices,
+                                                              partitionIndices, partitionCount));
+                break;
+            }
+            case beagle::TRACE_GET_ROOT_LOG_LIKELIHOODS_ASYNC: {
+                int blocking = args.getInt();
+                // at most one log likelihood per pattern
+                std::vector<double> outSumLogLikelihoodByPartition(instanceDimensions(instance).patternCount + 1);
+                double outSumLogLikelihood = 0.0;
+                REPLAY(beagleGetRootLogLikelihoodsAsync(instance, blocking, &outSumLogLikelihoodByPartition[0],
+                                                        &outSumLogLikelihood));
+                // a poll may find the calculation finished in one run and not in the other
+                if (record.returnValue == BEAGLE_SUCCESS && returnValue == BEAGLE_SUCCESS)
+                    compare(args.getDoubles(), &outSumLogLikelihood, 1, true);
+                else if (record.returnValue == BEAGLE_ERROR_NOT_READY || returnValue == BEAGLE_ERROR_NOT_READY)
+                    returnValue = record.returnValue;
+                break;
+            }
+            case beagle::TRACE_CALCULATE_EDGE_LOG_LIKELIHOODS: {
+                const int* parentBufferIndices = args.getInts();
+                const int* childBufferIndices = args.getInts();
+                const int* probabilityIndices = args.getInts();
+                const int* firstDerivativeIndices = args.getInts();
+                const int* secondDerivativeIndices = args.getInts();
+                const int* categoryWeightsIndices = args.getInts();
+                const int* stateFrequenciesIndices = args.getInts();
+                const int* cumulativeScaleIndices = args.getInts();
+                int count = args.getInt();
+                double outSums[3] = {0.0, 0.0, 0.0};
+                REPLAY(beagleCalculateEdgeLogLikelihoods(instance, parentBufferIndices, childBufferIndices,
+                                                         probabilityIndices, firstDerivativeIndices,
+                                                         secondDerivativeIndices, categoryWeightsIndices,
+                                                         stateFrequenciesIndices, cumulativeScaleIndices, count,
+                                                         &outSums[0],
+                                                         (firstDerivativeIndices != NULL ? &outSums[1] : NULL),
+                                                         (secondDerivativeIndices != NULL ? &outSums[2] : NULL)));
+                if (record.returnValue == BEAGLE_SUCCESS) {
+                    compare(args.getDoubles(), &outSums[0], 1, true);
+                    compare(args.getDoubles(), &outSums[1], 1, false);
+                    compare(args.getDoubles(), &outSums[2], 1, false);
+                }
+                break;
+            }
+            case beagle::TRACE_CALCULATE_EDGE_LOG_LIKELIHOODS_BY_PARTITION: {
+                const int* parentBufferIndices = args.getInts();
+                const int* childBufferIndices = args.getInts();
+                const int* probabilityIndices = args.getInts();
+                const int* firstDerivativeIndices = args.getInts();
+                const int* secondDerivativeIndices = args.getInts();
+                const int* categoryWeightsIndices = args.getInts();
+                const int* stateFrequenciesIndices = args.getInts();
+                const int* cumulativeScaleIndices = args.getInts();
+                const int* partitionIndices = args.getInts();
+                int partitionCount = args.getInt();
+                int count = args.getInt();
+                int byPartitionCount = (partitionCount > 0 ? partitionCount : 1);
+                std::vector<double> outByPartition(3 * byPartitionCount);
+                double outSums[3] = {0.0, 0.0, 0.0};
+                bool first = (firstDerivativeIndices != NULL);
+                bool second = (secondDerivativeIndices != NULL);
+                REPLAY(beagleCalculateEdgeLogLikelihoodsByPartition(instance, parentBufferIndices,
+                                                                    childBufferIndices, probabilityIndices,
+                                                                    firstDerivativeIndices,
+                                                                    secondDerivativeIndices,
+                                                                    categoryWeightsIndices,
+                                                                    stateFrequenciesIndices,
+                                                                    cumulativeScaleIndices, partitionIndices,
+                                                                    partitionCount, count,
+                                                                    &outByPartition[0], &outSums[0],
+                                                                    (first ? &outByPartition[byPartitionCount] : NULL),
+                                                                    (first ? &outSums[1] : NULL),
+                                                                    (second ? &outByPartition[2 * byPartitionCount] : NULL),
+                                                                    (second ? &outSums[2] : NULL)));
+                if (record.returnValue == BEAGLE_SUCCESS) {
+                    for (int k = 0; k < 3; k++) {
+                        compare(args.getDoubles(), &outByPartition[k * byPartitionCount], partitionCount, false);
+                        compare(args.getDoubles(), &outSums[k], 1, k == 0);
+                    }
+                }
+                break;
+            }
+            case beagle::TRACE_PREPARE_EDGE_PROJECTION: {
+                int parentBufferIndex = args.getInt();
+                int childBufferIndex = args.getInt();
+                int eigenIndex = args.getInt();
+                int categoryWeightsIndex = args.getInt();
+                int stateFrequenciesIndex = args.getInt();
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beaglePrepareEdgeProjection(instance, parentBufferIndex, childBufferIndex, eigenIndex,
+                                                   categoryWeightsIndex, stateFrequenciesIndex,
+                                                   cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_CALCULATE_EDGE_PROJECTION_LOG_LIKELIHOODS: {
+                double edgeLength = args.getDouble();
+                const double* recordedSums[3];
+                for (int k = 0; k < 3; k++)
+                    recordedSums[k] = args.getDoubles();
+                double outSums[3] = {0.0, 0.0, 0.0};
+                REPLAY(beagleCalculateEdgeProjectionLogLikelihoods(instance, edgeLength, &outSums[0],
+                                                                   (recordedSums[1] != NULL ? &outSums[1] : NULL),
+                                                                   (recordedSums[2] != NULL ? &outSums[2] : NULL)));
+                if (record.returnValue == BEAGLE_SUCCESS) {
+                    for (int k = 0; k < 3; k++)
+                        compare(recordedSums[k], &outSums[k], 1, k == 0);
+                }
+                break;
+            }
+            case beagle::TRACE_GET_SITE_LOG_LIKELIHOODS: {
+                std::vector<double> outLogLikelihoods(instanceDimensions(instance).patternCount);
+                REPLAY(beagleGetSiteLogLikelihoods(instance, &outLogLikelihoods[0]));
+                break;
+            }
+            case beagle::TRACE_GET_SITE_DERIVATIVES: {
+                bool first = (args.getInt() != 0);
+                bool second = (args.getInt() != 0);
+                int patternCount = instanceDimensions(instance).patternCount;
+                std::vector<double> outFirstDerivatives(patternCount);
+                std::vector<double> outSecondDerivatives(patternCount);
+                REPLAY(beagleGetSiteDerivatives(instance, (first ? &outFirstDerivatives[0] : NULL),
+                                                (second ? &outSecondDerivatives[0] : NULL)));
+                break;
+            }
+            case beagle::TRACE_CREATE_COMMAND_BUFFER: {
+                REPLAY(beagleCreateCommandBuffer(instance));
+                if (returnValue >= 0) {
+                    commandBuffers[record.returnValue] = returnValue;
+                    if (record.returnValue >= 0)
+                        returnValue = record.returnValue;
+                }
+                break;
+            }
+            case beagle::TRACE_RECORD_UPDATE_TRANSITION_MATRICES: {
+                int eigenIndex = args.getInt();
+                const int* probabilityIndices = args.getInts();
+                const int* firstDerivativeIndices = args.getInts();
+                const int* secondDerivativeIndices = args.getInts();
+                int count = args.getInt();
+                REPLAY(beagleRecordUpdateTransitionMatrices(handle, eigenIndex, probabilityIndices,
+                                                            firstDerivativeIndices, secondDerivativeIndices,
+                                                            count));
+                break;
+            }
+            case beagle::TRACE_RECORD_UPDATE_PARTIALS: {
+                const int* operations = args.getInts();
+                int operationCount = args.getInt();
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beagleRecordUpdatePartials(handle, (const BeagleOperation*) operations, operationCount,
+                                                  cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_RECORD_ACCUMULATE_SCALE_FACTORS: {
+                const int* scaleIndices = args.getInts();
+                int count = args.getInt();
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beagleRecordAccumulateScaleFactors(handle, scaleIndices, count, cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_RECORD_RESET_SCALE_FACTORS: {
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beagleRecordResetScaleFactors(handle, cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_RECORD_CALCULATE_ROOT_LOG_LIKELIHOODS: {
+                const int* bufferIndices = args.getInts();
+                const int* categoryWeightsIndices = args.getInts();
+                const int* stateFrequenciesIndices = args.getInts();
+                const int* cumulativeScaleIndices = args.getInts();
+                int count = args.getInt();
+                REPLAY(beagleRecordCalculateRootLogLikelihoods(handle, bufferIndices, categoryWeightsIndices,
+                                                               stateFrequenciesIndices, cumulativeScaleIndices,
+                                                               count));
+                break;
+            }
+            case beagle::TRACE_EXECUTE_COMMAND_BUFFER: {
+                const double* edgeLengths = args.getDoubles();
+                // the recorded log likelihoods give the number the buffer returns
+                int logLikelihoodCount = 0;
+                const double* recordedLogLikelihoods = args.getDoubles(&logLikelihoodCount);
+                std::vector<double> outSumLogLikelihoods(logLikelihoodCount > 0 ? logLikelihoodCount : 1);
+                REPLAY(beagleExecuteCommandBuffer(handle, edgeLengths, &outSumLogLikelihoods[0]));
+                if (record.returnValue == BEAGLE_SUCCESS)
+                    compare(recordedLogLikelihoods, &outSumLogLikelihoods[0], logLikelihoodCount, true);
+                break;
+            }
+            case beagle::TRACE_FINALIZE_COMMAND_BUFFER:
+                REPLAY(beagleFinalizeCommandBuffer(handle));
+                commandBuffers.erase(record.handle);
+                break;
+            case beagle::TRACE_SET_TREE_TOPOLOGY: {
+                int nodeCount = args.getInt();
+                const int* parentIndices = args.getInts();
+                const int* matrixIndices = args.getInts();
+                const int* scaleIndices = args.getInts();
+                int cumulativeScaleIndex = args.getInt();
+                REPLAY(beagleSetTreeTopology(instance, nodeCount, parentIndices, matrixIndices, scaleIndices,
+                                             cumulativeScaleIndex));
+                break;
+            }
+            case beagle::TRACE_INVALIDATE_TRANSITION_MATRICES: {
+                const int* matrixIndices = args.getInts();
+                int count = args.getInt();
+                REPLAY(beagleInvalidateTransitionMatrices(instance, matrixIndices, count));
+                break;
+            }
+            case beagle::TRACE_INVALIDATE_PARTIALS: {
+                const int* bufferIndices = args.getInts();
+                int count = args.getInt();
+                REPLAY(beagleInvalidatePartials(instance, bufferIndices, count));
+                break;
+            }
+            case beagle::TRACE_UPDATE_TREE_PARTIALS: {
+                int operationCount = 0;
+                REPLAY(beagleUpdateTreePartials(instance, &operationCount));
+                break;
+            }
+            default:
+                fprintf(stderr, "Unknown call %d in trace record %d\n", call, (int) index);
+                return false;
+        }
+#undef REPLAY
+
+        if (args.overrun()) {
+            fprintf(stderr, "Trace record %d (%s) is truncated\n", (int) index, beagle::traceCallName(call));
+            return false;
+        }
+        if (returnValue != record.returnValue)
+            reportMismatch(index, returnValue);
+
+        CallTimes& t = times[call];
+        t.count++;
+        t.recorded += record.seconds;
+        t.replayed += std::chrono::duration<double>(end - start).count();
+        return true;
+    }
+
+    void reportMismatch(size_t index, int returnValue) {
+        if (mismatchCount < 10 || options.verbose)
+            fprintf(stderr, "Call %d (%s) returned %d, recorded %d\n", (int) index,
+                    beagle::traceCallName(records[index].call), returnValue, records[index].returnValue);
+        mismatchCount++;
+    }
+
+    const char* fileName;
+    ReplayOptions options;
+    std::vector<beagle::TraceRecordHeader> records;
+    std::vector<std::vector<char> > payloads;
+    std::map<int, int> instances;      /// recorded handle to replayed handle
+    std::map<int, ReplayedInstance> dimensions;
+    std::map<int, int> commandBuffers;
+    std::map<int, CallTimes> times;
+    int mismatchCount;
+    double maxDifference;
+    double lastLogL;
+    bool announced;
+};
+
+void helpMessage() {
+    std::cerr << "Usage:\n\n";
+    std::cerr << "tracereplay <trace file> [--help] [--resourcelist] [--rsrc <integer>] [--reps <integer>] [--doubleprecision] [--singleprecision] [--SSE] [--AVX] [--tolerance <number>] [--verbose]\n\n";
+    std::cerr << "Traces are recorded by running a program with BEAGLE_TRACE=<trace file> in its environment\n\n";
+    std::cerr << "If --rsrc is specified, every instance is created on that resource instead of the recorded ones\n\n";
+    std::cerr << "If --doubleprecision, --singleprecision, --SSE or --AVX is specified, it replaces the recorded precision or vectorization flags\n\n";
+    std::cerr << "If --tolerance is specified, the replay fails when a log likelihood or derivative differs from the recorded one by more than that\n\n";
+    std::exit(0);
+}
+
+void printResourceList() {
+    BeagleResourceList* rList = beagleGetResourceList();
+    fprintf(stdout, "Available resources:\n");
+    for (int i = 0; i < rList->length; i++) {
+        fprintf(stdout, "\tResource %i:\n\t\tName : %s\n", i, rList->list[i].name);
+        fprintf(stdout, "\t\tDesc : %s\n", rList->list[i].description);
+    }
+    fprintf(stdout, "\n");
+    std::exit(0);
+}
+
+int main(int argc, const char* argv[]) {
+    ReplayOptions options;
+    const char* traceFileName = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "--help") {
+            helpMessage();
+        } else if (option == "--resourcelist") {
+            printResourceList();
+        } else if (option == "--rsrc" && i + 1 < argc) {
+            options.resource = atoi(argv[++i]);
+        } else if (option == "--reps" && i + 1 < argc) {
+            options.reps = atoi(argv[++i]);
+        } else if (option == "--tolerance" && i + 1 < argc) {
+            options.tolerance = atof(argv[++i]);
+        } else if (option == "--doubleprecision") {
+            options.precisionFlags = BEAGLE_FLAG_PRECISION_DOUBLE;
+        } else if (option == "--singleprecision") {
+            options.precisionFlags = BEAGLE_FLAG_PRECISION_SINGLE;
+        } else if (option == "--SSE") {
+            options.vectorFlags = BEAGLE_FLAG_VECTOR_SSE;
+        } else if (option == "--AVX") {
+            options.vectorFlags = BEAGLE_FLAG_VECTOR_AVX;
+        } else if (option == "--verbose") {
+            options.verbose = true;
+        } else if (option[0] != '-' && traceFileName == NULL) {
+            traceFileName = argv[i];
+        } else {
+            abort("Unknown or incomplete command line parameter \"" + option + "\"");
+        }
+    }
+    if (traceFileName == NULL)
+        helpMessage();
+    if (options.reps < 1)
+        options.reps = 1;
+
+    TraceReplay replay(traceFileName, options);
+    if (replay.getCallCount() == 0)
+        abort(std::string("No calls recorded in ") + traceFileName);
+    fprintf(stdout, "Replaying %d calls from %s\n\n", (int) replay.getCallCount(), traceFileName);
+
+    // the timing of the fastest repetition is reported
+    TraceReplay best = replay;
+    double bestTime = -1.0;
+    for (int rep = 0; rep < options.reps; rep++) {
+        replay.clearTimes();
+        if (!replay.run())
+            abort("Replay failed");
+        if (bestTime < 0.0 || replay.getReplayedTotal() < bestTime) {
+            bestTime = replay.getReplayedTotal();
+            best = replay;
+        }
+    }
+
+    fprintf(stdout, "\n");
+    best.printTimes();
+    fprintf(stdout, "\nbest run: %.6fs\n", bestTime);
+    fprintf(stdout, "logL = %.5f (max difference from recording %.3e)\n", best.getLastLogL(),
+            best.getMaxDifference());
+
+    if (best.getMismatchCount() > 0) {
+        fprintf(stderr, "%d calls returned a different value than recorded\n", best.getMismatchCount());
+        return 1;
+    }
+    if (options.tolerance >= 0.0 && !(best.getMaxDifference() <= options.tolerance)) {
+        fprintf(stderr, "Results differ from the recording by more than %g\n", options.tolerance);
+        return 1;
+    }
+    return 0;
+}
@@ -5,6 +5,11 @@
 
 package beagle;
 
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.DoubleBuffer;
+import java.nio.IntBuffer;
+
 /*
  * BeagleJNIjava
  *
@@ -379,6 +384,75 @@ public class BeagleJNIImpl implements Beagle {
         }
     }
 
+    /**
+     * Allocates a direct buffer in native byte order for use with the *Direct methods
+     * @param size the number of doubles
+     * @return the buffer
+     */
+    public static DoubleBuffer allocateDoubleBuffer(int size) {
+        return ByteBuffer.allocateDirect(size * 8).order(ByteOrder.nativeOrder()).asDoubleBuffer();
+    }
+
+    /**
+     * Allocates a direct buffer in native byte order for use with the *Direct methods
+     * @param size the number of ints
+     * @return the buffer
+     */
+    public static IntBuffer allocateIntBuffer(int size) {
+        return ByteBuffer.allocateDirect(size * 4).order(ByteOrder.nativeOrder()).asIntBuffer();
+    }
+
+    public void setPartials(int bufferIndex, final DoubleBuffer partials) {
+        int errCode = BeagleJNIWrapper.INSTANCE.setPartialsDirect(instance, bufferIndex, partials);
+        if (errCode != 0) {
+            throw new BeagleException("setPartials", errCode);
+        }
+    }
+
+    public void getPartials(int bufferIndex, int scaleIndex, final DoubleBuffer outPartials) {
+        int errCode = BeagleJNIWrapper.INSTANCE.getPartialsDirect(instance, bufferIndex, scaleIndex, outPartials);
+        if (errCode != 0) {
+            throw new BeagleException("getPartials", errCode);
+        }
+    }
+
+    public void getLogScaleFactors(int scaleIndex, final DoubleBuffer outFactors) {
+        int errCode = BeagleJNIWrapper.INSTANCE.getLogScaleFactorsDirect(instance, scaleIndex, outFactors);
+        if (errCode != 0) {
+            throw new BeagleException("getScaleFactors", errCode);
+        }
+    }
+
+    public void updateTransitionMatrices(int eigenIndex,
+                                         final IntBuffer probabilityIndices,
+                                         final IntBuffer firstDerivativeIndices,
+                                         final IntBuffer secondDervativeIndices,
+                                         final DoubleBuffer edgeLengths,
+                                         int count) {
+        int errCode = BeagleJNIWrapper.INSTANCE.updateTransitionMatricesDirect(instance,
+                eigenIndex, probabilityIndices,
+                firstDerivativeIndices, secondDervativeIndices,
+                edgeLengths, count);
+        if (errCode != 0) {
+            throw new BeagleException("updateTransitionMatrices", errCode);
+        }
+    }
+
+    public void updatePartials(final IntBuffer operations, final int operationCount, final int cumulativeScaleIndex) {
+        int errCode = BeagleJNIWrapper.INSTANCE.updatePartialsDirect(instance, operations, operationCount, cumulativeScaleIndex);
+        if (errCode != 0) {
+            throw new BeagleException("updatePartials", errCode);
+        }
+    }
+
+    public void getSiteLogLikelihoods(final DoubleBuffer outLogLikelihoods) {
+        int errCode = BeagleJNIWrapper.INSTANCE.getSiteLogLikelihoodsDirect(instance,
+                outLogLikelihoods);
+        if (errCode != 0) {
+            throw new BeagleException("getSiteLogLikelihoods", errCode);
+        }
+    }
+
     public InstanceDetails getDetails() {
         return details;
     }
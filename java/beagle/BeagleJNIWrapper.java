@@ -5,6 +5,8 @@
 
 package beagle;
 
+import java.nio.DoubleBuffer;
+import java.nio.IntBuffer;
 
 /*
  * BeagleJNIjava
@@ -195,6 +197,33 @@ public class BeagleJNIWrapper {
     public native int getSiteLogLikelihoods(final int instance,
                                             final double[] outLogLikelihoods);
 
+    /* Direct buffer variants: buffers must be allocated with allocateDirect() in native byte
+       order.  They are read and written from their current position, which is left unchanged,
+       and calls whose buffers hold too few elements from there on return
+       BEAGLE_ERROR_OUT_OF_RANGE. */
+
+    public native int setPartialsDirect(int instance, int bufferIndex, final DoubleBuffer inPartials);
+
+    public native int getPartialsDirect(int instance, int bufferIndex, int scaleIndex,
+                                        final DoubleBuffer outPartials);
+
+    public native int getLogScaleFactorsDirect(int instance, int scaleIndex, final DoubleBuffer outFactors);
+
+    public native int updateTransitionMatricesDirect(int instance, int eigenIndex,
+                                                     final IntBuffer probabilityIndices,
+                                                     final IntBuffer firstDerivativeIndices,
+                                                     final IntBuffer secondDervativeIndices,
+                                                     final DoubleBuffer edgeLengths,
+                                                     int count);
+
+    public native int updatePartialsDirect(final int instance,
+                                           final IntBuffer operations,
+                                           int operationCount,
+                                           int cumulativeScalingIndex);
+
+    public native int getSiteLogLikelihoodsDirect(final int instance,
+                                                  final DoubleBuffer outLogLikelihoods);
+
     /* Library loading routines */
 
     private static String getPlatformSpecificLibraryName()
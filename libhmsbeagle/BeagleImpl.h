@@ -58,10 +58,39 @@ public:
                                long requirementFlags) = 0;
     
     virtual int getInstanceDetails(BeagleInstanceDetails* returnInfo) = 0;
+
+    virtual int setDeviceMemoryBudget(int budgetMegabytes) = 0;
+
+    virtual int setTransitionMatrixCacheSize(int cacheSize) = 0;
+
+    virtual int setStatisticsEnabled(bool enabled) = 0;
+
+    virtual int getStatistics(BeagleInstanceStatistics* outStatistics) = 0;
+
+    virtual int copyInstance(BeagleImpl* source) = 0;
+
+    virtual int snapshotBuffers(int snapshotIndex,
+                                const int* partialsIndices,
+                                int partialsCount,
+                                const int* scaleIndices,
+                                int scaleCount,
+                                const int* matrixIndices,
+                                int matrixCount) = 0;
+
+    virtual int restoreSnapshot(int snapshotIndex) = 0;
+
+    virtual int releaseSnapshot(int snapshotIndex) = 0;
+
+    virtual int saveInstance(const char* fileName) = 0;
+
+    virtual int loadInstance(const char* fileName) = 0;
     
     virtual int setTipStates(int tipIndex,
                              const int* inStates) = 0;
 
+    virtual int setTipStatesExternal(int tipIndex,
+                                     const unsigned char* inStates) = 0;
+
     virtual int setTipPartials(int tipIndex,
                                const double* inPartials) = 0;
     
@@ -79,6 +108,9 @@ public:
     
     virtual int setStateFrequencies(int stateFrequenciesIndex,
                                   const double* inStateFrequencies) = 0;    
+
+    virtual int setInvariantSites(double proportionInvariant,
+                                  int stateFrequenciesIndex) = 0;
     
     virtual int setCategoryWeights(int categoryWeightsIndex,
                                  const double* inCategoryWeights) = 0;
@@ -114,6 +146,11 @@ public:
 	                                         const int* resultIndices,
 	                                         int matrixCount) = 0;
 
+    virtual int convolveTransitionMatrixChains(const int* matrixIndices,
+                                               const int* chainLengths,
+                                               const int* resultIndices,
+                                               int chainCount) = 0;
+
     virtual int updateTransitionMatrices(int eigenIndex,
                                          const int* probabilityIndices,
                                          const int* firstDerivativeIndices,
@@ -128,6 +165,14 @@ public:
                                                            const int* secondDerivativeIndices,
                                                            const double* edgeLengths,
                                                            int count) = 0;
+
+    virtual int setRateMatrix(int rateMatrixIndex,
+                              const double* inRateMatrix) = 0;
+
+    virtual int updateTransitionMatricesFromRateMatrix(int rateMatrixIndex,
+                                                       const int* probabilityIndices,
+                                                       const double* edgeLengths,
+                                                       int count) = 0;
     
     virtual int updatePartials(const int* operations,
                                int operationCount,
@@ -184,6 +229,17 @@ public:
                                                        int count,
                                                        double* outSumLogLikelihoodByPartition,
                                                        double* outSumLogLikelihood) = 0;
+
+    virtual int calculateRootLogLikelihoodsAsync(const int* bufferIndices,
+                                                 const int* categoryWeightsIndices,
+                                                 const int* stateFrequenciesIndices,
+                                                 const int* cumulativeScaleIndices,
+                                                 const int* partitionIndices,
+                                                 int partitionCount) = 0;
+
+    virtual int getRootLogLikelihoodsAsync(int blocking,
+                                           double* outSumLogLikelihoodByPartition,
+                                           double* outSumLogLikelihood) = 0;
     
     virtual int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
                                             const int* childBufferIndices,
@@ -215,6 +271,18 @@ public:
                                                        double* outSumFirstDerivative,
                                                        double* outSumSecondDerivativeByPartition,
                                                        double* outSumSecondDerivative) = 0;
+
+    virtual int prepareEdgeProjection(int parentBufferIndex,
+                                      int childBufferIndex,
+                                      int eigenIndex,
+                                      int categoryWeightsIndex,
+                                      int stateFrequenciesIndex,
+                                      int cumulativeScaleIndex) = 0;
+
+    virtual int calculateEdgeProjectionLogLikelihoods(double edgeLength,
+                                                      double* outSumLogLikelihood,
+                                                      double* outSumFirstDerivative,
+                                                      double* outSumSecondDerivative) = 0;
     
     virtual int getSiteLogLikelihoods(double* outLogLikelihoods) = 0;
     
@@ -0,0 +1,212 @@
+/*
+ *  BeagleTrace.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __beagle_trace__
+#define __beagle_trace__
+
+#include <stdint.h>
+
+/*
+ * Layout of the call traces written when the BEAGLE_TRACE environment variable names a file.
+ *
+ * A trace is a TraceFileHeader followed by one record per completed call: a TraceRecordHeader
+ * and `size` bytes of arguments, in host byte order. The arguments follow the order of the
+ * public function: int as int32, long as int64, double as float64, and each array as an int32
+ * element count (-1 for NULL) followed by its elements. Strings and byte arrays are stored as
+ * arrays of bytes. Values returned through pointers (log likelihoods and derivatives) come
+ * after the arguments, so a replay can be checked against the original run. A tip states file
+ * given to beagleMapTipStatesFile is recorded by name and size only and must be present at replay.
+ *
+ * The handle of a record is the instance, or the command buffer for the command buffer calls;
+ * for beagleCreateInstance it is -1 and the new instance is the return value.
+ */
+
+#define BEAGLE_TRACE_FILE_VERSION 1
+
+namespace beagle {
+
+struct TraceFileHeader {
+    char magic[8];      /// "BEAGLETR"
+    uint32_t byteOrder; /// 0x01020304 as written by the recording host
+    uint32_t version;
+    int32_t reserved[4];
+};
+
+struct TraceRecordHeader {
+    int32_t call;        /// TraceCall
+    int32_t handle;
+    int32_t returnValue;
+    uint32_t size;       /// bytes of arguments that follow
+    double seconds;      /// wall time of the original call
+};
+
+enum TraceCall {
+    TRACE_CREATE_INSTANCE                                = 0,
+    TRACE_FINALIZE_INSTANCE                              = 1,
+    TRACE_CLONE_INSTANCE                                 = 2,
+    TRACE_SET_DEVICE_MEMORY_BUDGET                       = 3,
+    TRACE_SET_TRANSITION_MATRIX_CACHE                    = 4,
+    TRACE_SET_INSTANCE_STATISTICS                        = 5,
+    TRACE_GET_INSTANCE_STATISTICS                        = 6,
+    TRACE_SNAPSHOT_BUFFERS                               = 7,
+    TRACE_RESTORE_SNAPSHOT                               = 8,
+    TRACE_RELEASE_SNAPSHOT                               = 9,
+    TRACE_SAVE_INSTANCE                                  = 10,
+    TRACE_LOAD_INSTANCE                                  = 11,
+    TRACE_SET_TIP_STATES                                 = 12,
+    TRACE_SET_TIP_STATES_EXTERNAL                        = 13,
+    TRACE_MAP_TIP_STATES_FILE                            = 14,
+    TRACE_SET_TIP_PARTIALS                               = 15,
+    TRACE_SET_PARTIALS                                   = 16,
+    TRACE_GET_PARTIALS                                   = 17,
+    TRACE_SET_EIGEN_DECOMPOSITION                        = 18,
+    TRACE_SET_STATE_FREQUENCIES                          = 19,
+    TRACE_SET_INVARIANT_SITES                            = 20,
+    TRACE_SET_CATEGORY_WEIGHTS                           = 21,
+    TRACE_SET_CATEGORY_RATES                             = 22,
+    TRACE_SET_CATEGORY_RATES_WITH_INDEX                  = 23,
+    TRACE_SET_PATTERN_WEIGHTS                            = 24,
+    TRACE_SET_PATTERN_PARTITIONS                         = 25,
+    TRACE_CONVOLVE_TRANSITION_MATRICES                   = 26,
+    TRACE_CONVOLVE_TRANSITION_MATRIX_CHAINS              = 27,
+    TRACE_UPDATE_TRANSITION_MATRICES                     = 28,
+    TRACE_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS = 29,
+    TRACE_SET_RATE_MATRIX                                = 30,
+    TRACE_UPDATE_TRANSITION_MATRICES_FROM_RATE_MATRIX    = 31,
+    TRACE_SET_TRANSITION_MATRIX                          = 32,
+    TRACE_GET_TRANSITION_MATRIX                          = 33,
+    TRACE_SET_TRANSITION_MATRICES                        = 34,
+    TRACE_UPDATE_PARTIALS                                = 35,
+    TRACE_UPDATE_PARTIALS_BY_PARTITION                   = 36,
+    TRACE_WAIT_FOR_PARTIALS                              = 37,
+    TRACE_ACCUMULATE_SCALE_FACTORS                       = 38,
+    TRACE_ACCUMULATE_SCALE_FACTORS_BY_PARTITION          = 39,
+    TRACE_REMOVE_SCALE_FACTORS                           = 40,
+    TRACE_REMOVE_SCALE_FACTORS_BY_PARTITION              = 41,
+    TRACE_RESET_SCALE_FACTORS                            = 42,
+    TRACE_RESET_SCALE_FACTORS_BY_PARTITION               = 43,
+    TRACE_COPY_SCALE_FACTORS                             = 44,
+    TRACE_GET_SCALE_FACTORS                              = 45,
+    TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS                 = 46,
+    TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS_BY_PARTITION    = 47,
+    TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS_ASYNC           = 48,
+    TRACE_GET_ROOT_LOG_LIKELIHOODS_ASYNC                 = 49,
+    TRACE_CALCULATE_EDGE_LOG_LIKELIHOODS                 = 50,
+    TRACE_CALCULATE_EDGE_LOG_LIKELIHOODS_BY_PARTITION    = 51,
+    TRACE_PREPARE_EDGE_PROJECTION                        = 52,
+    TRACE_CALCULATE_EDGE_PROJECTION_LOG_LIKELIHOODS      = 53,
+    TRACE_GET_SITE_LOG_LIKELIHOODS                       = 54,
+    TRACE_GET_SITE_DERIVATIVES                           = 55,
+    TRACE_CREATE_COMMAND_BUFFER                          = 56,
+    TRACE_RECORD_UPDATE_TRANSITION_MATRICES              = 57,
+    TRACE_RECORD_UPDATE_PARTIALS                         = 58,
+    TRACE_RECORD_ACCUMULATE_SCALE_FACTORS                = 59,
+    TRACE_RECORD_RESET_SCALE_FACTORS                     = 60,
+    TRACE_RECORD_CALCULATE_ROOT_LOG_LIKELIHOODS          = 61,
+    TRACE_EXECUTE_COMMAND_BUFFER                         = 62,
+    TRACE_FINALIZE_COMMAND_BUFFER                        = 63,
+    TRACE_SET_TREE_TOPOLOGY                              = 64,
+    TRACE_INVALIDATE_TRANSITION_MATRICES                 = 65,
+    TRACE_INVALIDATE_PARTIALS                            = 66,
+    TRACE_UPDATE_TREE_PARTIALS                           = 67,
+    TRACE_CALL_COUNT                                     = 68
+};
+
+/// public function recorded as a TraceCall
+inline const char* traceCallName(int call) {
+    static const char* names[TRACE_CALL_COUNT] = {
+        "beagleCreateInstance",
+        "beagleFinalizeInstance",
+        "beagleCloneInstance",
+        "beagleSetDeviceMemoryBudget",
+        "beagleSetTransitionMatrixCache",
+        "beagleSetInstanceStatistics",
+        "beagleGetInstanceStatistics",
+        "beagleSnapshotBuffers",
+        "beagleRestoreSnapshot",
+        "beagleReleaseSnapshot",
+        "beagleSaveInstance",
+        "beagleLoadInstance",
+        "beagleSetTipStates",
+        "beagleSetTipStatesExternal",
+        "beagleMapTipStatesFile",
+        "beagleSetTipPartials",
+        "beagleSetPartials",
+        "beagleGetPartials",
+        "beagleSetEigenDecomposition",
+        "beagleSetStateFrequencies",
+        "beagleSetInvariantSites",
+        "beagleSetCategoryWeights",
+        "beagleSetCategoryRates",
+        "beagleSetCategoryRatesWithIndex",
+        "beagleSetPatternWeights",
+        "beagleSetPatternPartitions",
+        "beagleConvolveTransitionMatrices",
+        "beagleConvolveTransitionMatrixChains",
+        "beagleUpdateTransitionMatrices",
+        "beagleUpdateTransitionMatricesWithMultipleModels",
+        "beagleSetRateMatrix",
+        "beagleUpdateTransitionMatricesFromRateMatrix",
+        "beagleSetTransitionMatrix",
+        "beagleGetTransitionMatrix",
+        "beagleSetTransitionMatrices",
+        "beagleUpdatePartials",
+        "beagleUpdatePartialsByPartition",
+        "beagleWaitForPartials",
+        "beagleAccumulateScaleFactors",
+        "beagleAccumulateScaleFactorsByPartition",
+        "beagleRemoveScaleFactors",
+        "beagleRemoveScaleFactorsByPartition",
+        "beagleResetScaleFactors",
+        "beagleResetScaleFactorsByPartition",
+        "beagleCopyScaleFactors",
+        "beagleGetScaleFactors",
+        "beagleCalculateRootLogLikelihoods",
+        "beagleCalculateRootLogLikelihoodsByPartition",
+        "beagleCalculateRootLogLikelihoodsAsync",
+        "beagleGetRootLogLikelihoodsAsync",
+        "beagleCalculateEdgeLogLikelihoods",
+        "beagleCalculateEdgeLogLikelihoodsByPartition",
+        "beaglePrepareEdgeProjection",
+        "beagleCalculateEdgeProjectionLogLikelihoods",
+        "beagleGetSiteLogLikelihoods",
+        "beagleGetSiteDerivatives",
+        "beagleCreateCommandBuffer",
+        "beagleRecordUpdateTransitionMatrices",
+        "beagleRecordUpdatePartials",
+        "beagleRecordAccumulateScaleFactors",
+        "beagleRecordResetScaleFactors",
+        "beagleRecordCalculateRootLogLikelihoods",
+        "beagleExecuteCommandBuffer",
+        "beagleFinalizeCommandBuffer",
+        "beagleSetTreeTopology",
+        "beagleInvalidateTransitionMatrices",
+        "beagleInvalidatePartials",
+        "beagleUpdateTreePartials"
+    };
+    return (call >= 0 && call < TRACE_CALL_COUNT ? names[call] : "unknown");
+}
+
+}	// end namespace beagle
+
+#endif // __beagle_trace__
@@ -69,6 +69,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gStateFrequencies;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::outLogLikelihoodsTmp;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::sumSiteLogLikelihoods;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_FLOAT>::gPatternWeights;
     
 public:    
@@ -82,19 +83,19 @@ protected:
 private:
     
 	virtual void calcStatesStates(float* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const float* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const float* matrices2);
     
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const float* __restrict matrices1,
                                     const float* __restrict partials2,
                                     const float* __restrict matrices2);
     
     virtual void calcStatesPartialsFixedScaling(float* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const float* __restrict matrices1,
                                                 const float* __restrict partials2,
                                                 const float* __restrict matrices2,
@@ -150,6 +151,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gStateFrequencies;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::outLogLikelihoodsTmp;
+    using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::sumSiteLogLikelihoods;
     using BeagleCPUImpl<BEAGLE_CPU_4_AVX_DOUBLE>::gPatternWeights;
     
 public:
@@ -163,19 +165,19 @@ protected:
 private:
     
     virtual void calcStatesStates(double* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const double* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const double* matrices2);
     
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const double* __restrict matrices1,
                                     const double* __restrict partials2,
                                     const double* __restrict matrices2);
     
     virtual void calcStatesPartialsFixedScaling(double* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const double* __restrict matrices1,
                                                 const double* __restrict partials2,
                                                 const double* __restrict matrices2,
@@ -116,9 +116,9 @@ inline const char* getBeagleCPU4StateAVXName<float>(){ return "CPU-4State-AVX-Si
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(float* destP,
-                                     const int* states_q,
+                                     const TipState* states_q,
                                      const float* matrices_q,
-                                     const int* states_r,
+                                     const TipState* states_r,
                                      const float* matrices_r) {
 
 									 BeagleCPU4StateImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(destP,
@@ -132,9 +132,9 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesStates(float* des
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const TipState* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
+                                     const TipState* states_r,
                                      const double* matrices_r) {
 
 	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -168,7 +168,7 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesStates(double* d
  */
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(float* destP,
-                                       const int* states_q,
+                                       const TipState* states_q,
                                        const float* matrices_q,
                                        const float* partials_r,
                                        const float* matrices_r) {
@@ -184,7 +184,7 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartials(float* d
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const TipState* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
                                        const double* matrices_r) {
@@ -233,7 +233,7 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartials(double*
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScaling(float* destP,
-                                const int* states1,
+                                const TipState* states1,
                                 const float* __restrict matrices1,
                                 const float* __restrict partials2,
                                 const float* __restrict matrices2,
@@ -249,7 +249,7 @@ void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::calcStatesPartialsFixedScal
 
 BEAGLE_CPU_4_AVX_TEMPLATE
 void BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
-                                const int* states_q,
+                                const TipState* states_q,
                                 const double* __restrict matrices_q,
                                 const double* __restrict partials_r,
                                 const double* __restrict matrices_r,
@@ -581,7 +581,7 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = gTipStates[childIndex];
 
         int w = 0;
         V_Real *vcl_r = (V_Real *)cl_r;
@@ -660,20 +660,10 @@ int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_DOUBLE>::calcEdgeLogLikelihoods(cons
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
     }
 
-
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
-
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
@@ -686,7 +676,6 @@ BEAGLE_CPU_4_AVX_TEMPLATE
 int BeagleCPU4StateAVXImpl<BEAGLE_CPU_4_AVX_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
 //	return 4;  // For single-precision, can operate on 4 patterns at a time
-	// TODO Vectorize final log operations over patterns
 }
     
 BEAGLE_CPU_4_AVX_TEMPLATE
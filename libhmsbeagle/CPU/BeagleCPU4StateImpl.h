@@ -65,6 +65,8 @@ protected:
 	using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::realtypeMin;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshhold;
   using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::gPatternPartitionsStartPatterns;
+  using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumSiteLogLikelihoods;
+  using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::addInvariantSiteLikelihoods;
 
 public:
     virtual ~BeagleCPU4StateImpl();
@@ -72,15 +74,15 @@ public:
 
 
     virtual void calcStatesStates(REALTYPE* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const REALTYPE* matrices1,
-                                    const int* states2,
+                                    const TipState* states2,
                                     const REALTYPE* matrices2,
                                     int startPattern,
                                     int endPattern);
     
     virtual void calcStatesPartials(REALTYPE* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
                                     const REALTYPE* matrices2,
@@ -95,19 +97,11 @@ public:
                                       int startPattern,
                                       int endPattern);
 
-    virtual int calcRootLogLikelihoods(const int bufferIndex,
-                                        const int categoryWeightsIndex,
-                                        const int stateFrequenciesIndex,
-                                        const int scalingFactorsIndex,
-                                        double* outSumLogLikelihood);
-
-    virtual void calcRootLogLikelihoodsByPartition(const int* bufferIndices,
-                                                  const int* categoryWeightsIndices,
-                                                  const int* stateFrequenciesIndices,
-                                                  const int* cumulativeScaleIndices,
-                                                  const int* partitionIndices,
-                                                  int partitionCount,
-                                                  double* outSumLogLikelihoodByPartition);
+    virtual void integrateRootSiteLikelihoods(const REALTYPE* rootPartials,
+                                              const REALTYPE* wt,
+                                              const REALTYPE* freqs,
+                                              int startPattern,
+                                              int endPattern);
     
     virtual int calcRootLogLikelihoodsMulti(const int* bufferIndices,
                                              const int* categoryWeightsIndices,
@@ -135,16 +129,16 @@ public:
                                                   double* outSumLogLikelihoodByPartition);
     
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
-                                              const int *child0States,
+                                              const TipState *child0States,
                                               const REALTYPE *child0TransMat,
-                                              const int *child1States,
+                                              const TipState *child1States,
                                               const REALTYPE *child1TransMat,
                                               const REALTYPE *scaleFactors,
                                               int startPattern,
                                               int endPattern);
 
     virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
-                                                const int *child0States,
+                                                const TipState *child0States,
                                                 const REALTYPE *child0TransMat,
                                                 const REALTYPE *child1Partials,
                                                 const REALTYPE *child1TransMat,
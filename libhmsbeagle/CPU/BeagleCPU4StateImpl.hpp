@@ -152,9 +152,9 @@ BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::~BeagleCPU4StateImpl() {
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                                               const int* states1,
+                                                               const TipState* states1,
                                                                const REALTYPE* matrices1,
-                                                               const int* states2,
+                                                               const TipState* states2,
                                                                const REALTYPE* matrices2,
                                                                int startPattern,
                                                                int endPattern) {
@@ -184,9 +184,9 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                                                           const int* states1,
+                                                                           const TipState* states1,
                                                                            const REALTYPE* matrices1,
-                                                                           const int* states2,
+                                                                           const TipState* states2,
                                                                            const REALTYPE* matrices2,
                                                                            const REALTYPE* scaleFactors,
                                                                            int startPattern,
@@ -221,7 +221,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALT
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                                                 const int* states1,
+                                                                 const TipState* states1,
                                                                  const REALTYPE* matrices1,
                                                                  const REALTYPE* partials2,
                                                                  const REALTYPE* matrices2,
@@ -255,7 +255,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                                                             const int* states1,
+                                                                             const TipState* states1,
                                                                              const REALTYPE* matrices1,
                                                                              const REALTYPE* partials2,
                                                                              const REALTYPE* matrices2,
@@ -443,21 +443,11 @@ int inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScale(c
         freq3 * integrationTmp[u + 3];
         
         u += 4;
-                        
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-    }        
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++) {
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-        }
+        outLogLikelihoodsTmp[k] = sumOverI;
     }
-    
-    *outSumLogLikelihood = 0.0;    
-    for(int k=0; k < kPatternCount; k++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
-    }    
+
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
     
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
@@ -498,21 +488,12 @@ void inline BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateOutStatesAndScaleB
           freq3 * integrationTmp[u + 3];
           
           u += 4;
-                          
-          outLogLikelihoodsTmp[k] = log(sumOverI);
-      }        
-
-      if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-          const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-          for(int k=startPattern; k < endPattern; k++) {
-              outLogLikelihoodsTmp[k] += scalingFactors[k];
-          }
-      }
-         
-      outSumLogLikelihoodByPartition[p] = 0.0;
-      for(int k=startPattern; k < endPattern; k++) {
-          outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[k] * gPatternWeights[k];
+
+          outLogLikelihoodsTmp[k] = sumOverI;
       }
+
+      outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                scalingFactorsIndex);
     }
     
 }
@@ -655,7 +636,7 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int pa
     
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
       
-        const int* statesChild = gTipStates[childIndex];    
+        const TipState* statesChild = gTipStates[childIndex];    
         int v = 0; // Index for parent partials
         int w = 0;
         for(int l = 0; l < kCategoryCount; l++) {
@@ -754,7 +735,7 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
         
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
           
-            const int* statesChild = gTipStates[childIndex];    
+            const TipState* statesChild = gTipStates[childIndex];    
             int v = startPattern * 4; // Index for parent partials
             int w = 0;
             for(int l = 0; l < kCategoryCount; l++) {
@@ -822,91 +803,29 @@ void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
 }
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
-                                                           const int categoryWeightsIndex,
-                                                           const int stateFrequenciesIndex,
-                                                const int scalingFactorsIndex,
-                                                double* outSumLogLikelihood) {
-
-    const REALTYPE* rootPartials = gPartials[bufferIndex];
-    assert(rootPartials);
-    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
-    
-    int u = 0;
-    int v = 0;
-    const REALTYPE wt0 = wt[0];
-    for (int k = 0; k < kPatternCount; k++) {
-        integrationTmp[v    ] = rootPartials[v    ] * wt0;
-        integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-        integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-        integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-        v += 4;
-    }
-    for (int l = 1; l < kCategoryCount; l++) {
-        u = 0;
-        const REALTYPE wtl = wt[l];
-        for (int k = 0; k < kPatternCount; k++) {
-            integrationTmp[u    ] += rootPartials[v    ] * wtl;
-            integrationTmp[u + 1] += rootPartials[v + 1] * wtl;
-            integrationTmp[u + 2] += rootPartials[v + 2] * wtl;
-            integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
-             
-            u += 4;
-            v += 4;
-        }
-		v += 4 * kExtraPatterns;
-    }
-    
-    return integrateOutStatesAndScale(integrationTmp, stateFrequenciesIndex, scalingFactorsIndex, outSumLogLikelihood);
-}
-
-BEAGLE_CPU_TEMPLATE
-void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
-                                                                    const int* bufferIndices,
-                                                                    const int* categoryWeightsIndices,
-                                                                    const int* stateFrequenciesIndices,
-                                                                    const int* cumulativeScaleIndices,
-                                                                    const int* partitionIndices,
-                                                                    int partitionCount,
-                                                                    double* outSumLogLikelihoodByPartition) {
-
+void BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::integrateRootSiteLikelihoods(const REALTYPE* rootPartials,
+                                                                        const REALTYPE* wt,
+                                                                        const REALTYPE* freqs,
+                                                                        int startPattern,
+                                                                        int endPattern) {
+    const REALTYPE freq0 = freqs[0];
+    const REALTYPE freq1 = freqs[1];
+    const REALTYPE freq2 = freqs[2];
+    const REALTYPE freq3 = freqs[3];
+    const int categoryStride = 4 * kPaddedPatternCount;
 
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
-        
-        int startPattern = gPatternPartitionsStartPatterns[pIndex];
-        int endPattern = gPatternPartitionsStartPatterns[pIndex + 1];
-
-        const REALTYPE* rootPartials = gPartials[bufferIndices[p]];
-        assert(rootPartials);
-        const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[p]];
-        
-        int v = startPattern * 4;
-        const REALTYPE wt0 = wt[0];
-        for (int k = startPattern; k < endPattern; k++) {
-            integrationTmp[v    ] = rootPartials[v    ] * wt0;
-            integrationTmp[v + 1] = rootPartials[v + 1] * wt0;
-            integrationTmp[v + 2] = rootPartials[v + 2] * wt0;
-            integrationTmp[v + 3] = rootPartials[v + 3] * wt0;
-            v += 4;
-        }
-        for (int l = 1; l < kCategoryCount; l++) {
-            int u = startPattern * 4;
-            v += ((kPatternCount - endPattern) + startPattern) * 4;
-            const REALTYPE wtl = wt[l];
-            for (int k = startPattern; k < endPattern; k++) {
-                integrationTmp[u    ] += rootPartials[v    ] * wtl;
-                integrationTmp[u + 1] += rootPartials[v + 1] * wtl;
-                integrationTmp[u + 2] += rootPartials[v + 2] * wtl;
-                integrationTmp[u + 3] += rootPartials[v + 3] * wtl;
-                 
-                u += 4;
-                v += 4;
-            }
-        v += 4 * kExtraPatterns;
+    for (int k = startPattern; k < endPattern; k++) {
+        const REALTYPE* partials = &rootPartials[4 * k];
+        REALTYPE sum = 0.0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            sum += (freq0 * partials[0] +
+                    freq1 * partials[1] +
+                    freq2 * partials[2] +
+                    freq3 * partials[3]) * wt[l];
+            partials += categoryStride;
         }
+        outLogLikelihoodsTmp[k] = sum;
     }
-    integrateOutStatesAndScaleByPartition(integrationTmp, stateFrequenciesIndices, cumulativeScaleIndices, partitionIndices, partitionCount, outSumLogLikelihoodByPartition);
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -1016,6 +935,8 @@ int BeagleCPU4StateImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const i
         for(int i=0; i<kPatternCount; i++)
             outLogLikelihoodsTmp[i] += maxScaleFactor[i];
     }
+
+    addInvariantSiteLikelihoods(0, kPatternCount, 0);
     
     *outSumLogLikelihood = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
@@ -69,6 +69,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gStateFrequencies;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::outLogLikelihoodsTmp;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::sumSiteLogLikelihoods;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gPatternWeights;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_FLOAT>::gPatternPartitionsStartPatterns;
     
@@ -83,19 +84,19 @@ protected:
 private:
     
 	virtual void calcStatesStates(float* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const float* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const float* matrices2);
     
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const float* __restrict matrices1,
                                     const float* __restrict partials2,
                                     const float* __restrict matrices2);
     
     virtual void calcStatesPartialsFixedScaling(float* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const float* __restrict matrices1,
                                                 const float* __restrict partials2,
                                                 const float* __restrict matrices2,
@@ -161,6 +162,7 @@ protected:
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gStateFrequencies;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::realtypeMin;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::outLogLikelihoodsTmp;
+    using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::sumSiteLogLikelihoods;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gPatternWeights;
     using BeagleCPUImpl<BEAGLE_CPU_4_SSE_DOUBLE>::gPatternPartitionsStartPatterns;
     
@@ -175,15 +177,15 @@ protected:
 private:
     
     virtual void calcStatesStates(double* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const double* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const double* matrices2,
                                   int startPattern,
                                   int endPattern);
     
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const double* __restrict matrices1,
                                     const double* __restrict partials2,
                                     const double* __restrict matrices2,
@@ -191,7 +193,7 @@ private:
                                     int endPattern);
     
     virtual void calcStatesPartialsFixedScaling(double* destP,
-                                                const int* states1,
+                                                const TipState* states1,
                                                 const double* __restrict matrices1,
                                                 const double* __restrict partials2,
                                                 const double* __restrict matrices2,
@@ -104,9 +104,9 @@ inline const char* getBeagleCPU4StateSSEName<float>(){ return "CPU-4State-SSE-Si
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* destP,
-                                                                       const int* states_q,
+                                                                       const TipState* states_q,
                                                                        const double* matrices_q,
-                                                                       const int* states_r,
+                                                                       const TipState* states_r,
                                                                        const double* matrices_r,
                                                                        int startPattern,
                                                                        int endPattern) {
@@ -147,7 +147,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesStates(double* d
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double* destP,
-                                                                         const int* states_q,
+                                                                         const TipState* states_q,
                                                                          const double* matrices_q,
                                                                          const double* partials_r,
                                                                          const double* matrices_r,
@@ -200,7 +200,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartials(double*
 
 BEAGLE_CPU_4_SSE_TEMPLATE
 void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcStatesPartialsFixedScaling(double* destP,
-                                                                                     const int* states_q,
+                                                                                     const TipState* states_q,
                                                                                      const double* __restrict matrices_q,
                                                                                      const double* __restrict partials_r,
                                                                                      const double* __restrict matrices_r,
@@ -522,7 +522,7 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
 
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = gTipStates[childIndex];
 
         int w = 0;
         V_Real *vcl_r = (V_Real *)cl_r;
@@ -605,20 +605,10 @@ int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoods(cons
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
     }
 
-
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
-
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
@@ -691,7 +681,7 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
 
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-            const int* statesChild = gTipStates[childIndex];
+            const TipState* statesChild = gTipStates[childIndex];
 
             int w = 0;
             V_Real *vcl_r = (V_Real *) (cl_r + startPattern * 4);
@@ -778,20 +768,11 @@ void BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_DOUBLE>::calcEdgeLogLikelihoodsByPa
                 u++;
             }
 
-            outLogLikelihoodsTmp[k] = log(sumOverI);
+            outLogLikelihoodsTmp[k] = sumOverI;
         }
 
-
-        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-            const double* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int k=startPattern; k < endPattern; k++)
-                outLogLikelihoodsTmp[k] += scalingFactors[k];
-        }
-
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-        }
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                  scalingFactorsIndex);
 
     }
 }
@@ -800,7 +781,6 @@ BEAGLE_CPU_4_SSE_TEMPLATE
 int BeagleCPU4StateSSEImpl<BEAGLE_CPU_4_SSE_FLOAT>::getPaddedPatternsModulus() {
 	return 1;  // We currently do not vectorize across patterns
 //	return 4;  // For single-precision, can operate on 4 patterns at a time
-	// TODO Vectorize final log operations over patterns
 }
     
 BEAGLE_CPU_4_SSE_TEMPLATE
@@ -61,9 +61,9 @@ inline const char* getBeagleCPUAVXName<float>(){ return "CPU-AVX-Single"; };
 
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
-                                     const int* states_q,
+                                     const TipState* states_q,
                                      const double* matrices_q,
-                                     const int* states_r,
+                                     const TipState* states_r,
                                      const double* matrices_r) {
 
 	BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(destP,
@@ -76,9 +76,9 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
 
 //template <>
 //void BeagleCPUAVXImpl<double>::calcStatesStates(double* destP,
-//                                     const int* states_q,
+//                                     const TipState* states_q,
 //                                     const double* matrices_q,
-//                                     const int* states_r,
+//                                     const TipState* states_r,
 //                                     const double* matrices_r) {
 //
 //	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -112,7 +112,7 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesStates(double* destP,
  */
 BEAGLE_CPU_AVX_TEMPLATE
 void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(double* destP,
-                                       const int* states_q,
+                                       const TipState* states_q,
                                        const double* matrices_q,
                                        const double* partials_r,
                                        const double* matrices_r) {
@@ -128,7 +128,7 @@ void BeagleCPUAVXImpl<BEAGLE_CPU_AVX_DOUBLE>::calcStatesPartials(double* destP,
 //
 //template <>
 //void BeagleCPUAVXImpl<double>::calcStatesPartials(double* destP,
-//                                       const int* states_q,
+//                                       const TipState* states_q,
 //                                       const double* matrices_q,
 //                                       const double* partials_r,
 //                                       const double* matrices_r) {
@@ -418,7 +418,7 @@ return BeagleCPUImpl<BEAGLE_CPU_AVX_DOUBLE>::calcEdgeLogLikelihoods(
 //
 //    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 //
-//        const int* statesChild = gTipStates[childIndex];
+//        const TipState* statesChild = gTipStates[childIndex];
 //
 //		int w = 0;
 //		V_Real *vcl_r = (V_Real *)cl_r;
@@ -0,0 +1,154 @@
+/*
+ *  BeagleCPUFixedStateImpl.h
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BeagleCPUFixedStateImpl__
+#define __BeagleCPUFixedStateImpl__
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+
+#define BEAGLE_CPU_FIXED_GENERIC	REALTYPE, T_PAD, P_PAD, STATE_COUNT
+#define BEAGLE_CPU_FIXED_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD, int STATE_COUNT>
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * Generic CPU implementation with the state count as a template parameter, so that the
+ * S x S contraction of the partials kernels has compile-time bounds and is fully vectorized.
+ * Instantiated for the common amino acid and codon state spaces (see the factory).
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+class BeagleCPUFixedStateImpl : public BeagleCPUImpl<BEAGLE_CPU_GENERIC> {
+
+protected:
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kPatternCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kCategoryCount;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::kMatrixSize;
+    using BeagleCPUImpl<BEAGLE_CPU_GENERIC>::scalingExponentThreshhold;
+
+public:
+    virtual ~BeagleCPUFixedStateImpl();
+    virtual const char* getName();
+
+    virtual void calcStatesStates(REALTYPE* destP,
+                                  const TipState* states1,
+                                  const REALTYPE* matrices1,
+                                  const TipState* states2,
+                                  const REALTYPE* matrices2,
+                                  int startPattern,
+                                  int endPattern);
+
+    virtual void calcStatesPartials(REALTYPE* destP,
+                                    const TipState* states1,
+                                    const REALTYPE* matrices1,
+                                    const REALTYPE* partials2,
+                                    const REALTYPE* matrices2,
+                                    int startPattern,
+                                    int endPattern);
+
+    virtual void calcPartialsPartials(REALTYPE* destP,
+                                      const REALTYPE* partials1,
+                                      const REALTYPE* matrices1,
+                                      const REALTYPE* partials2,
+                                      const REALTYPE* matrices2,
+                                      int startPattern,
+                                      int endPattern);
+
+    virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
+                                              const TipState *child0States,
+                                              const REALTYPE *child0TransMat,
+                                              const TipState *child1States,
+                                              const REALTYPE *child1TransMat,
+                                              const REALTYPE *scaleFactors,
+                                              int startPattern,
+                                              int endPattern);
+
+    virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
+                                                const TipState *child0States,
+                                                const REALTYPE *child0TransMat,
+                                                const REALTYPE *child1Partials,
+                                                const REALTYPE *child1TransMat,
+                                                const REALTYPE *scaleFactors,
+                                                int startPattern,
+                                                int endPattern);
+
+    virtual void calcPartialsPartialsFixedScaling(REALTYPE *destP,
+                                                  const REALTYPE *child0Partials,
+                                                  const REALTYPE *child0TransMat,
+                                                  const REALTYPE *child1Partials,
+                                                  const REALTYPE *child1TransMat,
+                                                  const REALTYPE *scaleFactors,
+                                                  int startPattern,
+                                                  int endPattern);
+
+    virtual void calcPartialsPartialsAutoScaling(REALTYPE *destP,
+                                                 const REALTYPE *child0Partials,
+                                                 const REALTYPE *child0TransMat,
+                                                 const REALTYPE *child1Partials,
+                                                 const REALTYPE *child1TransMat,
+                                                 int *activateScaling);
+
+private:
+    // rows of the result are columns of the matrix, the padding column included
+    inline void transposeMatrix(const REALTYPE* matrix,
+                                REALTYPE* transposed);
+
+    // sums[i] = sum over j of matrix[i][j] * partials[j], from a transposed matrix
+    inline void multiplyPartials(const REALTYPE* transposed,
+                                 const REALTYPE* partials,
+                                 REALTYPE* sums);
+};
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+class BeagleCPUFixedStateImplFactory : public BeagleImplFactory {
+public:
+    virtual BeagleImpl* createImpl(int tipCount,
+                                   int partialsBufferCount,
+                                   int compactBufferCount,
+                                   int stateCount,
+                                   int patternCount,
+                                   int eigenBufferCount,
+                                   int matrixBufferCount,
+                                   int categoryCount,
+                                   int scaleBufferCount,
+                                   int resourceNumber,
+                                   int pluginResourceNumber,
+                                   long preferenceFlags,
+                                   long requirementFlags,
+                                   int* errorCode);
+
+    virtual const char* getName();
+    virtual const long getFlags();
+};
+
+}	// namespace cpu
+}	// namespace beagle
+
+// now include the file containing template function implementations
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.hpp"
+
+#endif // __BeagleCPUFixedStateImpl__
@@ -0,0 +1,426 @@
+/*
+ *  BeagleCPUFixedStateImpl.hpp
+ *  BEAGLE
+ *
+ * Copyright 2009 Phylogenetic Likelihood Working Group
+ *
+ * This file is part of BEAGLE.
+ *
+ * BEAGLE is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * BEAGLE is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with BEAGLE.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BEAGLE_CPU_FIXED_STATE_IMPL_HPP
+#define BEAGLE_CPU_FIXED_STATE_IMPL_HPP
+
+#ifdef HAVE_CONFIG_H
+#include "libhmsbeagle/config.h"
+#endif
+
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <cmath>
+#include <string>
+
+#include "libhmsbeagle/beagle.h"
+#include "libhmsbeagle/CPU/BeagleCPUImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
+
+namespace beagle {
+namespace cpu {
+
+template<typename REALTYPE, int STATE_COUNT>
+inline const char* getBeagleCPUFixedStateName() {
+    static const std::string name = "CPU-" + std::to_string(STATE_COUNT) + "State-" +
+                                    (DOUBLE_PRECISION ? "Double" : "Single");
+    return name.c_str();
+}
+
+template<typename REALTYPE>
+inline const char* getBeagleCPUFixedStateFactoryName(){ return "CPU-FixedState-Unknown"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateFactoryName<double>(){ return "CPU-FixedState-Double"; };
+
+template<>
+inline const char* getBeagleCPUFixedStateFactoryName<float>(){ return "CPU-FixedState-Single"; };
+
+BEAGLE_CPU_FIXED_TEMPLATE
+BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::~BeagleCPUFixedStateImpl() {
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::transposeMatrix(const REALTYPE* matrix,
+                                                                        REALTYPE* transposed) {
+    for (int i = 0; i < STATE_COUNT; i++) {
+        for (int j = 0; j < STATE_COUNT + T_PAD; j++) {
+            transposed[j * STATE_COUNT + i] = matrix[i * (STATE_COUNT + T_PAD) + j];
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::multiplyPartials(const REALTYPE* transposed,
+                                                                         const REALTYPE* partials,
+                                                                         REALTYPE* sums) {
+    // the inner loop runs over contiguous rows of fixed length and vectorizes without
+    // reassociating any sum
+    const REALTYPE p0 = partials[0];
+    for (int i = 0; i < STATE_COUNT; i++)
+        sums[i] = transposed[i] * p0;
+
+    for (int j = 1; j < STATE_COUNT; j++) {
+        const REALTYPE pj = partials[j];
+        const REALTYPE* column = transposed + j * STATE_COUNT;
+        for (int i = 0; i < STATE_COUNT; i++)
+            sums[i] += column[i] * pj;
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when both children have states.
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesStates(REALTYPE* destP,
+                                                                         const TipState* states1,
+                                                                         const REALTYPE* matrices1,
+                                                                         const TipState* states2,
+                                                                         const REALTYPE* matrices2,
+                                                                         int startPattern,
+                                                                         int endPattern) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        REALTYPE* destPtr = destP + l * partialsStride * kPatternCount + partialsStride * startPattern;
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE* column1 = transposed1 + states1[k] * STATE_COUNT;
+            const REALTYPE* column2 = transposed2 + states2[k] * STATE_COUNT;
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = column1[i] * column2[i];
+            destPtr += partialsStride;
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
+                                                                                     const TipState* child1States,
+                                                                                     const REALTYPE* child1TransMat,
+                                                                                     const TipState* child2States,
+                                                                                     const REALTYPE* child2TransMat,
+                                                                                     const REALTYPE* scaleFactors,
+                                                                                     int startPattern,
+                                                                                     int endPattern) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        transposeMatrix(child1TransMat + l * kMatrixSize, transposed1);
+        transposeMatrix(child2TransMat + l * kMatrixSize, transposed2);
+
+        REALTYPE* destPtr = destP + l * partialsStride * kPatternCount + partialsStride * startPattern;
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE* column1 = transposed1 + child1States[k] * STATE_COUNT;
+            const REALTYPE* column2 = transposed2 + child2States[k] * STATE_COUNT;
+            const REALTYPE scaleFactor = scaleFactors[k];
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = column1[i] * column2[i] / scaleFactor;
+            destPtr += partialsStride;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when one child has states and one has partials.
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesPartials(REALTYPE* destP,
+                                                                           const TipState* states1,
+                                                                           const REALTYPE* matrices1,
+                                                                           const REALTYPE* partials2,
+                                                                           const REALTYPE* matrices2,
+                                                                           int startPattern,
+                                                                           int endPattern) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE sums2[STATE_COUNT];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        const int v = l * partialsStride * kPatternCount + partialsStride * startPattern;
+        const REALTYPE* partials2Ptr = partials2 + v;
+        REALTYPE* destPtr = destP + v;
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE* column1 = transposed1 + states1[k] * STATE_COUNT;
+            multiplyPartials(transposed2, partials2Ptr, sums2);
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = column1[i] * sums2[i];
+            destPtr += partialsStride;
+            partials2Ptr += partialsStride;
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
+                                                                                       const TipState* states1,
+                                                                                       const REALTYPE* matrices1,
+                                                                                       const REALTYPE* partials2,
+                                                                                       const REALTYPE* matrices2,
+                                                                                       const REALTYPE* scaleFactors,
+                                                                                       int startPattern,
+                                                                                       int endPattern) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE sums2[STATE_COUNT];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        const int v = l * partialsStride * kPatternCount + partialsStride * startPattern;
+        const REALTYPE* partials2Ptr = partials2 + v;
+        REALTYPE* destPtr = destP + v;
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE* column1 = transposed1 + states1[k] * STATE_COUNT;
+            const REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+            multiplyPartials(transposed2, partials2Ptr, sums2);
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = column1[i] * sums2[i] * oneOverScaleFactor;
+            destPtr += partialsStride;
+            partials2Ptr += partialsStride;
+        }
+    }
+}
+
+/*
+ * Calculates partial likelihoods at a node when both children have partials.
+ */
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartials(REALTYPE* destP,
+                                                                             const REALTYPE* partials1,
+                                                                             const REALTYPE* matrices1,
+                                                                             const REALTYPE* partials2,
+                                                                             const REALTYPE* matrices2,
+                                                                             int startPattern,
+                                                                             int endPattern) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE sums1[STATE_COUNT];
+        REALTYPE sums2[STATE_COUNT];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        const int v = l * partialsStride * kPatternCount + partialsStride * startPattern;
+        const REALTYPE* partials1Ptr = partials1 + v;
+        const REALTYPE* partials2Ptr = partials2 + v;
+        REALTYPE* destPtr = destP + v;
+        for (int k = startPattern; k < endPattern; k++) {
+            multiplyPartials(transposed1, partials1Ptr, sums1);
+            multiplyPartials(transposed2, partials2Ptr, sums2);
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = sums1[i] * sums2[i];
+            destPtr += partialsStride;
+            partials1Ptr += partialsStride;
+            partials2Ptr += partialsStride;
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartialsFixedScaling(REALTYPE* destP,
+                                                                                         const REALTYPE* partials1,
+                                                                                         const REALTYPE* matrices1,
+                                                                                         const REALTYPE* partials2,
+                                                                                         const REALTYPE* matrices2,
+                                                                                         const REALTYPE* scaleFactors,
+                                                                                         int startPattern,
+                                                                                         int endPattern) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE sums1[STATE_COUNT];
+        REALTYPE sums2[STATE_COUNT];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        const int v = l * partialsStride * kPatternCount + partialsStride * startPattern;
+        const REALTYPE* partials1Ptr = partials1 + v;
+        const REALTYPE* partials2Ptr = partials2 + v;
+        REALTYPE* destPtr = destP + v;
+        for (int k = startPattern; k < endPattern; k++) {
+            const REALTYPE oneOverScaleFactor = REALTYPE(1.0) / scaleFactors[k];
+            multiplyPartials(transposed1, partials1Ptr, sums1);
+            multiplyPartials(transposed2, partials2Ptr, sums2);
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = sums1[i] * sums2[i] * oneOverScaleFactor;
+            destPtr += partialsStride;
+            partials1Ptr += partialsStride;
+            partials2Ptr += partialsStride;
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+void BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::calcPartialsPartialsAutoScaling(REALTYPE* destP,
+                                                                                        const REALTYPE* partials1,
+                                                                                        const REALTYPE* matrices1,
+                                                                                        const REALTYPE* partials2,
+                                                                                        const REALTYPE* matrices2,
+                                                                                        int* activateScaling) {
+    const int partialsStride = STATE_COUNT + P_PAD;
+
+#pragma omp parallel for num_threads(kCategoryCount)
+    for (int l = 0; l < kCategoryCount; l++) {
+        REALTYPE transposed1[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE transposed2[(STATE_COUNT + T_PAD) * STATE_COUNT];
+        REALTYPE sums1[STATE_COUNT];
+        REALTYPE sums2[STATE_COUNT];
+        transposeMatrix(matrices1 + l * kMatrixSize, transposed1);
+        transposeMatrix(matrices2 + l * kMatrixSize, transposed2);
+
+        const int v = l * partialsStride * kPatternCount;
+        const REALTYPE* partials1Ptr = partials1 + v;
+        const REALTYPE* partials2Ptr = partials2 + v;
+        REALTYPE* destPtr = destP + v;
+        for (int k = 0; k < kPatternCount; k++) {
+            multiplyPartials(transposed1, partials1Ptr, sums1);
+            multiplyPartials(transposed2, partials2Ptr, sums2);
+            for (int i = 0; i < STATE_COUNT; i++)
+                destPtr[i] = sums1[i] * sums2[i];
+
+            if (*activateScaling == 0) {
+                for (int i = 0; i < STATE_COUNT; i++) {
+                    int expTmp;
+                    frexp(destPtr[i], &expTmp);
+                    if (abs(expTmp) > scalingExponentThreshhold)
+                        *activateScaling = 1;
+                }
+            }
+
+            destPtr += partialsStride;
+            partials1Ptr += partialsStride;
+            partials2Ptr += partialsStride;
+        }
+    }
+}
+
+BEAGLE_CPU_FIXED_TEMPLATE
+const char* BeagleCPUFixedStateImpl<BEAGLE_CPU_FIXED_GENERIC>::getName() {
+    return getBeagleCPUFixedStateName<REALTYPE, STATE_COUNT>();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// BeagleCPUFixedStateImplFactory public methods
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+BeagleImpl* BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::createImpl(int tipCount,
+                                             int partialsBufferCount,
+                                             int compactBufferCount,
+                                             int stateCount,
+                                             int patternCount,
+                                             int eigenBufferCount,
+                                             int matrixBufferCount,
+                                             int categoryCount,
+                                             int scaleBufferCount,
+                                             int resourceNumber,
+                                             int pluginResourceNumber,
+                                             long preferenceFlags,
+                                             long requirementFlags,
+                                             int* errorCode) {
+
+    BeagleImpl* impl = NULL;
+
+    // amino acids and codons (universal code and all 64 triplets)
+    switch (stateCount) {
+        case 20: impl = new BeagleCPUFixedStateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT, 20>(); break;
+        case 61: impl = new BeagleCPUFixedStateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT, 61>(); break;
+        case 64: impl = new BeagleCPUFixedStateImpl<REALTYPE, T_PAD_DEFAULT, P_PAD_DEFAULT, 64>(); break;
+        default: return NULL;
+    }
+
+    try {
+        *errorCode =
+            impl->createInstance(tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                 patternCount, eigenBufferCount, matrixBufferCount,
+                                 categoryCount,scaleBufferCount, resourceNumber,
+                                 pluginResourceNumber,
+                                 preferenceFlags, requirementFlags);
+        if (*errorCode == BEAGLE_SUCCESS) {
+            return impl;
+        }
+        delete impl;
+        return NULL;
+    }
+    catch(...) {
+        if (DEBUGGING_OUTPUT)
+            std::cerr << "exception in initialize\n";
+        delete impl;
+        throw;
+    }
+
+    delete impl;
+
+    return NULL;
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const char* BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getName() {
+    return getBeagleCPUFixedStateFactoryName<BEAGLE_CPU_FACTORY_GENERIC>();
+}
+
+BEAGLE_CPU_FACTORY_TEMPLATE
+const long BeagleCPUFixedStateImplFactory<BEAGLE_CPU_FACTORY_GENERIC>::getFlags() {
+    long flags = BEAGLE_FLAG_COMPUTATION_SYNCH |
+                 BEAGLE_FLAG_SCALING_MANUAL | BEAGLE_FLAG_SCALING_ALWAYS | BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALING_DYNAMIC |
+                 BEAGLE_FLAG_THREADING_NONE | BEAGLE_FLAG_THREADING_CPP |
+                 BEAGLE_FLAG_PROCESSOR_CPU |
+                 BEAGLE_FLAG_VECTOR_NONE |
+                 BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+                 BEAGLE_FLAG_EIGEN_COMPLEX | BEAGLE_FLAG_EIGEN_REAL |
+                 BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED |
+                 BEAGLE_FLAG_FRAMEWORK_CPU;
+    if (DOUBLE_PRECISION)
+        flags |= BEAGLE_FLAG_PRECISION_DOUBLE;
+    else
+        flags |= BEAGLE_FLAG_PRECISION_SINGLE;
+    return flags;
+}
+
+}	// namespace cpu
+}	// namespace beagle
+
+#endif // BEAGLE_CPU_FIXED_STATE_IMPL_HPP
@@ -35,6 +35,7 @@
 #include "libhmsbeagle/BeagleImpl.h"
 #include "libhmsbeagle/CPU/Precision.h"
 #include "libhmsbeagle/CPU/EigenDecomposition.h"
+#include "libhmsbeagle/CPU/RateMatrixExponential.h"
 
 #include <vector>
 #include <thread>
@@ -43,6 +44,9 @@
 #include <condition_variable>
 #include <mutex>
 #include <functional>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
 
 #define BEAGLE_CPU_GENERIC	REALTYPE, T_PAD, P_PAD
 #define BEAGLE_CPU_TEMPLATE	template <typename REALTYPE, int T_PAD, int P_PAD>
@@ -56,9 +60,19 @@
 
 #define BEAGLE_CPU_ASYNC_MIN_PATTERN_COUNT 256 // do not use CPU auto-threading for problems with fewer patterns
 
+#define BEAGLE_CPU_MAX_PACKED_STATE_COUNT  254 // larger state spaces keep their tips as partials
+
+#define BEAGLE_CPU_MISSING_BLOCK_SIZE      32  // patterns per block of all-missing tracking
+
+#define BEAGLE_CPU_INSTANCE_FILE_VERSION   3
+#define BEAGLE_CPU_INSTANCE_FILE_ALIGNMENT 64 // every section of a saved instance starts on this boundary
+
 namespace beagle {
 namespace cpu {
 
+/// one byte per pattern for compact tip states; missing data is coded as kStateCount
+typedef unsigned char TipState;
+
 BEAGLE_CPU_TEMPLATE
 class BeagleCPUImpl : public BeagleImpl {
 
@@ -94,6 +108,7 @@ protected:
     int scalingExponentThreshhold;
 
     EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* gEigenDecomposition;
+    RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>* gRateMatrixExponential; // created by the first setRateMatrix
 
     double** gCategoryRates; // Kept in double-precision until multiplication by edgelength
     double* gPatternWeights;
@@ -109,7 +124,8 @@ protected:
     //      tipStates field should be switched to vectors of vectors (to make
     //      memory management less error prone
     REALTYPE** gPartials;
-    int** gTipStates;
+    TipState** gTipStates;
+    bool* gTipStatesExternal; /// tip states owned by the caller, never written or freed
     REALTYPE** gScaleBuffers;
     
     signed short** gAutoScaleBuffers;
@@ -129,6 +145,38 @@ protected:
     REALTYPE* outFirstDerivativesTmp;
     REALTYPE* outSecondDerivativesTmp;
 
+    // edge projected onto the eigenvectors by prepareEdgeProjection, allocated on first use
+    REALTYPE* gEdgeProjection; // kPatternCount x kCategoryCount x kStateCount coefficients
+    REALTYPE* gEdgeProjectionScale; // cumulative scale factors captured with the projection
+    double* gEdgeProjectionRates; // eigenvalue times category rate, kCategoryCount x kStateCount
+    double* gEdgeProjectionTerms; // exponentials and their derivatives for one edge length
+    bool kEdgeProjectionScaled;
+    bool kEdgeProjectionPrepared;
+
+    // two matrix sets of scratch per worker for convolutions, allocated on first use
+    REALTYPE* gConvolutionTmp;
+    int kConvolutionTmpCount;
+
+    // invariable-sites component of the site likelihoods, off while the proportion is zero
+    double kProportionInvariant;
+    int kInvariantFrequenciesIndex;
+    bool kInvariantSitesDirty; // tip data changed since the products were built
+    std::vector<int> gInvariantPatterns; // ascending patterns that can be constant over the tips
+    std::vector<double> gInvariantProducts; // per such pattern, product over tips of each state
+
+    // blocks of patterns, never spanning two partitions, whose partials are all one in a buffer
+    // because every tip below it is missing; operations skip the kernels for such blocks
+    int kMissingBlockCount;
+    std::vector<int> gMissingBlockStarts; // first pattern of each block, then kPatternCount
+    std::vector<unsigned char> gMissingBlocks; // kBufferCount x kMissingBlockCount flags
+
+    // results of the last calculateRootLogLikelihoodsAsync call
+    double* gAsyncLogLikelihoods;
+    double kAsyncSumLogLikelihood;
+    int kAsyncLogLikelihoodsCount;
+    int kAsyncLogLikelihoodsSize;
+    int kAsyncReturnCode;
+
     REALTYPE* ones;
     REALTYPE* zeros;
 
@@ -139,6 +187,7 @@ protected:
         std::condition_variable cv; // The condition variable to wait for threads
         std::mutex m; // Mutex used for avoiding data races
         bool stop = false; // When set, this flag tells the thread that it should exit
+        std::atomic<uint64_t> busyTime{0}; // Nanoseconds spent running jobs, collected with instance statistics
     };
 
     int kNumThreads;
@@ -154,6 +203,66 @@ protected:
     double* gAutoPartitionOutSumLogLikelihoods;
     std::shared_future<void>* gFutures;
 
+    // read by the worker threads, so updated with relaxed atomics; idle time is in nanoseconds
+    std::atomic<bool> kStatisticsEnabled;
+    std::atomic<uint64_t> kStatisticsPatternOperations;
+    std::atomic<uint64_t> kStatisticsRescaleCount;
+    std::atomic<uint64_t> kStatisticsThreadIdleTime;
+
+    /// copies of buffers taken by snapshotBuffers; indices lists partials, then scale, then matrix indices
+    struct BufferSnapshot {
+        int* indices;
+        int indicesCapacity;
+        int partialsCount;
+        int scaleCount;
+        int matrixCount;
+        REALTYPE* data;
+        size_t dataCapacity;
+    };
+
+    BufferSnapshot* gSnapshots;
+    int kSnapshotCount;
+
+    /// saved instance layout: header, section table, then the sections in table order
+    struct InstanceFileHeader {
+        char magic[8];
+        uint32_t byteOrder;
+        uint32_t version;
+        uint32_t realSize;
+        uint32_t sectionCount;
+        int32_t dimensions[11];
+        int32_t partitionCount;
+        int64_t layoutFlags;
+        double proportionInvariant;
+        int32_t invariantFrequenciesIndex;
+        int32_t reserved;
+    };
+
+    struct InstanceFileSection {
+        int32_t type;
+        int32_t index;
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    enum InstanceFileSectionType {
+        SECTION_PATTERN_PARTITIONS,
+        SECTION_PATTERNS_NEW_ORDER,
+        SECTION_PATTERN_WEIGHTS,
+        SECTION_CATEGORY_RATES,
+        SECTION_CATEGORY_WEIGHTS,
+        SECTION_STATE_FREQUENCIES,
+        SECTION_EIGEN_DECOMPOSITION,
+        SECTION_TIP_STATES,
+        SECTION_PARTIALS,
+        SECTION_SCALE_FACTORS,
+        SECTION_AUTO_SCALE_FACTORS,
+        SECTION_ACTIVE_SCALING_FACTORS,
+        SECTION_TRANSITION_MATRICES,
+        SECTION_RATE_MATRICES,
+        SECTION_TYPE_COUNT
+    };
+
 public:
     virtual ~BeagleCPUImpl();
 
@@ -175,6 +284,32 @@ public:
     // initialization of instance,  returnInfo can be null
     int getInstanceDetails(BeagleInstanceDetails* returnInfo);
 
+    int setDeviceMemoryBudget(int budgetMegabytes);
+
+    int setTransitionMatrixCacheSize(int cacheSize);
+
+    int setStatisticsEnabled(bool enabled);
+
+    int getStatistics(BeagleInstanceStatistics* outStatistics);
+
+    int copyInstance(BeagleImpl* source);
+
+    int snapshotBuffers(int snapshotIndex,
+                        const int* partialsIndices,
+                        int partialsCount,
+                        const int* scaleIndices,
+                        int scaleCount,
+                        const int* matrixIndices,
+                        int matrixCount);
+
+    int restoreSnapshot(int snapshotIndex);
+
+    int releaseSnapshot(int snapshotIndex);
+
+    int saveInstance(const char* fileName);
+
+    int loadInstance(const char* fileName);
+
     // set the states for a given tip
     //
     // tipIndex the index of the tip
@@ -182,6 +317,9 @@ public:
     int setTipStates(int tipIndex,
                      const int* inStates);
 
+    int setTipStatesExternal(int tipIndex,
+                             const unsigned char* inStates);
+
     // set the partials for a given tip
     //
     // tipIndex the index of the tip
@@ -210,6 +348,9 @@ public:
 
     int setStateFrequencies(int stateFrequenciesIndex,
                             const double* inStateFrequencies);    
+
+    int setInvariantSites(double proportionInvariant,
+                          int stateFrequenciesIndex);
     
     int setCategoryWeights(int categoryWeightsIndex,
                            const double* inCategoryWeights);
@@ -248,6 +389,11 @@ public:
             const int* resultIndices,
             int count);
 
+    int convolveTransitionMatrixChains(const int* matrixIndices,
+                                       const int* chainLengths,
+                                       const int* resultIndices,
+                                       int chainCount);
+
     // calculate a transition probability matrices for a given list of node. This will
     // calculate for all categories (and all matrices if more than one is being used).
     //
@@ -269,6 +415,14 @@ public:
                                                    const double* edgeLengths,
                                                    int count);
 
+    int setRateMatrix(int rateMatrixIndex,
+                      const double* inRateMatrix);
+
+    int updateTransitionMatricesFromRateMatrix(int rateMatrixIndex,
+                                               const int* probabilityIndices,
+                                               const double* edgeLengths,
+                                               int count);
+
     // calculate or queue for calculation partials using an array of operations
     //
     // operations an array of triplets of indices: the two source partials and the destination
@@ -348,6 +502,18 @@ public:
                                                double* outSumLogLikelihoodByPartition,
                                                double* outSumLogLikelihood);
 
+    // the CPU computes synchronously; the result is held until it is retrieved
+    int calculateRootLogLikelihoodsAsync(const int* bufferIndices,
+                                         const int* categoryWeightsIndices,
+                                         const int* stateFrequenciesIndices,
+                                         const int* cumulativeScaleIndices,
+                                         const int* partitionIndices,
+                                         int partitionCount);
+
+    int getRootLogLikelihoodsAsync(int blocking,
+                                   double* outSumLogLikelihoodByPartition,
+                                   double* outSumLogLikelihood);
+
     // possible nulls: firstDerivativeIndices, secondDerivativeIndices,
     //                 outFirstDerivatives, outSecondDerivatives
     int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
@@ -380,7 +546,19 @@ public:
                                                double* outSumFirstDerivative,
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
-    
+
+    int prepareEdgeProjection(int parentBufferIndex,
+                              int childBufferIndex,
+                              int eigenIndex,
+                              int categoryWeightsIndex,
+                              int stateFrequenciesIndex,
+                              int cumulativeScaleIndex);
+
+    int calculateEdgeProjectionLogLikelihoods(double edgeLength,
+                                              double* outSumLogLikelihood,
+                                              double* outSumFirstDerivative,
+                                              double* outSumSecondDerivative);
+
     int getSiteLogLikelihoods(double* outLogLikelihoods);
     
     int getSiteDerivatives(double* outFirstDerivatives,
@@ -409,16 +587,16 @@ protected:
     virtual int reorderPatternsByPartition();
 
     virtual void calcStatesStates(REALTYPE* destP,
-                                  const int* states1,
+                                  const TipState* states1,
                                   const REALTYPE* matrices1,
-                                  const int* states2,
+                                  const TipState* states2,
                                   const REALTYPE* matrices2,
                                   int startPattern,
                                   int endPattern);
 
 
     virtual void calcStatesPartials(REALTYPE* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const REALTYPE* matrices1,
                                     const REALTYPE* partials2,
                                     const REALTYPE* matrices2,
@@ -433,6 +611,29 @@ protected:
                                       int startPattern,
                                       int endPattern);
 
+    // site likelihoods of [startPattern, endPattern) into outLogLikelihoodsTmp, in one pass
+    virtual void integrateRootSiteLikelihoods(const REALTYPE* rootPartials,
+                                              const REALTYPE* wt,
+                                              const REALTYPE* freqs,
+                                              int startPattern,
+                                              int endPattern);
+
+    // takes logs of the site likelihoods in outLogLikelihoodsTmp, adds scale factors and the
+    // invariable sites, and returns the pattern-weighted sum
+    double sumSiteLogLikelihoods(int startPattern,
+                                 int endPattern,
+                                 int scalingFactorsIndex,
+                                 int derivativeCount = 0);
+
+    // finds the patterns that can be constant and their tip products, if tip data changed
+    void updateInvariantSites();
+
+    // adds the invariable sites to the scaled log site likelihoods of [startPattern, endPattern)
+    // and rescales the first (and second) site derivatives in the out*DerivativesTmp buffers
+    void addInvariantSiteLikelihoods(int startPattern,
+                                     int endPattern,
+                                     int derivativeCount);
+
     virtual int calcRootLogLikelihoods(const int bufferIndex,
                                         const int categoryWeightsIndex,
                                         const int stateFrequenciesIndex,
@@ -553,16 +754,16 @@ protected:
                                                    double* outSumSecondDerivative);
 
     virtual void calcStatesStatesFixedScaling(REALTYPE *destP,
-                                              const int *child0States,
+                                              const TipState *child0States,
                                               const REALTYPE *child0TransMat,
-                                              const int *child1States,
+                                              const TipState *child1States,
                                               const REALTYPE *child1TransMat,
                                               const REALTYPE *scaleFactors,
                                               int startPattern,
                                               int endPattern);
 
     virtual void calcStatesPartialsFixedScaling(REALTYPE *destP,
-                                                const int *child0States,
+                                                const TipState *child0States,
                                                 const REALTYPE *child0TransMat,
                                                 const REALTYPE *child1Partials,
                                                 const REALTYPE *child1TransMat,
@@ -586,6 +787,37 @@ protected:
                                                   const REALTYPE* matrices2,
                                                   int* activateScaling);
 
+    // calls the unscaled kernel for the children of an operation over [startPattern, endPattern)
+    void calcUnscaledPartials(REALTYPE* destP,
+                              const TipState* tipStates1,
+                              const REALTYPE* partials1,
+                              const REALTYPE* matrices1,
+                              const TipState* tipStates2,
+                              const REALTYPE* partials2,
+                              const REALTYPE* matrices2,
+                              int startPattern,
+                              int endPattern);
+
+    // as calcUnscaledPartials, but blocks where both children are missing get the result of
+    // their first pattern copied in, and the missing blocks of the destination are updated
+    void calcPartialsSkippingMissing(int destIndex,
+                                     int child1Index,
+                                     const REALTYPE* matrices1,
+                                     int child2Index,
+                                     const REALTYPE* matrices2,
+                                     int startPattern,
+                                     int endPattern);
+
+    // lays the blocks out over the pattern partitions and finds the missing blocks of the tips
+    void resetMissingBlocks();
+
+    // finds the missing blocks of a buffer from its tip states or partials
+    void findMissingBlocks(int bufferIndex);
+
+    void clearMissingBlocks(int bufferIndex,
+                            int startPattern,
+                            int endPattern);
+
     virtual void rescalePartials(REALTYPE *destP,
     		                     REALTYPE *scaleFactors,
                                  REALTYPE *cumulativeScaleFactors,
@@ -604,8 +836,38 @@ protected:
 
     void* mallocAligned(size_t size);
 
+    int setTipStatesAsPartials(int tipIndex,
+                               const int* inStates);
+
+    void fillInstanceFileHeader(InstanceFileHeader* header);
+
+    int getInstanceFileSectionCount(int type);
+
+    void* getInstanceFileSection(int type,
+                                 int index,
+                                 size_t* outSize,
+                                 bool allocate);
+
     void threadWaiting(threadData* tData);
 
+    void multiplyTransitionMatrices(const REALTYPE* first,
+                                    const REALTYPE* second,
+                                    REALTYPE* result);
+
+    void convolveChainRange(const int* matrixIndices,
+                            const int* chainOffsets,
+                            const int* resultIndices,
+                            int chainStart,
+                            int chainCount,
+                            int chainStride,
+                            REALTYPE* scratch);
+
+    void countOperationStatistics(const int* operations,
+                                  int count,
+                                  bool byPartition);
+
+    void accumulateThreadIdleTime(std::chrono::steady_clock::time_point parallelStartTime);
+
 };
 
 BEAGLE_CPU_FACTORY_TEMPLATE
@@ -79,10 +79,12 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <algorithm>
 #include <cfloat>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/CPU/Precision.h"
+#include "libhmsbeagle/CPU/VectorLog.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
 #include "libhmsbeagle/CPU/EigenDecompositionCube.h"
 #include "libhmsbeagle/CPU/EigenDecompositionSquare.h"
@@ -146,11 +148,12 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     for(unsigned int i=0; i<kBufferCount; i++) {
         if (gPartials[i] != NULL)
             free(gPartials[i]);
-        if (gTipStates[i] != NULL)
+        if (gTipStates[i] != NULL && !gTipStatesExternal[i])
             free(gTipStates[i]);
     }
     free(gPartials);
     free(gTipStates);
+    free(gTipStatesExternal);
     
     if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
         for(unsigned int i=0; i<kScaleBufferCount; i++) {
@@ -191,10 +194,30 @@ BeagleCPUImpl<BEAGLE_CPU_GENERIC>::~BeagleCPUImpl() {
     free(outFirstDerivativesTmp);
     free(outSecondDerivativesTmp);
 
+    if (gAsyncLogLikelihoods)
+        free(gAsyncLogLikelihoods);
+
+    if (gEdgeProjection) {
+        free(gEdgeProjection);
+        free(gEdgeProjectionScale);
+        free(gEdgeProjectionRates);
+        free(gEdgeProjectionTerms);
+    }
+
+    if (gConvolutionTmp)
+        free(gConvolutionTmp);
+
+    for (int i = 0; i < kSnapshotCount; i++) {
+        free(gSnapshots[i].indices);
+        free(gSnapshots[i].data);
+    }
+    free(gSnapshots);
+
     free(ones);
     free(zeros);
 
     delete gEigenDecomposition;
+    delete gRateMatrixExponential;
 
     if (kThreadingEnabled) {
         // Send stop signal to all threads and join them...
@@ -265,6 +288,33 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
     kMaxPartitionCount = kPartitionCount;
     kPartitionsInitialised = false;
     kPatternsReordered = false;
+
+    gEdgeProjection = NULL;
+    gEdgeProjectionScale = NULL;
+    gEdgeProjectionRates = NULL;
+    gEdgeProjectionTerms = NULL;
+    kEdgeProjectionScaled = false;
+    kEdgeProjectionPrepared = false;
+
+    gConvolutionTmp = NULL;
+    kConvolutionTmpCount = 0;
+
+    kProportionInvariant = 0.0;
+    kInvariantFrequenciesIndex = 0;
+    kInvariantSitesDirty = true;
+
+    gAsyncLogLikelihoods = NULL;
+    kAsyncLogLikelihoodsCount = 0;
+    kAsyncLogLikelihoodsSize = 0;
+    kAsyncReturnCode = BEAGLE_SUCCESS;
+
+    kStatisticsEnabled = false;
+    kStatisticsPatternOperations = 0;
+    kStatisticsRescaleCount = 0;
+    kStatisticsThreadIdleTime = 0;
+
+    gSnapshots = NULL;
+    kSnapshotCount = 0;
     
     kInternalPartialsBufferCount = kBufferCount - kTipCount;
 
@@ -332,6 +382,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
         gEigenDecomposition = new EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
                 kStateCount, kCategoryCount,kFlags);
 
+    gRateMatrixExponential = NULL;
+
     gCategoryRates = (double**) calloc(sizeof(double), kEigenDecompCount);
     if (gCategoryRates == NULL)
         throw std::bad_alloc();
@@ -357,10 +409,14 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
 
     // assigning kBufferCount to this array so that we can just check if a tipStateBuffer is
     // allocated
-    gTipStates = (int**) malloc(sizeof(int*) * kBufferCount);
+    gTipStates = (TipState**) malloc(sizeof(TipState*) * kBufferCount);
     if (gTipStates == NULL)
         throw std::bad_alloc();
 
+    gTipStatesExternal = (bool*) calloc(sizeof(bool), kBufferCount);
+    if (gTipStatesExternal == NULL)
+        throw std::bad_alloc();
+
     for (int i = 0; i < kBufferCount; i++) {
         gPartials[i] = NULL;
         gTipStates[i] = NULL;
@@ -372,6 +428,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::createInstance(int tipCount,
             throw std::bad_alloc();
     }
 
+    resetMissingBlocks();
+
     gScaleBuffers = NULL;
 
     gAutoScaleBuffers = NULL;
@@ -494,23 +552,607 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceDetails(BeagleInstanceDetails*
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setDeviceMemoryBudget(int budgetMegabytes) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTransitionMatrixCacheSize(int cacheSize) {
+    if (cacheSize < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    if (!gEigenDecomposition->setMatrixCacheSize(cacheSize))
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setStatisticsEnabled(bool enabled) {
+    kStatisticsPatternOperations.store(0, std::memory_order_relaxed);
+    kStatisticsRescaleCount.store(0, std::memory_order_relaxed);
+    kStatisticsThreadIdleTime.store(0, std::memory_order_relaxed);
+    if (kThreadingEnabled) {
+        for (int i = 0; i < kNumThreads; i++)
+            gThreads[i].busyTime.store(0, std::memory_order_relaxed);
+    }
+    kStatisticsEnabled.store(enabled, std::memory_order_relaxed);
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getStatistics(BeagleInstanceStatistics* outStatistics) {
+    outStatistics->patternOperations = (double) kStatisticsPatternOperations.load(std::memory_order_relaxed);
+    outStatistics->rescaleCount = (long) kStatisticsRescaleCount.load(std::memory_order_relaxed);
+    outStatistics->threadIdleTime = kStatisticsThreadIdleTime.load(std::memory_order_relaxed) * 1E-9;
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::copyInstance(BeagleImpl* source) {
+    BeagleCPUImpl<BEAGLE_CPU_GENERIC>* other = dynamic_cast<BeagleCPUImpl<BEAGLE_CPU_GENERIC>*>(source);
+    if (other == NULL || other->kBufferCount != kBufferCount || other->kTipCount != kTipCount ||
+        other->kPartialsSize != kPartialsSize || other->kMatrixCount != kMatrixCount ||
+        other->kEigenDecompCount != kEigenDecompCount || other->kScaleBufferCount != kScaleBufferCount ||
+        other->kFlags != kFlags)
+        return BEAGLE_ERROR_GENERAL;
+
+    if (other->kPartitionsInitialised) {
+        // the source partitions are already sorted, so this never reorders the patterns again
+        int returnCode = setPatternPartitions(other->kPartitionCount, other->gPatternPartitions);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+        if (other->kPatternsReordered) {
+            gPatternsNewOrder = (int*) malloc(sizeof(int) * kPatternCount);
+            if (gPatternsNewOrder == NULL)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
+            memcpy(gPatternsNewOrder, other->gPatternsNewOrder, sizeof(int) * kPatternCount);
+            kPatternsReordered = true;
+        }
+    }
+
+    memcpy(gPatternWeights, other->gPatternWeights, sizeof(double) * kPatternCount);
+
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        if (other->gCategoryRates[i] != NULL) {
+            if (gCategoryRates[i] == NULL)
+                gCategoryRates[i] = (double*) malloc(sizeof(double) * kCategoryCount);
+            memcpy(gCategoryRates[i], other->gCategoryRates[i], sizeof(double) * kCategoryCount);
+        }
+        if (other->gCategoryWeights[i] != NULL) {
+            if (gCategoryWeights[i] == NULL)
+                gCategoryWeights[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * kCategoryCount);
+            memcpy(gCategoryWeights[i], other->gCategoryWeights[i], sizeof(REALTYPE) * kCategoryCount);
+        }
+        if (other->gStateFrequencies[i] != NULL) {
+            if (gStateFrequencies[i] == NULL)
+                gStateFrequencies[i] = (REALTYPE*) malloc(sizeof(REALTYPE) * kStateCount);
+            memcpy(gStateFrequencies[i], other->gStateFrequencies[i], sizeof(REALTYPE) * kStateCount);
+        }
+    }
+    gEigenDecomposition->copyFrom(other->gEigenDecomposition);
+
+    if (other->gRateMatrixExponential != NULL) {
+        if (gRateMatrixExponential == NULL)
+            gRateMatrixExponential = new RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
+                                                                                         kStateCount);
+        gRateMatrixExponential->copyFrom(other->gRateMatrixExponential);
+    }
+
+    kProportionInvariant = other->kProportionInvariant;
+    kInvariantFrequenciesIndex = other->kInvariantFrequenciesIndex;
+    kInvariantSitesDirty = true;
+
+    for (int i = 0; i < kBufferCount; i++) {
+        if (other->gTipStates[i] != NULL) {
+            if (gTipStates[i] == NULL || gTipStatesExternal[i]) {
+                gTipStates[i] = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
+                gTipStatesExternal[i] = false;
+            }
+            memcpy(gTipStates[i], other->gTipStates[i], sizeof(TipState) * kPaddedPatternCount);
+        }
+        if (other->gPartials[i] != NULL) {
+            if (gPartials[i] == NULL)
+                gPartials[i] = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
+            memcpy(gPartials[i], other->gPartials[i], sizeof(REALTYPE) * kPartialsSize);
+        }
+    }
+    kMissingBlockCount = other->kMissingBlockCount;
+    gMissingBlockStarts = other->gMissingBlockStarts;
+    gMissingBlocks = other->gMissingBlocks;
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
+        for (int i = 0; i < kScaleBufferCount; i++)
+            memcpy(gAutoScaleBuffers[i], other->gAutoScaleBuffers[i], sizeof(signed short) * kPaddedPatternCount);
+        memcpy(gActiveScalingFactors, other->gActiveScalingFactors, sizeof(int) * kInternalPartialsBufferCount);
+        memcpy(gScaleBuffers[0], other->gScaleBuffers[0], sizeof(REALTYPE) * kPaddedPatternCount);
+    } else {
+        for (int i = 0; i < kScaleBufferCount; i++)
+            memcpy(gScaleBuffers[i], other->gScaleBuffers[i], sizeof(REALTYPE) * kPaddedPatternCount);
+    }
+
+    for (int i = 0; i < kMatrixCount; i++)
+        memcpy(gTransitionMatrices[i], other->gTransitionMatrices[i], sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::snapshotBuffers(int snapshotIndex,
+                                                       const int* partialsIndices,
+                                                       int partialsCount,
+                                                       const int* scaleIndices,
+                                                       int scaleCount,
+                                                       const int* matrixIndices,
+                                                       int matrixCount) {
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (snapshotIndex < 0 || partialsCount < 0 || scaleCount < 0 || matrixCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    for (int i = 0; i < partialsCount; i++) {
+        if (partialsIndices[i] < 0 || partialsIndices[i] >= kBufferCount || gPartials[partialsIndices[i]] == NULL)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    for (int i = 0; i < scaleCount; i++) {
+        if (scaleIndices[i] < 0 || scaleIndices[i] >= kScaleBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    for (int i = 0; i < matrixCount; i++) {
+        if (matrixIndices[i] < 0 || matrixIndices[i] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    if (snapshotIndex >= kSnapshotCount) {
+        BufferSnapshot* snapshots = (BufferSnapshot*) realloc(gSnapshots, sizeof(BufferSnapshot) * (snapshotIndex + 1));
+        if (snapshots == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        memset(snapshots + kSnapshotCount, 0, sizeof(BufferSnapshot) * (snapshotIndex + 1 - kSnapshotCount));
+        gSnapshots = snapshots;
+        kSnapshotCount = snapshotIndex + 1;
+    }
+
+    BufferSnapshot* snapshot = &gSnapshots[snapshotIndex];
+
+    // storage is kept between snapshots and only grows
+    int indexCount = partialsCount + scaleCount + matrixCount;
+    if (indexCount > snapshot->indicesCapacity) {
+        free(snapshot->indices);
+        snapshot->indices = (int*) malloc(sizeof(int) * indexCount);
+        if (snapshot->indices == NULL) {
+            snapshot->indicesCapacity = 0;
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        }
+        snapshot->indicesCapacity = indexCount;
+    }
+    size_t dataSize = (size_t) partialsCount * kPartialsSize + (size_t) scaleCount * kPaddedPatternCount +
+                      (size_t) matrixCount * kMatrixSize * kCategoryCount;
+    if (dataSize > snapshot->dataCapacity) {
+        free(snapshot->data);
+        snapshot->data = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * dataSize);
+        if (snapshot->data == NULL) {
+            snapshot->dataCapacity = 0;
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        }
+        snapshot->dataCapacity = dataSize;
+    }
+
+    snapshot->partialsCount = partialsCount;
+    snapshot->scaleCount = scaleCount;
+    snapshot->matrixCount = matrixCount;
+    memcpy(snapshot->indices, partialsIndices, sizeof(int) * partialsCount);
+    memcpy(snapshot->indices + partialsCount, scaleIndices, sizeof(int) * scaleCount);
+    memcpy(snapshot->indices + partialsCount + scaleCount, matrixIndices, sizeof(int) * matrixCount);
+
+    REALTYPE* data = snapshot->data;
+    for (int i = 0; i < partialsCount; i++) {
+        memcpy(data, gPartials[partialsIndices[i]], sizeof(REALTYPE) * kPartialsSize);
+        data += kPartialsSize;
+    }
+    for (int i = 0; i < scaleCount; i++) {
+        memcpy(data, gScaleBuffers[scaleIndices[i]], sizeof(REALTYPE) * kPaddedPatternCount);
+        data += kPaddedPatternCount;
+    }
+    for (int i = 0; i < matrixCount; i++) {
+        memcpy(data, gTransitionMatrices[matrixIndices[i]], sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+        data += kMatrixSize * kCategoryCount;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::restoreSnapshot(int snapshotIndex) {
+    if (snapshotIndex < 0 || snapshotIndex >= kSnapshotCount || gSnapshots[snapshotIndex].data == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    const BufferSnapshot* snapshot = &gSnapshots[snapshotIndex];
+    const int* indices = snapshot->indices;
+    const REALTYPE* data = snapshot->data;
+    for (int i = 0; i < snapshot->partialsCount; i++) {
+        const int bufferIndex = *indices++;
+        memcpy(gPartials[bufferIndex], data, sizeof(REALTYPE) * kPartialsSize);
+        findMissingBlocks(bufferIndex);
+        data += kPartialsSize;
+    }
+    for (int i = 0; i < snapshot->scaleCount; i++) {
+        memcpy(gScaleBuffers[*indices++], data, sizeof(REALTYPE) * kPaddedPatternCount);
+        data += kPaddedPatternCount;
+    }
+    for (int i = 0; i < snapshot->matrixCount; i++) {
+        memcpy(gTransitionMatrices[*indices++], data, sizeof(REALTYPE) * kMatrixSize * kCategoryCount);
+        data += kMatrixSize * kCategoryCount;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::releaseSnapshot(int snapshotIndex) {
+    if (snapshotIndex < 0 || snapshotIndex >= kSnapshotCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    free(gSnapshots[snapshotIndex].indices);
+    free(gSnapshots[snapshotIndex].data);
+    memset(&gSnapshots[snapshotIndex], 0, sizeof(BufferSnapshot));
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::saveInstance(const char* fileName) {
+    InstanceFileHeader header;
+    fillInstanceFileHeader(&header);
+
+    std::vector<InstanceFileSection> sections;
+    std::vector<const void*> sectionData;
+    for (int type = 0; type < SECTION_TYPE_COUNT; type++) {
+        int count = getInstanceFileSectionCount(type);
+        for (int i = 0; i < count; i++) {
+            size_t size;
+            void* data = getInstanceFileSection(type, i, &size, false);
+            if (data != NULL) {
+                InstanceFileSection section = {type, i, 0, size};
+                sections.push_back(section);
+                sectionData.push_back(data);
+            }
+        }
+    }
+    header.sectionCount = (uint32_t) sections.size();
+
+    const uint64_t alignment = BEAGLE_CPU_INSTANCE_FILE_ALIGNMENT;
+    uint64_t offset = sizeof(InstanceFileHeader) + sizeof(InstanceFileSection) * sections.size();
+    for (size_t i = 0; i < sections.size(); i++) {
+        offset = (offset + alignment - 1) / alignment * alignment;
+        sections[i].offset = offset;
+        offset += sections[i].size;
+    }
+
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    static const char padding[BEAGLE_CPU_INSTANCE_FILE_ALIGNMENT] = {0};
+    bool written = (fwrite(&header, sizeof(InstanceFileHeader), 1, file) == 1);
+    if (written && !sections.empty())
+        written = (fwrite(&sections[0], sizeof(InstanceFileSection), sections.size(), file) == sections.size());
+    uint64_t position = sizeof(InstanceFileHeader) + sizeof(InstanceFileSection) * sections.size();
+    for (size_t i = 0; i < sections.size() && written; i++) {
+        size_t padSize = (size_t) (sections[i].offset - position);
+        written = (fwrite(padding, 1, padSize, file) == padSize &&
+                   fwrite(sectionData[i], 1, sections[i].size, file) == sections[i].size);
+        position = sections[i].offset + sections[i].size;
+    }
+
+    if (fclose(file) != 0 || !written)
+        return BEAGLE_ERROR_GENERAL;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::loadInstance(const char* fileName) {
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    InstanceFileHeader expected;
+    fillInstanceFileHeader(&expected);
+
+    InstanceFileHeader header;
+    if (fread(&header, sizeof(InstanceFileHeader), 1, file) != 1 ||
+        memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.byteOrder != expected.byteOrder || header.version != expected.version ||
+        header.realSize != expected.realSize || header.layoutFlags != expected.layoutFlags ||
+        memcmp(header.dimensions, expected.dimensions, sizeof(header.dimensions)) != 0 ||
+        !(header.proportionInvariant >= 0.0 && header.proportionInvariant < 1.0) ||
+        header.invariantFrequenciesIndex < 0 || header.invariantFrequenciesIndex >= kEigenDecompCount) {
+        fclose(file);
+        return BEAGLE_ERROR_GENERAL;
+    }
+    kProportionInvariant = header.proportionInvariant;
+    kInvariantFrequenciesIndex = header.invariantFrequenciesIndex;
+    kInvariantSitesDirty = true;
+
+    std::vector<InstanceFileSection> sections(header.sectionCount);
+    if (header.sectionCount > 0 &&
+        fread(&sections[0], sizeof(InstanceFileSection), header.sectionCount, file) != header.sectionCount) {
+        fclose(file);
+        return BEAGLE_ERROR_GENERAL;
+    }
+
+    // sections are stored in offset order, so the file is read front to back without seeking
+    int returnCode = BEAGLE_SUCCESS;
+    char padding[BEAGLE_CPU_INSTANCE_FILE_ALIGNMENT];
+    uint64_t position = sizeof(InstanceFileHeader) + sizeof(InstanceFileSection) * sections.size();
+    for (size_t i = 0; i < sections.size() && returnCode == BEAGLE_SUCCESS; i++) {
+        const InstanceFileSection& section = sections[i];
+        size_t padSize = (size_t) (section.offset - position);
+        if (section.offset < position || padSize > sizeof(padding) ||
+            fread(padding, 1, padSize, file) != padSize) {
+            returnCode = BEAGLE_ERROR_GENERAL;
+            break;
+        }
+        position = section.offset + section.size;
+
+        if (section.type == SECTION_PATTERN_PARTITIONS) {
+            // partitions were saved sorted, so setting them never reorders the patterns
+            int* patternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
+            if (patternPartitions == NULL) {
+                returnCode = BEAGLE_ERROR_OUT_OF_MEMORY;
+            } else if (section.size != sizeof(int) * kPatternCount || header.partitionCount < 1 ||
+                       fread(patternPartitions, 1, section.size, file) != section.size) {
+                returnCode = BEAGLE_ERROR_GENERAL;
+            } else {
+                returnCode = setPatternPartitions(header.partitionCount, patternPartitions);
+            }
+            free(patternPartitions);
+            continue;
+        }
+
+        if (section.type == SECTION_RATE_MATRICES) {
+            // set through setRateMatrix, which rebuilds the uniformized chain
+            std::vector<double> rateMatrix(kStateCount * kStateCount);
+            if (section.index < 0 || section.index >= kEigenDecompCount ||
+                section.size != sizeof(double) * rateMatrix.size() ||
+                fread(&rateMatrix[0], 1, section.size, file) != section.size)
+                returnCode = BEAGLE_ERROR_GENERAL;
+            else
+                returnCode = setRateMatrix(section.index, &rateMatrix[0]);
+            continue;
+        }
+
+        if (section.type == SECTION_PATTERNS_NEW_ORDER && !kPatternsReordered) {
+            if (!kPartitionsInitialised) {
+                returnCode = BEAGLE_ERROR_GENERAL;
+                break;
+            }
+            gPatternsNewOrder = (int*) malloc(sizeof(int) * kPatternCount);
+            if (gPatternsNewOrder == NULL) {
+                returnCode = BEAGLE_ERROR_OUT_OF_MEMORY;
+                break;
+            }
+            kPatternsReordered = true;
+        }
+
+        size_t size;
+        void* data = NULL;
+        if (section.type >= 0 && section.type < SECTION_TYPE_COUNT &&
+            section.index >= 0 && section.index < getInstanceFileSectionCount(section.type))
+            data = getInstanceFileSection(section.type, section.index, &size, true);
+        if (data == NULL || size != section.size || fread(data, 1, size, file) != size)
+            returnCode = BEAGLE_ERROR_GENERAL;
+    }
+
+    fclose(file);
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::fillInstanceFileHeader(InstanceFileHeader* header) {
+    memset(header, 0, sizeof(InstanceFileHeader));
+    memcpy(header->magic, "BEAGLEIN", sizeof(header->magic));
+    header->byteOrder = 0x01020304;
+    header->version = BEAGLE_CPU_INSTANCE_FILE_VERSION;
+    header->realSize = sizeof(REALTYPE);
+    header->dimensions[0] = kTipCount;
+    header->dimensions[1] = kBufferCount;
+    header->dimensions[2] = kStateCount;
+    header->dimensions[3] = kPatternCount;
+    header->dimensions[4] = kPaddedPatternCount;
+    header->dimensions[5] = kPartialsPaddedStateCount;
+    header->dimensions[6] = kTransPaddedStateCount;
+    header->dimensions[7] = kCategoryCount;
+    header->dimensions[8] = kMatrixCount;
+    header->dimensions[9] = kEigenDecompCount;
+    header->dimensions[10] = kScaleBufferCount;
+    header->partitionCount = (kPartitionsInitialised ? kPartitionCount : 0);
+    header->proportionInvariant = kProportionInvariant;
+    header->invariantFrequenciesIndex = kInvariantFrequenciesIndex;
+    // only the flags that change how buffers are laid out have to match
+    header->layoutFlags = kFlags & (BEAGLE_FLAG_SCALING_AUTO | BEAGLE_FLAG_SCALERS_LOG | BEAGLE_FLAG_SCALERS_RAW |
+                                    BEAGLE_FLAG_EIGEN_REAL | BEAGLE_FLAG_EIGEN_COMPLEX |
+                                    BEAGLE_FLAG_INVEVEC_STANDARD | BEAGLE_FLAG_INVEVEC_TRANSPOSED);
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceFileSectionCount(int type) {
+    bool autoScaling = (kFlags & BEAGLE_FLAG_SCALING_AUTO) != 0;
+    switch (type) {
+        case SECTION_PATTERN_PARTITIONS:     return (kPartitionsInitialised ? 1 : 0);
+        case SECTION_PATTERNS_NEW_ORDER:     return 1;
+        case SECTION_PATTERN_WEIGHTS:        return 1;
+        case SECTION_CATEGORY_RATES:
+        case SECTION_CATEGORY_WEIGHTS:
+        case SECTION_STATE_FREQUENCIES:      return kEigenDecompCount;
+        case SECTION_EIGEN_DECOMPOSITION:    return kEigenDecompCount * gEigenDecomposition->getStorageCount();
+        case SECTION_TIP_STATES:
+        case SECTION_PARTIALS:               return kBufferCount;
+        case SECTION_SCALE_FACTORS:          return (autoScaling ? 1 : kScaleBufferCount);
+        case SECTION_AUTO_SCALE_FACTORS:     return (autoScaling ? kScaleBufferCount : 0);
+        case SECTION_ACTIVE_SCALING_FACTORS: return (autoScaling ? 1 : 0);
+        case SECTION_TRANSITION_MATRICES:    return kMatrixCount;
+        case SECTION_RATE_MATRICES:          return kEigenDecompCount;
+        default:                             return 0;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void* BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getInstanceFileSection(int type,
+                                                                int index,
+                                                                size_t* outSize,
+                                                                bool allocate) {
+    switch (type) {
+        case SECTION_PATTERN_PARTITIONS:
+            *outSize = sizeof(int) * kPatternCount;
+            return gPatternPartitions;
+        case SECTION_PATTERNS_NEW_ORDER:
+            *outSize = sizeof(int) * kPatternCount;
+            return (kPatternsReordered ? gPatternsNewOrder : NULL);
+        case SECTION_PATTERN_WEIGHTS:
+            *outSize = sizeof(double) * kPatternCount;
+            return gPatternWeights;
+        case SECTION_CATEGORY_RATES:
+            *outSize = sizeof(double) * kCategoryCount;
+            if (gCategoryRates[index] == NULL && allocate)
+                gCategoryRates[index] = (double*) malloc(*outSize);
+            return gCategoryRates[index];
+        case SECTION_CATEGORY_WEIGHTS:
+            *outSize = sizeof(REALTYPE) * kCategoryCount;
+            if (gCategoryWeights[index] == NULL && allocate)
+                gCategoryWeights[index] = (REALTYPE*) malloc(*outSize);
+            return gCategoryWeights[index];
+        case SECTION_STATE_FREQUENCIES:
+            *outSize = sizeof(REALTYPE) * kStateCount;
+            if (gStateFrequencies[index] == NULL && allocate)
+                gStateFrequencies[index] = (REALTYPE*) malloc(*outSize);
+            return gStateFrequencies[index];
+        case SECTION_EIGEN_DECOMPOSITION: {
+            int storageCount = gEigenDecomposition->getStorageCount();
+            if (allocate) // about to be overwritten
+                gEigenDecomposition->clearMatrixCache(index / storageCount);
+            int length;
+            REALTYPE* storage = gEigenDecomposition->getStorage(index / storageCount, index % storageCount, &length);
+            *outSize = sizeof(REALTYPE) * length;
+            return storage;
+        }
+        case SECTION_TIP_STATES:
+            *outSize = sizeof(TipState) * kPaddedPatternCount;
+            if ((gTipStates[index] == NULL || gTipStatesExternal[index]) && allocate && index < kTipCount) {
+                gTipStates[index] = (TipState*) mallocAligned(*outSize);
+                gTipStatesExternal[index] = false;
+            }
+            if (allocate && index < kTipCount) {
+                kInvariantSitesDirty = true;
+                clearMissingBlocks(index, 0, kPatternCount);
+            }
+            return gTipStates[index];
+        case SECTION_PARTIALS:
+            *outSize = sizeof(REALTYPE) * kPartialsSize;
+            if (gPartials[index] == NULL && allocate)
+                gPartials[index] = (REALTYPE*) mallocAligned(*outSize);
+            if (allocate) {
+                if (index < kTipCount)
+                    kInvariantSitesDirty = true;
+                clearMissingBlocks(index, 0, kPatternCount);
+            }
+            return gPartials[index];
+        case SECTION_SCALE_FACTORS:
+            *outSize = sizeof(REALTYPE) * kPaddedPatternCount;
+            return gScaleBuffers[index];
+        case SECTION_AUTO_SCALE_FACTORS:
+            *outSize = sizeof(signed short) * kPaddedPatternCount;
+            return gAutoScaleBuffers[index];
+        case SECTION_ACTIVE_SCALING_FACTORS:
+            *outSize = sizeof(int) * kInternalPartialsBufferCount;
+            return gActiveScalingFactors;
+        case SECTION_TRANSITION_MATRICES:
+            *outSize = sizeof(REALTYPE) * kMatrixSize * kCategoryCount;
+            return gTransitionMatrices[index];
+        case SECTION_RATE_MATRICES:
+            // only saved from here; loadInstance sets them through setRateMatrix
+            *outSize = sizeof(double) * kStateCount * kStateCount;
+            if (gRateMatrixExponential == NULL || allocate)
+                return NULL;
+            return (void*) gRateMatrixExponential->getRateMatrix(index);
+        default:
+            return NULL;
+    }
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStates(int tipIndex,
                                 const int* inStates) {
     if (tipIndex < 0 || tipIndex >= kTipCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
-    gTipStates[tipIndex] = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
+    if (kStateCount > BEAGLE_CPU_MAX_PACKED_STATE_COUNT)
+        return setTipStatesAsPartials(tipIndex, inStates);
+    if (gTipStates[tipIndex] == NULL || gTipStatesExternal[tipIndex]) {
+        gTipStates[tipIndex] = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
+        gTipStatesExternal[tipIndex] = false;
+    }
     // TODO: What if this throws a memory full error?
     for (int j = 0; j < kPatternCount; j++) {
-        gTipStates[tipIndex][j] = (inStates[j] < kStateCount ? inStates[j] : kStateCount);
+        gTipStates[tipIndex][j] = (TipState) (inStates[j] < kStateCount ? inStates[j] : kStateCount);
     }
     for (int j = kPatternCount; j < kPaddedPatternCount; j++) {
         gTipStates[tipIndex][j] = kStateCount;
     }
+    kInvariantSitesDirty = true;
+    findMissingBlocks(tipIndex);
 
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStatesExternal(int tipIndex,
+                                                            const unsigned char* inStates) {
+    if (tipIndex < 0 || tipIndex >= kTipCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // the caller's codes can only be used as they are when they need no padding or clamping
+    bool useDirectly = (kStateCount <= BEAGLE_CPU_MAX_PACKED_STATE_COUNT &&
+                        kPaddedPatternCount == kPatternCount && !kPatternsReordered);
+    for (int j = 0; j < kPatternCount && useDirectly; j++) {
+        if (inStates[j] > kStateCount)
+            useDirectly = false;
+    }
+    if (!useDirectly) {
+        std::vector<int> states(inStates, inStates + kPatternCount);
+        return setTipStates(tipIndex, &states[0]);
+    }
+
+    if (gTipStates[tipIndex] != NULL && !gTipStatesExternal[tipIndex])
+        free(gTipStates[tipIndex]);
+    gTipStates[tipIndex] = (TipState*) inStates;
+    gTipStatesExternal[tipIndex] = true;
+    kInvariantSitesDirty = true;
+    findMissingBlocks(tipIndex);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipStatesAsPartials(int tipIndex,
+                                                              const int* inStates) {
+    // states beyond one byte are expanded to partials, with all states allowed for missing data
+    double* tipPartials = (double*) malloc(sizeof(double) * kPatternCount * kStateCount);
+    if (tipPartials == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    for (int j = 0; j < kPatternCount; j++) {
+        bool missing = (inStates[j] < 0 || inStates[j] >= kStateCount);
+        for (int k = 0; k < kStateCount; k++)
+            tipPartials[j * kStateCount + k] = (missing || inStates[j] == k ? 1.0 : 0.0);
+    }
+    int returnCode = setTipPartials(tipIndex, tipPartials);
+    free(tipPartials);
+
+    return returnCode;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
                                   const double* inPartials) {
@@ -523,6 +1165,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
             return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
 
+    kInvariantSitesDirty = true;
+
     const double* inPartialsOffset;
     REALTYPE* tmpRealPartialsOffset = gPartials[tipIndex];
     for (int l = 0; l < kCategoryCount; l++) {
@@ -538,6 +1182,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setTipPartials(int tipIndex,
         }
     }
 
+    findMissingBlocks(tipIndex);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -552,6 +1198,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
             return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
     
+    if (bufferIndex < kTipCount)
+        kInvariantSitesDirty = true;
+
     const double* inPartialsOffset = inPartials;
     REALTYPE* tmpRealPartialsOffset = gPartials[bufferIndex];
     for (int l = 0; l < kCategoryCount; l++) {
@@ -566,6 +1215,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPartials(int bufferIndex,
         }
     }
 
+    findMissingBlocks(bufferIndex);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -771,6 +1422,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setPatternPartitions(int partitionCount,
 
     kPartitionsInitialised = true;
 
+    // blocks follow the partitions, so a gene missing for a taxon is found here
+    resetMissingBlocks();
+
     return returnCode;
 }
 
@@ -789,6 +1443,22 @@ BEAGLE_CPU_TEMPLATE
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setInvariantSites(double proportionInvariant,
+                                                         int stateFrequenciesIndex) {
+    if (stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (!(proportionInvariant >= 0.0 && proportionInvariant < 1.0))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    kProportionInvariant = proportionInvariant;
+    kInvariantFrequenciesIndex = stateFrequenciesIndex;
+    // external tip states may have been changed in place
+    kInvariantSitesDirty = true;
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setCategoryWeights(int categoryWeightsIndex,
                                                  const double* inCategoryWeights) {
@@ -908,103 +1578,222 @@ if (T_PAD != 0) {
 //---TODO: Epoch model---//
 ///////////////////////////
 
-//TODO: move to EigenDecompositionSquare
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::multiplyTransitionMatrices(const REALTYPE* first,
+                                                                   const REALTYPE* second,
+                                                                   REALTYPE* result) {
+    // i-k-j order keeps the inner loop on contiguous rows of the second matrix so that it
+    // vectorizes; four result rows share each of those row loads. Every entry still sums
+    // over k in increasing order, as the plain triple loop did.
+    const int rowBlock = 4;
+
+    for (int l = 0; l < kCategoryCount; l++) {
+        const REALTYPE* A = first + l * kMatrixSize;
+        const REALTYPE* B = second + l * kMatrixSize;
+        REALTYPE* C = result + l * kMatrixSize;
+
+        int i = 0;
+        for (; i + rowBlock <= kStateCount; i += rowBlock) {
+            const REALTYPE* A0 = A + kTransPaddedStateCount * i;
+            const REALTYPE* A1 = A0 + kTransPaddedStateCount;
+            const REALTYPE* A2 = A1 + kTransPaddedStateCount;
+            const REALTYPE* A3 = A2 + kTransPaddedStateCount;
+            REALTYPE* C0 = C + kTransPaddedStateCount * i;
+            REALTYPE* C1 = C0 + kTransPaddedStateCount;
+            REALTYPE* C2 = C1 + kTransPaddedStateCount;
+            REALTYPE* C3 = C2 + kTransPaddedStateCount;
+
+            for (int j = 0; j < kStateCount; j++) {
+                C0[j] = 0.0;
+                C1[j] = 0.0;
+                C2[j] = 0.0;
+                C3[j] = 0.0;
+            }
+
+            for (int k = 0; k < kStateCount; k++) {
+                const REALTYPE a0 = A0[k];
+                const REALTYPE a1 = A1[k];
+                const REALTYPE a2 = A2[k];
+                const REALTYPE a3 = A3[k];
+                const REALTYPE* Bk = B + kTransPaddedStateCount * k;
+                for (int j = 0; j < kStateCount; j++) {
+                    const REALTYPE b = Bk[j];
+                    C0[j] += a0 * b;
+                    C1[j] += a1 * b;
+                    C2[j] += a2 * b;
+                    C3[j] += a3 * b;
+                }
+            }
+
+            if (T_PAD != 0) {
+                C0[kStateCount] = 1.0;
+                C1[kStateCount] = 1.0;
+                C2[kStateCount] = 1.0;
+                C3[kStateCount] = 1.0;
+            }
+        }
+
+        for (; i < kStateCount; i++) {
+            const REALTYPE* Ai = A + kTransPaddedStateCount * i;
+            REALTYPE* Ci = C + kTransPaddedStateCount * i;
+
+            for (int j = 0; j < kStateCount; j++)
+                Ci[j] = 0.0;
+
+            for (int k = 0; k < kStateCount; k++) {
+                const REALTYPE a = Ai[k];
+                const REALTYPE* Bk = B + kTransPaddedStateCount * k;
+                for (int j = 0; j < kStateCount; j++)
+                    Ci[j] += a * Bk[j];
+            }
+
+            if (T_PAD != 0)
+                Ci[kStateCount] = 1.0;
+        }
+    }
+}
 
 BEAGLE_CPU_TEMPLATE
-int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* firstIndices,
-        const int* secondIndices,
-        const int* resultIndices,
-        int matrixCount) {
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveChainRange(const int* matrixIndices,
+                                                           const int* chainOffsets,
+                                                           const int* resultIndices,
+                                                           int chainStart,
+                                                           int chainCount,
+                                                           int chainStride,
+                                                           REALTYPE* scratch) {
+    const int matrixSetSize = kMatrixSize * kCategoryCount;
+    REALTYPE* current = scratch;
+    REALTYPE* next = scratch + matrixSetSize;
+
+    for (int u = chainStart; u < chainCount; u += chainStride) {
+        const int* chain = matrixIndices + chainOffsets[u];
+        const int length = chainOffsets[u + 1] - chainOffsets[u];
+
+        // products go through scratch, so the result may be any matrix of its own chain
+        if (length == 1) {
+            memcpy(current, gTransitionMatrices[chain[0]], sizeof(REALTYPE) * matrixSetSize);
+        } else {
+            multiplyTransitionMatrices(gTransitionMatrices[chain[0]],
+                                       gTransitionMatrices[chain[1]],
+                                       current);
+            for (int m = 2; m < length; m++) {
+                multiplyTransitionMatrices(current, gTransitionMatrices[chain[m]], next);
+                std::swap(current, next);
+            }
+        }
+
+        memcpy(gTransitionMatrices[resultIndices[u]], current, sizeof(REALTYPE) * matrixSetSize);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrixChains(const int* matrixIndices,
+                                                                       const int* chainLengths,
+                                                                       const int* resultIndices,
+                                                                       int chainCount) {
 
 #ifdef BEAGLE_DEBUG_FLOW
-    fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrices \n");
+    fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrixChains \n");
 #endif
 
-    int returnCode = BEAGLE_SUCCESS;
+    if (chainCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    for (int u = 0; u < matrixCount; u++) {
+    std::vector<int> chainOffsets(chainCount + 1);
+    chainOffsets[0] = 0;
+    for (int u = 0; u < chainCount; u++) {
+        if (chainLengths[u] < 1)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (resultIndices[u] < 0 || resultIndices[u] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        chainOffsets[u + 1] = chainOffsets[u] + chainLengths[u];
+    }
+    for (int m = 0; m < chainOffsets[chainCount]; m++) {
+        if (matrixIndices[m] < 0 || matrixIndices[m] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
 
-        if(firstIndices[u] == resultIndices[u] || secondIndices[u] == resultIndices[u]) {
+    const int workerCount = (kThreadingEnabled && chainCount > 1 ? kNumThreads : 1);
+    const int scratchSize = 2 * kMatrixSize * kCategoryCount;
+
+    if (kConvolutionTmpCount < workerCount) {
+        REALTYPE* scratch = (REALTYPE*) malloc(sizeof(REALTYPE) * scratchSize * workerCount);
+        if (scratch == NULL)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        if (gConvolutionTmp)
+            free(gConvolutionTmp);
+        gConvolutionTmp = scratch;
+        kConvolutionTmpCount = workerCount;
+    }
+
+    if (workerCount == 1) {
+        convolveChainRange(matrixIndices, &chainOffsets[0], resultIndices, 0, chainCount, 1,
+                           gConvolutionTmp);
+    } else {
+        // chains are independent apart from shared results, which the caller must avoid
+        std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
+        for (int i = 0; i < workerCount; i++) {
+            std::packaged_task<void()> threadTask(
+                std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveChainRange, this,
+                          matrixIndices,
+                          (const int*) &chainOffsets[0],
+                          resultIndices,
+                          i,
+                          chainCount,
+                          workerCount,
+                          gConvolutionTmp + i * scratchSize));
+
+            gFutures[i] = threadTask.get_future();
+            threadData* td = &gThreads[i];
+
+            std::unique_lock<std::mutex> l(td->m);
+            td->jobs.push(std::move(threadTask));
+            l.unlock();
+
+            gThreads[i].cv.notify_one();
+        }
+
+        for (int i = 0; i < workerCount; i++) {
+            gFutures[i].wait();
+        }
+
+        if (kStatisticsEnabled.load(std::memory_order_relaxed))
+            accumulateThreadIdleTime(parallelStartTime);
+    }
 
 #ifdef BEAGLE_DEBUG_FLOW
-            fprintf(stderr, "In-place convolution is not allowed \n");
+    fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrixChains \n");
 #endif
 
-            returnCode = BEAGLE_ERROR_OUT_OF_RANGE;
-            break;
+    return BEAGLE_SUCCESS;
+}
 
-        }//END: overwrite check
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::convolveTransitionMatrices(const int* firstIndices,
+        const int* secondIndices,
+        const int* resultIndices,
+        int matrixCount) {
 
-        REALTYPE* C = gTransitionMatrices[resultIndices[u]];
-        REALTYPE* A = gTransitionMatrices[firstIndices[u]];
-        REALTYPE* B = gTransitionMatrices[secondIndices[u]];
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t Entering BeagleCPUImpl::convolveTransitionMatrices \n");
+#endif
 
-        int n = 0;
-        for (int l = 0; l < kCategoryCount; l++) {
+    if (matrixCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-            for (int i = 0; i < kStateCount; i++) {
-                for (int j = 0; j < kStateCount; j++) {
+    // each pair is a chain of two
+    std::vector<int> pairIndices(2 * matrixCount);
+    std::vector<int> pairLengths(matrixCount, 2);
+    for (int u = 0; u < matrixCount; u++) {
+        pairIndices[2 * u    ] = firstIndices[u];
+        pairIndices[2 * u + 1] = secondIndices[u];
+    }
 
-                    REALTYPE sum = 0.0;
-                    for (int k = 0; k < kStateCount; k++) {
-                        sum += A[k + kTransPaddedStateCount * i] * B[j + kTransPaddedStateCount * k];
-                    }
-//                  printf("%.30f %.30f %d: \n", C[n], sum, l);
-                    C[n] = sum;
-                    n++;
-
-                }//END: j loop
-
-                if (T_PAD != 0) {
-
-                    //                      A[n] = 1.0;
-                    //                      B[n] = 1.0;
-                    C[n] = 1.0;
-
-                    n += T_PAD;
-
-                }//END: padding check
-
-            }//END: i loop
-
-            A += kStateCount * kTransPaddedStateCount;
-            B += kStateCount * kTransPaddedStateCount;
-
-
-            ///////////////
-            //      printf("rate category: %d \n", l);
-            //
-            //      printf("A:");
-            //      for (int i = 0; i < kStateCount; i++) {
-            //          printf("| ");
-            //          for (int j = 0; j < kStateCount; j++)
-            //          printf("%f ", A[j + i * kTransPaddedStateCount]);
-            //          printf("|\n");
-            //      }
-            //      printf("\n");
-            //
-            //      printf("A:");
-            //      for (int i = 0; i < kStateCount; i++) {
-            //          printf("| ");
-            //          for (int j = 0; j < kStateCount; j++)
-            //          printf("%f ", B[j + i * kTransPaddedStateCount]);
-            //          printf("|\n");
-            //      }
-            //      printf("\n");
-            //
-//                      printf("C: \n");
-//                      for (int i = 0; i < kStateCount; i++) {
-//                          printf("| ");
-//                          for (int j = 0; j < kTransPaddedStateCount; j++)
-//                          printf("%.20f ", C[j + i * kTransPaddedStateCount]);
-//                          printf("|\n");
-//                      }
-//                      printf("\n");
-            ////////////////
-
-        }//END: rates loop
-
-    }//END: u loop
+    int returnCode = BEAGLE_SUCCESS;
+    if (matrixCount > 0)
+        returnCode = convolveTransitionMatrixChains(&pairIndices[0], &pairLengths[0],
+                                                    resultIndices, matrixCount);
 
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t Leaving BeagleCPUImpl::convolveTransitionMatrices \n");
@@ -1067,6 +1856,97 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesWithMultipleModel
 }
 
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::setRateMatrix(int rateMatrixIndex,
+                                                     const double* inRateMatrix) {
+    if (rateMatrixIndex < 0 || rateMatrixIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    try {
+        if (gRateMatrixExponential == NULL)
+            gRateMatrixExponential = new RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>(kEigenDecompCount,
+                                                                                         kStateCount);
+
+        if (!gRateMatrixExponential->setRateMatrix(rateMatrixIndex, inRateMatrix))
+            return BEAGLE_ERROR_GENERAL;
+    }
+    catch (std::bad_alloc&) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateTransitionMatricesFromRateMatrix(int rateMatrixIndex,
+                                                                              const int* probabilityIndices,
+                                                                              const double* edgeLengths,
+                                                                              int count) {
+    if (rateMatrixIndex < 0 || rateMatrixIndex >= kEigenDecompCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    for (int i = 0; i < count; i++) {
+        if (probabilityIndices[i] < 0 || probabilityIndices[i] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    if (gRateMatrixExponential == NULL || !gRateMatrixExponential->isRateMatrixSet(rateMatrixIndex) ||
+        gCategoryRates[0] == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    try {
+        // the powers shared by all edges are built before the edges are split over threads
+        gRateMatrixExponential->preparePowers(rateMatrixIndex, edgeLengths, gCategoryRates[0],
+                                              kCategoryCount, count);
+
+        if (kThreadingEnabled && count > 1) {
+            const int threadCount = std::min(kNumThreads, count);
+
+            std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < threadCount; i++) {
+                std::packaged_task<void()> threadTask(
+                    std::bind(&RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices,
+                              gRateMatrixExponential,
+                              rateMatrixIndex,
+                              probabilityIndices,
+                              edgeLengths,
+                              (const double*) gCategoryRates[0],
+                              kCategoryCount,
+                              gTransitionMatrices,
+                              (i * count) / threadCount,
+                              ((i + 1) * count) / threadCount));
+
+                gFutures[i] = threadTask.get_future();
+                threadData* td = &gThreads[i];
+
+                std::unique_lock<std::mutex> l(td->m);
+                td->jobs.push(std::move(threadTask));
+                l.unlock();
+
+                gThreads[i].cv.notify_one();
+            }
+
+            for (int i = 0; i < threadCount; i++) {
+                gFutures[i].wait();
+            }
+
+            if (kStatisticsEnabled.load(std::memory_order_relaxed))
+                accumulateThreadIdleTime(parallelStartTime);
+        } else {
+            gRateMatrixExponential->updateTransitionMatrices(rateMatrixIndex, probabilityIndices, edgeLengths,
+                                                             gCategoryRates[0], kCategoryCount,
+                                                             gTransitionMatrices, 0, count);
+        }
+    }
+    catch (std::bad_alloc&) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
                                                       int count,
@@ -1074,6 +1954,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartials(const int* operations,
 
     int returnCode = BEAGLE_ERROR_GENERAL;
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        countOperationStatistics(operations, count, false);
+
     if (kAutoPartitioningEnabled) {
         autoPartitionPartialsOperations(operations,
                                         gAutoPartitionOperations,
@@ -1100,6 +1983,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updatePartialsByPartition(const int* oper
     
     int returnCode = BEAGLE_ERROR_GENERAL;
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        countOperationStatistics(operations, count, true);
+
     if (kThreadingEnabled) {
         returnCode = upPartialsByPartitionAsync(operations,
                                                 count);            
@@ -1150,6 +2036,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByPartitionAsync(const int* ope
         gThreadOpCounts[t]++;
     }
 
+    std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
     for (int i=0; i<kNumThreads; i++) {
         std::packaged_task<void()> threadTask(
             std::bind(&BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials, this,
@@ -1172,6 +2060,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartialsByPartitionAsync(const int* ope
         gFutures[i].wait();
     }
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        accumulateThreadIdleTime(parallelStartTime);
+
     return BEAGLE_SUCCESS;
 }
 
@@ -1219,8 +2110,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
         const REALTYPE* partials1 = gPartials[child1Index];
         const REALTYPE* partials2 = gPartials[child2Index];
 
-        const int* tipStates1 = gTipStates[child1Index];
-        const int* tipStates2 = gTipStates[child2Index];
+        const TipState* tipStates1 = gTipStates[child1Index];
+        const TipState* tipStates2 = gTipStates[child2Index];
 
         const REALTYPE* matrices1 = gTransitionMatrices[child1TransMatIndex];
         const REALTYPE* matrices2 = gTransitionMatrices[child2TransMatIndex];
@@ -1270,8 +2161,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                                                  matrices2, scalingFactors, startPattern, endPattern);
                 } else {
                     // First compute without any scaling
-                    calcStatesStates(destPartials, tipStates1, matrices1, tipStates2, matrices2,
-                                     startPattern, endPattern);
+                    calcPartialsSkippingMissing(parIndex, child1Index, matrices1, child2Index, matrices2,
+                                                startPattern, endPattern);
                     if (rescale == 1) { // Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -1285,8 +2176,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                     calcStatesPartialsFixedScaling(destPartials, tipStates1, matrices1, partials2,
                                                    matrices2, scalingFactors, startPattern, endPattern);
                 } else {
-                    calcStatesPartials(destPartials, tipStates1, matrices1, partials2, matrices2,
-                                       startPattern, endPattern);
+                    calcPartialsSkippingMissing(parIndex, child1Index, matrices1, child2Index, matrices2,
+                                                startPattern, endPattern);
                     if (rescale == 1) { // Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -1302,8 +2193,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                     calcStatesPartialsFixedScaling(destPartials,tipStates2,matrices2,partials1,matrices1,
                                                    scalingFactors, startPattern, endPattern);
                 } else {
-                    calcStatesPartials(destPartials, tipStates2, matrices2, partials1, matrices1,
-                                       startPattern, endPattern);
+                    calcPartialsSkippingMissing(parIndex, child1Index, matrices1, child2Index, matrices2,
+                                                startPattern, endPattern);
                     if (rescale == 1) {// Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -1324,8 +2215,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                     calcPartialsPartialsFixedScaling(destPartials,partials1,matrices1,partials2,
                                                      matrices2,scalingFactors,startPattern,endPattern);
                 } else {
-                    calcPartialsPartials(destPartials, partials1, matrices1, partials2, matrices2,
-                                         startPattern, endPattern);
+                    calcPartialsSkippingMissing(parIndex, child1Index, matrices1, child2Index, matrices2,
+                                                startPattern, endPattern);
                     if (rescale == 1) {// Recompute scaleFactors
                         if (byPartition) {
                             rescalePartialsByPartition(destPartials,scalingFactors,cumulativeScaleBuffer,0, currentPartition);
@@ -1336,6 +2227,11 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
                 }
             }
         }
+
+        if (rescale == 0 || rescale == 2) {
+            // scaled partials are not all one, whatever the children
+            clearMissingBlocks(parIndex, startPattern, endPattern);
+        }
         
         if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
             int parScalingIndex = parIndex - kTipCount;
@@ -1367,6 +2263,162 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::upPartials(bool byPartition,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcUnscaledPartials(REALTYPE* destP,
+                                                            const TipState* tipStates1,
+                                                            const REALTYPE* partials1,
+                                                            const REALTYPE* matrices1,
+                                                            const TipState* tipStates2,
+                                                            const REALTYPE* partials2,
+                                                            const REALTYPE* matrices2,
+                                                            int startPattern,
+                                                            int endPattern) {
+    if (tipStates1 != NULL) {
+        if (tipStates2 != NULL)
+            calcStatesStates(destP, tipStates1, matrices1, tipStates2, matrices2,
+                             startPattern, endPattern);
+        else
+            calcStatesPartials(destP, tipStates1, matrices1, partials2, matrices2,
+                               startPattern, endPattern);
+    } else {
+        if (tipStates2 != NULL)
+            calcStatesPartials(destP, tipStates2, matrices2, partials1, matrices1,
+                               startPattern, endPattern);
+        else
+            calcPartialsPartials(destP, partials1, matrices1, partials2, matrices2,
+                                 startPattern, endPattern);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcPartialsSkippingMissing(int destIndex,
+                                                                   int child1Index,
+                                                                   const REALTYPE* matrices1,
+                                                                   int child2Index,
+                                                                   const REALTYPE* matrices2,
+                                                                   int startPattern,
+                                                                   int endPattern) {
+    REALTYPE* destP = gPartials[destIndex];
+    const TipState* tipStates1 = gTipStates[child1Index];
+    const TipState* tipStates2 = gTipStates[child2Index];
+    const REALTYPE* partials1 = gPartials[child1Index];
+    const REALTYPE* partials2 = gPartials[child2Index];
+
+    unsigned char* destMissing = &gMissingBlocks[(size_t) destIndex * kMissingBlockCount];
+    const unsigned char* missing1 = &gMissingBlocks[(size_t) child1Index * kMissingBlockCount];
+    const unsigned char* missing2 = &gMissingBlocks[(size_t) child2Index * kMissingBlockCount];
+
+    // the first pattern of the first missing block is computed by the kernels in place and
+    // copied to the rest, so skipped patterns hold exactly what the kernels would have written
+    int sourcePattern = -1;
+    bool missingPartialsAreOne = false;
+
+    int block = (int) (std::upper_bound(gMissingBlockStarts.begin(), gMissingBlockStarts.end(), startPattern) -
+                       gMissingBlockStarts.begin()) - 1;
+    int runStart = startPattern;
+    for (; block < kMissingBlockCount && gMissingBlockStarts[block] < endPattern; block++) {
+        const int blockStart = gMissingBlockStarts[block];
+        const int blockEnd = gMissingBlockStarts[block + 1];
+        if (blockStart < startPattern || blockEnd > endPattern || !missing1[block] || !missing2[block]) {
+            destMissing[block] = 0;
+            continue;
+        }
+
+        int copyStart = blockStart;
+        if (sourcePattern < 0) {
+            calcUnscaledPartials(destP, tipStates1, partials1, matrices1, tipStates2, partials2, matrices2,
+                                 runStart, blockStart + 1);
+            sourcePattern = blockStart;
+            copyStart = blockStart + 1;
+
+            // only partials that are exactly one keep the parent missing for the next operation
+            missingPartialsAreOne = true;
+            for (int l = 0; l < kCategoryCount && missingPartialsAreOne; l++) {
+                const REALTYPE* source = destP + ((size_t) l * kPaddedPatternCount + sourcePattern) * kPartialsPaddedStateCount;
+                for (int i = 0; i < kStateCount; i++) {
+                    if (source[i] != 1.0)
+                        missingPartialsAreOne = false;
+                }
+            }
+        } else if (runStart < blockStart) {
+            calcUnscaledPartials(destP, tipStates1, partials1, matrices1, tipStates2, partials2, matrices2,
+                                 runStart, blockStart);
+        }
+
+        for (int l = 0; l < kCategoryCount; l++) {
+            const REALTYPE* source = destP + ((size_t) l * kPaddedPatternCount + sourcePattern) * kPartialsPaddedStateCount;
+            REALTYPE* destPtr = destP + ((size_t) l * kPaddedPatternCount + copyStart) * kPartialsPaddedStateCount;
+            for (int k = copyStart; k < blockEnd; k++) {
+                for (int i = 0; i < kStateCount; i++)
+                    destPtr[i] = source[i];
+                destPtr += kPartialsPaddedStateCount;
+            }
+        }
+
+        destMissing[block] = (missingPartialsAreOne ? 1 : 0);
+        runStart = blockEnd;
+    }
+
+    if (runStart < endPattern)
+        calcUnscaledPartials(destP, tipStates1, partials1, matrices1, tipStates2, partials2, matrices2,
+                             runStart, endPattern);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::resetMissingBlocks() {
+    const int partitionCount = (kPartitionsInitialised ? kPartitionCount : 1);
+
+    gMissingBlockStarts.clear();
+    for (int p = 0; p < partitionCount; p++) {
+        const int startPattern = (kPartitionsInitialised ? gPatternPartitionsStartPatterns[p] : 0);
+        const int endPattern = (kPartitionsInitialised ? gPatternPartitionsStartPatterns[p + 1] : kPatternCount);
+        for (int k = startPattern; k < endPattern; k += BEAGLE_CPU_MISSING_BLOCK_SIZE)
+            gMissingBlockStarts.push_back(k);
+    }
+    gMissingBlockStarts.push_back(kPatternCount);
+    kMissingBlockCount = (int) gMissingBlockStarts.size() - 1;
+
+    // partials computed under the old layout are recomputed before they are skipped
+    gMissingBlocks.assign((size_t) kBufferCount * kMissingBlockCount, 0);
+    for (int i = 0; i < kTipCount; i++)
+        findMissingBlocks(i);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::findMissingBlocks(int bufferIndex) {
+    unsigned char* missing = &gMissingBlocks[(size_t) bufferIndex * kMissingBlockCount];
+    const TipState* tipStates = gTipStates[bufferIndex];
+    const REALTYPE* partials = gPartials[bufferIndex];
+
+    for (int block = 0; block < kMissingBlockCount; block++) {
+        bool allMissing = (tipStates != NULL || partials != NULL);
+        for (int k = gMissingBlockStarts[block]; k < gMissingBlockStarts[block + 1] && allMissing; k++) {
+            if (tipStates != NULL) {
+                allMissing = (tipStates[k] >= kStateCount);
+            } else {
+                for (int l = 0; l < kCategoryCount && allMissing; l++) {
+                    const REALTYPE* patternPartials = partials +
+                        ((size_t) l * kPaddedPatternCount + k) * kPartialsPaddedStateCount;
+                    for (int i = 0; i < kStateCount && allMissing; i++)
+                        allMissing = (patternPartials[i] == 1.0);
+                }
+            }
+        }
+        missing[block] = (allMissing ? 1 : 0);
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::clearMissingBlocks(int bufferIndex,
+                                                          int startPattern,
+                                                          int endPattern) {
+    unsigned char* missing = &gMissingBlocks[(size_t) bufferIndex * kMissingBlockCount];
+    for (int block = 0; block < kMissingBlockCount; block++) {
+        if (gMissingBlockStarts[block] < endPattern && gMissingBlockStarts[block + 1] > startPattern)
+            missing[block] = 0;
+    }
+}
+
 
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::waitForPartials(const int* destinationPartials,
@@ -1383,6 +2435,8 @@ BEAGLE_CPU_TEMPLATE
                                                              int count,
                                                              double* outSumLogLikelihood) {
 
+    updateInvariantSites();
+
     if (count == 1) {
         // We treat this as a special case so that we don't have convoluted logic
         //      at the end of the loop over patterns
@@ -1440,6 +2494,8 @@ BEAGLE_CPU_TEMPLATE
 
     int returnCode = BEAGLE_SUCCESS;
 
+    updateInvariantSites();
+
     if (count == 1) {
         if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
             returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
@@ -1454,18 +2510,83 @@ BEAGLE_CPU_TEMPLATE
 
             *outSumLogLikelihood = 0.0;
 
-            for (int i = 0; i < partitionCount; i++) {
-                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
-            }
+            for (int i = 0; i < partitionCount; i++) {
+                *outSumLogLikelihood += outSumLogLikelihoodByPartition[i];
+            }
+
+            if (*outSumLogLikelihood != *outSumLogLikelihood) 
+                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+        }
+    } else {
+        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    return returnCode;
+}
+
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateRootLogLikelihoodsAsync(const int* bufferIndices,
+                                                                  const int* categoryWeightsIndices,
+                                                                  const int* stateFrequenciesIndices,
+                                                                  const int* cumulativeScaleIndices,
+                                                                  const int* partitionIndices,
+                                                                  int partitionCount) {
+
+    if (partitionCount < 1 || (partitionIndices == NULL && partitionCount != 1))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-            if (*outSumLogLikelihood != *outSumLogLikelihood) 
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+    if (partitionCount > kAsyncLogLikelihoodsSize) {
+        if (gAsyncLogLikelihoods)
+            free(gAsyncLogLikelihoods);
+        gAsyncLogLikelihoods = (double*) malloc(sizeof(double) * partitionCount);
+        if (gAsyncLogLikelihoods == NULL) {
+            kAsyncLogLikelihoodsSize = 0;
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
         }
+        kAsyncLogLikelihoodsSize = partitionCount;
+    }
+
+    kAsyncLogLikelihoodsCount = 0;
+
+    int returnCode;
+    if (partitionIndices == NULL) {
+        returnCode = calculateRootLogLikelihoods(bufferIndices, categoryWeightsIndices,
+                                                 stateFrequenciesIndices, cumulativeScaleIndices,
+                                                 1, &kAsyncSumLogLikelihood);
+        gAsyncLogLikelihoods[0] = kAsyncSumLogLikelihood;
     } else {
-        returnCode = BEAGLE_ERROR_NO_IMPLEMENTATION;
+        returnCode = calculateRootLogLikelihoodsByPartition(bufferIndices, categoryWeightsIndices,
+                                                            stateFrequenciesIndices, cumulativeScaleIndices,
+                                                            partitionIndices, partitionCount, 1,
+                                                            gAsyncLogLikelihoods, &kAsyncSumLogLikelihood);
     }
 
-    return returnCode;
+    // floating-point problems are reported when the result is retrieved, as on devices
+    if (returnCode != BEAGLE_SUCCESS && returnCode != BEAGLE_ERROR_FLOATING_POINT)
+        return returnCode;
+
+    kAsyncLogLikelihoodsCount = partitionCount;
+    kAsyncReturnCode = returnCode;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+    int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::getRootLogLikelihoodsAsync(int blocking,
+                                                            double* outSumLogLikelihoodByPartition,
+                                                            double* outSumLogLikelihood) {
+
+    if (kAsyncLogLikelihoodsCount == 0)
+        return BEAGLE_ERROR_GENERAL;
+
+    if (outSumLogLikelihoodByPartition != NULL) {
+        for (int i = 0; i < kAsyncLogLikelihoodsCount; i++)
+            outSumLogLikelihoodByPartition[i] = gAsyncLogLikelihoods[i];
+    }
+
+    *outSumLogLikelihood = kAsyncSumLogLikelihood;
+
+    return kAsyncReturnCode;
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -1481,6 +2602,9 @@ BEAGLE_CPU_TEMPLATE
     int partitionsPerThreadFloor = partitionCount / kNumThreads;
     int partitionsRemainder = partitionCount % kNumThreads;
     int currentPartitionIndex = 0;
+
+    std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
     for (int i=0; i<kNumThreads; i++) {
         int partitionCountThread = partitionsPerThreadFloor;
         if (partitionsRemainder) {
@@ -1511,6 +2635,9 @@ BEAGLE_CPU_TEMPLATE
         gFutures[i].wait();
     }
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        accumulateThreadIdleTime(parallelStartTime);
+
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -1522,6 +2649,8 @@ BEAGLE_CPU_TEMPLATE
                                                         const int* partitionIndices,
                                                         double* outSumLogLikelihoodByPartition) {
 
+    std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
     for (int i=0; i<kNumThreads; i++) {
 
         std::packaged_task<void()> threadTask(
@@ -1546,6 +2675,9 @@ BEAGLE_CPU_TEMPLATE
         gFutures[i].wait();
     }
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        accumulateThreadIdleTime(parallelStartTime);
+
 }
 
 
@@ -1652,6 +2784,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bu
             outLogLikelihoodsTmp[i] += maxScaleFactor[i];
     }
 
+    addInvariantSiteLikelihoods(0, kPatternCount, 0);
+
     *outSumLogLikelihood = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
         *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
@@ -1664,6 +2798,138 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsMulti(const int* bu
 
 }
 
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::integrateRootSiteLikelihoods(const REALTYPE* rootPartials,
+                                                                  const REALTYPE* wt,
+                                                                  const REALTYPE* freqs,
+                                                                  int startPattern,
+                                                                  int endPattern) {
+    const int categoryStride = kPaddedPatternCount * kPartialsPaddedStateCount;
+    for (int k = startPattern; k < endPattern; k++) {
+        const REALTYPE* partials = &rootPartials[k * kPartialsPaddedStateCount];
+        REALTYPE sum = 0.0;
+        for (int l = 0; l < kCategoryCount; l++) {
+            REALTYPE sumOverI = 0.0;
+            for (int i = 0; i < kStateCount; i++)
+                sumOverI += freqs[i] * partials[i];
+            sum += sumOverI * (REALTYPE) wt[l];
+            partials += categoryStride;
+        }
+        outLogLikelihoodsTmp[k] = sum;
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+double BeagleCPUImpl<BEAGLE_CPU_GENERIC>::sumSiteLogLikelihoods(int startPattern,
+                                                             int endPattern,
+                                                             int scalingFactorsIndex,
+                                                             int derivativeCount) {
+    beagleLogInPlace(&outLogLikelihoodsTmp[startPattern], endPattern - startPattern);
+
+    if (scalingFactorsIndex >= 0) {
+        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
+        for (int k = startPattern; k < endPattern; k++)
+            outLogLikelihoodsTmp[k] += scalingFactors[k];
+    }
+
+    addInvariantSiteLikelihoods(startPattern, endPattern, derivativeCount);
+
+    double sumLogLikelihood = 0.0;
+    for (int k = startPattern; k < endPattern; k++)
+        sumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
+
+    return sumLogLikelihood;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::updateInvariantSites() {
+    if (kProportionInvariant == 0.0 || !kInvariantSitesDirty)
+        return;
+
+    gInvariantPatterns.clear();
+    gInvariantProducts.clear();
+
+    std::vector<double> products(kStateCount);
+    for (int k = 0; k < kPatternCount; k++) {
+        std::fill(products.begin(), products.end(), 1.0);
+        bool possible = true;
+        for (int tip = 0; tip < kTipCount && possible; tip++) {
+            if (gTipStates[tip] != NULL) {
+                // missing data is coded as kStateCount and allows every state
+                const int tipState = gTipStates[tip][k];
+                if (tipState >= kStateCount)
+                    continue;
+                for (int i = 0; i < kStateCount; i++) {
+                    if (i != tipState)
+                        products[i] = 0.0;
+                }
+            } else if (gPartials[tip] != NULL) {
+                const REALTYPE* tipPartials = gPartials[tip] + k * kPartialsPaddedStateCount;
+                for (int i = 0; i < kStateCount; i++)
+                    products[i] *= tipPartials[i];
+            } else {
+                continue;
+            }
+            possible = false;
+            for (int i = 0; i < kStateCount && !possible; i++)
+                possible = (products[i] != 0.0);
+        }
+
+        if (possible) {
+            gInvariantPatterns.push_back(k);
+            gInvariantProducts.insert(gInvariantProducts.end(), products.begin(), products.end());
+        }
+    }
+
+    kInvariantSitesDirty = false;
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::addInvariantSiteLikelihoods(int startPattern,
+                                                                   int endPattern,
+                                                                   int derivativeCount) {
+    if (kProportionInvariant == 0.0 || gStateFrequencies[kInvariantFrequenciesIndex] == NULL)
+        return;
+
+    const REALTYPE* freqs = gStateFrequencies[kInvariantFrequenciesIndex];
+    const int invariantCount = (int) gInvariantPatterns.size();
+    int n = (int) (std::lower_bound(gInvariantPatterns.begin(), gInvariantPatterns.end(), startPattern) -
+                   gInvariantPatterns.begin());
+
+    for (; n < invariantCount && gInvariantPatterns[n] < endPattern; n++) {
+        const int k = gInvariantPatterns[n];
+        const double* products = &gInvariantProducts[(size_t) n * kStateCount];
+        double sum = 0.0;
+        for (int i = 0; i < kStateCount; i++)
+            sum += freqs[i] * products[i];
+        if (sum <= 0.0)
+            continue;
+
+        // log(L_v + p * L_inv), with L_v only known on the log scale
+        const double logVariable = outLogLikelihoodsTmp[k];
+        const double logInvariant = log(kProportionInvariant * sum);
+        double logSite;
+        if (logVariable > logInvariant)
+            logSite = logVariable + log1p(exp(logInvariant - logVariable));
+        else
+            logSite = logInvariant + log1p(exp(logVariable - logInvariant));
+        outLogLikelihoodsTmp[k] = (REALTYPE) logSite;
+
+        if (derivativeCount > 0) {
+            // the invariable component does not depend on edge lengths, so the derivatives of
+            // L_v are rescaled by the share L_v / L of the site likelihood
+            const double share = exp(logVariable - logSite);
+            const double firstDerivative = (share > 0.0 ? outFirstDerivativesTmp[k] : 0.0);
+            outFirstDerivativesTmp[k] = (REALTYPE) (share * firstDerivative);
+            if (derivativeCount > 1) {
+                const double secondDerivative = (share > 0.0 ? outSecondDerivativesTmp[k] : 0.0);
+                outSecondDerivativesTmp[k] = (REALTYPE) (share * (secondDerivative + firstDerivative * firstDerivative) -
+                                                         share * share * firstDerivative * firstDerivative);
+            }
+        }
+    }
+}
+
 BEAGLE_CPU_TEMPLATE
 int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIndex,
                             const int categoryWeightsIndex,
@@ -1676,54 +2942,13 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoods(const int bufferIn
     const REALTYPE* rootPartials = gPartials[bufferIndex];
     const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
     const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
-    int u = 0;
-    int v = 0;
-    for (int k = 0; k < kPatternCount; k++) {
-        for (int i = 0; i < kStateCount; i++) {
-            integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-            u++;
-            v++;
-        }
-        v += P_PAD;
-    }
-    for (int l = 1; l < kCategoryCount; l++) {
-        u = 0;
-        for (int k = 0; k < kPatternCount; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                u++;
-                v++;
-            }
-            v += P_PAD;
-        }
-    }
-    u = 0;
-    for (int k = 0; k < kPatternCount; k++) {
-        REALTYPE sum = 0.0;
-        for (int i = 0; i < kStateCount; i++) {
-            sum += freqs[i] * integrationTmp[u];
-            u++;
-        }
-
-        outLogLikelihoodsTmp[k] = log(sum);
-    }
 
-    if (scalingFactorsIndex >= 0) {
-        const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int i=0; i<kPatternCount; i++) {
-            outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
-        }
-    }
+    integrateRootSiteLikelihoods(rootPartials, wt, freqs, 0, kPatternCount);
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
-    
-    // TODO: merge the three kPatternCount loops above into one
 
     return returnCode;
 }
@@ -1748,50 +2973,11 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcRootLogLikelihoodsByPartition(
         const REALTYPE* wt = gCategoryWeights[categoryWeightsIndices[p]];
         const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndices[p]];
         const int scalingFactorsIndex = cumulativeScaleIndices[p];
-        int u = startPattern * kStateCount;
-        int v = startPattern * kPartialsPaddedStateCount;
-        for (int k = startPattern; k < endPattern; k++) {
-            for (int i = 0; i < kStateCount; i++) {
-                integrationTmp[u] = rootPartials[v] * (REALTYPE) wt[0];
-                u++;
-                v++;
-            }
-            v += P_PAD;
-        }
-        for (int l = 1; l < kCategoryCount; l++) {
-            u = startPattern * kStateCount;
-            v += ((kPatternCount - endPattern) + startPattern) * kPartialsPaddedStateCount;
-            for (int k = startPattern; k < endPattern; k++) {
-                for (int i = 0; i < kStateCount; i++) {
-                    integrationTmp[u] += rootPartials[v] * (REALTYPE) wt[l];
-                    u++;
-                    v++;
-                }
-                v += P_PAD;
-            }
-        }
-        u = startPattern * kStateCount;
-        for (int k = startPattern; k < endPattern; k++) {
-            REALTYPE sum = 0.0;
-            for (int i = 0; i < kStateCount; i++) {
-                sum += freqs[i] * integrationTmp[u];
-                u++;
-            }
-
-            outLogLikelihoodsTmp[k] = log(sum);
-        }
 
-        if (scalingFactorsIndex >= 0) {
-            const REALTYPE* cumulativeScaleFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int i=startPattern; i<endPattern; i++) {
-                outLogLikelihoodsTmp[i] += cumulativeScaleFactors[i];
-            }
-        }
+        integrateRootSiteLikelihoods(rootPartials, wt, freqs, startPattern, endPattern);
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-        }
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                  scalingFactorsIndex);
 
     }
 
@@ -1967,6 +3153,8 @@ BEAGLE_CPU_TEMPLATE
                                                              double* outSumSecondDerivative) {
     // TODO: implement for count > 1
 
+    updateInvariantSites();
+
     if (count == 1) {
         int cumulativeScalingFactorIndex;
         if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
@@ -2064,6 +3252,8 @@ BEAGLE_CPU_TEMPLATE
 
     int returnCode = BEAGLE_SUCCESS;
 
+    updateInvariantSites();
+
     if (count == 1) {
         if (kFlags & BEAGLE_FLAG_SCALING_AUTO) {
             returnCode =  BEAGLE_ERROR_NO_IMPLEMENTATION;
@@ -2147,6 +3337,191 @@ BEAGLE_CPU_TEMPLATE
     return returnCode;
 }
 
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::prepareEdgeProjection(int parentBufferIndex,
+                                                             int childBufferIndex,
+                                                             int eigenIndex,
+                                                             int categoryWeightsIndex,
+                                                             int stateFrequenciesIndex,
+                                                             int cumulativeScaleIndex) {
+    if (parentBufferIndex < 0 || parentBufferIndex >= kBufferCount ||
+        childBufferIndex < 0 || childBufferIndex >= kBufferCount ||
+        eigenIndex < 0 || eigenIndex >= kEigenDecompCount ||
+        categoryWeightsIndex < 0 || categoryWeightsIndex >= kEigenDecompCount ||
+        stateFrequenciesIndex < 0 || stateFrequenciesIndex >= kEigenDecompCount ||
+        (cumulativeScaleIndex != BEAGLE_OP_NONE &&
+         (cumulativeScaleIndex < 0 || cumulativeScaleIndex >= kScaleBufferCount)))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // complex eigenvalues and implicit scale factors are not projected
+    if ((kFlags & BEAGLE_FLAG_EIGEN_COMPLEX) ||
+        (kFlags & BEAGLE_FLAG_SCALING_AUTO) || (kFlags & BEAGLE_FLAG_SCALING_ALWAYS))
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    const TipState* parentStates = (parentBufferIndex < kTipCount ? gTipStates[parentBufferIndex] : NULL);
+    const TipState* childStates = (childBufferIndex < kTipCount ? gTipStates[childBufferIndex] : NULL);
+    const REALTYPE* parentPartials = gPartials[parentBufferIndex];
+    const REALTYPE* childPartials = gPartials[childBufferIndex];
+    const REALTYPE* wt = gCategoryWeights[categoryWeightsIndex];
+    const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
+    const double* rates = gCategoryRates[0];
+
+    if ((parentStates == NULL && parentPartials == NULL) ||
+        (childStates == NULL && childPartials == NULL) ||
+        wt == NULL || freqs == NULL || rates == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    const int termCount = kCategoryCount * kStateCount;
+
+    if (gEdgeProjection == NULL) {
+        gEdgeProjection = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount * termCount);
+        gEdgeProjectionScale = (REALTYPE*) malloc(sizeof(REALTYPE) * kPatternCount);
+        gEdgeProjectionRates = (double*) malloc(sizeof(double) * termCount);
+        gEdgeProjectionTerms = (double*) malloc(sizeof(double) * 3 * termCount);
+        if (gEdgeProjection == NULL || gEdgeProjectionScale == NULL ||
+            gEdgeProjectionRates == NULL || gEdgeProjectionTerms == NULL) {
+            free(gEdgeProjection);
+            free(gEdgeProjectionScale);
+            free(gEdgeProjectionRates);
+            free(gEdgeProjectionTerms);
+            gEdgeProjection = NULL;
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        }
+    }
+
+    kEdgeProjectionPrepared = false;
+
+    REALTYPE* parentVector = (REALTYPE*) malloc(sizeof(REALTYPE) * 2 * kStateCount);
+    if (parentVector == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    REALTYPE* childVector = parentVector + kStateCount;
+
+    // parent and child vectors are folded with the category weight and state frequencies,
+    // so that the site likelihood is a plain sum of coefficients times exponentials
+    for (int l = 0; l < kCategoryCount; l++) {
+        const REALTYPE weight = wt[l];
+        for (int k = 0; k < kPatternCount; k++) {
+            const int v = (l * kPaddedPatternCount + k) * kPartialsPaddedStateCount;
+
+            if (parentStates != NULL) {
+                const int state = parentStates[k];
+                for (int i = 0; i < kStateCount; i++)
+                    parentVector[i] = (state == i || state >= kStateCount ? weight * freqs[i] : 0.0);
+            } else {
+                for (int i = 0; i < kStateCount; i++)
+                    parentVector[i] = weight * freqs[i] * parentPartials[v + i];
+            }
+
+            if (childStates != NULL) {
+                const int state = childStates[k];
+                for (int j = 0; j < kStateCount; j++)
+                    childVector[j] = (state == j || state >= kStateCount ? 1.0 : 0.0);
+            } else {
+                for (int j = 0; j < kStateCount; j++)
+                    childVector[j] = childPartials[v + j];
+            }
+
+            if (!gEigenDecomposition->projectEdge(eigenIndex, parentVector, childVector,
+                                                  gEdgeProjection + (k * kCategoryCount + l) * kStateCount)) {
+                free(parentVector);
+                return BEAGLE_ERROR_NO_IMPLEMENTATION;
+            }
+        }
+    }
+
+    free(parentVector);
+
+    const REALTYPE* eigenValues = gEigenDecomposition->getEigenValues(eigenIndex);
+    for (int l = 0; l < kCategoryCount; l++) {
+        for (int m = 0; m < kStateCount; m++)
+            gEdgeProjectionRates[l * kStateCount + m] = eigenValues[m] * rates[l];
+    }
+
+    kEdgeProjectionScaled = (cumulativeScaleIndex != BEAGLE_OP_NONE);
+    if (kEdgeProjectionScaled)
+        memcpy(gEdgeProjectionScale, gScaleBuffers[cumulativeScaleIndex], sizeof(REALTYPE) * kPatternCount);
+
+    kEdgeProjectionPrepared = true;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_CPU_TEMPLATE
+int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calculateEdgeProjectionLogLikelihoods(double edgeLength,
+                                                                             double* outSumLogLikelihood,
+                                                                             double* outSumFirstDerivative,
+                                                                             double* outSumSecondDerivative) {
+    if (!kEdgeProjectionPrepared)
+        return BEAGLE_ERROR_GENERAL;
+
+    updateInvariantSites();
+
+    const int termCount = kCategoryCount * kStateCount;
+    double* expTerms = gEdgeProjectionTerms;
+    double* firstTerms = expTerms + termCount;
+    double* secondTerms = firstTerms + termCount;
+
+    // only kCategoryCount x kStateCount exponentials per edge length
+    for (int j = 0; j < termCount; j++) {
+        const double rate = gEdgeProjectionRates[j];
+        expTerms[j] = exp(rate * edgeLength);
+        firstTerms[j] = rate * expTerms[j];
+        secondTerms[j] = rate * firstTerms[j];
+    }
+
+    const bool derivatives = (outSumFirstDerivative != NULL || outSumSecondDerivative != NULL);
+
+    for (int k = 0; k < kPatternCount; k++) {
+        const REALTYPE* coefficients = gEdgeProjection + k * termCount;
+        double sum = 0.0;
+        for (int j = 0; j < termCount; j++)
+            sum += coefficients[j] * expTerms[j];
+        outLogLikelihoodsTmp[k] = sum;
+
+        if (derivatives) {
+            double sumD1 = 0.0;
+            double sumD2 = 0.0;
+            for (int j = 0; j < termCount; j++) {
+                sumD1 += coefficients[j] * firstTerms[j];
+                sumD2 += coefficients[j] * secondTerms[j];
+            }
+            const double firstDerivative = sumD1 / sum;
+            outFirstDerivativesTmp[k] = firstDerivative;
+            outSecondDerivativesTmp[k] = sumD2 / sum - firstDerivative * firstDerivative;
+        }
+    }
+
+    beagleLogInPlace(outLogLikelihoodsTmp, kPatternCount);
+
+    if (kEdgeProjectionScaled) {
+        for (int k = 0; k < kPatternCount; k++)
+            outLogLikelihoodsTmp[k] += gEdgeProjectionScale[k];
+    }
+
+    addInvariantSiteLikelihoods(0, kPatternCount, (derivatives ? 2 : 0));
+
+    *outSumLogLikelihood = 0.0;
+    for (int k = 0; k < kPatternCount; k++)
+        *outSumLogLikelihood += outLogLikelihoodsTmp[k] * gPatternWeights[k];
+
+    if (outSumFirstDerivative != NULL) {
+        *outSumFirstDerivative = 0.0;
+        for (int k = 0; k < kPatternCount; k++)
+            *outSumFirstDerivative += outFirstDerivativesTmp[k] * gPatternWeights[k];
+    }
+
+    if (outSumSecondDerivative != NULL) {
+        *outSumSecondDerivative = 0.0;
+        for (int k = 0; k < kPatternCount; k++)
+            *outSumSecondDerivative += outSecondDerivativesTmp[k] * gPatternWeights[k];
+    }
+
+    if (*outSumLogLikelihood != *outSumLogLikelihood)
+        return BEAGLE_ERROR_FLOATING_POINT;
+
+    return BEAGLE_SUCCESS;
+}
+
 BEAGLE_CPU_TEMPLATE
     void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartitionAsync(
                                                         const int* parentBufferIndices,
@@ -2162,6 +3537,9 @@ BEAGLE_CPU_TEMPLATE
     int partitionsPerThreadFloor = kPartitionCount / kNumThreads;
     int partitionsRemainder = kPartitionCount % kNumThreads;
     int currentPartitionIndex = 0;
+
+    std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
     for (int i=0; i<kNumThreads; i++) {
         int partitionCountThread = partitionsPerThreadFloor;
         if (partitionsRemainder) {
@@ -2197,6 +3575,9 @@ BEAGLE_CPU_TEMPLATE
         gFutures[i].wait();
     }
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        accumulateThreadIdleTime(parallelStartTime);
+
 }
 
 BEAGLE_CPU_TEMPLATE
@@ -2210,6 +3591,8 @@ BEAGLE_CPU_TEMPLATE
                                                         const int* partitionIndices,
                                                         double* outSumLogLikelihoodByPartition) {
 
+    std::chrono::steady_clock::time_point parallelStartTime = std::chrono::steady_clock::now();
+
     for (int i=0; i<kNumThreads; i++) {
 
         std::packaged_task<void()> threadTask(
@@ -2238,6 +3621,9 @@ BEAGLE_CPU_TEMPLATE
         gFutures[i].wait();
     }
 
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        accumulateThreadIdleTime(parallelStartTime);
+
 }
 
 
@@ -2265,7 +3651,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
     
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = gTipStates[childIndex];
         int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
@@ -2337,20 +3723,10 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoods(const int parIndex
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
-    }
-
-
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
+        outLogLikelihoodsTmp[k] = sumOverI;
     }
 
-    *outSumLogLikelihood = 0.0;
-    for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-    }
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex);
 
     if (*outSumLogLikelihood != *outSumLogLikelihood)
         returnCode = BEAGLE_ERROR_FLOATING_POINT;
@@ -2394,7 +3770,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
         const REALTYPE* freqs = gStateFrequencies[stateFrequenciesIndex];
 
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
-            const int* statesChild = gTipStates[childIndex];
+            const TipState* statesChild = gTipStates[childIndex];
             int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
 
             for(int l = 0; l < kCategoryCount; l++) {
@@ -2467,20 +3843,11 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsByPartition(
                 u++;
             }
 
-            outLogLikelihoodsTmp[k] = log(sumOverI);
-        }
-
-
-        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int k=startPattern; k < endPattern; k++)
-                outLogLikelihoodsTmp[k] += scalingFactors[k];
+            outLogLikelihoodsTmp[k] = sumOverI;
         }
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p] += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-        }
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                  scalingFactorsIndex);
 
     }
 }
@@ -2532,7 +3899,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByParti
 
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-            const int* statesChild = gTipStates[childIndex];
+            const TipState* statesChild = gTipStates[childIndex];
             int v = startPattern * kPartialsPaddedStateCount; // Index for parent partials
 
             for(int l = 0; l < kCategoryCount; l++) {
@@ -2602,24 +3969,17 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDerivByParti
                 u++;
             }
 
-            outLogLikelihoodsTmp[k] = log(sumOverI);
+            outLogLikelihoodsTmp[k] = sumOverI;
             outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
             outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
         }
 
+        outSumLogLikelihoodByPartition[p] = sumSiteLogLikelihoods(startPattern, endPattern,
+                                                                  scalingFactorsIndex, 2);
 
-        if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-            const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-            for(int k=startPattern; k < endPattern; k++)
-                outLogLikelihoodsTmp[k] += scalingFactors[k];
-        }
-
-
-        outSumLogLikelihoodByPartition[p] = 0.0;
         outSumFirstDerivativeByPartition[p] = 0.0;
         outSumSecondDerivativeByPartition[p] = 0.0;
         for (int i = startPattern; i < endPattern; i++) {
-            outSumLogLikelihoodByPartition[p]    += outLogLikelihoodsTmp[i]    * gPatternWeights[i];
             outSumFirstDerivativeByPartition[p]  += outFirstDerivativesTmp[i]  * gPatternWeights[i];
             outSumSecondDerivativeByPartition[p] += outSecondDerivativesTmp[i] * gPatternWeights[i];
         }
@@ -2655,7 +4015,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
         
         if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
             
-            const int* statesChild = gTipStates[childIndex];
+            const TipState* statesChild = gTipStates[childIndex];
             int v = 0; // Index for parent partials
             
             for(int l = 0; l < kCategoryCount; l++) {
@@ -2769,7 +4129,8 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsMulti(const int* pa
         for(int i=0; i<kPatternCount; i++)
             outLogLikelihoodsTmp[i] += maxScaleFactor[i];
     }
-    
+
+    addInvariantSiteLikelihoods(0, kPatternCount, 0);
 
     *outSumLogLikelihood = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
@@ -2810,7 +4171,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
 
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = gTipStates[childIndex];
         int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
@@ -2873,22 +4234,14 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsFirstDeriv(const in
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
         outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
     }
 
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex, 1);
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
-
-    *outSumLogLikelihood = 0.0;
     *outSumFirstDerivative = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-
         *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
     }
     
@@ -2929,7 +4282,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
 
     if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 
-        const int* statesChild = gTipStates[childIndex];
+        const TipState* statesChild = gTipStates[childIndex];
         int v = 0; // Index for parent partials
 
         for(int l = 0; l < kCategoryCount; l++) {
@@ -2998,24 +4351,16 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcEdgeLogLikelihoodsSecondDeriv(const i
             u++;
         }
 
-        outLogLikelihoodsTmp[k] = log(sumOverI);
+        outLogLikelihoodsTmp[k] = sumOverI;
         outFirstDerivativesTmp[k] = sumOverID1 / sumOverI;
         outSecondDerivativesTmp[k] = sumOverID2 / sumOverI - outFirstDerivativesTmp[k] * outFirstDerivativesTmp[k];
     }
 
+    *outSumLogLikelihood = sumSiteLogLikelihoods(0, kPatternCount, scalingFactorsIndex, 2);
 
-    if (scalingFactorsIndex != BEAGLE_OP_NONE) {
-        const REALTYPE* scalingFactors = gScaleBuffers[scalingFactorsIndex];
-        for(int k=0; k < kPatternCount; k++)
-            outLogLikelihoodsTmp[k] += scalingFactors[k];
-    }
-
-    *outSumLogLikelihood = 0.0;
     *outSumFirstDerivative = 0.0;
     *outSumSecondDerivative = 0.0;
     for (int i = 0; i < kPatternCount; i++) {
-        *outSumLogLikelihood += outLogLikelihoodsTmp[i] * gPatternWeights[i];
-
         *outSumFirstDerivative += outFirstDerivativesTmp[i] * gPatternWeights[i];
 
         *outSumSecondDerivative += outSecondDerivativesTmp[i] * gPatternWeights[i];
@@ -3216,7 +4561,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
     gPatternWeights = sortedPatternWeights;
 
     REALTYPE* sortedPartials = (REALTYPE*) mallocAligned(sizeof(REALTYPE) * kPartialsSize);
-    int* sortedTips = (int*) mallocAligned(sizeof(int) * kPaddedPatternCount);
+    TipState* sortedTips = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
 
     for (int tip=0; tip < kTipCount; tip++) {
         if (gTipStates[tip] == NULL) {
@@ -3233,14 +4578,20 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
             gPartials[tip] = sortedPartials;
             sortedPartials = unsortedPartials;
         } else {
-            int* unsortedTips = gTipStates[tip];
+            TipState* unsortedTips = gTipStates[tip];
             for (int i=0; i < kPatternCount; i++) {
                 int sortIndex = gPatternsNewOrder[i];
                 int pIndex = i;
                 sortedTips[sortIndex] = unsortedTips[pIndex];
             }
             gTipStates[tip] = sortedTips;
-            sortedTips = unsortedTips;
+            if (gTipStatesExternal[tip]) {
+                // the caller's array is read-only, keep the sorted copy and take a new scratch buffer
+                gTipStatesExternal[tip] = false;
+                sortedTips = (TipState*) mallocAligned(sizeof(TipState) * kPaddedPatternCount);
+            } else {
+                sortedTips = unsortedTips;
+            }
         }        
     }
 
@@ -3248,6 +4599,7 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
     free(sortedTips);
 
     kPatternsReordered = true;
+    kInvariantSitesDirty = true;
 
     return BEAGLE_SUCCESS;
 }
@@ -3258,9 +4610,9 @@ int BeagleCPUImpl<BEAGLE_CPU_GENERIC>::reorderPatternsByPartition() {
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
-                                                         const int* states1,
+                                                         const TipState* states1,
                                                          const REALTYPE* matrices1,
-                                                         const int* states2,
+                                                         const TipState* states2,
                                                          const REALTYPE* matrices2,
                                                          int startPattern,
                                                          int endPattern) {
@@ -3289,9 +4641,9 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStates(REALTYPE* destP,
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* destP,
-                                                                     const int* child1States,
+                                                                     const TipState* child1States,
                                                                      const REALTYPE* child1TransMat,
-                                                                     const int* child2States,
+                                                                     const TipState* child2States,
                                                                      const REALTYPE* child2TransMat,
                                                                      const REALTYPE* scaleFactors,
                                                                      int startPattern,
@@ -3322,7 +4674,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesStatesFixedScaling(REALTYPE* d
  */
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
-                                                           const int* states1,
+                                                           const TipState* states1,
                                                            const REALTYPE* matrices1,
                                                            const REALTYPE* partials2,
                                                            const REALTYPE* matrices2,
@@ -3374,7 +4726,7 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartials(REALTYPE* destP,
 
 BEAGLE_CPU_TEMPLATE
 void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::calcStatesPartialsFixedScaling(REALTYPE* destP,
-                                                                       const int* states1,
+                                                                       const TipState* states1,
                                                                        const REALTYPE* matrices1,
                                                                        const REALTYPE* partials2,
                                                                        const REALTYPE* matrices2,
@@ -3648,8 +5000,54 @@ void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::threadWaiting(threadData* tData)
         l.unlock();
 
         // Execute the task!
-        j();
+        if (kStatisticsEnabled.load(std::memory_order_relaxed)) {
+            std::chrono::steady_clock::time_point jobStartTime = std::chrono::steady_clock::now();
+            j();
+            tData->busyTime.fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - jobStartTime).count(),
+                std::memory_order_relaxed);
+        } else {
+            j();
+        }
+    }
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::countOperationStatistics(const int* operations,
+                                                                 int count,
+                                                                 bool byPartition) {
+    int numOps = (byPartition ? BEAGLE_PARTITION_OP_COUNT : BEAGLE_OP_COUNT);
+    uint64_t patternOperations = 0;
+    uint64_t rescaleCount = 0;
+
+    for (int op = 0; op < count; op++) {
+        int patternCount = kPatternCount;
+        if (byPartition) {
+            int currentPartition = operations[op * numOps + 7];
+            patternCount = gPatternPartitionsStartPatterns[currentPartition + 1] -
+                           gPatternPartitionsStartPatterns[currentPartition];
+        }
+        patternOperations += patternCount;
+
+        if ((kFlags & BEAGLE_FLAG_SCALING_ALWAYS) || operations[op * numOps + 1] >= 0)
+            rescaleCount++;
     }
+
+    kStatisticsPatternOperations.fetch_add(patternOperations, std::memory_order_relaxed);
+    kStatisticsRescaleCount.fetch_add(rescaleCount, std::memory_order_relaxed);
+}
+
+BEAGLE_CPU_TEMPLATE
+void BeagleCPUImpl<BEAGLE_CPU_GENERIC>::accumulateThreadIdleTime(std::chrono::steady_clock::time_point parallelStartTime) {
+    int64_t parallelTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::steady_clock::now() - parallelStartTime).count();
+
+    int64_t idleTime = parallelTime * kNumThreads;
+    for (int i = 0; i < kNumThreads; i++)
+        idleTime -= (int64_t) gThreads[i].busyTime.exchange(0, std::memory_order_relaxed);
+
+    if (idleTime > 0)
+        kStatisticsThreadIdleTime.fetch_add(idleTime, std::memory_order_relaxed);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
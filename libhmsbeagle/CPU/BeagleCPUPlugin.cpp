@@ -7,6 +7,7 @@
 
 #include "libhmsbeagle/CPU/BeagleCPUPlugin.h"
 #include "libhmsbeagle/CPU/BeagleCPU4StateImpl.h"
+#include "libhmsbeagle/CPU/BeagleCPUFixedStateImpl.h"
 #include "libhmsbeagle/CPU/BeagleCPUImpl.h"
 #include <iostream>
 
@@ -36,6 +37,8 @@ Plugin("CPU", "CPU")
 	// list with compatible factories
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPU4StateImplFactory<float>());
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUFixedStateImplFactory<double>());
+	beagleFactories.push_back(new beagle::cpu::BeagleCPUFixedStateImplFactory<float>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<double>());
 	beagleFactories.push_back(new beagle::cpu::BeagleCPUImplFactory<float>());
 }
@@ -99,13 +99,13 @@ protected:
 
 private:
 	virtual void calcStatesStates(float* destP,
-                                     const int* states1,
+                                     const TipState* states1,
                                      const float* matrices1,
-                                     const int* states2,
+                                     const TipState* states2,
                                      const float* matrices2);
 
     virtual void calcStatesPartials(float* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const float* matrices1,
                                     const float* partials2,
                                     const float* matrices2);
@@ -173,15 +173,15 @@ protected:
 
 private:
 	virtual void calcStatesStates(double* destP,
-                                const int* states1,
+                                const TipState* states1,
                                 const double* matrices1,
-                                const int* states2,
+                                const TipState* states2,
                                 const double* matrices2,
                                 int startPattern,
                                 int endPattern);
 
     virtual void calcStatesPartials(double* destP,
-                                    const int* states1,
+                                    const TipState* states1,
                                     const double* matrices1,
                                     const double* partials2,
                                     const double* matrices2,
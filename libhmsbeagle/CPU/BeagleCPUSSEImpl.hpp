@@ -62,9 +62,9 @@ inline const char* getBeagleCPUSSEName<float>(){ return "CPU-SSE-Single"; };
 
 BEAGLE_CPU_SSE_TEMPLATE
 void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
-                                                               const int* states_q,
+                                                               const TipState* states_q,
                                                                const double* matrices_q,
-                                                               const int* states_r,
+                                                               const TipState* states_r,
                                                                const double* matrices_r,
                                                                int startPattern,
                                                                int endPattern) {
@@ -81,9 +81,9 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
 
 //template <>
 //void BeagleCPUSSEImpl<double>::calcStatesStates(double* destP,
-//                                     const int* states_q,
+//                                     const TipState* states_q,
 //                                     const double* matrices_q,
-//                                     const int* states_r,
+//                                     const TipState* states_r,
 //                                     const double* matrices_r) {
 //
 //	VecUnion vu_mq[OFFSET][2], vu_mr[OFFSET][2];
@@ -117,7 +117,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesStates(double* destP,
  */
 BEAGLE_CPU_SSE_TEMPLATE
 void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesPartials(double* destP,
-                                                                 const int* states_q,
+                                                                 const TipState* states_q,
                                                                  const double* matrices_q,
                                                                  const double* partials_r,
                                                                  const double* matrices_r,
@@ -136,7 +136,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcStatesPartials(double* destP,
 //
 //template <>
 //void BeagleCPUSSEImpl<double>::calcStatesPartials(double* destP,
-//                                       const int* states_q,
+//                                       const TipState* states_q,
 //                                       const double* matrices_q,
 //                                       const double* partials_r,
 //                                       const double* matrices_r) {
@@ -225,7 +225,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartials(double* __res
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
     	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
+    	int v = l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
             for (int i = 0; i < kStateCount;
@@ -310,7 +310,7 @@ void BeagleCPUSSEImpl<BEAGLE_CPU_SSE_DOUBLE>::calcPartialsPartialsFixedScaling(d
 #pragma omp parallel for num_threads(kCategoryCount)
     for (int l = 0; l < kCategoryCount; l++) {
     	double* destPu = destP + l*kPartialsPaddedStateCount*kPatternCount + kPartialsPaddedStateCount*startPattern;
-    	int v = l*kPartialsPaddedStateCount*kPatternCount;
+    	int v = l*kPartialsPaddedStateCount*kPatternCount + startPattern*kPartialsPaddedStateCount;
         for (int k = startPattern; k < endPattern; k++) {
             int w = l * kMatrixSize;
             const V_Real scalar = VEC_SPLAT(scaleFactors[k]);
@@ -424,7 +424,7 @@ return BeagleCPUImpl<BEAGLE_CPU_SSE_DOUBLE>::calcEdgeLogLikelihoods(
 //
 //    if (childIndex < kTipCount && gTipStates[childIndex]) { // Integrate against a state at the child
 //
-//        const int* statesChild = gTipStates[childIndex];
+//        const TipState* statesChild = gTipStates[childIndex];
 //
 //		int w = 0;
 //		V_Real *vcl_r = (V_Real *)cl_r;
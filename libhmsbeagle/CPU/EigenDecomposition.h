@@ -15,6 +15,7 @@
 #include <cmath>
 #include <cassert>
 #include <vector>
+#include <stdint.h>
 
 #define BEAGLE_CPU_EIGEN_GENERIC	REALTYPE, T_PAD
 #define BEAGLE_CPU_EIGEN_TEMPLATE	template <typename REALTYPE, int T_PAD>
@@ -34,7 +35,44 @@ protected:
     REALTYPE* matrixTmp;
     REALTYPE* firstDerivTmp;
     REALTYPE* secondDerivTmp;
-    
+
+    // direct-mapped cache of single-category transition matrices, keyed by eigen index and
+    // rate times edge length; entries with a negative eigen index are empty
+    int kMatrixCacheSize;
+    REALTYPE* gMatrixCache;
+    int* gMatrixCacheEigenIndices;
+    double* gMatrixCacheDistances;
+
+    int getMatrixCacheSlot(int eigenIndex, double distance) {
+        uint64_t bits;
+        memcpy(&bits, &distance, sizeof(bits));
+        bits ^= (uint64_t) eigenIndex * 0x9e3779b97f4a7c15ULL;
+        bits ^= bits >> 29;
+        bits *= 0xbf58476d1ce4e5b9ULL;
+        bits ^= bits >> 32;
+        return (int) (bits % (uint64_t) kMatrixCacheSize);
+    }
+
+    // returns the cached matrix for a key or NULL
+    const REALTYPE* findCachedMatrix(int eigenIndex, double distance) {
+        if (kMatrixCacheSize == 0)
+            return NULL;
+        int slot = getMatrixCacheSlot(eigenIndex, distance);
+        if (gMatrixCacheEigenIndices[slot] != eigenIndex || gMatrixCacheDistances[slot] != distance)
+            return NULL;
+        return gMatrixCache + (size_t) slot * kStateCount * (kStateCount + T_PAD);
+    }
+
+    void storeCachedMatrix(int eigenIndex, double distance, const REALTYPE* matrix) {
+        if (kMatrixCacheSize == 0)
+            return;
+        int slot = getMatrixCacheSlot(eigenIndex, distance);
+        const size_t matrixSize = kStateCount * (kStateCount + T_PAD);
+        memcpy(gMatrixCache + slot * matrixSize, matrix, sizeof(REALTYPE) * matrixSize);
+        gMatrixCacheEigenIndices[slot] = eigenIndex;
+        gMatrixCacheDistances[slot] = distance;
+    }
+
 public:
 	EigenDecomposition(int decompositionCount,
 					   int stateCount,
@@ -46,9 +84,51 @@ public:
 					   		kStateCount = stateCount;
 					   		kCategoryCount = categoryCount;
                             kFlags = flags;
+                            kMatrixCacheSize = 0;
+                            gMatrixCache = NULL;
+                            gMatrixCacheEigenIndices = NULL;
+                            gMatrixCacheDistances = NULL;
 					   	};
 	
-	virtual ~EigenDecomposition() {};
+	virtual ~EigenDecomposition() {
+        free(gMatrixCache);
+        free(gMatrixCacheEigenIndices);
+        free(gMatrixCacheDistances);
+    };
+
+    // keeps up to cacheSize single-category transition matrices and reuses them in
+    // updateTransitionMatrices when the same eigen index and rate times length come back;
+    // zero disables the cache. Returns false if memory could not be allocated
+    bool setMatrixCacheSize(int cacheSize) {
+        free(gMatrixCache);
+        free(gMatrixCacheEigenIndices);
+        free(gMatrixCacheDistances);
+        gMatrixCache = NULL;
+        gMatrixCacheEigenIndices = NULL;
+        gMatrixCacheDistances = NULL;
+        kMatrixCacheSize = 0;
+        if (cacheSize <= 0)
+            return true;
+
+        gMatrixCache = (REALTYPE*) malloc(sizeof(REALTYPE) * cacheSize * kStateCount * (kStateCount + T_PAD));
+        gMatrixCacheEigenIndices = (int*) malloc(sizeof(int) * cacheSize);
+        gMatrixCacheDistances = (double*) malloc(sizeof(double) * cacheSize);
+        if (gMatrixCache == NULL || gMatrixCacheEigenIndices == NULL || gMatrixCacheDistances == NULL) {
+            setMatrixCacheSize(0);
+            return false;
+        }
+        kMatrixCacheSize = cacheSize;
+        clearMatrixCache(-1);
+        return true;
+    }
+
+    // forgets the cached matrices of an eigen-decomposition, or of all of them if eigenIndex < 0
+    void clearMatrixCache(int eigenIndex) {
+        for (int i = 0; i < kMatrixCacheSize; i++) {
+            if (eigenIndex < 0 || gMatrixCacheEigenIndices[i] == eigenIndex)
+                gMatrixCacheEigenIndices[i] = -1;
+        }
+    }
 	
     // sets the Eigen decomposition for a given matrix
     //
@@ -76,6 +156,30 @@ public:
                                  REALTYPE** transitionMatrices,
                                  int count) = 0;
 
+    // copies all eigen-decompositions from another decomposition of the same type and size
+    virtual void copyFrom(const EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* source) = 0;
+
+    // number of arrays that make up one eigen-decomposition
+    virtual int getStorageCount() = 0;
+
+    // returns one of the arrays of an eigen-decomposition and its length, used to save and load instances
+    virtual REALTYPE* getStorage(int eigenIndex,
+                                 int storageIndex,
+                                 int* outLength) = 0;
+
+    // projects a parent and a child state vector onto the eigenvectors so that
+    // parent' P(t) child = sum_k outProjection[k] * exp(eigenValue[k] * t); returns false
+    // when the decomposition has complex eigenvalues and cannot be split this way
+    virtual bool projectEdge(int eigenIndex,
+                             const REALTYPE* parent,
+                             const REALTYPE* child,
+                             REALTYPE* outProjection) = 0;
+
+    // returns the (real) eigenvalues of an eigen-decomposition
+    const REALTYPE* getEigenValues(int eigenIndex) const {
+        return gEigenValues[eigenIndex];
+    }
+
 };
 
 }
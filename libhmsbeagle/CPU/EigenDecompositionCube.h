@@ -24,6 +24,8 @@ class EigenDecompositionCube : public EigenDecomposition<BEAGLE_CPU_EIGEN_GENERI
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::firstDerivTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::secondDerivTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kFlags;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::findCachedMatrix;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::storeCachedMatrix;
 
 protected:
     REALTYPE** gCMatrices;
@@ -49,6 +51,19 @@ public:
                                  const double* categoryRates,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual void copyFrom(const EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* source);
+
+    virtual int getStorageCount();
+
+    virtual REALTYPE* getStorage(int eigenIndex,
+                                 int storageIndex,
+                                 int* outLength);
+
+    virtual bool projectEdge(int eigenIndex,
+                             const REALTYPE* parent,
+                             const REALTYPE* child,
+                             REALTYPE* outProjection);
 	
 };
 
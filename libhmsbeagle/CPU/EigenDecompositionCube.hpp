@@ -65,6 +65,53 @@ EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionCube() {
 	free(secondDerivTmp);
 }
 
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::copyFrom(const EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* source) {
+    const EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>* other =
+        static_cast<const EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>*>(source);
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        memcpy(gCMatrices[i], other->gCMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount * kStateCount);
+        memcpy(gEigenValues[i], other->gEigenValues[i], sizeof(REALTYPE) * kStateCount);
+    }
+    this->clearMatrixCache(-1);
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+int EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::getStorageCount() {
+    return 2;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+REALTYPE* EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::getStorage(int eigenIndex,
+                                                                        int storageIndex,
+                                                                        int* outLength) {
+    if (storageIndex == 0) {
+        *outLength = kStateCount * kStateCount * kStateCount;
+        return gCMatrices[eigenIndex];
+    }
+    *outLength = kStateCount;
+    return gEigenValues[eigenIndex];
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::projectEdge(int eigenIndex,
+                                                                   const REALTYPE* parent,
+                                                                   const REALTYPE* child,
+                                                                   REALTYPE* outProjection) {
+    const REALTYPE* tmpCMatrices = gCMatrices[eigenIndex];
+    for (int k = 0; k < kStateCount; k++)
+        outProjection[k] = 0.0;
+    for (int i = 0; i < kStateCount; i++) {
+        for (int j = 0; j < kStateCount; j++) {
+            const REALTYPE weight = parent[i] * child[j];
+            const REALTYPE* cRow = tmpCMatrices + (i * kStateCount + j) * kStateCount;
+            for (int k = 0; k < kStateCount; k++)
+                outProjection[k] += weight * cRow[k];
+        }
+    }
+    return true;
+}
+
 BEAGLE_CPU_EIGEN_TEMPLATE
 void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int eigenIndex,
 										           const double* inEigenVectors,
@@ -96,7 +143,7 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(int
             }
         }
     }
-
+    this->clearMatrixCache(eigenIndex);
 }
     
 #define UNROLL
@@ -119,9 +166,17 @@ void EigenDecompositionCube<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(
 			REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
 			int n = 0;
 			for (int l = 0; l < kCategoryCount; l++) {
-				
+				const double distance = (REALTYPE)edgeLengths[u] * categoryRates[l];
+				const int matrixStart = n;
+				const REALTYPE* cachedMatrix = findCachedMatrix(eigenIndex, distance);
+				if (cachedMatrix != NULL) {
+					memcpy(transitionMat + n, cachedMatrix, sizeof(REALTYPE) * kStateCount * (kStateCount + T_PAD));
+					n += kStateCount * (kStateCount + T_PAD);
+					continue;
+				}
+
                 for (int i = 0; i < kStateCount; i++) {
-					matrixTmp[i] = exp(gEigenValues[eigenIndex][i] * ((REALTYPE)edgeLengths[u] * categoryRates[l]));
+					matrixTmp[i] = exp(gEigenValues[eigenIndex][i] * distance);
                 }
 				
                 REALTYPE* tmpCMatrices = gCMatrices[eigenIndex];
@@ -156,6 +211,7 @@ if (T_PAD != 0) {
 					n += T_PAD;
 }
 				}
+				storeCachedMatrix(eigenIndex, distance, transitionMat + matrixStart);
 			}
 			
 			if (DEBUGGING_OUTPUT) {
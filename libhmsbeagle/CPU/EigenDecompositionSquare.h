@@ -22,6 +22,8 @@ class EigenDecompositionSquare: public EigenDecomposition<BEAGLE_CPU_EIGEN_GENER
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kCategoryCount;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::matrixTmp;
 	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::kFlags;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::findCachedMatrix;
+	using EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>::storeCachedMatrix;
 
 protected:
     REALTYPE** gEMatrices; // kStateCount^2 flattened array
@@ -50,6 +52,19 @@ public:
                                  const double* categoryRates,
                                  REALTYPE** transitionMatrices,
                                  int count);
+
+    virtual void copyFrom(const EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* source);
+
+    virtual int getStorageCount();
+
+    virtual REALTYPE* getStorage(int eigenIndex,
+                                 int storageIndex,
+                                 int* outLength);
+
+    virtual bool projectEdge(int eigenIndex,
+                             const REALTYPE* parent,
+                             const REALTYPE* child,
+                             REALTYPE* outProjection);
 };
 
 }
@@ -76,6 +76,60 @@ EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::~EigenDecompositionSquare()
 	free(gEigenValues);
 	free(matrixTmp);
 }
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::copyFrom(const EigenDecomposition<BEAGLE_CPU_EIGEN_GENERIC>* source) {
+    const EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>* other =
+        static_cast<const EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>*>(source);
+    for (int i = 0; i < kEigenDecompCount; i++) {
+        memcpy(gEMatrices[i], other->gEMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount);
+        memcpy(gIMatrices[i], other->gIMatrices[i], sizeof(REALTYPE) * kStateCount * kStateCount);
+        memcpy(gEigenValues[i], other->gEigenValues[i], sizeof(REALTYPE) * kEigenValuesSize);
+    }
+    this->clearMatrixCache(-1);
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+int EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::getStorageCount() {
+    return 3;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+REALTYPE* EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::getStorage(int eigenIndex,
+                                                                          int storageIndex,
+                                                                          int* outLength) {
+    if (storageIndex == 0) {
+        *outLength = kStateCount * kStateCount;
+        return gEMatrices[eigenIndex];
+    } else if (storageIndex == 1) {
+        *outLength = kStateCount * kStateCount;
+        return gIMatrices[eigenIndex];
+    }
+    *outLength = kEigenValuesSize;
+    return gEigenValues[eigenIndex];
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::projectEdge(int eigenIndex,
+                                                                     const REALTYPE* parent,
+                                                                     const REALTYPE* child,
+                                                                     REALTYPE* outProjection) {
+    if (isComplex)
+        return false;
+
+    const REALTYPE* Ievc = gIMatrices[eigenIndex];
+    const REALTYPE* Evec = gEMatrices[eigenIndex];
+    for (int k = 0; k < kStateCount; k++) {
+        REALTYPE left = 0.0;
+        REALTYPE right = 0.0;
+        for (int i = 0; i < kStateCount; i++)
+            left += parent[i] * Evec[i * kStateCount + k];
+        for (int j = 0; j < kStateCount; j++)
+            right += Ievc[k * kStateCount + j] * child[j];
+        outProjection[k] = left * right;
+    }
+    return true;
+}
     
 /**
  * @brief Transposes a square matrix in place
@@ -104,6 +158,7 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::setEigenDecomposition(i
 	beagleMemCpy(gIMatrices[eigenIndex],inInverseEigenVectors,len);
     if (kFlags & BEAGLE_FLAG_INVEVEC_TRANSPOSED) // TODO: optimize, might not need to transpose here
         transposeSquareMatrix(gIMatrices[eigenIndex], kStateCount);
+    this->clearMatrixCache(eigenIndex);
 }
 
 BEAGLE_CPU_EIGEN_TEMPLATE
@@ -126,6 +181,13 @@ void EigenDecompositionSquare<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrice
         int n = 0;
         for (int l = 0; l < kCategoryCount; l++) {
 			const REALTYPE distance = categoryRates[l] * edgeLength;
+			const int matrixStart = n;
+			const REALTYPE* cachedMatrix = findCachedMatrix(eigenIndex, distance);
+			if (cachedMatrix != NULL) {
+				memcpy(transitionMat + n, cachedMatrix, sizeof(REALTYPE) * kStateCount * (kStateCount + T_PAD));
+				n += kStateCount * (kStateCount + T_PAD);
+				continue;
+			}
         	for(int i=0; i<kStateCount; i++) {
         		if (!isComplex || EvalImag[i] == 0) {
         			const REALTYPE tmp = exp(Eval[i] * distance);
@@ -174,6 +236,7 @@ if (T_PAD != 0) {
                 n += T_PAD;
 }
             }
+            storeCachedMatrix(eigenIndex, distance, transitionMat + matrixStart);
         }
 
         if (DEBUGGING_OUTPUT) {
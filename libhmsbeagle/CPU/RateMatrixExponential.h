@@ -0,0 +1,110 @@
+/*
+ * RateMatrixExponential.h
+ *
+ *  Transition probability matrices computed directly from rate matrices by uniformization,
+ *  for models given without an eigen-decomposition (irreversible or defective rate matrices).
+ */
+
+#ifndef RATEMATRIXEXPONENTIAL_H_
+#define RATEMATRIXEXPONENTIAL_H_
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "libhmsbeagle/CPU/EigenDecomposition.h"
+
+#define BEAGLE_CPU_UNIFORMIZATION_MAX_STEP   32.0  // largest exit rate times length summed before squaring
+#define BEAGLE_CPU_UNIFORMIZATION_TOLERANCE  1E-16 // Poisson tail left out of each sum
+#define BEAGLE_CPU_UNIFORMIZATION_SPARSE     0.25  // highest fraction of non-zero rates multiplied sparsely
+
+namespace beagle {
+namespace cpu {
+
+/*
+ * P(t) = sum over k of Poisson(mu t; k) B^k with B = I + Q / mu and mu the largest exit rate.
+ * The powers of B depend only on Q, so they are computed once and shared by every edge and
+ * category; each matrix is then a weighted sum of them, squared when mu t is large. Powers
+ * of a sparse B (e.g. codon models) are built from its non-zero entries only.
+ */
+BEAGLE_CPU_EIGEN_TEMPLATE
+class RateMatrixExponential {
+
+protected:
+    struct UniformizedChain {
+        std::vector<double> rates;      // Q, kStateCount^2 row-major
+        double exitRate;                // mu
+        bool sparse;
+        std::vector<int> rowStarts;     // non-zero entries of B, row by row
+        std::vector<int> columns;
+        std::vector<double> values;
+        std::vector<double> powers;     // B^0, B^1, ... back to back
+        int powerCount;
+    };
+
+    int kStateCount;
+    int kRateMatrixCount;
+    std::vector<UniformizedChain> gChains;
+
+    // Poisson weights of x up to a negligible tail
+    void getPoissonWeights(double x,
+                           std::vector<double>& weights) const;
+
+    // halves distance * exit rate until it is at most the largest step, returns the halvings
+    int reduceStep(double exitRate,
+                   double distance,
+                   double* outStep) const;
+
+    void extendPowers(UniformizedChain& chain,
+                      int powerCount);
+
+    // result = left * right, all dense kStateCount^2
+    void multiplyDense(const double* left,
+                       const double* right,
+                       double* result) const;
+
+public:
+    RateMatrixExponential(int rateMatrixCount,
+                          int stateCount);
+
+    virtual ~RateMatrixExponential();
+
+    // returns false if an off-diagonal rate is negative or a rate is not finite
+    bool setRateMatrix(int rateMatrixIndex,
+                       const double* inRateMatrix);
+
+    bool isRateMatrixSet(int rateMatrixIndex) const;
+
+    // the rate matrix as set, or NULL
+    const double* getRateMatrix(int rateMatrixIndex) const;
+
+    // computes the powers needed by the distances edgeLengths[i] * categoryRates[l]
+    void preparePowers(int rateMatrixIndex,
+                       const double* edgeLengths,
+                       const double* categoryRates,
+                       int categoryCount,
+                       int count);
+
+    // fills the matrices of edges [start, end); preparePowers must have seen these edges.
+    // Does not modify the object, so disjoint ranges may run concurrently
+    void updateTransitionMatrices(int rateMatrixIndex,
+                                  const int* probabilityIndices,
+                                  const double* edgeLengths,
+                                  const double* categoryRates,
+                                  int categoryCount,
+                                  REALTYPE** transitionMatrices,
+                                  int start,
+                                  int end) const;
+
+    void copyFrom(const RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>* source);
+};
+
+}
+}
+
+// Include the template implementation header
+#include "libhmsbeagle/CPU/RateMatrixExponential.hpp"
+
+#endif /* RATEMATRIXEXPONENTIAL_H_ */
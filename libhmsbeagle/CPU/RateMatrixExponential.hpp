@@ -0,0 +1,270 @@
+/*
+ * RateMatrixExponential.hpp
+ *
+ *  Uniformization backend for transition matrices from rate matrices.
+ */
+
+#ifndef _RateMatrixExponential_hpp_
+#define _RateMatrixExponential_hpp_
+
+#include "RateMatrixExponential.h"
+#include "libhmsbeagle/beagle.h"
+
+namespace beagle {
+namespace cpu {
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::RateMatrixExponential(int rateMatrixCount,
+                                                                        int stateCount) {
+    kRateMatrixCount = rateMatrixCount;
+    kStateCount = stateCount;
+    gChains.resize(kRateMatrixCount);
+    for (int i = 0; i < kRateMatrixCount; i++) {
+        gChains[i].exitRate = 0.0;
+        gChains[i].sparse = false;
+        gChains[i].powerCount = 0;
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::~RateMatrixExponential() {
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::setRateMatrix(int rateMatrixIndex,
+                                                                    const double* inRateMatrix) {
+    const int S = kStateCount;
+
+    double exitRate = 0.0;
+    for (int i = 0; i < S; i++) {
+        for (int j = 0; j < S; j++) {
+            const double q = inRateMatrix[i * S + j];
+            if (!(q > -HUGE_VAL && q < HUGE_VAL) || (i != j && q < 0.0))
+                return false;
+        }
+        exitRate = std::max(exitRate, -inRateMatrix[i * S + i]);
+    }
+
+    UniformizedChain& chain = gChains[rateMatrixIndex];
+    chain.rates.assign(inRateMatrix, inRateMatrix + S * S);
+    chain.exitRate = exitRate;
+    chain.powers.clear();
+    chain.powerCount = 0;
+
+    // B = I + Q / mu; with no exit rate every P(t) is the identity and B = I
+    std::vector<double> B(S * S, 0.0);
+    int nonZeroCount = 0;
+    for (int i = 0; i < S; i++) {
+        for (int j = 0; j < S; j++) {
+            double b = (i == j ? 1.0 : 0.0);
+            if (exitRate > 0.0)
+                b += inRateMatrix[i * S + j] / exitRate;
+            B[i * S + j] = b;
+            if (b != 0.0)
+                nonZeroCount++;
+        }
+    }
+
+    chain.sparse = (nonZeroCount <= BEAGLE_CPU_UNIFORMIZATION_SPARSE * S * S);
+    chain.rowStarts.clear();
+    chain.columns.clear();
+    chain.values.clear();
+    if (chain.sparse) {
+        chain.rowStarts.push_back(0);
+        for (int i = 0; i < S; i++) {
+            for (int j = 0; j < S; j++) {
+                if (B[i * S + j] != 0.0) {
+                    chain.columns.push_back(j);
+                    chain.values.push_back(B[i * S + j]);
+                }
+            }
+            chain.rowStarts.push_back((int) chain.columns.size());
+        }
+    }
+
+    chain.powers.resize(2 * S * S, 0.0);
+    for (int i = 0; i < S; i++)
+        chain.powers[i * S + i] = 1.0;
+    memcpy(&chain.powers[S * S], &B[0], sizeof(double) * S * S);
+    chain.powerCount = 2;
+
+    return true;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+bool RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::isRateMatrixSet(int rateMatrixIndex) const {
+    return gChains[rateMatrixIndex].powerCount > 0;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+const double* RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::getRateMatrix(int rateMatrixIndex) const {
+    return (isRateMatrixSet(rateMatrixIndex) ? &gChains[rateMatrixIndex].rates[0] : NULL);
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::getPoissonWeights(double x,
+                                                                        std::vector<double>& weights) const {
+    weights.clear();
+    double w = exp(-x);
+    weights.push_back(w);
+    for (int k = 1; ; k++) {
+        w *= x / k;
+        weights.push_back(w);
+        // past the mode the weights fall at least geometrically with ratio x / (k + 1)
+        if (k > x && w * (k + 1) / (k + 1 - x) < BEAGLE_CPU_UNIFORMIZATION_TOLERANCE)
+            break;
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+int RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::reduceStep(double exitRate,
+                                                                double distance,
+                                                                double* outStep) const {
+    double step = exitRate * distance;
+    int squarings = 0;
+    while (step > BEAGLE_CPU_UNIFORMIZATION_MAX_STEP) {
+        step *= 0.5;
+        squarings++;
+    }
+    *outStep = step;
+    return squarings;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::extendPowers(UniformizedChain& chain,
+                                                                   int powerCount) {
+    const int S = kStateCount;
+    if (chain.powerCount >= powerCount)
+        return;
+
+    chain.powers.resize((size_t) powerCount * S * S);
+    const double* B = &chain.powers[S * S];
+
+    for (int k = chain.powerCount; k < powerCount; k++) {
+        const double* previous = &chain.powers[(size_t) (k - 1) * S * S];
+        double* current = &chain.powers[(size_t) k * S * S];
+
+        if (chain.sparse) {
+            // B^k = B^(k-1) B over the non-zero entries of B
+            for (int i = 0; i < S; i++) {
+                double* row = current + i * S;
+                for (int j = 0; j < S; j++)
+                    row[j] = 0.0;
+                for (int j = 0; j < S; j++) {
+                    const double a = previous[i * S + j];
+                    if (a == 0.0)
+                        continue;
+                    for (int n = chain.rowStarts[j]; n < chain.rowStarts[j + 1]; n++)
+                        row[chain.columns[n]] += a * chain.values[n];
+                }
+            }
+        } else {
+            multiplyDense(previous, B, current);
+        }
+    }
+    chain.powerCount = powerCount;
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::multiplyDense(const double* left,
+                                                                    const double* right,
+                                                                    double* result) const {
+    const int S = kStateCount;
+    for (int i = 0; i < S; i++) {
+        double* row = result + i * S;
+        for (int j = 0; j < S; j++)
+            row[j] = 0.0;
+        for (int k = 0; k < S; k++) {
+            const double a = left[i * S + k];
+            const double* rightRow = right + k * S;
+            for (int j = 0; j < S; j++)
+                row[j] += a * rightRow[j];
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::preparePowers(int rateMatrixIndex,
+                                                                    const double* edgeLengths,
+                                                                    const double* categoryRates,
+                                                                    int categoryCount,
+                                                                    int count) {
+    UniformizedChain& chain = gChains[rateMatrixIndex];
+    std::vector<double> weights;
+
+    int powerCount = 0;
+    for (int u = 0; u < count; u++) {
+        for (int l = 0; l < categoryCount; l++) {
+            double step;
+            reduceStep(chain.exitRate, edgeLengths[u] * categoryRates[l], &step);
+            getPoissonWeights(step, weights);
+            powerCount = std::max(powerCount, (int) weights.size());
+        }
+    }
+
+    extendPowers(chain, powerCount);
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::updateTransitionMatrices(int rateMatrixIndex,
+                                                                               const int* probabilityIndices,
+                                                                               const double* edgeLengths,
+                                                                               const double* categoryRates,
+                                                                               int categoryCount,
+                                                                               REALTYPE** transitionMatrices,
+                                                                               int start,
+                                                                               int end) const {
+    const int S = kStateCount;
+    const UniformizedChain& chain = gChains[rateMatrixIndex];
+
+    std::vector<double> weights;
+    std::vector<double> sum(S * S);
+    std::vector<double> squared(S * S);
+
+    for (int u = start; u < end; u++) {
+        REALTYPE* transitionMat = transitionMatrices[probabilityIndices[u]];
+        int n = 0;
+        for (int l = 0; l < categoryCount; l++) {
+            double step;
+            int squarings = reduceStep(chain.exitRate, edgeLengths[u] * categoryRates[l], &step);
+            getPoissonWeights(step, weights);
+
+            double* P = &sum[0];
+            double* tmp = &squared[0];
+
+            const int termCount = std::min((int) weights.size(), chain.powerCount);
+            for (int i = 0; i < S * S; i++)
+                P[i] = weights[0] * chain.powers[i];
+            for (int k = 1; k < termCount; k++) {
+                const double w = weights[k];
+                const double* power = &chain.powers[(size_t) k * S * S];
+                for (int i = 0; i < S * S; i++)
+                    P[i] += w * power[i];
+            }
+
+            for (int s = 0; s < squarings; s++) {
+                multiplyDense(P, P, tmp);
+                std::swap(P, tmp);
+            }
+
+            for (int i = 0; i < S; i++) {
+                for (int j = 0; j < S; j++)
+                    transitionMat[n++] = (REALTYPE) P[i * S + j];
+                if (T_PAD != 0) {
+                    transitionMat[n] = 1.0;
+                    n += T_PAD;
+                }
+            }
+        }
+    }
+}
+
+BEAGLE_CPU_EIGEN_TEMPLATE
+void RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>::copyFrom(const RateMatrixExponential<BEAGLE_CPU_EIGEN_GENERIC>* source) {
+    gChains = source->gChains;
+}
+
+}
+}
+
+#endif // _RateMatrixExponential_hpp_
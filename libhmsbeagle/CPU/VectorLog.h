@@ -0,0 +1,80 @@
+/*
+ * VectorLog.h
+ *
+ *  Natural logarithm over arrays of site likelihoods, written without branches or library
+ *  calls so that the compiler vectorizes it across patterns.
+ */
+
+#ifndef VECTORLOG_H_
+#define VECTORLOG_H_
+
+#include <cmath>
+#include <cstring>
+#include <cfloat>
+#include <stdint.h>
+
+/*
+ * Cephes rational approximation of log(x) for positive, normal, finite x; accurate to about
+ * one unit in the last place. Exponent and mantissa are split with integer operations only.
+ */
+inline double beagleLogNormal(double x) {
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+
+    // biased exponent converted exactly through the 2^52 trick
+    uint64_t exponentBits = (bits >> 52) | 0x4330000000000000ULL;
+    double e;
+    memcpy(&e, &exponentBits, sizeof(e));
+    e -= 4503599627370496.0 + 1022.0;
+
+    // mantissa in [0.5, 1)
+    bits = (bits & 0x000fffffffffffffULL) | 0x3fe0000000000000ULL;
+    double m;
+    memcpy(&m, &bits, sizeof(m));
+
+    const bool small = m < 0.70710678118654752440;
+    e = (small ? e - 1.0 : e);
+    const double y = (small ? m + m - 1.0 : m - 1.0);
+
+    const double z = y * y;
+    double p = 1.01875663804580931796E-4;
+    p = p * y + 4.97494994976747001425E-1;
+    p = p * y + 4.70579119878881725854E0;
+    p = p * y + 1.44989225341610930846E1;
+    p = p * y + 1.79368678507819816313E1;
+    p = p * y + 7.70838733755885391666E0;
+    double q = y + 1.12873587189167450590E1;
+    q = q * y + 4.52279145837532221105E1;
+    q = q * y + 8.29875266912776603211E1;
+    q = q * y + 7.11544750618563894466E1;
+    q = q * y + 2.31251620126765340583E1;
+
+    // log(2) is split in two parts so that e * log(2) stays exact
+    double r = y * (z * p / q);
+    r -= e * 2.121944400546905827679E-4;
+    r -= 0.5 * z;
+    return (y + r) + e * 0.693359375;
+}
+
+/*
+ * Replaces each value by its natural logarithm. Zero, negative, subnormal, infinite and NaN
+ * values are rare (unscaled underflow); if any is present the whole array takes std::log.
+ */
+template<typename F>
+inline void beagleLogInPlace(F* values, int length) {
+    int abnormal = 0;
+    for (int i = 0; i < length; i++) {
+        const double x = (double) values[i];
+        abnormal |= !(x >= DBL_MIN && x <= DBL_MAX);
+    }
+
+    if (abnormal) {
+        for (int i = 0; i < length; i++)
+            values[i] = (F) std::log((double) values[i]);
+    } else {
+        for (int i = 0; i < length; i++)
+            values[i] = (F) beagleLogNormal((double) values[i]);
+    }
+}
+
+#endif /* VECTORLOG_H_ */
@@ -106,6 +106,8 @@ private:
     GPUPtr dSumLogLikelihood;
     GPUPtr dSumFirstDeriv;
     GPUPtr dSumSecondDeriv;
+
+    GPUPtr dLogLikelihoodResults[2]; // reduced log likelihoods, synchronous and queued calls
     
     GPUPtr dPatternWeights;    
 	
@@ -136,6 +138,22 @@ private:
     
     GPUPtr* dCompactBuffers;
     GPUPtr* dTipPartialsBuffers;
+
+    // partials are allocated on first use; under a device memory budget internal
+    // buffers share kPartialsSlotCount slots and cold buffers are spilled to the host
+    size_t kDeviceMemoryBudget;
+    size_t kPartialsBufferAllocSize;
+    int kPartialsBufferCountTotal;
+    int kPartialsSlotCount;
+    bool kPartialsAllocated;
+    bool kPartialsPaging;
+    unsigned int kPartialsUseClock;
+    GPUPtr* dPartialsSlots;
+    int* hPartialsSlotOwners;
+    int* hPartialsBufferSlots;
+    unsigned int* hPartialsLastUse;
+    Real** hPartialsSpill;
+    bool* hPartialsSpilled;
     
     bool kUsingMultiGrid;
     int kNumPatternBlocks;
@@ -159,6 +177,7 @@ private:
     GPUPtr  dStatesOrigin;
     GPUPtr  dStatesSortOrigin;
     GPUPtr  dPatternWeightsSort;
+    GPUPtr  dPartitionSumOffsets;
     GPUPtr* dStatesSort;
     unsigned int* hPartialsPtrs;
     unsigned int* hPartitionOffsets;
@@ -183,6 +202,22 @@ private:
     int* hPatternsNewOrder;
     int* hGridOpIndices;
 
+    // multi-grid launch plan of the last updatePartials call, reused while the operation list repeats
+    int* hGridStartOp;
+    int* hGridOpType;
+    int* hGridOpBlocks;
+    int* hGridPlanOperations;
+    int kGridPlanCapacity;
+    int kGridPlanOperationCount;
+    int kGridPlanLaunches;
+    int kGridPlanOpIndexCount;
+    bool kGridPlanByPartition;
+    bool kGridPlanValid;
+
+    std::atomic<bool> kStatisticsEnabled;
+    std::atomic<uint64_t> kStatisticsPatternOperations;
+    std::atomic<uint64_t> kStatisticsRescaleCount;
+
     unsigned int* hPtrQueue;
     
     double** hCategoryRates; // Can keep in double-precision
@@ -194,6 +229,10 @@ private:
     Real* hWeightsCache;
     Real* hFrequenciesCache;
     Real* hLogLikelihoodsCache;
+    Real* hLogLikelihoodResults[2];
+    int* hLogLikelihoodResultsOffsets[2]; // range of entries holding each partition's sum
+    int kLogLikelihoodResultsSize;        // partitions each result buffer can hold
+    int kLogLikelihoodResultsCount[2];
     Real* hPartialsCache;
     int* hStatesCache;
     Real* hMatrixCache;
@@ -202,6 +241,24 @@ private:
     GPUPtr dRescalingTrigger;
     
     GPUPtr* dScalingFactorsMaster;
+
+    // device copies taken by snapshotBuffers; indices lists partials, then scale, then matrix indices
+    struct BufferSnapshot {
+        int* indices;
+        int indicesCapacity;
+        int partialsCount;
+        int scaleCount;
+        int matrixCount;
+        GPUPtr* dPartialsCopies;
+        int partialsCapacity;
+        GPUPtr* dScaleCopies;
+        int scaleCapacity;
+        GPUPtr* dMatrixCopies;
+        int matrixCapacity;
+    };
+
+    BufferSnapshot* hSnapshots;
+    int kSnapshotCount;
     
     int* hStreamIndices;
 
@@ -226,9 +283,38 @@ public:
     
     int getInstanceDetails(BeagleInstanceDetails* retunInfo);
 
+    int setDeviceMemoryBudget(int budgetMegabytes);
+
+    int setTransitionMatrixCacheSize(int cacheSize);
+
+    int setStatisticsEnabled(bool enabled);
+
+    int getStatistics(BeagleInstanceStatistics* outStatistics);
+
+    int copyInstance(BeagleImpl* source);
+
+    int snapshotBuffers(int snapshotIndex,
+                        const int* partialsIndices,
+                        int partialsCount,
+                        const int* scaleIndices,
+                        int scaleCount,
+                        const int* matrixIndices,
+                        int matrixCount);
+
+    int restoreSnapshot(int snapshotIndex);
+
+    int releaseSnapshot(int snapshotIndex);
+
+    int saveInstance(const char* fileName);
+
+    int loadInstance(const char* fileName);
+
     int setTipStates(int tipIndex,
                      const int* inStates);
 
+    int setTipStatesExternal(int tipIndex,
+                             const unsigned char* inStates);
+
     int setTipPartials(int tipIndex,
                        const double* inPartials);
     
@@ -246,6 +332,9 @@ public:
     
     int setStateFrequencies(int stateFrequenciesIndex,
                             const double* inStateFrequencies);    
+
+    int setInvariantSites(double proportionInvariant,
+                          int stateFrequenciesIndex);
     
     int setCategoryWeights(int categoryWeightsIndex,
                            const double* inCategoryWeights);
@@ -281,6 +370,11 @@ public:
                                    const int* resultIndices,
                                    int matrixCount);
 
+    int convolveTransitionMatrixChains(const int* matrixIndices,
+                                       const int* chainLengths,
+                                       const int* resultIndices,
+                                       int chainCount);
+
     int updateTransitionMatrices(int eigenIndex,
                                  const int* probabilityIndices,
                                  const int* firstDerivativeIndices,
@@ -295,7 +389,15 @@ public:
                                                    const int* secondDerivativeIndices,
                                                    const double* edgeLengths,
                                                    int count);
-    
+
+    int setRateMatrix(int rateMatrixIndex,
+                      const double* inRateMatrix);
+
+    int updateTransitionMatricesFromRateMatrix(int rateMatrixIndex,
+                                               const int* probabilityIndices,
+                                               const double* edgeLengths,
+                                               int count);
+
     int updatePartials(const int* operations,
                        int operationCount,
                        int cumulativeScalingIndex);
@@ -350,6 +452,17 @@ public:
                                                int count,
                                                double* outSumLogLikelihoodByPartition,
                                                double* outSumLogLikelihood);
+
+    int calculateRootLogLikelihoodsAsync(const int* bufferIndices,
+                                         const int* categoryWeightsIndices,
+                                         const int* stateFrequenciesIndices,
+                                         const int* cumulativeScaleIndices,
+                                         const int* partitionIndices,
+                                         int partitionCount);
+
+    int getRootLogLikelihoodsAsync(int blocking,
+                                   double* outSumLogLikelihoodByPartition,
+                                   double* outSumLogLikelihood);
     
     int calculateEdgeLogLikelihoods(const int* parentBufferIndices,
                                     const int* childBufferIndices,
@@ -382,6 +495,18 @@ public:
                                                double* outSumSecondDerivativeByPartition,
                                                double* outSumSecondDerivative);
 
+    int prepareEdgeProjection(int parentBufferIndex,
+                              int childBufferIndex,
+                              int eigenIndex,
+                              int categoryWeightsIndex,
+                              int stateFrequenciesIndex,
+                              int cumulativeScaleIndex);
+
+    int calculateEdgeProjectionLogLikelihoods(double edgeLength,
+                                              double* outSumLogLikelihood,
+                                              double* outSumFirstDerivative,
+                                              double* outSumSecondDerivative);
+
     int getSiteLogLikelihoods(double* outLogLikelihoods);
     
     int getSiteDerivatives(double* outFirstDerivatives,
@@ -393,6 +518,32 @@ private:
 
     void  allocateMultiGridBuffers();
 
+    int allocatePartialsBuffers();
+
+    void growSnapshotCopies(GPUPtr** copies,
+                            int* capacity,
+                            int count,
+                            size_t bufferSize);
+
+    void freeSnapshot(BufferSnapshot* snapshot);
+
+    void useMasterScaleFactors(int scaleIndex);
+
+    int touchPartials(int bufferIndex,
+                      bool restore);
+
+    void countOperationStatistics(const int* operations,
+                                  int count,
+                                  bool byPartition);
+
+    int requirePartials(const int* bufferIndices1,
+                        const int* bufferIndices2,
+                        int count);
+
+    // checks a partition list against the partitions set and the log likelihood result buffer
+    int checkPartitionIndices(const int* partitionIndices,
+                              int partitionCount);
+
     int  reorderPatternsByPartition();
 
     int upPartials(bool byPartition,
@@ -400,6 +551,38 @@ private:
                    int operationCount,
                    int cumulativeScalingIndex);
 
+    void allocateLogLikelihoodResults(int count);
+
+    int integrateRootLikelihoods(const int* bufferIndices,
+                                 const int* categoryWeightsIndices,
+                                 const int* stateFrequenciesIndices,
+                                 const int* cumulativeScaleIndices);
+
+    int integrateRootLikelihoodsByPartition(const int* bufferIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* cumulativeScaleIndices,
+                                            const int* partitionIndices,
+                                            int partitionCount);
+
+    // results == 1 selects the buffer of beagleCalculateRootLogLikelihoodsAsync, so that
+    // synchronous calls made before its result is collected do not overwrite it
+    void sumSiteLogLikelihoods(int startPattern,
+                               int endPattern,
+                               int results,
+                               int resultIndex);
+
+    void sumSiteLogLikelihoodsByPartition(const int* partitionIndices,
+                                          int partitionCount,
+                                          int results);
+
+    void queueLogLikelihoodResults(int results,
+                                   int count);
+
+    int readLogLikelihoodResults(int results,
+                                 double* outSumLogLikelihoodByPartition,
+                                 double* outSumLogLikelihood);
+
 };
 
 BEAGLE_GPU_TEMPLATE
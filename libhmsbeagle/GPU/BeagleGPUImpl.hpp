@@ -69,6 +69,9 @@ BeagleGPUImpl<BEAGLE_GPU_GENERIC>::BeagleGPUImpl() {
     dSumLogLikelihood = (GPUPtr)NULL;
     dSumFirstDeriv = (GPUPtr)NULL;
     dSumSecondDeriv = (GPUPtr)NULL;
+
+    dLogLikelihoodResults[0] = (GPUPtr)NULL;
+    dLogLikelihoodResults[1] = (GPUPtr)NULL;
     
     dPatternWeights = (GPUPtr)NULL;    
     
@@ -109,6 +112,13 @@ BeagleGPUImpl<BEAGLE_GPU_GENERIC>::BeagleGPUImpl() {
     hWeightsCache = NULL;
     hFrequenciesCache = NULL;
     hLogLikelihoodsCache = NULL;
+    hLogLikelihoodResults[0] = NULL;
+    hLogLikelihoodResults[1] = NULL;
+    hLogLikelihoodResultsOffsets[0] = NULL;
+    hLogLikelihoodResultsOffsets[1] = NULL;
+    kLogLikelihoodResultsSize = 0;
+    kLogLikelihoodResultsCount[0] = 0;
+    kLogLikelihoodResultsCount[1] = 0;
     hPartialsCache = NULL;
     hStatesCache = NULL;
     hMatrixCache = NULL;
@@ -116,6 +126,31 @@ BeagleGPUImpl<BEAGLE_GPU_GENERIC>::BeagleGPUImpl() {
     hRescalingTrigger = NULL;
     dRescalingTrigger = (GPUPtr)NULL;
     dScalingFactorsMaster = NULL;
+
+    hSnapshots = NULL;
+    kSnapshotCount = 0;
+
+    kDeviceMemoryBudget = 0;
+    kPartialsAllocated = false;
+    kPartialsPaging = false;
+    kPartialsUseClock = 0;
+    dPartialsSlots = NULL;
+    hPartialsSlotOwners = NULL;
+    hPartialsBufferSlots = NULL;
+    hPartialsLastUse = NULL;
+    hPartialsSpill = NULL;
+    hPartialsSpilled = NULL;
+
+    hGridStartOp = NULL;
+    hGridOpType = NULL;
+    hGridOpBlocks = NULL;
+    hGridPlanOperations = NULL;
+    kGridPlanCapacity = 0;
+    kGridPlanValid = false;
+
+    kStatisticsEnabled = false;
+    kStatisticsPatternOperations = 0;
+    kStatisticsRescaleCount = 0;
     
 }
 
@@ -156,6 +191,7 @@ BeagleGPUImpl<BEAGLE_GPU_GENERIC>::~BeagleGPUImpl() {
             free(hIntegratePartitionsStartBlocks);
             free(hPatternPartitionsStartBlocks);
             free(hIntegratePartitionOffsets);
+            gpu->FreeMemory(dPartitionSumOffsets);
             if (kPatternsReordered) {
                 free(hPatternsNewOrder);
                 gpu->FreeMemory(dPatternsNewOrder);
@@ -184,7 +220,35 @@ BeagleGPUImpl<BEAGLE_GPU_GENERIC>::~BeagleGPUImpl() {
             free(hGridOpIndices);
         }
 
-        gpu->FreeMemory(dPartialsOrigin);
+        free(hGridStartOp);
+        free(hGridOpType);
+        free(hGridOpBlocks);
+        free(hGridPlanOperations);
+
+        for (int i = 0; i < kSnapshotCount; i++)
+            freeSnapshot(&hSnapshots[i]);
+        free(hSnapshots);
+
+        if (kPartialsAllocated)
+            gpu->FreeMemory(dPartialsOrigin);
+
+        if (kPartialsPaging) {
+            for (int i = 0; i < kBufferCount; i++) {
+                if (hPartialsSpill[i] != NULL) {
+#ifdef CUDA
+                    gpu->FreePinnedHostMemory(hPartialsSpill[i]);
+#else
+                    gpu->FreeHostMemory(hPartialsSpill[i]);
+#endif
+                }
+            }
+            free(hPartialsSpill);
+            free(hPartialsSpilled);
+            free(hPartialsLastUse);
+            free(hPartialsBufferSlots);
+            free(hPartialsSlotOwners);
+            free(dPartialsSlots);
+        }
 
         if (kCompactBufferCount > 0)
             gpu->FreeMemory(dStatesOrigin);
@@ -199,6 +263,18 @@ BeagleGPUImpl<BEAGLE_GPU_GENERIC>::~BeagleGPUImpl() {
         gpu->FreeMemory(dSumLogLikelihood);
         gpu->FreeMemory(dSumFirstDeriv);
         gpu->FreeMemory(dSumSecondDeriv);
+
+        for (int i = 0; i < 2; i++) {
+            if (hLogLikelihoodResults[i] != NULL) {
+#ifdef CUDA
+                gpu->FreePinnedHostMemory(hLogLikelihoodResults[i]);
+#else
+                gpu->FreeMemory(dLogLikelihoodResults[i]);
+                gpu->FreeHostMemory(hLogLikelihoodResults[i]);
+#endif
+                free(hLogLikelihoodResultsOffsets[i]);
+            }
+        }
         
         gpu->FreeMemory(dPatternWeights);
 
@@ -373,6 +449,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::createInstance(int tipCount,
     if (kDeviceCode == BEAGLE_OPENCL_DEVICE_INTEL_CPU ||
         kDeviceCode == BEAGLE_OPENCL_DEVICE_INTEL_MIC ||
         kDeviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU ||
+        kDeviceCode == BEAGLE_OPENCL_DEVICE_POCL_CPU ||
         kDeviceCode == BEAGLE_OPENCL_DEVICE_APPLE_CPU) {
         
         CPUImpl = true;
@@ -621,6 +698,8 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::createInstance(int tipCount,
     dSumLogLikelihood = gpu->AllocateMemory(kSumSitesBlockCount * sizeof(Real));
     dSumFirstDeriv = gpu->AllocateMemory(kSumSitesBlockCount * sizeof(Real));
     dSumSecondDeriv = gpu->AllocateMemory(kSumSitesBlockCount * sizeof(Real));
+
+    allocateLogLikelihoodResults(1);
     
     dPartialsTmp = gpu->AllocateMemory(kPartialsSize * sizeof(Real));
     dFirstDerivTmp = gpu->AllocateMemory(kPartialsSize * sizeof(Real));
@@ -633,9 +712,9 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::createInstance(int tipCount,
     // Fill with 0s so 'free' does not choke if unallocated
     dPartials = (GPUPtr*) calloc(sizeof(GPUPtr), bufferCountTotal);
 
-    ptrIncrement = gpu->AlignMemOffset(kPartialsSize * sizeof(Real));
-    GPUPtr dPartialsTmpOrigin = gpu->AllocateMemory(bufferCountTotal * ptrIncrement); 
-    dPartialsOrigin = gpu->CreateSubPointer(dPartialsTmpOrigin, 0, ptrIncrement);
+    // the partials arena itself is allocated on first use, see allocatePartialsBuffers()
+    kPartialsBufferAllocSize = gpu->AlignMemOffset(kPartialsSize * sizeof(Real));
+    kPartialsBufferCountTotal = bufferCountTotal;
     hPartialsOffsets = (unsigned int*) calloc(sizeof(unsigned int), bufferCountTotal);
     kIndexOffsetPat = gpu->AlignMemOffset(kPartialsSize * sizeof(Real)) / sizeof(Real);
 
@@ -657,19 +736,8 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::createInstance(int tipCount,
     
     hStreamIndices = (int*) malloc(sizeof(int) * kBufferCount);
 
-    for (int i = 0; i < bufferCountTotal; i++) {
-        if (i < kTipCount) { // For the tips
-            if (i < kCompactBufferCount) {
-                dCompactBuffers[i] = gpu->CreateSubPointer(dStatesTmpOrigin, ptrIncrementStates*i, ptrIncrementStates);
-            }
-            if (i < kTipPartialsBufferCount) {
-                dTipPartialsBuffers[i] = gpu->CreateSubPointer(dPartialsTmpOrigin, ptrIncrement*i, ptrIncrement);
-            }
-        } else {
-            int partialsSubIndex = i - (kTipCount - kTipPartialsBufferCount);
-            dPartials[i] = gpu->CreateSubPointer(dPartialsTmpOrigin, ptrIncrement*partialsSubIndex, ptrIncrement);
-            hPartialsOffsets[i] = kIndexOffsetPat*partialsSubIndex;
-        }
+    for (int i = 0; i < kTipCount && i < kCompactBufferCount; i++) {
+        dCompactBuffers[i] = gpu->CreateSubPointer(dStatesTmpOrigin, ptrIncrementStates*i, ptrIncrementStates);
     }
     
     kLastCompactBufferIndex = kCompactBufferCount - 1;
@@ -772,6 +840,180 @@ void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::allocateMultiGridBuffers() {
     hGridOpIndices = (int*) malloc(sizeof(int) * kInternalPartialsBufferCount * (ptrsPerOp-2));
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::allocatePartialsBuffers() {
+    if (kPartialsAllocated)
+        return BEAGLE_SUCCESS;
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tEntering BeagleGPUImpl::allocatePartialsBuffers\n");
+#endif
+
+    size_t ptrIncrement = kPartialsBufferAllocSize;
+
+    int slotCount = kPartialsBufferCountTotal;
+    if (kDeviceMemoryBudget > 0 && kDeviceMemoryBudget / ptrIncrement < (size_t) slotCount) {
+        slotCount = (int) (kDeviceMemoryBudget / ptrIncrement);
+        // room for the tip partials plus the parent and both children of one operation
+        if (slotCount < kTipPartialsBufferCount + 3)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+        kPartialsPaging = true;
+    }
+
+    GPUPtr dPartialsTmpOrigin = gpu->AllocateMemory(slotCount * ptrIncrement);
+    dPartialsOrigin = gpu->CreateSubPointer(dPartialsTmpOrigin, 0, ptrIncrement);
+
+    for (int i = 0; i < kTipPartialsBufferCount; i++) {
+        dTipPartialsBuffers[i] = gpu->CreateSubPointer(dPartialsTmpOrigin, ptrIncrement*i, ptrIncrement);
+    }
+
+    if (!kPartialsPaging) {
+        for (int i = kTipCount; i < kPartialsBufferCountTotal; i++) {
+            int partialsSubIndex = i - (kTipCount - kTipPartialsBufferCount);
+            dPartials[i] = gpu->CreateSubPointer(dPartialsTmpOrigin, ptrIncrement*partialsSubIndex, ptrIncrement);
+            hPartialsOffsets[i] = kIndexOffsetPat*partialsSubIndex;
+        }
+    } else {
+        kPartialsSlotCount = slotCount;
+        dPartialsSlots = (GPUPtr*) calloc(sizeof(GPUPtr), kPartialsSlotCount);
+        hPartialsSlotOwners = (int*) malloc(sizeof(int) * kPartialsSlotCount);
+        checkHostMemory(hPartialsSlotOwners);
+        for (int s = kTipPartialsBufferCount; s < kPartialsSlotCount; s++) {
+            dPartialsSlots[s] = gpu->CreateSubPointer(dPartialsTmpOrigin, ptrIncrement*s, ptrIncrement);
+            hPartialsSlotOwners[s] = -1;
+        }
+
+        hPartialsBufferSlots = (int*) malloc(sizeof(int) * kBufferCount);
+        checkHostMemory(hPartialsBufferSlots);
+        for (int i = 0; i < kBufferCount; i++)
+            hPartialsBufferSlots[i] = -1;
+        hPartialsLastUse = (unsigned int*) calloc(sizeof(unsigned int), kBufferCount);
+        hPartialsSpill = (Real**) calloc(sizeof(Real*), kBufferCount);
+        hPartialsSpilled = (bool*) calloc(sizeof(bool), kBufferCount);
+        kPartialsUseClock = 0;
+    }
+
+    kPartialsAllocated = true;
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tLeaving  BeagleGPUImpl::allocatePartialsBuffers\n");
+#endif
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::touchPartials(int bufferIndex,
+                                                     bool restore) {
+    if (!kPartialsPaging || bufferIndex < kTipCount)
+        return BEAGLE_SUCCESS;
+
+    hPartialsLastUse[bufferIndex] = kPartialsUseClock;
+
+    if (hPartialsBufferSlots[bufferIndex] >= 0)
+        return BEAGLE_SUCCESS;
+
+    int slot = -1;
+    for (int s = kTipPartialsBufferCount; s < kPartialsSlotCount; s++) {
+        if (hPartialsSlotOwners[s] == -1) {
+            slot = s;
+            break;
+        }
+    }
+
+    if (slot == -1) {
+        // evict the least recently used buffer not needed by the current call
+        unsigned int oldestUse = kPartialsUseClock;
+        for (int s = kTipPartialsBufferCount; s < kPartialsSlotCount; s++) {
+            if (hPartialsLastUse[hPartialsSlotOwners[s]] < oldestUse) {
+                oldestUse = hPartialsLastUse[hPartialsSlotOwners[s]];
+                slot = s;
+            }
+        }
+        if (slot == -1)
+            return BEAGLE_ERROR_OUT_OF_MEMORY;
+
+        int victim = hPartialsSlotOwners[slot];
+        if (hPartialsSpill[victim] == NULL) {
+#ifdef CUDA
+            hPartialsSpill[victim] = (Real*) gpu->AllocatePinnedHostMemory(sizeof(Real) * kPartialsSize, false, false);
+#else
+            hPartialsSpill[victim] = (Real*) gpu->MallocHost(sizeof(Real) * kPartialsSize);
+#endif
+            checkHostMemory(hPartialsSpill[victim]);
+        }
+        gpu->MemcpyDeviceToHost(hPartialsSpill[victim], dPartialsSlots[slot], sizeof(Real) * kPartialsSize);
+        hPartialsSpilled[victim] = true;
+        hPartialsBufferSlots[victim] = -1;
+        dPartials[victim] = (GPUPtr)NULL;
+    }
+
+    hPartialsSlotOwners[slot] = bufferIndex;
+    hPartialsBufferSlots[bufferIndex] = slot;
+    dPartials[bufferIndex] = dPartialsSlots[slot];
+    hPartialsOffsets[bufferIndex] = kIndexOffsetPat*slot;
+    kGridPlanValid = false;
+
+    if (restore && hPartialsSpilled[bufferIndex])
+        gpu->MemcpyHostToDevice(dPartials[bufferIndex], hPartialsSpill[bufferIndex], sizeof(Real) * kPartialsSize);
+    hPartialsSpilled[bufferIndex] = false;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::countOperationStatistics(const int* operations,
+                                                                 int count,
+                                                                 bool byPartition) {
+    int numOps = (byPartition ? BEAGLE_PARTITION_OP_COUNT : BEAGLE_OP_COUNT);
+
+    for (int op = 0; op < count; op++) {
+        int patternCount = kPatternCount;
+        if (byPartition) {
+            int currentPartition = operations[op * numOps + 7];
+            patternCount = hPatternPartitionsStartPatterns[currentPartition + 1] -
+                           hPatternPartitionsStartPatterns[currentPartition];
+        }
+        kStatisticsPatternOperations.fetch_add(patternCount, std::memory_order_relaxed);
+
+        if ((kFlags & BEAGLE_FLAG_SCALING_ALWAYS) || operations[op * numOps + 1] >= 0)
+            kStatisticsRescaleCount.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::requirePartials(const int* bufferIndices1,
+                                                       const int* bufferIndices2,
+                                                       int count) {
+    int returnCode = allocatePartialsBuffers();
+    if (returnCode != BEAGLE_SUCCESS || !kPartialsPaging)
+        return returnCode;
+
+    kPartialsUseClock++;
+    for (int i = 0; i < count && returnCode == BEAGLE_SUCCESS; i++) {
+        returnCode = touchPartials(bufferIndices1[i], true);
+        if (bufferIndices2 != NULL && returnCode == BEAGLE_SUCCESS)
+            returnCode = touchPartials(bufferIndices2[i], true);
+    }
+
+    return returnCode;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::checkPartitionIndices(const int* partitionIndices,
+                                                             int partitionCount) {
+    if (!kPartitionsInitialised || partitionIndices == NULL || partitionCount < 1 ||
+        partitionCount > kPartitionCount || partitionCount > kLogLikelihoodResultsSize)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    for (int p = 0; p < partitionCount; p++) {
+        if (partitionIndices[p] < 0 || partitionIndices[p] >= kPartitionCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
 #ifdef CUDA
 template<>
 char* BeagleGPUImpl<double>::getInstanceName() {
@@ -794,6 +1036,533 @@ char* BeagleGPUImpl<float>::getInstanceName() {
 }
 #endif
 
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::allocateLogLikelihoodResults(int count) {
+
+    // in single precision the block sums of each partition are kept and added on the host
+    // in double, so a buffer holds up to one extra block per partition
+    int length = count;
+    if (!(kFlags & BEAGLE_FLAG_PRECISION_DOUBLE))
+        length += kSumSitesBlockCount;
+
+    if (hLogLikelihoodResults[0] != NULL)
+        gpu->SynchronizeHost();
+
+    for (int i = 0; i < 2; i++) {
+        if (hLogLikelihoodResults[i] != NULL) {
+#ifdef CUDA
+            gpu->FreePinnedHostMemory(hLogLikelihoodResults[i]);
+#else
+            gpu->FreeMemory(dLogLikelihoodResults[i]);
+            gpu->FreeHostMemory(hLogLikelihoodResults[i]);
+#endif
+            free(hLogLikelihoodResultsOffsets[i]);
+        }
+
+#ifdef CUDA
+        // mapped pinned memory, so that the final reduction writes straight into host memory
+        hLogLikelihoodResults[i] = (Real*) gpu->AllocatePinnedHostMemory(length * sizeof(Real), false, true);
+        dLogLikelihoodResults[i] = gpu->GetDeviceHostPointer((void*) hLogLikelihoodResults[i]);
+#else
+        dLogLikelihoodResults[i] = gpu->AllocateMemory(length * sizeof(Real));
+        hLogLikelihoodResults[i] = (Real*) gpu->MallocHost(length * sizeof(Real));
+#endif
+
+        hLogLikelihoodResultsOffsets[i] = (int*) calloc(count + 1, sizeof(int));
+        checkHostMemory(hLogLikelihoodResultsOffsets[i]);
+
+        kLogLikelihoodResultsCount[i] = 0;
+    }
+
+    kLogLikelihoodResultsSize = count;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::integrateRootLikelihoods(const int* bufferIndices,
+                                                                const int* categoryWeightsIndices,
+                                                                const int* stateFrequenciesIndices,
+                                                                const int* cumulativeScaleIndices) {
+
+    const int rootNodeIndex = bufferIndices[0];
+    const int categoryWeightsIndex = categoryWeightsIndices[0];
+    const int stateFrequenciesIndex = stateFrequenciesIndices[0];
+    
+
+    GPUPtr dCumulativeScalingFactor;
+    bool scale = 1;
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        dCumulativeScalingFactor = dAccumulatedScalingFactors;
+    else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
+        dCumulativeScalingFactor = dScalingFactors[bufferIndices[0] - kTipCount];
+    else if (cumulativeScaleIndices[0] != BEAGLE_OP_NONE)
+        dCumulativeScalingFactor = dScalingFactors[cumulativeScaleIndices[0]];
+    else
+        scale = 0;
+
+#ifdef BEAGLE_DEBUG_VALUES
+    Real r = 0;
+    fprintf(stderr,"root partials = \n");
+    gpu->PrintfDeviceVector(dPartials[rootNodeIndex], kPaddedPatternCount, r);
+#endif
+
+    if (scale) {
+        kernels->IntegrateLikelihoodsDynamicScaling(dIntegrationTmp, dPartials[rootNodeIndex],
+                                                    dWeights[categoryWeightsIndex],
+                                                    dFrequencies[stateFrequenciesIndex],
+                                                    dCumulativeScalingFactor,
+                                                    kPaddedPatternCount,
+                                                    kCategoryCount);
+    } else {
+        kernels->IntegrateLikelihoods(dIntegrationTmp, dPartials[rootNodeIndex],
+                                      dWeights[categoryWeightsIndex],
+                                      dFrequencies[stateFrequenciesIndex],
+                                      kPaddedPatternCount, kCategoryCount);
+    }
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::integrateRootLikelihoodsByPartition(const int* bufferIndices,
+                                                                           const int* categoryWeightsIndices,
+                                                                           const int* stateFrequenciesIndices,
+                                                                           const int* cumulativeScaleIndices,
+                                                                           const int* partitionIndices,
+                                                                           int partitionCount) {
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO || kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    int gridOpIndex = 0;
+    int gridSize = 0;
+    kGridPlanValid = false; // the offsets below overwrite the updatePartials launch plan
+
+    int scale = 0;
+
+    for (int p = 0; p < partitionCount; p++) {
+        int pIndex = partitionIndices[p];
+
+        int startBlock = hIntegratePartitionsStartBlocks[pIndex];
+        int endBlock = hIntegratePartitionsStartBlocks[pIndex+1];
+
+        gridSize += endBlock - startBlock;
+
+        const int rootNodeIndex = bufferIndices[p];
+        const int categoryWeightsIndex = categoryWeightsIndices[p];
+        const int stateFrequenciesIndex = stateFrequenciesIndices[p];
+              int cumulativeScalingIndex = 0;
+
+        if (cumulativeScaleIndices[p] != BEAGLE_OP_NONE) {
+            if (scale == -1) {
+                return BEAGLE_ERROR_NO_IMPLEMENTATION;
+            }
+            cumulativeScalingIndex = cumulativeScaleIndices[p];
+            scale = 1;
+        } else {
+            if (scale == 1) {
+                return BEAGLE_ERROR_NO_IMPLEMENTATION;
+            }
+            scale = -1;
+        }
+
+        unsigned int rNOff      = hPartialsOffsets[rootNodeIndex];
+        unsigned int cWOff      = categoryWeightsIndex  * kWeightsOffset;
+        unsigned int sFOff      = stateFrequenciesIndex * kFrequenciesOffset;
+        unsigned int scaleOff   = cumulativeScalingIndex * kScaleBufferSize;
+
+        for (int i=startBlock; i < endBlock; i++) {
+            hPartialsPtrs[gridOpIndex++] = hIntegratePartitionOffsets[i*2];
+            hPartialsPtrs[gridOpIndex++] = hIntegratePartitionOffsets[i*2+1];
+            hPartialsPtrs[gridOpIndex++] = rNOff;
+            hPartialsPtrs[gridOpIndex++] = cWOff;
+            hPartialsPtrs[gridOpIndex++] = sFOff;
+            hPartialsPtrs[gridOpIndex++] = scaleOff;
+        }
+    }
+
+    size_t transferSize = sizeof(unsigned int) * gridOpIndex;
+    #ifdef FW_OPENCL
+    gpu->UnmapMemory(dPartialsPtrs, hPartialsPtrs);
+    #else
+    gpu->MemcpyHostToDevice(dPartialsPtrs, hPartialsPtrs, transferSize);
+    #endif
+
+    if (scale == 1) {
+        kernels->IntegrateLikelihoodsDynamicScalingPartition(dIntegrationTmp,
+                                                             dPartialsOrigin,
+                                                             dWeights[0],
+                                                             dFrequencies[0],
+                                                             dScalingFactors[0],
+                                                             dPartialsPtrs,
+                                                             kPaddedPatternCount,
+                                                             kCategoryCount,
+                                                             gridSize);
+    } else {
+        kernels->IntegrateLikelihoodsPartition(dIntegrationTmp,
+                                               dPartialsOrigin,
+                                               dWeights[0],
+                                               dFrequencies[0],
+                                               dPartialsPtrs,
+                                               kPaddedPatternCount,
+                                               kCategoryCount,
+                                               gridSize);
+    }
+
+    #ifdef FW_OPENCL
+    hPartialsPtrs = (unsigned int*)gpu->MapMemory(dPartialsPtrs, kOpOffsetsSize);
+    #endif
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::sumSiteLogLikelihoods(int startPattern,
+                                                              int endPattern,
+                                                              int results,
+                                                              int resultIndex) {
+    int blockCount;
+
+    if (startPattern == 0 && endPattern == kPatternCount) {
+        kernels->SumSites1(dIntegrationTmp, dSumLogLikelihood, dPatternWeights,
+                           kPatternCount);
+        blockCount = kSumSitesBlockCount;
+    } else {
+        int partitionPatternCount = endPattern - startPattern;
+        blockCount = partitionPatternCount / kSumSitesBlockSize;
+        if (partitionPatternCount % kSumSitesBlockSize != 0)
+            blockCount += 1;
+
+        kernels->SumSites1Partition(dIntegrationTmp,
+                                    dSumLogLikelihood,
+                                    dPatternWeights,
+                                    startPattern,
+                                    endPattern,
+                                    blockCount);
+    }
+
+    // second stage stays on the device; dSumLogLikelihood can be reused by the next partition
+    int* offsets = hLogLikelihoodResultsOffsets[results];
+    kernels->SumSitesFinal(dSumLogLikelihood, dLogLikelihoodResults[results], blockCount,
+                           offsets[resultIndex]);
+    if (kFlags & BEAGLE_FLAG_PRECISION_DOUBLE)
+        offsets[resultIndex + 1] = offsets[resultIndex] + 1;
+    else
+        offsets[resultIndex + 1] = offsets[resultIndex] + blockCount;
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::sumSiteLogLikelihoodsByPartition(const int* partitionIndices,
+                                                                         int partitionCount,
+                                                                         int results) {
+    bool allPartitionsInOrder = (partitionCount == kPartitionCount);
+    for (int p = 0; p < partitionCount && allPartitionsInOrder; p++) {
+        if (partitionIndices[p] != p)
+            allPartitionsInOrder = false;
+    }
+
+    if (allPartitionsInOrder && (kFlags & BEAGLE_FLAG_PRECISION_DOUBLE)) {
+        // batched instances: every partition reduced by one launch
+        kernels->SumSitesByPartition(dIntegrationTmp, dLogLikelihoodResults[results], dPatternWeights,
+                                     dPartitionSumOffsets, partitionCount);
+        for (int p = 0; p <= partitionCount; p++)
+            hLogLikelihoodResultsOffsets[results][p] = p;
+    } else {
+        for (int p = 0; p < partitionCount; p++) {
+            int pIndex = partitionIndices[p];
+            sumSiteLogLikelihoods(hPatternPartitionsStartPatterns[pIndex],
+                                  hPatternPartitionsStartPatterns[pIndex + 1],
+                                  results, p);
+        }
+    }
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::queueLogLikelihoodResults(int results,
+                                                                  int count) {
+#ifndef CUDA
+    gpu->MemcpyDeviceToHostAsync(hLogLikelihoodResults[results], dLogLikelihoodResults[results],
+                                 sizeof(Real) * hLogLikelihoodResultsOffsets[results][count]);
+#endif
+    gpu->RecordCompletionEvent();
+
+    kLogLikelihoodResultsCount[results] = count;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::readLogLikelihoodResults(int results,
+                                                                double* outSumLogLikelihoodByPartition,
+                                                                double* outSumLogLikelihood) {
+    int returnCode = BEAGLE_SUCCESS;
+
+    const Real* hResults = hLogLikelihoodResults[results];
+    const int* offsets = hLogLikelihoodResultsOffsets[results];
+
+    *outSumLogLikelihood = 0.0;
+    for (int p = 0; p < kLogLikelihoodResultsCount[results]; p++) {
+        double sumLogLikelihood = 0.0;
+        for (int i = offsets[p]; i < offsets[p + 1]; i++) {
+            if (hResults[i] != hResults[i])
+                returnCode = BEAGLE_ERROR_FLOATING_POINT;
+            sumLogLikelihood += hResults[i];
+        }
+        if (outSumLogLikelihoodByPartition != NULL)
+            outSumLogLikelihoodByPartition[p] = sumLogLikelihood;
+        *outSumLogLikelihood += sumLogLikelihood;
+    }
+
+    return returnCode;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setDeviceMemoryBudget(int budgetMegabytes) {
+    if (budgetMegabytes < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // the budget only shapes the partials arena, which must not exist yet
+    if (kPartialsAllocated)
+        return BEAGLE_ERROR_GENERAL;
+
+    kDeviceMemoryBudget = (size_t) budgetMegabytes * 1024 * 1024;
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTransitionMatrixCacheSize(int cacheSize) {
+    // all matrices of a call are computed by one kernel launch, which is cheaper than copying
+    // cached matrices into place one at a time
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setStatisticsEnabled(bool enabled) {
+    kStatisticsPatternOperations.store(0, std::memory_order_relaxed);
+    kStatisticsRescaleCount.store(0, std::memory_order_relaxed);
+    gpu->SetStatisticsEnabled(enabled);
+    kStatisticsEnabled.store(enabled, std::memory_order_relaxed);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getStatistics(BeagleInstanceStatistics* outStatistics) {
+    outStatistics->patternOperations = (double) kStatisticsPatternOperations.load(std::memory_order_relaxed);
+    outStatistics->rescaleCount = (long) kStatisticsRescaleCount.load(std::memory_order_relaxed);
+    outStatistics->bytesTransferred = gpu->GetBytesTransferred();
+    outStatistics->deviceWaitTime = gpu->GetWaitTime();
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::copyInstance(BeagleImpl* source) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::snapshotBuffers(int snapshotIndex,
+                                                       const int* partialsIndices,
+                                                       int partialsCount,
+                                                       const int* scaleIndices,
+                                                       int scaleCount,
+                                                       const int* matrixIndices,
+                                                       int matrixCount) {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tEntering BeagleGPUImpl::snapshotBuffers\n");
+#endif
+
+    if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+
+    if (snapshotIndex < 0 || partialsCount < 0 || scaleCount < 0 || matrixCount < 0)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    int returnCode = allocatePartialsBuffers();
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    for (int i = 0; i < partialsCount; i++) {
+        int bufferIndex = partialsIndices[i];
+        if (bufferIndex < 0 || bufferIndex >= kBufferCount ||
+            (bufferIndex < kTipCount && dPartials[bufferIndex] == 0))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    for (int i = 0; i < scaleCount; i++) {
+        if (scaleIndices[i] < 0 || scaleIndices[i] >= kScaleBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    for (int i = 0; i < matrixCount; i++) {
+        if (matrixIndices[i] < 0 || matrixIndices[i] >= kMatrixCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    if (snapshotIndex >= kSnapshotCount) {
+        BufferSnapshot* snapshots = (BufferSnapshot*) realloc(hSnapshots, sizeof(BufferSnapshot) * (snapshotIndex + 1));
+        checkHostMemory(snapshots);
+        memset(snapshots + kSnapshotCount, 0, sizeof(BufferSnapshot) * (snapshotIndex + 1 - kSnapshotCount));
+        hSnapshots = snapshots;
+        kSnapshotCount = snapshotIndex + 1;
+    }
+
+    BufferSnapshot* snapshot = &hSnapshots[snapshotIndex];
+
+    // device copies are kept between snapshots and only grow
+    int indexCount = partialsCount + scaleCount + matrixCount;
+    if (indexCount > snapshot->indicesCapacity) {
+        free(snapshot->indices);
+        snapshot->indices = (int*) malloc(sizeof(int) * indexCount);
+        checkHostMemory(snapshot->indices);
+        snapshot->indicesCapacity = indexCount;
+    }
+    growSnapshotCopies(&snapshot->dPartialsCopies, &snapshot->partialsCapacity, partialsCount,
+                       sizeof(Real) * kPartialsSize);
+    growSnapshotCopies(&snapshot->dScaleCopies, &snapshot->scaleCapacity, scaleCount,
+                       sizeof(Real) * kScaleBufferSize);
+    growSnapshotCopies(&snapshot->dMatrixCopies, &snapshot->matrixCapacity, matrixCount,
+                       sizeof(Real) * kMatrixSize * kCategoryCount);
+
+    snapshot->partialsCount = partialsCount;
+    snapshot->scaleCount = scaleCount;
+    snapshot->matrixCount = matrixCount;
+    memcpy(snapshot->indices, partialsIndices, sizeof(int) * partialsCount);
+    memcpy(snapshot->indices + partialsCount, scaleIndices, sizeof(int) * scaleCount);
+    memcpy(snapshot->indices + partialsCount + scaleCount, matrixIndices, sizeof(int) * matrixCount);
+
+    kPartialsUseClock++;
+    for (int i = 0; i < partialsCount; i++) {
+        returnCode = touchPartials(partialsIndices[i], true);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+        gpu->MemcpyDeviceToDevice(snapshot->dPartialsCopies[i], dPartials[partialsIndices[i]],
+                                  sizeof(Real) * kPartialsSize);
+    }
+    for (int i = 0; i < scaleCount; i++) {
+        if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC && dScalingFactors[scaleIndices[i]] == 0)
+            useMasterScaleFactors(scaleIndices[i]);
+        gpu->MemcpyDeviceToDevice(snapshot->dScaleCopies[i], dScalingFactors[scaleIndices[i]],
+                                  sizeof(Real) * kScaleBufferSize);
+    }
+    for (int i = 0; i < matrixCount; i++) {
+        gpu->MemcpyDeviceToDevice(snapshot->dMatrixCopies[i], dMatrices[matrixIndices[i]],
+                                  sizeof(Real) * kMatrixSize * kCategoryCount);
+    }
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tLeaving  BeagleGPUImpl::snapshotBuffers\n");
+#endif
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::restoreSnapshot(int snapshotIndex) {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tEntering BeagleGPUImpl::restoreSnapshot\n");
+#endif
+
+    if (snapshotIndex < 0 || snapshotIndex >= kSnapshotCount || hSnapshots[snapshotIndex].indices == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    const BufferSnapshot* snapshot = &hSnapshots[snapshotIndex];
+    const int* indices = snapshot->indices;
+
+    kPartialsUseClock++;
+    for (int i = 0; i < snapshot->partialsCount; i++) {
+        int returnCode = touchPartials(indices[i], false);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+        gpu->MemcpyDeviceToDevice(dPartials[indices[i]], snapshot->dPartialsCopies[i],
+                                  sizeof(Real) * kPartialsSize);
+    }
+    indices += snapshot->partialsCount;
+    for (int i = 0; i < snapshot->scaleCount; i++) {
+        // a dynamically rescaled buffer may currently alias another one; restore into its own storage
+        if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC)
+            useMasterScaleFactors(indices[i]);
+        gpu->MemcpyDeviceToDevice(dScalingFactors[indices[i]], snapshot->dScaleCopies[i],
+                                  sizeof(Real) * kScaleBufferSize);
+    }
+    indices += snapshot->scaleCount;
+    for (int i = 0; i < snapshot->matrixCount; i++) {
+        gpu->MemcpyDeviceToDevice(dMatrices[indices[i]], snapshot->dMatrixCopies[i],
+                                  sizeof(Real) * kMatrixSize * kCategoryCount);
+    }
+
+#ifdef BEAGLE_DEBUG_SYNCH
+    gpu->SynchronizeHost();
+#endif
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tLeaving  BeagleGPUImpl::restoreSnapshot\n");
+#endif
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::releaseSnapshot(int snapshotIndex) {
+    if (snapshotIndex < 0 || snapshotIndex >= kSnapshotCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    freeSnapshot(&hSnapshots[snapshotIndex]);
+
+    return BEAGLE_SUCCESS;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::saveInstance(const char* fileName) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::loadInstance(const char* fileName) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::growSnapshotCopies(GPUPtr** copies,
+                                                           int* capacity,
+                                                           int count,
+                                                           size_t bufferSize) {
+    if (count <= *capacity)
+        return;
+
+    // separate allocations, as OpenCL buffers cannot be offset into
+    GPUPtr* grown = (GPUPtr*) realloc(*copies, sizeof(GPUPtr) * count);
+    checkHostMemory(grown);
+    for (int i = *capacity; i < count; i++)
+        grown[i] = gpu->AllocateMemory(bufferSize);
+    *copies = grown;
+    *capacity = count;
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::freeSnapshot(BufferSnapshot* snapshot) {
+    for (int i = 0; i < snapshot->partialsCapacity; i++)
+        gpu->FreeMemory(snapshot->dPartialsCopies[i]);
+    for (int i = 0; i < snapshot->scaleCapacity; i++)
+        gpu->FreeMemory(snapshot->dScaleCopies[i]);
+    for (int i = 0; i < snapshot->matrixCapacity; i++)
+        gpu->FreeMemory(snapshot->dMatrixCopies[i]);
+    free(snapshot->dPartialsCopies);
+    free(snapshot->dScaleCopies);
+    free(snapshot->dMatrixCopies);
+    free(snapshot->indices);
+    memset(snapshot, 0, sizeof(BufferSnapshot));
+}
+
+BEAGLE_GPU_TEMPLATE
+void BeagleGPUImpl<BEAGLE_GPU_GENERIC>::useMasterScaleFactors(int scaleIndex) {
+    if (dScalingFactors[scaleIndex] != dScalingFactorsMaster[scaleIndex])
+        dScalingFactors[scaleIndex] = dScalingFactorsMaster[scaleIndex];
+
+    if (dScalingFactors[scaleIndex] == 0) {
+        dScalingFactors[scaleIndex] = gpu->AllocateMemory(kScaleBufferSize * sizeof(Real));
+        dScalingFactorsMaster[scaleIndex] = dScalingFactors[scaleIndex];
+    }
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getInstanceDetails(BeagleInstanceDetails* returnInfo) {
     if (returnInfo != NULL) {
@@ -841,6 +1610,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipStates(int tipIndex,
         dStates[tipIndex] = dCompactBuffers[kLastCompactBufferIndex];
         hStatesOffsets[tipIndex] = kIndexOffsetStates * kLastCompactBufferIndex;
         kLastCompactBufferIndex--;
+        kGridPlanValid = false;
     }
     // Copy to GPU device
     gpu->MemcpyHostToDevice(dStates[tipIndex], hStatesCache, sizeof(int) * kPaddedPatternCount);
@@ -852,6 +1622,14 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipStates(int tipIndex,
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipStatesExternal(int tipIndex,
+                                                            const unsigned char* inStates) {
+    // the states live on the device as 32-bit codes, so the caller's memory is only read once
+    std::vector<int> states(inStates, inStates + kPatternCount);
+    return setTipStates(tipIndex, &states[0]);
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipPartials(int tipIndex,
                                   const double* inPartials) {
@@ -862,6 +1640,10 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipPartials(int tipIndex,
     if (tipIndex < 0 || tipIndex >= kTipCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
+    int returnCode = allocatePartialsBuffers();
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
     const double* inPartialsOffset = inPartials;
     Real* tmpRealPartialsOffset = hPartialsCache;
     for (int i = 0; i < kPatternCount; i++) {
@@ -887,6 +1669,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setTipPartials(int tipIndex,
             dPartials[tipIndex] = dTipPartialsBuffers[kLastTipPartialsBufferIndex];
             hPartialsOffsets[tipIndex] = kIndexOffsetPat*kLastTipPartialsBufferIndex;
             kLastTipPartialsBufferIndex--;
+            kGridPlanValid = false;
         }
     }
     // Copy to GPU device
@@ -909,6 +1692,14 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPartials(int bufferIndex,
     if (bufferIndex < 0 || bufferIndex >= kPartialsBufferCount)
         return BEAGLE_ERROR_OUT_OF_RANGE;
 
+    int returnCode = allocatePartialsBuffers();
+    if (returnCode == BEAGLE_SUCCESS && kPartialsPaging) {
+        kPartialsUseClock++;
+        returnCode = touchPartials(bufferIndex, false);
+    }
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
     const double* inPartialsOffset = inPartials;
     Real* tmpRealPartialsOffset = hPartialsCache;
     for (int l = 0; l < kCategoryCount; l++) {
@@ -932,6 +1723,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPartials(int bufferIndex,
             dPartials[bufferIndex] = dTipPartialsBuffers[kLastTipPartialsBufferIndex];
             hPartialsOffsets[bufferIndex] = kIndexOffsetPat*kLastTipPartialsBufferIndex;
             kLastTipPartialsBufferIndex--;
+            kGridPlanValid = false;
         }
     }
     // Copy to GPU device
@@ -952,6 +1744,10 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getPartials(int bufferIndex,
     fprintf(stderr, "\tEntering BeagleGPUImpl::getPartials\n");
 #endif
 
+    int returnCode = requirePartials(&bufferIndex, NULL, 1);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
     gpu->MemcpyDeviceToHost(hPartialsCache, dPartials[bufferIndex], sizeof(Real) * kPartialsSize);
     
     double* outPartialsOffset = outPartials;
@@ -1095,6 +1891,12 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setStateFrequencies(int stateFrequenciesI
     return BEAGLE_SUCCESS;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setInvariantSites(double proportionInvariant,
+                                                         int stateFrequenciesIndex) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setCategoryWeights(int categoryWeightsIndex,
                                       const double* inCategoryWeights) {
@@ -1216,6 +2018,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPatternPartitions(int partitionCount,
     assert(inPatternPartitions != 0L);
 
     kPartitionCount = partitionCount;
+    kGridPlanValid = false;
 
     if (!kPartitionsInitialised) {
         hPatternPartitions = (int*) malloc(sizeof(int) * kPatternCount);
@@ -1250,6 +2053,12 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPatternPartitions(int partitionCount,
     }
 
     if (reorderPatterns) {
+        // reordering permutes every partials buffer in place, which paging cannot follow
+        returnCode = allocatePartialsBuffers();
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+        if (kPartialsPaging)
+            return BEAGLE_ERROR_NO_IMPLEMENTATION;
         returnCode = reorderPatternsByPartition();
     } else {
         int currentPartition = hPatternPartitions[0];
@@ -1374,9 +2183,28 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setPatternPartitions(int partitionCount,
     }
     hIntegratePartitionsStartBlocks[kPartitionCount] = blockIndex;
 
+    // pattern ranges for the single-launch, one work-group per partition site sum
+    if (!kPartitionsInitialised || kPartitionCount > kMaxPartitionCount) {
+        if (kPartitionsInitialised) {
+            gpu->FreeMemory(dPartitionSumOffsets);
+        }
+        dPartitionSumOffsets = gpu->AllocateMemory(sizeof(unsigned int) * kPartitionCount * 2);
+    }
+    unsigned int* hPartitionSumOffsets = (unsigned int*) malloc(sizeof(unsigned int) * kPartitionCount * 2);
+    checkHostMemory(hPartitionSumOffsets);
+    for (int i=0; i < kPartitionCount; i++) {
+        hPartitionSumOffsets[i*2    ] = hPatternPartitionsStartPatterns[i];
+        hPartitionSumOffsets[i*2 + 1] = hPatternPartitionsStartPatterns[i+1];
+    }
+    gpu->MemcpyHostToDevice(dPartitionSumOffsets, hPartitionSumOffsets, sizeof(unsigned int) * kPartitionCount * 2);
+    free(hPartitionSumOffsets);
+
     if (kPartitionCount > kMaxPartitionCount) {
         kMaxPartitionCount = kPartitionCount;
     }
+    if (kPartitionCount > kLogLikelihoodResultsSize) {
+        allocateLogLikelihoodResults(kPartitionCount);
+    }
     if (kPaddedPartitionBlocks > kMaxPaddedPartitionBlocks) {
         kMaxPaddedPartitionBlocks = kPaddedPartitionBlocks;
     }
@@ -1725,6 +2553,27 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::convolveTransitionMatrices(const int* fir
     return returnCode;
 }//END: convolveTransitionMatrices
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::convolveTransitionMatrixChains(const int* matrixIndices,
+                                                                      const int* chainLengths,
+                                                                      const int* resultIndices,
+                                                                      int chainCount) {
+    // only pairs map onto the convolution kernel; longer chains need device scratch matrices
+    std::vector<int> firstIndices(chainCount);
+    std::vector<int> secondIndices(chainCount);
+    for (int u = 0; u < chainCount; u++) {
+        if (chainLengths[u] != 2)
+            return BEAGLE_ERROR_NO_IMPLEMENTATION;
+        firstIndices[u] = matrixIndices[2 * u];
+        secondIndices[u] = matrixIndices[2 * u + 1];
+    }
+
+    if (chainCount == 0)
+        return BEAGLE_SUCCESS;
+
+    return convolveTransitionMatrices(&firstIndices[0], &secondIndices[0], resultIndices, chainCount);
+}
+
 
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updateTransitionMatrices(int eigenIndex,
@@ -1890,6 +2739,9 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updatePartials(const int* operations,
 #endif
     
     bool byPartition = false;
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        countOperationStatistics(operations, operationCount, byPartition);
+
     int returnCode = upPartials(byPartition,
                                 operations,
                                 operationCount,
@@ -1910,6 +2762,9 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updatePartialsByPartition(const int* oper
 #endif
 
     bool byPartition = true;
+    if (kStatisticsEnabled.load(std::memory_order_relaxed))
+        countOperationStatistics(operations, operationCount, byPartition);
+
     int returnCode = upPartials(byPartition,
                                 operations,
                                 operationCount,
@@ -1941,6 +2796,28 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
         numOps = BEAGLE_PARTITION_OP_COUNT;
     }
 
+    int returnCode = allocatePartialsBuffers();
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    if (kPartialsPaging) {
+        if (operationCount > 1) {
+            // issue one operation at a time so that its buffers are resident when it runs
+            for (int op = 0; op < operationCount && returnCode == BEAGLE_SUCCESS; op++)
+                returnCode = upPartials(byPartition, operations + op * numOps, 1, cumulativeScalingIndex);
+            return returnCode;
+        }
+
+        kPartialsUseClock++;
+        returnCode = touchPartials(operations[3], true);
+        if (returnCode == BEAGLE_SUCCESS)
+            returnCode = touchPartials(operations[5], true);
+        if (returnCode == BEAGLE_SUCCESS)
+            returnCode = touchPartials(operations[0], false);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
+    }
+
     int gridLaunches = 0;
     int* gridStartOp;
     int* gridOpType;
@@ -1949,10 +2826,32 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
     int lastStreamIndex = 0;
     int gridOpIndex = 0;
 
+    bool reusePlan = false;
+
     if (kUsingMultiGrid) {
-        gridStartOp  = (int*) malloc(sizeof(int) * (operationCount + 1));
-        gridOpType   = (int*) malloc(sizeof(int) * (operationCount + 1));
-        gridOpBlocks = (int*) malloc(sizeof(int) * (operationCount + 1));
+        reusePlan = kGridPlanValid &&
+                    byPartition == kGridPlanByPartition &&
+                    operationCount == kGridPlanOperationCount &&
+                    memcmp(operations, hGridPlanOperations, sizeof(int) * operationCount * numOps) == 0;
+
+        if (operationCount + 1 > kGridPlanCapacity) {
+            free(hGridStartOp);
+            free(hGridOpType);
+            free(hGridOpBlocks);
+            free(hGridPlanOperations);
+            kGridPlanCapacity = operationCount + 1;
+            hGridStartOp  = (int*) malloc(sizeof(int) * kGridPlanCapacity);
+            hGridOpType   = (int*) malloc(sizeof(int) * kGridPlanCapacity);
+            hGridOpBlocks = (int*) malloc(sizeof(int) * kGridPlanCapacity);
+            hGridPlanOperations = (int*) malloc(sizeof(int) * kGridPlanCapacity * BEAGLE_PARTITION_OP_COUNT);
+            checkHostMemory(hGridPlanOperations);
+            kGridPlanValid = false;
+            reusePlan = false;
+        }
+
+        gridStartOp  = hGridStartOp;
+        gridOpType   = hGridOpType;
+        gridOpBlocks = hGridOpBlocks;
     }
 
     int anyRescale = BEAGLE_OP_NONE;
@@ -1969,6 +2868,13 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
         }
     }
 
+    // an unchanged traversal keeps its schedule and, on CUDA, the offsets already on the device
+    reusePlan = reusePlan && anyRescale != 1 && !(kFlags & BEAGLE_FLAG_SCALING_ALWAYS);
+    if (reusePlan) {
+        gridLaunches = kGridPlanLaunches;
+        gridOpIndex = kGridPlanOpIndexCount;
+    }
+
     int streamIndex = -1;
     int waitIndex = -1;
     if (!kUsingMultiGrid || anyRescale == 1) {
@@ -1978,7 +2884,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
         }
     }
 
-    for (int op = 0; op < operationCount; op++) {
+    for (int op = 0; op < operationCount && !reusePlan; op++) {
         const int parIndex = operations[op * numOps];
         const int writeScalingIndex = operations[op * numOps + 1];
         const int readScalingIndex = operations[op * numOps + 2];
@@ -2265,12 +3171,24 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
 
     if (kUsingMultiGrid && (anyRescale != 1)) {
 // printf("USING MULTIGRID!\n");
-        size_t transferSize = sizeof(unsigned int) * gridOpIndex;
         #ifdef FW_OPENCL
         gpu->UnmapMemory(dPartialsPtrs, hPartialsPtrs);
         #else
-        gpu->MemcpyHostToDevice(dPartialsPtrs, hPartialsPtrs, transferSize);
+        if (!reusePlan) {
+            size_t transferSize = sizeof(unsigned int) * gridOpIndex;
+            gpu->MemcpyHostToDevice(dPartialsPtrs, hPartialsPtrs, transferSize);
+        }
         #endif
+
+        if (!reusePlan) {
+            memcpy(hGridPlanOperations, operations, sizeof(int) * operationCount * numOps);
+            kGridPlanOperationCount = operationCount;
+            kGridPlanByPartition = byPartition;
+            kGridPlanLaunches = gridLaunches;
+            kGridPlanOpIndexCount = gridOpIndex;
+            kGridPlanValid = true;
+        }
+
 // int statesStatesCount = 0;
         gridStartOp[gridLaunches] = operationCount;
         int gridStart = 0;
@@ -2279,10 +3197,11 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
 // printf("%d ", (gridStartOp[i+1] - gridStartOp[i]));
             int rescaleMulti = BEAGLE_OP_NONE;
             GPUPtr scalingFactorsMulti = (GPUPtr)NULL;
-            if (gridOpType[i] < 0) {
+            int opType = gridOpType[i];
+            if (opType < 0) {
                 scalingFactorsMulti = dScalingFactors[0];
                 rescaleMulti = 0;
-                gridOpType[i] *= -1;
+                opType *= -1;
             }
 // printf("rescaleMulti[%d] = %d, opType = %d\n", i, rescaleMulti, gridOpType[i]);
 
@@ -2309,7 +3228,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
                 // printf("op[%03d]: c1 %03d (%d), c2 %03d (%d), c1m %03d, c2m %03d, par %03d, rescale %d\n", i, child1Index, (tipStates1?1:0), child2Index, (tipStates2?1:0), child1TransMatIndex, child2TransMatIndex, parIndex, rescaleMulti);
                 
 
-                if (gridOpType[i] == 1) {
+                if (opType == 1) {
                         kernels->PartialsPartialsPruningDynamicScaling(partials1, partials2, partials3,
                                                                        matrices1, matrices2, scalingFactorsMulti,
                                                                        cumulativeScalingBuffer, 
@@ -2317,7 +3236,7 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
                                                                        kPaddedPatternCount, kCategoryCount,
                                                                        rescaleMulti,
                                                                        -1, -1);
-                } else if (gridOpType[i] == 2) {
+                } else if (opType == 2) {
                     if (tipStates1 != 0) {
                         kernels->StatesPartialsPruningDynamicScaling(tipStates1, partials2, partials3,
                                                                      matrices1, matrices2, scalingFactorsMulti,
@@ -2345,14 +3264,14 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
                                                                -1, -1);
                 }
             } else {
-                if (gridOpType[i] == 1) {
+                if (opType == 1) {
                     kernels->PartialsPartialsPruningMulti(dPartialsOrigin, dMatrices[0],
                                                           scalingFactorsMulti,
                                                           dPartialsPtrs,
                                                           kPaddedPatternCount,
                                                           gridStart, gridSize,
                                                           rescaleMulti);
-                } else if (gridOpType[i] == 2) {
+                } else if (opType == 2) {
                     kernels->StatesPartialsPruningMulti(dStatesOrigin, dPartialsOrigin, dMatrices[0],
                                                         scalingFactorsMulti,
                                                         dPartialsPtrs,
@@ -2386,12 +3305,6 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::upPartials(bool byPartition,
         gpu->SynchronizeDevice();
     }
 
-    if (kUsingMultiGrid) {
-        free(gridStartOp);
-        free(gridOpType);
-        free(gridOpBlocks);
-    }
-
 #ifdef BEAGLE_DEBUG_SYNCH    
     gpu->SynchronizeHost();
 #endif
@@ -2597,15 +3510,8 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::resetScaleFactors(int cumulativeScalingIn
     fprintf(stderr, "\tEntering BeagleGPUImpl::resetScaleFactors\n");
 #endif
 
-    if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC) {
-        if (dScalingFactors[cumulativeScalingIndex] != dScalingFactorsMaster[cumulativeScalingIndex])
-            dScalingFactors[cumulativeScalingIndex] = dScalingFactorsMaster[cumulativeScalingIndex];
-        
-        if (dScalingFactors[cumulativeScalingIndex] == 0) {
-            dScalingFactors[cumulativeScalingIndex] = gpu->AllocateMemory(kScaleBufferSize * sizeof(Real));
-            dScalingFactorsMaster[cumulativeScalingIndex] = dScalingFactors[cumulativeScalingIndex];
-        }
-    }
+    if (kFlags & BEAGLE_FLAG_SCALING_DYNAMIC)
+        useMasterScaleFactors(cumulativeScalingIndex);
     
     Real* zeroes = (Real*) gpu->CallocHost(sizeof(Real), kPaddedPatternCount);
     
@@ -2749,62 +3655,21 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateRootLogLikelihoods(const int* bu
     fprintf(stderr, "\tEntering BeagleGPUImpl::calculateRootLogLikelihoods\n");
 #endif
     
-    int returnCode = BEAGLE_SUCCESS;
-        
-    if (count == 1) {         
-        const int rootNodeIndex = bufferIndices[0];
-        const int categoryWeightsIndex = categoryWeightsIndices[0];
-        const int stateFrequenciesIndex = stateFrequenciesIndices[0];
-        
+    int returnCode = requirePartials(bufferIndices, NULL, count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-        GPUPtr dCumulativeScalingFactor;
-        bool scale = 1;
-        if (kFlags & BEAGLE_FLAG_SCALING_AUTO)
-            dCumulativeScalingFactor = dAccumulatedScalingFactors;
-        else if (kFlags & BEAGLE_FLAG_SCALING_ALWAYS)
-            dCumulativeScalingFactor = dScalingFactors[bufferIndices[0] - kTipCount];
-        else if (cumulativeScaleIndices[0] != BEAGLE_OP_NONE)
-            dCumulativeScalingFactor = dScalingFactors[cumulativeScaleIndices[0]];
-        else
-            scale = 0;
-
-#ifdef BEAGLE_DEBUG_VALUES
-        Real r = 0;
-        fprintf(stderr,"root partials = \n");
-        gpu->PrintfDeviceVector(dPartials[rootNodeIndex], kPaddedPatternCount, r);
-#endif
+    if (count == 1) {
+        integrateRootLikelihoods(bufferIndices, categoryWeightsIndices,
+                                 stateFrequenciesIndices, cumulativeScaleIndices);
 
-        if (scale) {
-            kernels->IntegrateLikelihoodsDynamicScaling(dIntegrationTmp, dPartials[rootNodeIndex],
-                                                        dWeights[categoryWeightsIndex],
-                                                        dFrequencies[stateFrequenciesIndex],
-                                                        dCumulativeScalingFactor,
-                                                        kPaddedPatternCount,
-                                                        kCategoryCount);
-        } else {
-            kernels->IntegrateLikelihoods(dIntegrationTmp, dPartials[rootNodeIndex],
-                                          dWeights[categoryWeightsIndex],
-                                          dFrequencies[stateFrequenciesIndex],
-                                          kPaddedPatternCount, kCategoryCount);
-        }
-        
-#ifdef BEAGLE_DEBUG_VALUES
-        fprintf(stderr,"before SumSites1 = \n");
-        gpu->PrintfDeviceVector(dIntegrationTmp, kPaddedPatternCount, r);
-#endif
+        sumSiteLogLikelihoods(0, kPatternCount, 0, 0);
 
-        kernels->SumSites1(dIntegrationTmp, dSumLogLikelihood, dPatternWeights,
-                                    kPatternCount);
+        queueLogLikelihoodResults(0, 1);
 
-        gpu->MemcpyDeviceToHost(hLogLikelihoodsCache, dSumLogLikelihood, sizeof(Real) * kSumSitesBlockCount);
+        gpu->SynchronizeCompletionEvent();
 
-        *outSumLogLikelihood = 0.0;
-        for (int i = 0; i < kSumSitesBlockCount; i++) {
-            if (hLogLikelihoodsCache[i] != hLogLikelihoodsCache[i])
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;
-            
-            *outSumLogLikelihood += hLogLikelihoodsCache[i];
-        }    
+        returnCode = readLogLikelihoodResults(0, NULL, outSumLogLikelihood);
         
     } else {
         // TODO: evaluate performance, maybe break up kernels below for each subsetIndex case
@@ -2850,18 +3715,13 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateRootLogLikelihoods(const int* bu
             }
             
 
-            kernels->SumSites1(dIntegrationTmp, dSumLogLikelihood, dPatternWeights,
-                                        kPatternCount);
-                        
-            gpu->MemcpyDeviceToHost(hLogLikelihoodsCache, dSumLogLikelihood, sizeof(Real) * kSumSitesBlockCount);
-            
-            *outSumLogLikelihood = 0.0;
-            for (int i = 0; i < kSumSitesBlockCount; i++) {
-                if (hLogLikelihoodsCache[i] != hLogLikelihoodsCache[i])
-                    returnCode = BEAGLE_ERROR_FLOATING_POINT;
-                
-                *outSumLogLikelihood += hLogLikelihoodsCache[i];
-            }    
+            sumSiteLogLikelihoods(0, kPatternCount, 0, 0);
+
+            queueLogLikelihoodResults(0, 1);
+
+            gpu->SynchronizeCompletionEvent();
+
+            returnCode = readLogLikelihoodResults(0, NULL, outSumLogLikelihood);
         }
     }
     
@@ -2895,148 +3755,110 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateRootLogLikelihoodsByPartition(
     fprintf(stderr, "\tEntering BeagleGPUImpl::calculateRootLogLikelihoodsByPartition\n");
 #endif
     
-    if (count != 1 || kFlags & BEAGLE_FLAG_SCALING_AUTO || kFlags & BEAGLE_FLAG_SCALING_ALWAYS) {
+    if (count != 1) {
         return BEAGLE_ERROR_NO_IMPLEMENTATION;
     }
 
-    int returnCode = BEAGLE_SUCCESS;
-        
-    int gridOpIndex = 0;
-    int gridSize = 0;
+    int returnCode = checkPartitionIndices(partitionIndices, partitionCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-    int scale = 0;
+    returnCode = requirePartials(bufferIndices, NULL, partitionCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
+    returnCode = integrateRootLikelihoodsByPartition(bufferIndices, categoryWeightsIndices,
+                                                         stateFrequenciesIndices, cumulativeScaleIndices,
+                                                         partitionIndices, partitionCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-        int startBlock = hIntegratePartitionsStartBlocks[pIndex];
-        int endBlock = hIntegratePartitionsStartBlocks[pIndex+1];
+    sumSiteLogLikelihoodsByPartition(partitionIndices, partitionCount, 0);
 
-        gridSize += endBlock - startBlock;
+    queueLogLikelihoodResults(0, partitionCount);
 
-        const int rootNodeIndex = bufferIndices[p];
-        const int categoryWeightsIndex = categoryWeightsIndices[p];
-        const int stateFrequenciesIndex = stateFrequenciesIndices[p];
-              int cumulativeScalingIndex = 0;
+    gpu->SynchronizeCompletionEvent();
 
-        if (cumulativeScaleIndices[p] != BEAGLE_OP_NONE) {
-            if (scale == -1) {
-                return BEAGLE_ERROR_NO_IMPLEMENTATION;
-            }
-            cumulativeScalingIndex = cumulativeScaleIndices[p];
-            scale = 1;
-        } else {
-            if (scale == 1) {
-                return BEAGLE_ERROR_NO_IMPLEMENTATION;
-            }
-            scale = -1;
-        }
+    returnCode = readLogLikelihoodResults(0, outSumLogLikelihoodByPartition, outSumLogLikelihood);
 
-        unsigned int rNOff      = hPartialsOffsets[rootNodeIndex];
-        unsigned int cWOff      = categoryWeightsIndex  * kWeightsOffset;
-        unsigned int sFOff      = stateFrequenciesIndex * kFrequenciesOffset;
-        unsigned int scaleOff   = cumulativeScalingIndex * kScaleBufferSize;
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tLeaving  BeagleGPUImpl::calculateRootLogLikelihoodsByPartition\n");
+#endif
+    
+    return returnCode;
+}
 
-        for (int i=startBlock; i < endBlock; i++) {
-            hPartialsPtrs[gridOpIndex++] = hIntegratePartitionOffsets[i*2];
-            hPartialsPtrs[gridOpIndex++] = hIntegratePartitionOffsets[i*2+1];
-            hPartialsPtrs[gridOpIndex++] = rNOff;
-            hPartialsPtrs[gridOpIndex++] = cWOff;
-            hPartialsPtrs[gridOpIndex++] = sFOff;
-            hPartialsPtrs[gridOpIndex++] = scaleOff;
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateRootLogLikelihoodsAsync(const int* bufferIndices,
+                                                                        const int* categoryWeightsIndices,
+                                                                        const int* stateFrequenciesIndices,
+                                                                        const int* cumulativeScaleIndices,
+                                                                        const int* partitionIndices,
+                                                                        int partitionCount) {
 
-// printf("block %d, hPP = %d %d %d %d %d %d\n", i,
-//        hPartialsPtrs[gridOpIndex-6],
-//        hPartialsPtrs[gridOpIndex-5],
-//        hPartialsPtrs[gridOpIndex-4],
-//        hPartialsPtrs[gridOpIndex-3],
-//        hPartialsPtrs[gridOpIndex-2],
-//        hPartialsPtrs[gridOpIndex-1]);
-        }
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tEntering BeagleGPUImpl::calculateRootLogLikelihoodsAsync\n");
+#endif
 
-        // Real r = 0;
-        // fprintf(stderr,"root partials = \n");
-        // gpu->PrintfDeviceVector(dPartials[rootNodeIndex], kPaddedPatternCount, r);
+    if (partitionCount < 1 || (partitionIndices == NULL && partitionCount != 1))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    if (partitionIndices != NULL && checkPartitionIndices(partitionIndices, partitionCount) != BEAGLE_SUCCESS)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
 
-    }
+    kLogLikelihoodResultsCount[1] = 0;
 
-    size_t transferSize = sizeof(unsigned int) * gridOpIndex;
-    #ifdef FW_OPENCL
-    gpu->UnmapMemory(dPartialsPtrs, hPartialsPtrs);
-    #else
-    gpu->MemcpyHostToDevice(dPartialsPtrs, hPartialsPtrs, transferSize);
-    #endif
+    int returnCode = requirePartials(bufferIndices, NULL, partitionCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
-    if (scale == 1) {
-        kernels->IntegrateLikelihoodsDynamicScalingPartition(dIntegrationTmp,
-                                                             dPartialsOrigin,
-                                                             dWeights[0],
-                                                             dFrequencies[0],
-                                                             dScalingFactors[0],
-                                                             dPartialsPtrs,
-                                                             kPaddedPatternCount,
-                                                             kCategoryCount,
-                                                             gridSize);
+    if (partitionIndices == NULL) {
+        integrateRootLikelihoods(bufferIndices, categoryWeightsIndices,
+                                 stateFrequenciesIndices, cumulativeScaleIndices);
+
+        sumSiteLogLikelihoods(0, kPatternCount, 1, 0);
     } else {
-        kernels->IntegrateLikelihoodsPartition(dIntegrationTmp,
-                                               dPartialsOrigin,
-                                               dWeights[0],
-                                               dFrequencies[0],
-                                               dPartialsPtrs,
-                                               kPaddedPatternCount,
-                                               kCategoryCount,
-                                               gridSize);
+        returnCode = integrateRootLikelihoodsByPartition(bufferIndices, categoryWeightsIndices,
+                                                             stateFrequenciesIndices, cumulativeScaleIndices,
+                                                             partitionIndices, partitionCount);
+        if (returnCode != BEAGLE_SUCCESS)
+            return returnCode;
 
-            // kernels->IntegrateLikelihoods(dIntegrationTmp, dPartials[bufferIndices[0]],
-            //                               dWeights[0],
-            //                               dFrequencies[0],
-            //                               kPaddedPatternCount, kCategoryCount);
+        sumSiteLogLikelihoodsByPartition(partitionIndices, partitionCount, 1);
     }
 
-// Real r = 0;
-// fprintf(stderr,"before SumSites1 = \n");
-// gpu->PrintfDeviceVector(dIntegrationTmp, kPaddedPatternCount, r);
+    queueLogLikelihoodResults(1, partitionCount);
 
-    
-    #ifdef FW_OPENCL
-    hPartialsPtrs = (unsigned int*)gpu->MapMemory(dPartialsPtrs, kOpOffsetsSize);
-    #endif
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tLeaving  BeagleGPUImpl::calculateRootLogLikelihoodsAsync\n");
+#endif
 
-    *outSumLogLikelihood = 0.0;
-    
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
-        int startPattern = hPatternPartitionsStartPatterns[pIndex];
-        int endPattern = hPatternPartitionsStartPatterns[pIndex + 1];
-        int partitionPatternCount = endPattern - startPattern;
-        int partitionSumSitesBlockCount = partitionPatternCount / kSumSitesBlockSize;
-        if (partitionPatternCount % kSumSitesBlockSize != 0)
-            partitionSumSitesBlockCount += 1;
+    return BEAGLE_SUCCESS;
+}
 
-        kernels->SumSites1Partition(dIntegrationTmp,
-                                    dSumLogLikelihood,
-                                    dPatternWeights,
-                                    startPattern,
-                                    endPattern,
-                                    partitionSumSitesBlockCount);
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getRootLogLikelihoodsAsync(int blocking,
+                                                                  double* outSumLogLikelihoodByPartition,
+                                                                  double* outSumLogLikelihood) {
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\tEntering BeagleGPUImpl::getRootLogLikelihoodsAsync\n");
+#endif
 
-        gpu->MemcpyDeviceToHost(hLogLikelihoodsCache,
-                                dSumLogLikelihood,
-                                sizeof(Real) * partitionSumSitesBlockCount);
+    if (kLogLikelihoodResultsCount[1] == 0)
+        return BEAGLE_ERROR_GENERAL;
+
+    if (blocking) {
+        gpu->SynchronizeCompletionEvent();
+    } else if (!gpu->QueryCompletionEvent()) {
+        return BEAGLE_ERROR_NOT_READY;
+    }
+
+    int returnCode = readLogLikelihoodResults(1, outSumLogLikelihoodByPartition, outSumLogLikelihood);
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = 0; i < partitionSumSitesBlockCount; i++) {
-            if (hLogLikelihoodsCache[i] != hLogLikelihoodsCache[i])
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;           
-            outSumLogLikelihoodByPartition[p] += hLogLikelihoodsCache[i];
-        }
-        *outSumLogLikelihood += outSumLogLikelihoodByPartition[p];
-    }    
-    
 #ifdef BEAGLE_DEBUG_FLOW
-    fprintf(stderr, "\tLeaving  BeagleGPUImpl::calculateRootLogLikelihoodsByPartition\n");
+    fprintf(stderr, "\tLeaving  BeagleGPUImpl::getRootLogLikelihoodsAsync\n");
 #endif
-    
+
     return returnCode;
 }
 
@@ -3058,8 +3880,10 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoods(const int* pa
     fprintf(stderr, "\tEntering BeagleGPUImpl::calculateEdgeLogLikelihoods\n");
 #endif
     
-    int returnCode = BEAGLE_SUCCESS;
-    
+    int returnCode = requirePartials(parentBufferIndices, childBufferIndices, count);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
     if (count == 1) { 
                  
         
@@ -3126,18 +3950,13 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoods(const int* pa
                                               kPaddedPatternCount, kCategoryCount);
             }
             
-            kernels->SumSites1(dIntegrationTmp, dSumLogLikelihood, dPatternWeights,
-                                        kPatternCount);
-            
-            gpu->MemcpyDeviceToHost(hLogLikelihoodsCache, dSumLogLikelihood, sizeof(Real) * kSumSitesBlockCount);
-            
-            *outSumLogLikelihood = 0.0;
-            for (int i = 0; i < kSumSitesBlockCount; i++) {
-                if (hLogLikelihoodsCache[i] != hLogLikelihoodsCache[i])
-                    returnCode = BEAGLE_ERROR_FLOATING_POINT;
-                
-                *outSumLogLikelihood += hLogLikelihoodsCache[i];
-            }    
+            sumSiteLogLikelihoods(0, kPatternCount, 0, 0);
+
+            queueLogLikelihoodResults(0, 1);
+
+            gpu->SynchronizeCompletionEvent();
+
+            returnCode = readLogLikelihoodResults(0, NULL, outSumLogLikelihood);
         } else if (secondDerivativeIndices == NULL) {
             // TODO: remove this "hack" for a proper version that only calculates firstDeriv
             
@@ -3318,18 +4137,13 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoods(const int* pa
                     }
                 }
                 
-                kernels->SumSites1(dIntegrationTmp, dSumLogLikelihood, dPatternWeights,
-                                   kPatternCount);
-                
-                gpu->MemcpyDeviceToHost(hLogLikelihoodsCache, dSumLogLikelihood, sizeof(Real) * kSumSitesBlockCount);
-                
-                *outSumLogLikelihood = 0.0;
-                for (int i = 0; i < kSumSitesBlockCount; i++) {
-                    if (hLogLikelihoodsCache[i] != hLogLikelihoodsCache[i])
-                        returnCode = BEAGLE_ERROR_FLOATING_POINT;
-                    
-                    *outSumLogLikelihood += hLogLikelihoodsCache[i];
-                }    
+                sumSiteLogLikelihoods(0, kPatternCount, 0, 0);
+
+                queueLogLikelihoodResults(0, 1);
+
+                gpu->SynchronizeCompletionEvent();
+
+                returnCode = readLogLikelihoodResults(0, NULL, outSumLogLikelihood);
             }
 
         } else {
@@ -3375,10 +4189,17 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
         return BEAGLE_ERROR_NO_IMPLEMENTATION;
     }
 
-    int returnCode = BEAGLE_SUCCESS;
+    int returnCode = checkPartitionIndices(partitionIndices, partitionCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
+
+    returnCode = requirePartials(parentBufferIndices, childBufferIndices, partitionCount);
+    if (returnCode != BEAGLE_SUCCESS)
+        return returnCode;
 
     int gridOpIndex = 0;
     int gridSize = 0;
+    kGridPlanValid = false; // the offsets below overwrite the updatePartials launch plan
     int statesChild = -1;
 
     for (int p = 0; p < partitionCount; p++) {
@@ -3525,36 +4346,13 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
     hPartialsPtrs = (unsigned int*)gpu->MapMemory(dPartialsPtrs, kOpOffsetsSize);
     #endif
 
-    *outSumLogLikelihood = 0.0;
-    
-    for (int p = 0; p < partitionCount; p++) {
-        int pIndex = partitionIndices[p];
-        int startPattern = hPatternPartitionsStartPatterns[pIndex];
-        int endPattern = hPatternPartitionsStartPatterns[pIndex + 1];
-        int partitionPatternCount = endPattern - startPattern;
-        int partitionSumSitesBlockCount = partitionPatternCount / kSumSitesBlockSize;
-        if (partitionPatternCount % kSumSitesBlockSize != 0)
-            partitionSumSitesBlockCount += 1;
+    sumSiteLogLikelihoodsByPartition(partitionIndices, partitionCount, 0);
 
-        kernels->SumSites1Partition(dIntegrationTmp,
-                                    dSumLogLikelihood,
-                                    dPatternWeights,
-                                    startPattern,
-                                    endPattern,
-                                    partitionSumSitesBlockCount);
+    queueLogLikelihoodResults(0, partitionCount);
 
-        gpu->MemcpyDeviceToHost(hLogLikelihoodsCache,
-                                dSumLogLikelihood,
-                                sizeof(Real) * partitionSumSitesBlockCount);
+    gpu->SynchronizeCompletionEvent();
 
-        outSumLogLikelihoodByPartition[p] = 0.0;
-        for (int i = 0; i < partitionSumSitesBlockCount; i++) {
-            if (hLogLikelihoodsCache[i] != hLogLikelihoodsCache[i])
-                returnCode = BEAGLE_ERROR_FLOATING_POINT;           
-            outSumLogLikelihoodByPartition[p] += hLogLikelihoodsCache[i];
-        }
-        *outSumLogLikelihood += outSumLogLikelihoodByPartition[p];
-    }    
+    returnCode = readLogLikelihoodResults(0, outSumLogLikelihoodByPartition, outSumLogLikelihood);
 
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\tLeaving  BeagleGPUImpl::calculateEdgeLogLikelihoodsByPartition\n");
@@ -3563,6 +4361,38 @@ int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeLogLikelihoodsByPartition(
     return returnCode;
 }
 
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::setRateMatrix(int rateMatrixIndex,
+                                                     const double* inRateMatrix) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::updateTransitionMatricesFromRateMatrix(int rateMatrixIndex,
+                                                                              const int* probabilityIndices,
+                                                                              const double* edgeLengths,
+                                                                              int count) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::prepareEdgeProjection(int parentBufferIndex,
+                                                             int childBufferIndex,
+                                                             int eigenIndex,
+                                                             int categoryWeightsIndex,
+                                                             int stateFrequenciesIndex,
+                                                             int cumulativeScaleIndex) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
+BEAGLE_GPU_TEMPLATE
+int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::calculateEdgeProjectionLogLikelihoods(double edgeLength,
+                                                                             double* outSumLogLikelihood,
+                                                                             double* outSumFirstDerivative,
+                                                                             double* outSumSecondDerivative) {
+    return BEAGLE_ERROR_NO_IMPLEMENTATION;
+}
+
 
 BEAGLE_GPU_TEMPLATE
 int BeagleGPUImpl<BEAGLE_GPU_GENERIC>::getSiteLogLikelihoods(double* outLogLikelihoods) {
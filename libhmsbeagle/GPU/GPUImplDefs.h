@@ -61,6 +61,7 @@ enum BeagleDeviceImplementationCodes {
     BEAGLE_OPENCL_DEVICE_APPLE_AMD_GPU   = 7,
     BEAGLE_OPENCL_DEVICE_APPLE_INTEL_GPU = 8,
     BEAGLE_CUDA_DEVICE_NVIDIA_GPU        = 9,
+    BEAGLE_OPENCL_DEVICE_POCL_CPU        = 10,
 };
 
 #define BEAGLE_CACHED_MATRICES_COUNT 3 // max number of matrices that can be cached for a single memcpy to device operation
@@ -33,6 +33,9 @@
 #endif
 
 #include <map>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
 
 #include "libhmsbeagle/GPU/GPUImplHelper.h"
 #include "libhmsbeagle/GPU/GPUImplDefs.h"
@@ -77,17 +80,41 @@ private:
     CUmodule cudaModule;
     CUstream* cudaStreams;
     CUevent* cudaEvents;
+    CUevent cudaCompletionEvent;
     const char* GetCUDAErrorDescription(int errorCode);
 #elif defined(FW_OPENCL)
     cl_device_id openClDeviceId;             // compute device id 
     cl_context openClContext;                // compute context
     cl_command_queue* openClCommandQueues;   // compute command queue
     cl_event* openClEvents;                  // compute events
+    cl_event openClCompletionEvent;          // marker polled by the host
     cl_program openClProgram;                // compute program
     std::map<int, cl_device_id> openClDeviceMap;
     const char* GetCLErrorDescription(int errorCode);
 #endif
 
+    std::atomic<bool> statisticsEnabled;
+    std::atomic<uint64_t> bytesTransferred;
+    std::atomic<uint64_t> waitTime; // nanoseconds
+    std::chrono::steady_clock::time_point waitStartTime;
+
+    void BeginWait() {
+        if (statisticsEnabled.load(std::memory_order_relaxed))
+            waitStartTime = std::chrono::steady_clock::now();
+    }
+
+    void EndWait() {
+        if (statisticsEnabled.load(std::memory_order_relaxed))
+            waitTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now() - waitStartTime).count(),
+                               std::memory_order_relaxed);
+    }
+
+    void CountTransfer(size_t memSize) {
+        if (statisticsEnabled.load(std::memory_order_relaxed))
+            bytesTransferred.fetch_add(memSize, std::memory_order_relaxed);
+    }
+
 public:
     GPUInterface();
     
@@ -111,6 +138,22 @@ public:
     void SynchronizeDevice();
     void SynchronizeDeviceWithIndex(int streamRecordIndex,
                                     int streamWaitIndex);
+
+    void RecordCompletionEvent();
+
+    bool QueryCompletionEvent();
+
+    void SynchronizeCompletionEvent();
+
+    void SetStatisticsEnabled(bool enabled) {
+        bytesTransferred.store(0, std::memory_order_relaxed);
+        waitTime.store(0, std::memory_order_relaxed);
+        statisticsEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    double GetBytesTransferred() { return (double) bytesTransferred.load(std::memory_order_relaxed); }
+
+    double GetWaitTime() { return waitTime.load(std::memory_order_relaxed) * 1E-9; }
     
     GPUFunction GetFunction(const char* functionName);
     
@@ -167,6 +210,10 @@ public:
     void MemcpyDeviceToHost(void* dest,
                             const GPUPtr src,
                             size_t memSize);
+
+    void MemcpyDeviceToHostAsync(void* dest,
+                                 const GPUPtr src,
+                                 size_t memSize);
     
     void MemcpyDeviceToDevice(GPUPtr dest,
                               GPUPtr src,
@@ -130,8 +130,13 @@ GPUInterface::GPUInterface() {
     cudaModule = NULL;
     cudaStreams = NULL;
     cudaEvents = NULL;
+    cudaCompletionEvent = NULL;
     kernelResource = NULL;
     supportDoublePrecision = true;
+
+    statisticsEnabled = false;
+    bytesTransferred = 0;
+    waitTime = 0;
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr,"\t\t\tLeaving  GPUInterface::GPUInterface\n");
@@ -159,6 +164,9 @@ GPUInterface::~GPUInterface() {
         free(cudaEvents);
     }
 
+    if (cudaCompletionEvent != NULL)
+        SAFE_CUDA(cuEventDestroy(cudaCompletionEvent));
+
     if (cudaContext != NULL) {
         SAFE_CUDA(cuCtxPushCurrent(cudaContext));
         SAFE_CUDA(cuCtxDetach(cudaContext));
@@ -263,11 +271,8 @@ void GPUInterface::SetDevice(int deviceNumber, int paddedStateCount, int categor
 
     SAFE_CUDA(cuDeviceGet(&cudaDevice, (*resourceMap)[deviceNumber]));
     
-    if (flags & BEAGLE_FLAG_SCALING_DYNAMIC) {
-        SAFE_CUDA(cuCtxCreate(&cudaContext, CU_CTX_SCHED_AUTO | CU_CTX_MAP_HOST, cudaDevice));
-    } else {
-        SAFE_CUDA(cuCtxCreate(&cudaContext, CU_CTX_SCHED_AUTO, cudaDevice));
-    }
+    // host mapping is needed for dynamic scaling and for the mapped log likelihood results
+    SAFE_CUDA(cuCtxCreate(&cudaContext, CU_CTX_SCHED_AUTO | CU_CTX_MAP_HOST, cudaDevice));
     
     InitializeKernelResource(paddedStateCount, flags & BEAGLE_FLAG_PRECISION_DOUBLE);
 
@@ -384,7 +389,9 @@ void GPUInterface::SynchronizeHost() {
     fprintf(stderr,"\t\t\tEntering GPUInterface::SynchronizeHost\n");
 #endif                
     
+    BeginWait();
     SAFE_CUPP(cuCtxSynchronize());
+    EndWait();
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr,"\t\t\tLeaving  GPUInterface::SynchronizeHost\n");
@@ -423,6 +430,61 @@ void GPUInterface::SynchronizeDeviceWithIndex(int streamRecordIndex, int streamW
 #endif                
 }
 
+void GPUInterface::RecordCompletionEvent() {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tEntering GPUInterface::RecordCompletionEvent\n");
+#endif
+
+    if (cudaCompletionEvent == NULL)
+        SAFE_CUPP(cuEventCreate(&cudaCompletionEvent, CU_EVENT_DISABLE_TIMING));
+
+    SAFE_CUPP(cuEventRecord(cudaCompletionEvent, cudaStreams[0]));
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tLeaving  GPUInterface::RecordCompletionEvent\n");
+#endif
+}
+
+bool GPUInterface::QueryCompletionEvent() {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tEntering GPUInterface::QueryCompletionEvent\n");
+#endif
+
+    bool complete = true;
+
+    if (cudaCompletionEvent != NULL) {
+        SAFE_CUDA(cuCtxPushCurrent(cudaContext));
+        CUresult status = cuEventQuery(cudaCompletionEvent);
+        SAFE_CUDA(cuCtxPopCurrent(&cudaContext));
+        if (status == CUDA_ERROR_NOT_READY) {
+            complete = false;
+        } else {
+            SAFE_CUDA(status);
+        }
+    }
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tLeaving  GPUInterface::QueryCompletionEvent\n");
+#endif
+
+    return complete;
+}
+
+void GPUInterface::SynchronizeCompletionEvent() {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tEntering GPUInterface::SynchronizeCompletionEvent\n");
+#endif
+
+    BeginWait();
+    if (cudaCompletionEvent != NULL)
+        SAFE_CUPP(cuEventSynchronize(cudaCompletionEvent));
+    EndWait();
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tLeaving  GPUInterface::SynchronizeCompletionEvent\n");
+#endif
+}
+
 GPUFunction GPUInterface::GetFunction(const char* functionName) {
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr,"\t\t\tEntering GPUInterface::GetFunction\n");
@@ -733,6 +795,8 @@ void GPUInterface::MemcpyHostToDevice(GPUPtr dest,
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\t\tEntering GPUInterface::MemcpyHostToDevice\n");
 #endif    
+
+    CountTransfer(memSize);
     
     // SAFE_CUPP(cuMemcpyHtoDAsync(dest, src, memSize, cudaStreams[0]));
     SAFE_CUPP(cuMemcpyHtoD(dest, src, memSize));
@@ -749,8 +813,12 @@ void GPUInterface::MemcpyDeviceToHost(void* dest,
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\t\tEntering GPUInterface::MemcpyDeviceToHost\n");
 #endif        
+
+    CountTransfer(memSize);
     
+    BeginWait();
     SAFE_CUPP(cuMemcpyDtoHAsync(dest, src, memSize, cudaStreams[0]));
+    EndWait();
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\t\tLeaving  GPUInterface::MemcpyDeviceToHost\n");
@@ -758,6 +826,23 @@ void GPUInterface::MemcpyDeviceToHost(void* dest,
     
 }
 
+void GPUInterface::MemcpyDeviceToHostAsync(void* dest,
+                                           const GPUPtr src,
+                                           size_t memSize) {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\t\tEntering GPUInterface::MemcpyDeviceToHostAsync\n");
+#endif
+
+    CountTransfer(memSize);
+
+    SAFE_CUPP(cuMemcpyDtoHAsync(dest, src, memSize, cudaStreams[0]));
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\t\tLeaving  GPUInterface::MemcpyDeviceToHostAsync\n");
+#endif
+
+}
+
 void GPUInterface::MemcpyDeviceToDevice(GPUPtr dest,
                                         GPUPtr src,
                                         size_t memSize) {
@@ -72,9 +72,14 @@ GPUInterface::GPUInterface() {
     openClDeviceId = NULL;
     openClContext = NULL;
     openClCommandQueues = NULL;
+    openClCompletionEvent = NULL;
     openClProgram = NULL;
 
     supportDoublePrecision = true;
+
+    statisticsEnabled = false;
+    bytesTransferred = 0;
+    waitTime = 0;
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr,"\t\t\tLeaving  GPUInterface::GPUInterface\n");
@@ -88,6 +93,9 @@ GPUInterface::~GPUInterface() {
     
     // TODO: cleanup mem objects, kernels
     
+    if (openClCompletionEvent != NULL)
+        SAFE_CL(clReleaseEvent(openClCompletionEvent));
+
     if (openClProgram != NULL)
         SAFE_CL(clReleaseProgram(openClProgram));
 
@@ -226,7 +234,8 @@ void GPUInterface::InitializeKernelResource(int paddedStateCount,
     BeagleDeviceImplementationCodes deviceCode = GetDeviceImplementationCode(-1);
     if (deviceCode == BEAGLE_OPENCL_DEVICE_INTEL_CPU || 
         deviceCode == BEAGLE_OPENCL_DEVICE_INTEL_MIC ||
-        deviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU) {
+        deviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU ||
+        deviceCode == BEAGLE_OPENCL_DEVICE_POCL_CPU) {
         CPUImpl = true;
     } else if (deviceCode == BEAGLE_OPENCL_DEVICE_APPLE_CPU) {
         AppleCPUImpl = true;
@@ -410,7 +419,8 @@ void GPUInterface::SetDevice(int deviceNumber,
     BeagleDeviceImplementationCodes deviceCode = GetDeviceImplementationCode(deviceNumber);
     if (deviceCode == BEAGLE_OPENCL_DEVICE_INTEL_CPU ||
         deviceCode == BEAGLE_OPENCL_DEVICE_INTEL_MIC ||
-        deviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU) {
+        deviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU ||
+        deviceCode == BEAGLE_OPENCL_DEVICE_POCL_CPU) {
         strcat(buildDefs, "-D FW_OPENCL_CPU");
     } else if (deviceCode == BEAGLE_OPENCL_DEVICE_APPLE_CPU) {
         strcat(buildDefs, "-D FW_OPENCL_CPU -D FW_OPENCL_APPLECPU");
@@ -472,7 +482,9 @@ void GPUInterface::SynchronizeHost() {
     //     SAFE_CL(clFinish(openClCommandQueues[i]));
     // }
 
+    BeginWait();
     SAFE_CL(clFinish(openClCommandQueues[0]));
+    EndWait();
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr,"\t\t\tLeaving  GPUInterface::SynchronizeHost\n");
@@ -507,6 +519,67 @@ void GPUInterface::SynchronizeDeviceWithIndex(int streamRecordIndex, int streamW
 #endif                
 }
 
+void GPUInterface::RecordCompletionEvent() {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tEntering GPUInterface::RecordCompletionEvent\n");
+#endif
+
+    if (openClCompletionEvent != NULL)
+        SAFE_CL(clReleaseEvent(openClCompletionEvent));
+
+#ifdef CL_VERSION_1_2
+    SAFE_CL(clEnqueueMarkerWithWaitList(openClCommandQueues[0], 0, NULL, &openClCompletionEvent));
+#else
+    SAFE_CL(clEnqueueMarker(openClCommandQueues[0], &openClCompletionEvent));
+#endif
+
+    // make sure the queue is submitted so that polling can make progress
+    SAFE_CL(clFlush(openClCommandQueues[0]));
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tLeaving  GPUInterface::RecordCompletionEvent\n");
+#endif
+}
+
+bool GPUInterface::QueryCompletionEvent() {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tEntering GPUInterface::QueryCompletionEvent\n");
+#endif
+
+    bool complete = true;
+
+    if (openClCompletionEvent != NULL) {
+        cl_int status;
+        SAFE_CL(clGetEventInfo(openClCompletionEvent, CL_EVENT_COMMAND_EXECUTION_STATUS,
+                               sizeof(cl_int), &status, NULL));
+        if (status < 0) {
+            SAFE_CL(status);
+        }
+        complete = (status == CL_COMPLETE);
+    }
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tLeaving  GPUInterface::QueryCompletionEvent\n");
+#endif
+
+    return complete;
+}
+
+void GPUInterface::SynchronizeCompletionEvent() {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tEntering GPUInterface::SynchronizeCompletionEvent\n");
+#endif
+
+    BeginWait();
+    if (openClCompletionEvent != NULL)
+        SAFE_CL(clWaitForEvents(1, &openClCompletionEvent));
+    EndWait();
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr,"\t\t\tLeaving  GPUInterface::SynchronizeCompletionEvent\n");
+#endif
+}
+
 GPUFunction GPUInterface::GetFunction(const char* functionName) {
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr,"\t\t\tEntering GPUInterface::GetFunction\n");
@@ -918,6 +991,8 @@ void GPUInterface::MemcpyHostToDevice(GPUPtr dest,
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\t\tEntering GPUInterface::MemcpyHostToDevice\n");
 #endif    
+
+    CountTransfer(memSize);
     
     SAFE_CL(clEnqueueWriteBuffer(openClCommandQueues[0], dest, CL_TRUE, 0, memSize, src, 0,
                                  NULL, NULL));
@@ -933,9 +1008,13 @@ void GPUInterface::MemcpyDeviceToHost(void* dest,
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\t\tEntering GPUInterface::MemcpyDeviceToHost\n");
 #endif        
+
+    CountTransfer(memSize);
     
+    BeginWait();
     SAFE_CL(clEnqueueReadBuffer(openClCommandQueues[0], src, CL_TRUE, 0, memSize, dest, 0,
                                 NULL, NULL));
+    EndWait();
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\t\tLeaving  GPUInterface::MemcpyDeviceToHost\n");
@@ -943,6 +1022,24 @@ void GPUInterface::MemcpyDeviceToHost(void* dest,
 
 }
 
+void GPUInterface::MemcpyDeviceToHostAsync(void* dest,
+                                           const GPUPtr src,
+                                           size_t memSize) {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\t\tEntering GPUInterface::MemcpyDeviceToHostAsync\n");
+#endif
+
+    CountTransfer(memSize);
+
+    SAFE_CL(clEnqueueReadBuffer(openClCommandQueues[0], src, CL_FALSE, 0, memSize, dest, 0,
+                                NULL, NULL));
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\t\tLeaving  GPUInterface::MemcpyDeviceToHostAsync\n");
+#endif
+
+}
+
 void GPUInterface::MemcpyDeviceToDevice(GPUPtr dest,
                                         GPUPtr src,
                                         size_t memSize) {
@@ -1175,6 +1272,9 @@ BeagleDeviceImplementationCodes GPUInterface::GetDeviceImplementationCode(int de
             deviceCode = BEAGLE_OPENCL_DEVICE_AMD_CPU;
         else if (deviceTypeFlag == BEAGLE_FLAG_PROCESSOR_GPU)
             deviceCode = BEAGLE_OPENCL_DEVICE_AMD_GPU;
+    } else if (!strncmp("Portable Computing Language", platform_string, strlen("Portable Computing Language"))) {
+        if (deviceTypeFlag == BEAGLE_FLAG_PROCESSOR_CPU)
+            deviceCode = BEAGLE_OPENCL_DEVICE_POCL_CPU;
     } else if (!strncmp("Apple", platform_string, strlen("Apple"))) {
         if (deviceTypeFlag == BEAGLE_FLAG_PROCESSOR_CPU)
             deviceCode = BEAGLE_OPENCL_DEVICE_APPLE_CPU;
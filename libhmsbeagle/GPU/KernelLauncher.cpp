@@ -62,7 +62,8 @@ void KernelLauncher::SetupKernelBlocksAndGrids() {
     BeagleDeviceImplementationCodes deviceCode = gpu->GetDeviceImplementationCode(-1);
     if (deviceCode == BEAGLE_OPENCL_DEVICE_INTEL_CPU ||
         deviceCode == BEAGLE_OPENCL_DEVICE_INTEL_MIC ||
-        deviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU) {
+        deviceCode == BEAGLE_OPENCL_DEVICE_AMD_CPU ||
+        deviceCode == BEAGLE_OPENCL_DEVICE_POCL_CPU) {
         kCPUImplementation = true;
     } else if (deviceCode == BEAGLE_OPENCL_DEVICE_APPLE_CPU) {
         kCPUImplementation = true;
@@ -185,6 +186,7 @@ void KernelLauncher::SetupKernelBlocksAndGrids() {
     } else {
         bgSumSitesBlock = Dim3Int(kSumSitesBlockSize);
     }
+    bgSumSitesFinalBlock = bgSumSitesBlock;
     bgSumSitesGrid  = Dim3Int(kUnpaddedPatternCount / kSumSitesBlockSize);
     if (kUnpaddedPatternCount % kSumSitesBlockSize != 0)
         bgSumSitesGrid.x += 1;
@@ -335,6 +337,7 @@ void KernelLauncher::LoadKernels() {
 	fIntegrateLikelihoodsFixedScaleMulti = gpu->GetFunction("kernelIntegrateLikelihoodsFixedScaleMulti");
     
     fSumSites1 = gpu->GetFunction("kernelSumSites1");
+    fSumSitesFinal = gpu->GetFunction("kernelSumSitesFinal");
     fSumSites2 = gpu->GetFunction("kernelSumSites2");
     fSumSites3 = gpu->GetFunction("kernelSumSites3");
 
@@ -431,6 +434,8 @@ void KernelLauncher::LoadKernels() {
         fIntegrateLikelihoodsPartition = gpu->GetFunction("kernelIntegrateLikelihoodsPartition");
         
         fSumSites1Partition = gpu->GetFunction("kernelSumSites1Partition");
+
+        fSumSitesByPartition = gpu->GetFunction("kernelSumSitesByPartition");
     }
 #endif // !FW_OPENCL_TESTING
 }
@@ -520,19 +525,33 @@ void KernelLauncher::GetTransitionProbabilitiesSquareMulti(GPUPtr dMatrices,
     fprintf(stderr, "\t\tEntering KernelLauncher::GetTransitionProbabilitiesSquareMulti\n");
 #endif
 
-    bgTransitionProbabilitiesGrid.x *= totalMatrix;
-
-    // Transposed (interchanged Ievc and Evec)    
-    int parameterCountV = 6;
-    int totalParameterCount = 9;
-    gpu->LaunchKernel(fMatrixMulADBMulti,
-                      bgTransitionProbabilitiesBlock, bgTransitionProbabilitiesGrid,
-                      parameterCountV, totalParameterCount,
-                      dMatrices, dPtrQueue, dIevc, dEigenValues, dEvec, distanceQueue,
-                      kPaddedStateCount, kPaddedStateCount,
-                      totalMatrix);
-
-    bgTransitionProbabilitiesGrid.x /= totalMatrix; // Reset value
+    if (kCPUImplementation) {
+        // CPU variant computes one matrix row per work-item
+        Dim3Int bgTransitionProbabilitiesCPUGrid = Dim3Int(totalMatrix, kPaddedStateCount);
+
+        int parameterCountV = 6;
+        int totalParameterCount = 9;
+        gpu->LaunchKernel(fMatrixMulADBMulti,
+                          Dim3Int(1), bgTransitionProbabilitiesCPUGrid,
+                          parameterCountV, totalParameterCount,
+                          dMatrices, dPtrQueue, dIevc, dEigenValues, dEvec, distanceQueue,
+                          kPaddedStateCount, kPaddedStateCount,
+                          totalMatrix);
+    } else {
+        bgTransitionProbabilitiesGrid.x *= totalMatrix;
+
+        // Transposed (interchanged Ievc and Evec)
+        int parameterCountV = 6;
+        int totalParameterCount = 9;
+        gpu->LaunchKernel(fMatrixMulADBMulti,
+                          bgTransitionProbabilitiesBlock, bgTransitionProbabilitiesGrid,
+                          parameterCountV, totalParameterCount,
+                          dMatrices, dPtrQueue, dIevc, dEigenValues, dEvec, distanceQueue,
+                          kPaddedStateCount, kPaddedStateCount,
+                          totalMatrix);
+
+        bgTransitionProbabilitiesGrid.x /= totalMatrix; // Reset value
+    }
     
 #ifdef BEAGLE_DEBUG_FLOW
     fprintf(stderr, "\t\tLeaving  KernelLauncher::GetTransitionProbabilitiesSquareMulti\n");
@@ -550,19 +569,33 @@ void KernelLauncher::GetTransitionProbabilitiesSquare(GPUPtr dMatrices,
     fprintf(stderr, "\t\tEntering KernelLauncher::GetTransitionProbabilitiesSquare\n");
 #endif
 
-   bgTransitionProbabilitiesGrid.x *= totalMatrix;
-
-    // Transposed (interchanged Ievc and Evec)    
-    int parameterCountV = 6;
-    int totalParameterCount = 9;
-    gpu->LaunchKernel(fMatrixMulADB,
-                               bgTransitionProbabilitiesBlock, bgTransitionProbabilitiesGrid,
-                               parameterCountV, totalParameterCount,
-                               dMatrices, dPtrQueue, dIevc, dEigenValues, dEvec, distanceQueue,
-                               kPaddedStateCount, kPaddedStateCount,
-                               totalMatrix);
-
-    bgTransitionProbabilitiesGrid.x /= totalMatrix; // Reset value
+    if (kCPUImplementation) {
+        // CPU variant computes one matrix row per work-item
+        Dim3Int bgTransitionProbabilitiesCPUGrid = Dim3Int(totalMatrix, kPaddedStateCount);
+
+        int parameterCountV = 6;
+        int totalParameterCount = 9;
+        gpu->LaunchKernel(fMatrixMulADB,
+                          Dim3Int(1), bgTransitionProbabilitiesCPUGrid,
+                          parameterCountV, totalParameterCount,
+                          dMatrices, dPtrQueue, dIevc, dEigenValues, dEvec, distanceQueue,
+                          kPaddedStateCount, kPaddedStateCount,
+                          totalMatrix);
+    } else {
+        bgTransitionProbabilitiesGrid.x *= totalMatrix;
+
+        // Transposed (interchanged Ievc and Evec)
+        int parameterCountV = 6;
+        int totalParameterCount = 9;
+        gpu->LaunchKernel(fMatrixMulADB,
+                          bgTransitionProbabilitiesBlock, bgTransitionProbabilitiesGrid,
+                          parameterCountV, totalParameterCount,
+                          dMatrices, dPtrQueue, dIevc, dEigenValues, dEvec, distanceQueue,
+                          kPaddedStateCount, kPaddedStateCount,
+                          totalMatrix);
+
+        bgTransitionProbabilitiesGrid.x /= totalMatrix; // Reset value
+    }
 
     
 #ifdef BEAGLE_DEBUG_FLOW
@@ -1997,6 +2030,54 @@ void KernelLauncher::SumSites1Partition(GPUPtr dArray1,
     
 }
 
+void KernelLauncher::SumSitesFinal(GPUPtr dSum,
+                                   GPUPtr dResult,
+                                   int blockCount,
+                                   int resultIndex) {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\tEntering KernelLauncher::SumSitesFinal\n");
+#endif
+
+    Dim3Int bgSumSitesFinalGrid = Dim3Int(1);
+
+    int parameterCountV = 2;
+    int totalParameterCount = 4;
+    gpu->LaunchKernel(fSumSitesFinal,
+                      bgSumSitesFinalBlock, bgSumSitesFinalGrid,
+                      parameterCountV, totalParameterCount,
+                      dSum, dResult,
+                      blockCount, resultIndex);
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\tLeaving  KernelLauncher::SumSitesFinal\n");
+#endif
+
+}
+
+void KernelLauncher::SumSitesByPartition(GPUPtr dArray1,
+                                         GPUPtr dResult,
+                                         GPUPtr dPatternWeights,
+                                         GPUPtr dPtrOffsets,
+                                         int partitionCount) {
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\tEntering KernelLauncher::SumSitesByPartition\n");
+#endif
+
+    Dim3Int bgSumSitesByPartitionGrid = Dim3Int(partitionCount);
+
+    int parameterCountV = 4;
+    int totalParameterCount = 4;
+    gpu->LaunchKernel(fSumSitesByPartition,
+                      bgSumSitesBlock, bgSumSitesByPartitionGrid,
+                      parameterCountV, totalParameterCount,
+                      dArray1, dResult, dPatternWeights, dPtrOffsets);
+
+#ifdef BEAGLE_DEBUG_FLOW
+    fprintf(stderr, "\t\tLeaving  KernelLauncher::SumSitesByPartition\n");
+#endif
+
+}
+
 void KernelLauncher::SumSites2(GPUPtr dArray1,
                               GPUPtr dSum1,
                               GPUPtr dArray2,
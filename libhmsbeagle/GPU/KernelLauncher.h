@@ -104,6 +104,8 @@ private:
 
     GPUFunction fSumSites1;
     GPUFunction fSumSites1Partition;
+    GPUFunction fSumSitesFinal;
+    GPUFunction fSumSitesByPartition;
     GPUFunction fSumSites2;
     GPUFunction fSumSites3;
 
@@ -121,6 +123,7 @@ private:
     Dim3Int bgScaleGrid;
     Dim3Int bgSumSitesBlock;
     Dim3Int bgSumSitesGrid;
+    Dim3Int bgSumSitesFinalBlock;
     Dim3Int bgReorderPatternsBlock;
     Dim3Int bgReorderPatternsGrid;
 
@@ -494,6 +497,17 @@ public:
                             int endPattern,
                             int blockCount);
     
+    void SumSitesFinal(GPUPtr dSum,
+                       GPUPtr dResult,
+                       int blockCount,
+                       int resultIndex);
+
+    void SumSitesByPartition(GPUPtr dArray1,
+                             GPUPtr dResult,
+                             GPUPtr dPatternWeights,
+                             GPUPtr dPtrOffsets,
+                             int partitionCount);
+
     void SumSites2(GPUPtr dArray1,
                   GPUPtr dSum1,
                   GPUPtr dArray2,
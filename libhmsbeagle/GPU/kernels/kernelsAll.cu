@@ -108,6 +108,35 @@ KW_GLOBAL_KERNEL void kernelMatrixMulADBMulti(KW_GLOBAL_VAR REAL* dMatrices,
                                               int length,
                                               int wB,
                                               int totalMatrix) {
+#ifdef FW_OPENCL_CPU // CPU/MIC implementation
+    // one work-item per matrix row, no local memory or barriers; the inner
+    // loop runs along contiguous rows of B and C so that it vectorizes
+    int wMatrix = KW_GROUP_ID_0;
+    int row = KW_GROUP_ID_1;
+
+    int offIndex = wMatrix * 3;
+    KW_GLOBAL_VAR REAL* C = dMatrices + offsets[offIndex];
+    KW_GLOBAL_VAR REAL* B = Blist + offsets[offIndex + 1]; // dEvec
+    KW_GLOBAL_VAR REAL* A = Alist + offsets[offIndex + 1]; // dIevc
+    KW_GLOBAL_VAR REAL* D = Dlist + offsets[offIndex + 2]; // dEigenValues
+    REAL distance = distanceQueue[wMatrix];
+
+    REAL Crow[PADDED_STATE_COUNT];
+    for (int j = 0; j < PADDED_STATE_COUNT; j++)
+        Crow[j] = 0;
+
+    for (int k = 0; k < PADDED_STATE_COUNT; k++) {
+        REAL aD = A[row * PADDED_STATE_COUNT + k] * exp(D[k] * distance);
+        KW_GLOBAL_VAR REAL* Bk = B + k * PADDED_STATE_COUNT;
+        for (int j = 0; j < PADDED_STATE_COUNT; j++)
+            Crow[j] += aD * Bk[j];
+    }
+
+    KW_GLOBAL_VAR REAL* Cout = C + row * PADDED_STATE_COUNT;
+    for (int j = 0; j < PADDED_STATE_COUNT; j++)
+        Cout[j] = (Crow[j] < 0) ? 0 : Crow[j];
+
+#else // GPU implementation
            
     int wMatrix = KW_GROUP_ID_0 % totalMatrix;
     int offIndex = wMatrix * 3;
@@ -202,6 +231,7 @@ KW_GLOBAL_KERNEL void kernelMatrixMulADBMulti(KW_GLOBAL_VAR REAL* dMatrices,
             C[PADDED_STATE_COUNT* MULTIPLY_BLOCK_SIZE * by + MULTIPLY_BLOCK_SIZE * bx +
               PADDED_STATE_COUNT * ty + tx] = Csub;
     }
+#endif // FW_OPENCL_CPU
 }
 
 KW_GLOBAL_KERNEL void kernelMatrixMulADB(KW_GLOBAL_VAR REAL* dMatrices,
@@ -213,6 +243,31 @@ KW_GLOBAL_KERNEL void kernelMatrixMulADB(KW_GLOBAL_VAR REAL* dMatrices,
                                    int length,
                                    int wB,
                                    int totalMatrix) {
+#ifdef FW_OPENCL_CPU // CPU/MIC implementation
+    // one work-item per matrix row, no local memory or barriers; the inner
+    // loop runs along contiguous rows of B and C so that it vectorizes
+    int wMatrix = KW_GROUP_ID_0;
+    int row = KW_GROUP_ID_1;
+
+    KW_GLOBAL_VAR REAL* C = dMatrices + listC[wMatrix];
+    REAL distance = distanceQueue[wMatrix];
+
+    REAL Crow[PADDED_STATE_COUNT];
+    for (int j = 0; j < PADDED_STATE_COUNT; j++)
+        Crow[j] = 0;
+
+    for (int k = 0; k < PADDED_STATE_COUNT; k++) {
+        REAL aD = A[row * PADDED_STATE_COUNT + k] * exp(D[k] * distance);
+        KW_GLOBAL_VAR REAL* Bk = B + k * PADDED_STATE_COUNT;
+        for (int j = 0; j < PADDED_STATE_COUNT; j++)
+            Crow[j] += aD * Bk[j];
+    }
+
+    KW_GLOBAL_VAR REAL* Cout = C + row * PADDED_STATE_COUNT;
+    for (int j = 0; j < PADDED_STATE_COUNT; j++)
+        Cout[j] = (Crow[j] < 0) ? 0 : Crow[j];
+
+#else // GPU implementation
 
     int wMatrix = KW_GROUP_ID_0 % totalMatrix;
 
@@ -316,6 +371,7 @@ KW_GLOBAL_KERNEL void kernelMatrixMulADB(KW_GLOBAL_VAR REAL* dMatrices,
             C[PADDED_STATE_COUNT* MULTIPLY_BLOCK_SIZE * by + MULTIPLY_BLOCK_SIZE * bx +
               PADDED_STATE_COUNT * ty + tx] = Csub;
     }
+#endif // FW_OPENCL_CPU
 }
     
 KW_GLOBAL_KERNEL void kernelMatrixMulADBFirstDeriv(KW_GLOBAL_VAR REAL* dMatrices,
@@ -1265,6 +1321,105 @@ KW_GLOBAL_KERNEL void kernelSumSites1Partition(KW_GLOBAL_VAR REAL* dArray,
 #endif
 }
 
+// Second reduction stage for the block partial sums left by kernelSumSites1 /
+// kernelSumSites1Partition. In double precision a single work-group folds them
+// into dResult[resultIndex]; in single precision they are copied to
+// dResult[resultIndex ... resultIndex + blockCount) and added on the host in
+// double, as a float accumulator loses digits over long alignments.
+KW_GLOBAL_KERNEL void kernelSumSitesFinal(KW_GLOBAL_VAR REAL* dSum,
+                                          KW_GLOBAL_VAR REAL* dResult,
+                                          int blockCount,
+                                          int resultIndex) {
+#ifndef DOUBLE_PRECISION
+
+#ifdef FW_OPENCL_CPU
+    for (int i = 0; i < blockCount; i++)
+        dResult[resultIndex + i] = dSum[i];
+#else
+    for (int i = KW_LOCAL_ID_0; i < blockCount; i += SUM_SITES_BLOCK_SIZE)
+        dResult[resultIndex + i] = dSum[i];
+#endif
+
+#elif defined(FW_OPENCL_CPU)
+
+    REAL sum = 0;
+
+    for (int i = 0; i < blockCount; i++)
+        sum += dSum[i];
+
+    dResult[resultIndex] = sum;
+
+#else
+
+    KW_LOCAL_MEM REAL sum[SUM_SITES_BLOCK_SIZE];
+
+    int tx = KW_LOCAL_ID_0;
+
+    REAL partial = 0;
+    for (int i = tx; i < blockCount; i += SUM_SITES_BLOCK_SIZE)
+        partial += dSum[i];
+    sum[tx] = partial;
+
+    KW_LOCAL_FENCE;
+
+    for (unsigned int s = SUM_SITES_BLOCK_SIZE / 2; s > 0; s >>= 1) {
+        if (tx < s)
+            sum[tx] += sum[tx + s];
+        KW_LOCAL_FENCE;
+    }
+
+    if (tx == 0)
+        dResult[resultIndex] = sum[0];
+
+#endif
+}
+
+// one work-group per partition; dPtrOffsets holds [startPattern, endPattern) pairs.
+// Only launched in double precision, see kernelSumSitesFinal
+KW_GLOBAL_KERNEL void kernelSumSitesByPartition(KW_GLOBAL_VAR REAL*         dArray,
+                                                KW_GLOBAL_VAR REAL*         dResult,
+                                                KW_GLOBAL_VAR REAL*         dPatternWeights,
+                                                KW_GLOBAL_VAR unsigned int* dPtrOffsets) {
+
+    int partition = KW_GROUP_ID_0;
+    int startPattern = dPtrOffsets[partition * 2    ];
+    int endPattern   = dPtrOffsets[partition * 2 + 1];
+
+#ifdef FW_OPENCL_CPU
+
+    REAL sum = 0;
+
+    for (int pattern = startPattern; pattern < endPattern; pattern++) {
+        FMA(dArray[pattern],  dPatternWeights[pattern], sum);
+    }
+
+    dResult[partition] = sum;
+
+#else
+
+    KW_LOCAL_MEM REAL sum[SUM_SITES_BLOCK_SIZE];
+
+    int tx = KW_LOCAL_ID_0;
+
+    REAL partial = 0;
+    for (int pattern = startPattern + tx; pattern < endPattern; pattern += SUM_SITES_BLOCK_SIZE)
+        partial += dArray[pattern] * dPatternWeights[pattern];
+    sum[tx] = partial;
+
+    KW_LOCAL_FENCE;
+
+    for (unsigned int s = SUM_SITES_BLOCK_SIZE / 2; s > 0; s >>= 1) {
+        if (tx < s)
+            sum[tx] += sum[tx + s];
+        KW_LOCAL_FENCE;
+    }
+
+    if (tx == 0)
+        dResult[partition] = sum[0];
+
+#endif
+}
+
 // KW_GLOBAL_KERNEL void kernelSumSites1Partition(KW_GLOBAL_VAR REAL*         dArray,
 //                                                KW_GLOBAL_VAR REAL*         dSum,
 //                                                KW_GLOBAL_VAR REAL*         dPatternWeights,
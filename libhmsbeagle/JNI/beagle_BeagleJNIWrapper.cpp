@@ -6,11 +6,68 @@
 #include <cstdlib>
 #include <cstring>
 #include <cmath>
+#include <map>
+#include <mutex>
 #include <jni.h>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/JNI/beagle_BeagleJNIWrapper.h"
 
+/*
+ * The hot calls pin their array arguments with GetPrimitiveArrayCritical, which hands out the
+ * Java heap storage directly on JVMs that support pinning instead of copying the array on entry
+ * and release.  No JNI calls may be made between Get and Release, so the library call is the only
+ * thing done in between.  The *Direct variants take direct NIO buffers and never copy; they start
+ * at the position of each buffer and need as many elements past it as the call reads or writes,
+ * so the sizes of the instances created here are kept for them.
+ */
+
+struct InstanceSizes {
+    int patternCount;
+    int partialsSize;
+};
+
+static std::map<jint, InstanceSizes> instanceSizes;
+static std::mutex instanceSizesMutex;
+
+static bool getInstanceSizes(jint instance, InstanceSizes* outSizes)
+{
+    std::lock_guard<std::mutex> lock(instanceSizesMutex);
+    std::map<jint, InstanceSizes>::const_iterator it = instanceSizes.find(instance);
+    if (it == instanceSizes.end())
+        return false;
+    *outSizes = it->second;
+    return true;
+}
+
+static jmethodID getBufferPositionMethodID(JNIEnv *env)
+{
+    jclass bufferClass = env->FindClass("java/nio/Buffer");
+    return (bufferClass != NULL ? env->GetMethodID(bufferClass, "position", "()I") : NULL);
+}
+
+/*
+ * Stores the address of the element at the position of a direct buffer that holds at least
+ * count elements from there on.  Returns BEAGLE_ERROR_GENERAL for a NULL or non-direct buffer
+ * and BEAGLE_ERROR_OUT_OF_RANGE for one that is too small.
+ */
+static jint getDirectBufferAddress(JNIEnv *env, jobject buffer, size_t elementSize, jlong count,
+                                   void** outAddress)
+{
+    static const jmethodID positionMethodID = getBufferPositionMethodID(env);
+
+    char* address = (buffer != NULL ? (char*) env->GetDirectBufferAddress(buffer) : NULL);
+    if (address == NULL || positionMethodID == NULL)
+        return BEAGLE_ERROR_GENERAL;
+
+    jlong position = env->CallIntMethod(buffer, positionMethodID);
+    if (count < 0 || env->GetDirectBufferCapacity(buffer) - position < count)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    *outAddress = address + position * elementSize;
+    return BEAGLE_SUCCESS;
+}
+
 /*
  * Class:     beagle_BeagleJNIWrapper
  * Method:    getVersion
@@ -133,6 +190,12 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_createInstance
         env->ReleaseIntArrayElements(inResourceList, resourceList, JNI_ABORT);
     
 	if (instance >= 0) {
+		{
+			InstanceSizes sizes = {patternCount, patternCount * stateCount * categoryCount};
+			std::lock_guard<std::mutex> lock(instanceSizesMutex);
+			instanceSizes[instance] = sizes;
+		}
+
 		jclass objClass = env->FindClass("beagle/InstanceDetails");
 		if (objClass == NULL) {
 			printf("NULL returned in FindClass: can't find class: beagle/InstanceDetails\n");
@@ -167,6 +230,10 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_finalize
   (JNIEnv *env, jobject obj, jint instance)
 {
 	jint errCode = (jint)beagleFinalizeInstance(instance);
+    if (errCode == BEAGLE_SUCCESS) {
+        std::lock_guard<std::mutex> lock(instanceSizesMutex);
+        instanceSizes.erase(instance);
+    }
     return errCode;
 }
 
@@ -262,11 +329,13 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setTipPartials
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartials
   (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jdoubleArray inPartials)
 {
-    jdouble *partials = env->GetDoubleArrayElements(inPartials, NULL);
+    jdouble *partials = (jdouble *)env->GetPrimitiveArrayCritical(inPartials, NULL);
+    if (partials == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
 
 	jint errCode = (jint)beagleSetPartials(instance, bufferIndex, (double *)partials);
 
-    env->ReleaseDoubleArrayElements(inPartials, partials, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inPartials, partials, JNI_ABORT);
     return errCode;
 }
 
@@ -278,12 +347,14 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartials
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartials
 (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jint scaleIndex, jdoubleArray outPartials)
 {
-    jdouble *partials = env->GetDoubleArrayElements(outPartials, NULL);
+    jdouble *partials = (jdouble *)env->GetPrimitiveArrayCritical(outPartials, NULL);
+    if (partials == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
 
     jint errCode = beagleGetPartials(instance, bufferIndex, scaleIndex, (double *)partials);
 
     // not using JNI_ABORT flag here because we want the values to be copied back...
-    env->ReleaseDoubleArrayElements(outPartials, partials, 0);
+    env->ReleasePrimitiveArrayCritical(outPartials, partials, 0);
     return errCode;
 }
 
@@ -295,12 +366,14 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartials
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getLogScaleFactors
   (JNIEnv *env, jobject obj, jint instance, jint scaleIndex, jdoubleArray outScaleFactors)
 {
-    jdouble *scaleFactors = env->GetDoubleArrayElements(outScaleFactors, NULL);
+    jdouble *scaleFactors = (jdouble *)env->GetPrimitiveArrayCritical(outScaleFactors, NULL);
+    if (scaleFactors == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
 
     jint errCode = beagleGetScaleFactors(instance, scaleIndex, (double *)scaleFactors);
 
     // not using JNI_ABORT flag here because we want the values to be copied back...
-    env->ReleaseDoubleArrayElements(outScaleFactors, scaleFactors, 0);
+    env->ReleasePrimitiveArrayCritical(outScaleFactors, scaleFactors, 0);
     return errCode;
 }
 
@@ -462,16 +535,23 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_convolveTransitionMatrices
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updateTransitionMatrices
   (JNIEnv *env, jobject obj, jint instance, jint eigenIndex, jintArray inProbabilityIndices, jintArray inFirstDerivativeIndices, jintArray inSecondDerivativeIndices, jdoubleArray inEdgeLengths, jint count)
 {
-    jint *probabilityIndices = env->GetIntArrayElements(inProbabilityIndices, NULL);
-    jint *firstDerivativeIndices = inFirstDerivativeIndices != NULL ? env->GetIntArrayElements(inFirstDerivativeIndices, NULL) : NULL;
-    jint *secondDerivativeIndices = inSecondDerivativeIndices != NULL ? env->GetIntArrayElements(inSecondDerivativeIndices, NULL) : NULL;
-    jdouble *edgeLengths = env->GetDoubleArrayElements(inEdgeLengths, NULL);
-    jint errCode = (jint)beagleUpdateTransitionMatrices(instance, eigenIndex, (int *)probabilityIndices, (int *)firstDerivativeIndices, (int *)secondDerivativeIndices, (double *)edgeLengths, count);
+    jint *probabilityIndices = (jint *)env->GetPrimitiveArrayCritical(inProbabilityIndices, NULL);
+    jint *firstDerivativeIndices = inFirstDerivativeIndices != NULL ? (jint *)env->GetPrimitiveArrayCritical(inFirstDerivativeIndices, NULL) : NULL;
+    jint *secondDerivativeIndices = inSecondDerivativeIndices != NULL ? (jint *)env->GetPrimitiveArrayCritical(inSecondDerivativeIndices, NULL) : NULL;
+    jdouble *edgeLengths = (jdouble *)env->GetPrimitiveArrayCritical(inEdgeLengths, NULL);
 
-    env->ReleaseDoubleArrayElements(inEdgeLengths, edgeLengths, JNI_ABORT);
-    if (inSecondDerivativeIndices != NULL) env->ReleaseIntArrayElements(inSecondDerivativeIndices, secondDerivativeIndices, JNI_ABORT);
-    if (inFirstDerivativeIndices != NULL) env->ReleaseIntArrayElements(inFirstDerivativeIndices, firstDerivativeIndices, JNI_ABORT);
-    env->ReleaseIntArrayElements(inProbabilityIndices, probabilityIndices, JNI_ABORT);
+    jint errCode;
+    if (probabilityIndices == NULL || edgeLengths == NULL ||
+        (inFirstDerivativeIndices != NULL && firstDerivativeIndices == NULL) ||
+        (inSecondDerivativeIndices != NULL && secondDerivativeIndices == NULL))
+        errCode = BEAGLE_ERROR_OUT_OF_MEMORY;
+    else
+        errCode = (jint)beagleUpdateTransitionMatrices(instance, eigenIndex, (int *)probabilityIndices, (int *)firstDerivativeIndices, (int *)secondDerivativeIndices, (double *)edgeLengths, count);
+
+    if (edgeLengths != NULL) env->ReleasePrimitiveArrayCritical(inEdgeLengths, edgeLengths, JNI_ABORT);
+    if (secondDerivativeIndices != NULL) env->ReleasePrimitiveArrayCritical(inSecondDerivativeIndices, secondDerivativeIndices, JNI_ABORT);
+    if (firstDerivativeIndices != NULL) env->ReleasePrimitiveArrayCritical(inFirstDerivativeIndices, firstDerivativeIndices, JNI_ABORT);
+    if (probabilityIndices != NULL) env->ReleasePrimitiveArrayCritical(inProbabilityIndices, probabilityIndices, JNI_ABORT);
 
     return errCode;
 }
@@ -511,11 +591,13 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updateTransitionMatricesWith
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartials
   (JNIEnv *env, jobject obj, jint instance, jintArray inOperations, jint operationCount, jint cumulativeScalingIndex)
 {
-    jint *operations = env->GetIntArrayElements(inOperations, NULL);
+    jint *operations = (jint *)env->GetPrimitiveArrayCritical(inOperations, NULL);
+    if (operations == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
 
 	jint errCode = (jint)beagleUpdatePartials(instance, (BeagleOperation*)operations, operationCount, cumulativeScalingIndex);
 
-    env->ReleaseIntArrayElements(inOperations, operations, JNI_ABORT);
+    env->ReleasePrimitiveArrayCritical(inOperations, operations, JNI_ABORT);
 
     return errCode;
 }
@@ -793,15 +875,141 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_calculateEdgeLogLikelihoods
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoods
 (JNIEnv *env, jobject obj, jint instance, jdoubleArray outSiteLogLikelihoods) {
 	
-	jdouble *siteLogLikelihoods = env->GetDoubleArrayElements(outSiteLogLikelihoods, NULL);
+	jdouble *siteLogLikelihoods = (jdouble *)env->GetPrimitiveArrayCritical(outSiteLogLikelihoods, NULL);
+    if (siteLogLikelihoods == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
 	
 	jint errCode = (jint)beagleGetSiteLogLikelihoods(instance, (double *)siteLogLikelihoods);
 	
     // not using JNI_ABORT flag here because we want the values to be copied back...
-    env->ReleaseDoubleArrayElements(outSiteLogLikelihoods, siteLogLikelihoods, 0);
+    env->ReleasePrimitiveArrayCritical(outSiteLogLikelihoods, siteLogLikelihoods, 0);
     return errCode;
 }
 
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setPartialsDirect
+ * Signature: (IILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jobject inPartials)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+
+    void *partials = NULL;
+    jint errCode = getDirectBufferAddress(env, inPartials, sizeof(double), sizes.partialsSize, &partials);
+    if (errCode != BEAGLE_SUCCESS)
+        return errCode;
+
+    return (jint)beagleSetPartials(instance, bufferIndex, (double *)partials);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getPartialsDirect
+ * Signature: (IIILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint bufferIndex, jint scaleIndex, jobject outPartials)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+
+    void *partials = NULL;
+    jint errCode = getDirectBufferAddress(env, outPartials, sizeof(double), sizes.partialsSize, &partials);
+    if (errCode != BEAGLE_SUCCESS)
+        return errCode;
+
+    return (jint)beagleGetPartials(instance, bufferIndex, scaleIndex, (double *)partials);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getLogScaleFactorsDirect
+ * Signature: (IILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getLogScaleFactorsDirect
+  (JNIEnv *env, jobject obj, jint instance, jint scaleIndex, jobject outScaleFactors)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+
+    void *scaleFactors = NULL;
+    jint errCode = getDirectBufferAddress(env, outScaleFactors, sizeof(double), sizes.patternCount, &scaleFactors);
+    if (errCode != BEAGLE_SUCCESS)
+        return errCode;
+
+    return (jint)beagleGetScaleFactors(instance, scaleIndex, (double *)scaleFactors);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    updateTransitionMatricesDirect
+ * Signature: (IILjava/nio/IntBuffer;Ljava/nio/IntBuffer;Ljava/nio/IntBuffer;Ljava/nio/DoubleBuffer;I)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updateTransitionMatricesDirect
+  (JNIEnv *env, jobject obj, jint instance, jint eigenIndex, jobject inProbabilityIndices, jobject inFirstDerivativeIndices, jobject inSecondDerivativeIndices, jobject inEdgeLengths, jint count)
+{
+    void *probabilityIndices = NULL;
+    void *firstDerivativeIndices = NULL;
+    void *secondDerivativeIndices = NULL;
+    void *edgeLengths = NULL;
+
+    jint errCode = getDirectBufferAddress(env, inProbabilityIndices, sizeof(int), count, &probabilityIndices);
+    if (errCode == BEAGLE_SUCCESS)
+        errCode = getDirectBufferAddress(env, inEdgeLengths, sizeof(double), count, &edgeLengths);
+    if (errCode == BEAGLE_SUCCESS && inFirstDerivativeIndices != NULL)
+        errCode = getDirectBufferAddress(env, inFirstDerivativeIndices, sizeof(int), count, &firstDerivativeIndices);
+    if (errCode == BEAGLE_SUCCESS && inSecondDerivativeIndices != NULL)
+        errCode = getDirectBufferAddress(env, inSecondDerivativeIndices, sizeof(int), count, &secondDerivativeIndices);
+    if (errCode != BEAGLE_SUCCESS)
+        return errCode;
+
+    return (jint)beagleUpdateTransitionMatrices(instance, eigenIndex, (int *)probabilityIndices, (int *)firstDerivativeIndices, (int *)secondDerivativeIndices, (double *)edgeLengths, count);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    updatePartialsDirect
+ * Signature: (ILjava/nio/IntBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartialsDirect
+  (JNIEnv *env, jobject obj, jint instance, jobject inOperations, jint operationCount, jint cumulativeScalingIndex)
+{
+    const jlong operationSize = sizeof(BeagleOperation) / sizeof(int);
+
+    void *operations = NULL;
+    jint errCode = getDirectBufferAddress(env, inOperations, sizeof(int), operationCount * operationSize, &operations);
+    if (errCode != BEAGLE_SUCCESS)
+        return errCode;
+
+    return (jint)beagleUpdatePartials(instance, (BeagleOperation *)operations, operationCount, cumulativeScalingIndex);
+}
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getSiteLogLikelihoodsDirect
+ * Signature: (ILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoodsDirect
+  (JNIEnv *env, jobject obj, jint instance, jobject outSiteLogLikelihoods)
+{
+    InstanceSizes sizes;
+    if (!getInstanceSizes(instance, &sizes))
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+
+    void *siteLogLikelihoods = NULL;
+    jint errCode = getDirectBufferAddress(env, outSiteLogLikelihoods, sizeof(double), sizes.patternCount, &siteLogLikelihoods);
+    if (errCode != BEAGLE_SUCCESS)
+        return errCode;
+
+    return (jint)beagleGetSiteLogLikelihoods(instance, (double *)siteLogLikelihoods);
+}
+
 //void __attribute__ ((constructor)) beagle_jni_library_initialize(void) {
 //	
 //}
@@ -295,6 +295,54 @@ JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_calculateRootLogLikelihoodsB
 JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoods
   (JNIEnv *, jobject, jint, jdoubleArray);
 
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    setPartialsDirect
+ * Signature: (IILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_setPartialsDirect
+  (JNIEnv *, jobject, jint, jint, jobject);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getPartialsDirect
+ * Signature: (IIILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getPartialsDirect
+  (JNIEnv *, jobject, jint, jint, jint, jobject);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getLogScaleFactorsDirect
+ * Signature: (IILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getLogScaleFactorsDirect
+  (JNIEnv *, jobject, jint, jint, jobject);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    updateTransitionMatricesDirect
+ * Signature: (IILjava/nio/IntBuffer;Ljava/nio/IntBuffer;Ljava/nio/IntBuffer;Ljava/nio/DoubleBuffer;I)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updateTransitionMatricesDirect
+  (JNIEnv *, jobject, jint, jint, jobject, jobject, jobject, jobject, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    updatePartialsDirect
+ * Signature: (ILjava/nio/IntBuffer;II)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_updatePartialsDirect
+  (JNIEnv *, jobject, jint, jobject, jint, jint);
+
+/*
+ * Class:     beagle_BeagleJNIWrapper
+ * Method:    getSiteLogLikelihoodsDirect
+ * Signature: (ILjava/nio/DoubleBuffer;)I
+ */
+JNIEXPORT jint JNICALL Java_beagle_BeagleJNIWrapper_getSiteLogLikelihoodsDirect
+  (JNIEnv *, jobject, jint, jobject);
+
 #ifdef __cplusplus
 }
 #endif
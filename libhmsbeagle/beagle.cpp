@@ -32,20 +32,37 @@
 
 #ifdef _WIN32
 #include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #endif
 
 #include <cstdio>
+#include <cmath>
 #include <cstdlib>
 #include <cstring>
 #include <exception>    // for exception, bad_exception
 #include <stdexcept>    // for std exception hierarchy
 #include <list>
+#include <map>
+#include <string>
+#include <fstream>
+#include <iterator>
+#include <algorithm>
 #include <utility>
 #include <vector>
 #include <iostream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <stdint.h>
 
 #include "libhmsbeagle/beagle.h"
 #include "libhmsbeagle/BeagleImpl.h"
+#include "libhmsbeagle/BeagleTrace.h"
 
 #include "libhmsbeagle/plugin/Plugin.h"
 
@@ -79,20 +96,524 @@ double debugGetTime() {
 #define DEBUG_FINALIZE_TIME()
 #endif
 
-//@CHANGED make this a std::vector<BeagleImpl *> and use at to reference.
-std::vector<beagle::BeagleImpl*> *instances = NULL;
+#define STATISTICS_TIME(entryPoint) beagle::StatisticsTimer statisticsTimer(instance, entryPoint);
+#define TRACE_CALL(call) beagle::TraceRecord trace(instance, call);
 
-/// returns an initialized instance or NULL if the index refers to an invalid instance
 namespace beagle {
-BeagleImpl* getBeagleInstance(int instanceIndex);
 
+/// buffer counts of an instance, used to check commands when they are recorded
+struct InstanceDimensions {
+    int bufferCount;
+    int eigenBufferCount;
+    int matrixBufferCount;
+    int scaleBufferCount;
+};
+
+/// arguments an instance was created with, used to create clones on the same resource
+struct InstanceCreation {
+    int tipCount;
+    int partialsBufferCount;
+    int compactBufferCount;
+    int stateCount;
+    int patternCount;
+    int eigenBufferCount;
+    int matrixBufferCount;
+    int categoryCount;
+    int scaleBufferCount;
+    int resource;
+    long preferenceFlags;
+    long requirementFlags;
+    BeagleImplFactory* factory;
+};
+
+enum CommandCode {
+    COMMAND_UPDATE_TRANSITION_MATRICES,
+    COMMAND_UPDATE_PARTIALS,
+    COMMAND_ACCUMULATE_SCALE_FACTORS,
+    COMMAND_RESET_SCALE_FACTORS,
+    COMMAND_CALCULATE_ROOT_LOG_LIKELIHOODS
+};
+
+/// a single recorded call; empty index lists stand for NULL arguments
+struct RecordedCommand {
+    CommandCode code;
+    int count;
+    int index;
+    std::vector<int> indices0;
+    std::vector<int> indices1;
+    std::vector<int> indices2;
+    std::vector<int> indices3;
+};
+
+struct CommandBuffer {
+    int instance;
+    std::vector<RecordedCommand> commands;
+    int edgeLengthCount;
+    int logLikelihoodCount;
+};
+
+/*
+ * Instance handles index a table of slots that is read without locks. The low bits of a handle
+ * select the slot and the high bits carry the generation of the slot when the handle was issued,
+ * so a handle to a finalized instance stays invalid after its slot has been reused. Slots are
+ * allocated in chunks that are never moved or freed while the library is loaded, and free slots
+ * are kept on a lock-free stack whose head carries a tag against ABA.
+ * Each instance must still be used by one thread at a time.
+ */
+#define BEAGLE_INSTANCE_SLOT_BITS        16
+#define BEAGLE_INSTANCE_GENERATION_MASK  0x7fff
+#define BEAGLE_INSTANCE_CHUNK_SIZE       256
+#define BEAGLE_INSTANCE_CHUNK_COUNT      ((1 << BEAGLE_INSTANCE_SLOT_BITS) / BEAGLE_INSTANCE_CHUNK_SIZE)
+
+/// layout of a file written by beagleWriteTipStatesFile; the states of each tip start on a 64-byte boundary
+#define BEAGLE_TIP_STATES_FILE_VERSION   2
+#define BEAGLE_TIP_STATES_FILE_ALIGNMENT 64
+
+struct TipStatesFileHeader {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t version;
+    int32_t tipCount;
+    int32_t patternCount;
+    int32_t stateCount;
+    int32_t reserved[9];
+};
+
+struct MappedFile {
+    void* data;
+    size_t size;
+};
+
+/// tree registered with beagleSetTreeTopology; node i is partials buffer i
+struct TreeState {
+    std::vector<int> parents;
+    std::vector<int> children;     /// two per node, BEAGLE_OP_NONE at tips
+    std::vector<int> matrices;     /// transition matrix of the edge above each node
+    std::vector<int> scaleIndices; /// scale buffer written by each internal node or BEAGLE_OP_NONE
+    std::vector<int> accumulated;  /// scale buffer currently included in the cumulative buffer
+    std::vector<char> dirty;       /// partials to recompute; ancestors of a dirty node are dirty
+    int root;
+    int cumulativeScaleIndex;
+    bool resetCumulative;          /// cumulative buffer must be rebuilt from all scale buffers
+};
+
+/// entry point counters of an instance; calls on other threads and readers only race on
+/// relaxed atomics, and the counters stay allocated from the first enable until the slot is freed
+struct EntryPointStatistics {
+    std::atomic<bool> enabled;
+    std::atomic<uint64_t> callCount[BEAGLE_STATISTICS_ENTRY_POINT_COUNT];
+    std::atomic<uint64_t> wallTime[BEAGLE_STATISTICS_ENTRY_POINT_COUNT]; /// nanoseconds
+
+    EntryPointStatistics() : enabled(false) {
+        reset();
+    }
+
+    void reset() {
+        for (int i = 0; i < BEAGLE_STATISTICS_ENTRY_POINT_COUNT; i++) {
+            callCount[i].store(0, std::memory_order_relaxed);
+            wallTime[i].store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+struct InstanceSlot {
+    InstanceSlot() : ready(false), impl(NULL), generation(0), nextFree(-1), statistics(NULL), tree(NULL),
+                     flags(0) {
+        tipStatesFile.data = NULL;
+        tipStatesFile.size = 0;
+    }
+
+    /// set once the slot has been reserved; lookups ignore slots that are not ready
+    std::atomic<bool> ready;
+    std::atomic<BeagleImpl*> impl;
+    std::atomic<int> generation;
+    std::atomic<int> nextFree;
+    /// entry point statistics, NULL until collection is first enabled
+    std::atomic<EntryPointStatistics*> statistics;
+    InstanceDimensions dimensions;
+    InstanceCreation creation;
+    /// file mapped by beagleMapTipStatesFile, released after the instance is deleted
+    MappedFile tipStatesFile;
+    /// tree registered with beagleSetTreeTopology or NULL
+    TreeState* tree;
+    /// flags reported by the implementation, used to size the arrays of traced calls
+    long flags;
+};
+
+class InstanceTable {
+public:
+    InstanceTable() : reservedCount(0), freeHead(0) {
+        for (int i = 0; i < BEAGLE_INSTANCE_CHUNK_COUNT; i++)
+            chunks[i].store(NULL, std::memory_order_relaxed);
+    }
+
+    /// returns the slot of a live instance handle or NULL
+    InstanceSlot* lookup(int handle) {
+        if (handle < 0)
+            return NULL;
+        InstanceSlot* slot = slotAt(handle & ((1 << BEAGLE_INSTANCE_SLOT_BITS) - 1));
+        if (slot == NULL)
+            return NULL;
+        int generation = handle >> BEAGLE_INSTANCE_SLOT_BITS;
+        if ((slot->generation.load(std::memory_order_acquire) & BEAGLE_INSTANCE_GENERATION_MASK) != generation ||
+            slot->impl.load(std::memory_order_acquire) == NULL)
+            return NULL;
+        return slot;
+    }
+
+    /// returns the slot of a live instance handle and its instance, or NULL
+    InstanceSlot* lookup(int handle, BeagleImpl** outImpl) {
+        InstanceSlot* slot = lookup(handle);
+        if (slot == NULL)
+            return NULL;
+        BeagleImpl* impl = slot->impl.load(std::memory_order_acquire);
+        // the slot may have been finalized and reused between the generation check and the load
+        if (impl == NULL ||
+            (slot->generation.load(std::memory_order_acquire) & BEAGLE_INSTANCE_GENERATION_MASK) !=
+            (handle >> BEAGLE_INSTANCE_SLOT_BITS))
+            return NULL;
+        *outImpl = impl;
+        return slot;
+    }
+
+    BeagleImpl* getImpl(int handle) {
+        BeagleImpl* impl = NULL;
+        return (lookup(handle, &impl) != NULL ? impl : NULL);
+    }
+
+    /// stores an instance in a free slot and returns its handle, or -1 if the table is full
+    int insert(BeagleImpl* impl, const InstanceDimensions& dimensions, const InstanceCreation& creation) {
+        int index = popFree();
+        if (index < 0)
+            return -1;
+        InstanceSlot* slot = slotAt(index);
+        slot->statistics.store(NULL, std::memory_order_relaxed);
+        slot->dimensions = dimensions;
+        slot->creation = creation;
+        slot->tipStatesFile.data = NULL;
+        slot->tipStatesFile.size = 0;
+        slot->tree = NULL;
+        slot->flags = 0;
+        slot->impl.store(impl, std::memory_order_release);
+        int generation = slot->generation.load(std::memory_order_relaxed) & BEAGLE_INSTANCE_GENERATION_MASK;
+        return (generation << BEAGLE_INSTANCE_SLOT_BITS) | index;
+    }
+
+    /// detaches the instance of a handle; only one of several concurrent callers gets it back,
+    /// together with the tip states file it still uses
+    BeagleImpl* remove(int handle, MappedFile* outTipStatesFile) {
+        InstanceSlot* slot = lookup(handle);
+        if (slot == NULL)
+            return NULL;
+        BeagleImpl* impl = slot->impl.load(std::memory_order_acquire);
+        if (impl == NULL || !slot->impl.compare_exchange_strong(impl, NULL, std::memory_order_acq_rel))
+            return NULL;
+        *outTipStatesFile = slot->tipStatesFile;
+        delete slot->statistics.exchange(NULL, std::memory_order_acq_rel);
+        delete slot->tree;
+        slot->tree = NULL;
+        slot->generation.fetch_add(1, std::memory_order_acq_rel);
+        pushFree(handle & ((1 << BEAGLE_INSTANCE_SLOT_BITS) - 1));
+        return impl;
+    }
+
+    /// frees the statistics and trees of all slots; instances themselves belong to the caller
+    void clear() {
+        for (int i = 0; i < BEAGLE_INSTANCE_CHUNK_COUNT; i++) {
+            InstanceSlot* chunk = chunks[i].load(std::memory_order_acquire);
+            if (chunk != NULL) {
+                for (int j = 0; j < BEAGLE_INSTANCE_CHUNK_SIZE; j++) {
+                    delete chunk[j].statistics.exchange(NULL, std::memory_order_acq_rel);
+                    delete chunk[j].tree;
+                    chunk[j].tree = NULL;
+                }
+            }
+        }
+    }
+
+private:
+    InstanceSlot* slotAt(int index) {
+        InstanceSlot* chunk = chunks[index / BEAGLE_INSTANCE_CHUNK_SIZE].load(std::memory_order_acquire);
+        if (chunk == NULL || index >= reservedCount.load(std::memory_order_acquire))
+            return NULL;
+        InstanceSlot* slot = &chunk[index % BEAGLE_INSTANCE_CHUNK_SIZE];
+        return (slot->ready.load(std::memory_order_acquire) ? slot : NULL);
+    }
+
+    int popFree() {
+        uint64_t head = freeHead.load(std::memory_order_acquire);
+        int index = (int) (head & 0xffffffff) - 1;
+        while (index >= 0) {
+            int next = slotAt(index)->nextFree.load(std::memory_order_relaxed);
+            uint64_t newHead = (((head >> 32) + 1) << 32) | (uint64_t) (next + 1);
+            if (freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel))
+                return index;
+            index = (int) (head & 0xffffffff) - 1;
+        }
+
+        // no free slot, take a fresh one
+        int capacity = BEAGLE_INSTANCE_CHUNK_COUNT * BEAGLE_INSTANCE_CHUNK_SIZE;
+        index = reservedCount.fetch_add(1, std::memory_order_acq_rel);
+        if (index >= capacity) {
+            reservedCount.fetch_sub(1, std::memory_order_acq_rel);
+            return -1;
+        }
+        std::atomic<InstanceSlot*>& chunkPointer = chunks[index / BEAGLE_INSTANCE_CHUNK_SIZE];
+        if (chunkPointer.load(std::memory_order_acquire) == NULL) {
+            InstanceSlot* chunk = new InstanceSlot[BEAGLE_INSTANCE_CHUNK_SIZE];
+            InstanceSlot* expected = NULL;
+            if (!chunkPointer.compare_exchange_strong(expected, chunk, std::memory_order_acq_rel))
+                delete[] chunk;
+        }
+        chunkPointer.load(std::memory_order_acquire)[index % BEAGLE_INSTANCE_CHUNK_SIZE].ready.store(
+            true, std::memory_order_release);
+        return index;
+    }
+
+    void pushFree(int index) {
+        InstanceSlot* slot = slotAt(index);
+        uint64_t head = freeHead.load(std::memory_order_acquire);
+        uint64_t newHead;
+        do {
+            slot->nextFree.store((int) (head & 0xffffffff) - 1, std::memory_order_relaxed);
+            newHead = (((head >> 32) + 1) << 32) | (uint64_t) (index + 1);
+        } while (!freeHead.compare_exchange_weak(head, newHead, std::memory_order_acq_rel));
+    }
+
+    std::atomic<InstanceSlot*> chunks[BEAGLE_INSTANCE_CHUNK_COUNT];
+    std::atomic<int> reservedCount;
+    /// 1 + index of the first free slot in the low 32 bits, a tag against ABA in the high ones
+    std::atomic<uint64_t> freeHead;
+};
+
+/*
+ * Command buffer handles carry a generation in their high bits like instance handles, so a
+ * finalized buffer's handle stays invalid once its index is reused. The table is guarded by a
+ * mutex; a buffer, like its instance, must still be used by one thread at a time.
+ */
+class CommandBufferTable {
+public:
+    // constant-initialized, so the table is usable before any other static constructor runs
+    constexpr CommandBufferTable() : slots(NULL), freeIndices(NULL) {}
+
+    /// returns the buffer of a live handle or NULL
+    CommandBuffer* lookup(int handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        CommandBufferSlot* slot = slotOf(handle);
+        return (slot != NULL ? slot->buffer : NULL);
+    }
+
+    /// stores a buffer in a free slot and returns its handle, or -1 if the table is full
+    int insert(CommandBuffer* buffer) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slots == NULL)
+            slots = new std::vector<CommandBufferSlot>;
+        if (freeIndices == NULL)
+            freeIndices = new std::vector<int>;
+        int index;
+        if (!freeIndices->empty()) {
+            index = freeIndices->back();
+            freeIndices->pop_back();
+        } else {
+            index = (int) slots->size();
+            if (index >= (1 << BEAGLE_INSTANCE_SLOT_BITS))
+                return -1;
+            CommandBufferSlot slot = {NULL, 0};
+            slots->push_back(slot);
+        }
+        CommandBufferSlot& slot = (*slots)[index];
+        slot.buffer = buffer;
+        return ((slot.generation & BEAGLE_INSTANCE_GENERATION_MASK) << BEAGLE_INSTANCE_SLOT_BITS) | index;
+    }
+
+    /// detaches the buffer of a handle and recycles its slot; the caller deletes the buffer
+    CommandBuffer* remove(int handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        CommandBufferSlot* slot = slotOf(handle);
+        if (slot == NULL)
+            return NULL;
+        CommandBuffer* buffer = slot->buffer;
+        slot->buffer = NULL;
+        slot->generation++;
+        freeIndices->push_back(handle & ((1 << BEAGLE_INSTANCE_SLOT_BITS) - 1));
+        return buffer;
+    }
+
+    /// deletes every buffer; the table itself stays usable
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (slots != NULL) {
+            for (size_t i = 0; i < slots->size(); i++)
+                delete (*slots)[i].buffer;
+            delete slots;
+            slots = NULL;
+        }
+        delete freeIndices;
+        freeIndices = NULL;
+    }
 
+private:
+    struct CommandBufferSlot {
+        CommandBuffer* buffer;
+        int generation;
+    };
+
+    CommandBufferSlot* slotOf(int handle) {
+        if (handle < 0 || slots == NULL)
+            return NULL;
+        int index = handle & ((1 << BEAGLE_INSTANCE_SLOT_BITS) - 1);
+        if (index >= (int) slots->size())
+            return NULL;
+        CommandBufferSlot* slot = &(*slots)[index];
+        if (slot->buffer == NULL ||
+            (slot->generation & BEAGLE_INSTANCE_GENERATION_MASK) != (handle >> BEAGLE_INSTANCE_SLOT_BITS))
+            return NULL;
+        return slot;
+    }
+
+    // plain pointers, so the table can still be cleared from the library destructor
+    std::mutex mutex;
+    std::vector<CommandBufferSlot>* slots;
+    std::vector<int>* freeIndices;
+};
+
+}	// end namespace beagle
+
+beagle::InstanceTable instanceTable;
+
+beagle::CommandBufferTable commandBufferTable;
+
+/// file named by BEAGLE_TRACE that completed calls are appended to, NULL while not tracing
+static FILE* traceFile = NULL;
+static std::mutex traceMutex;
+
+namespace beagle {
+
+/// returns an initialized instance or NULL if the index refers to an invalid instance
 BeagleImpl* getBeagleInstance(int instanceIndex) {
-    if (instanceIndex > instances->size())
-        return NULL;
-    return (*instances)[instanceIndex];
+    return instanceTable.getImpl(instanceIndex);
 }
 
+/// counts one entry point call and its wall time if the instance collects statistics
+class StatisticsTimer {
+public:
+    StatisticsTimer(int instanceIndex, int entryPoint) : statistics(NULL), entryPoint(entryPoint) {
+        InstanceSlot* slot = instanceTable.lookup(instanceIndex);
+        if (slot != NULL) {
+            EntryPointStatistics* slotStatistics = slot->statistics.load(std::memory_order_acquire);
+            if (slotStatistics != NULL && slotStatistics->enabled.load(std::memory_order_relaxed))
+                statistics = slotStatistics;
+        }
+        if (statistics != NULL)
+            startTime = std::chrono::steady_clock::now();
+    }
+
+    ~StatisticsTimer() {
+        if (statistics != NULL) {
+            statistics->callCount[entryPoint].fetch_add(1, std::memory_order_relaxed);
+            statistics->wallTime[entryPoint].fetch_add(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - startTime).count(),
+                std::memory_order_relaxed);
+        }
+    }
+
+private:
+    EntryPointStatistics* statistics;
+    int entryPoint;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+/// collects the arguments of one call and appends them to the trace file, see BeagleTrace.h;
+/// does nothing unless BEAGLE_TRACE was set when the library was loaded
+class TraceRecord {
+public:
+    TraceRecord(int handle, TraceCall call) : active(traceFile != NULL), slot(NULL) {
+        if (!active)
+            return;
+        header.call = call;
+        header.handle = handle;
+        header.returnValue = BEAGLE_SUCCESS;
+        header.size = 0;
+        header.seconds = 0.0;
+        slot = instanceTable.lookup(handle);
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    void putInt(int value) {
+        int32_t stored = value;
+        append(&stored, sizeof(stored));
+    }
+
+    void putLong(long value) {
+        int64_t stored = value;
+        append(&stored, sizeof(stored));
+    }
+
+    void putDouble(double value) {
+        append(&value, sizeof(value));
+    }
+
+    void putInts(const int* values, int count) {
+        putCount(values, count);
+        if (values != NULL && count > 0)
+            append(values, sizeof(int) * count);
+    }
+
+    void putDoubles(const double* values, int count) {
+        putCount(values, count);
+        if (values != NULL && count > 0)
+            append(values, sizeof(double) * count);
+    }
+
+    void putBytes(const void* values, size_t count) {
+        putCount(values, (int) count);
+        if (values != NULL && count > 0)
+            append(values, count);
+    }
+
+    void putString(const char* value) {
+        putBytes(value, (value != NULL ? strlen(value) : 0));
+    }
+
+    /// instance dimensions for the arrays of the call, zero without an instance
+    int stateCount() const { return (slot != NULL ? slot->creation.stateCount : 0); }
+    int patternCount() const { return (slot != NULL ? slot->creation.patternCount : 0); }
+    int categoryCount() const { return (slot != NULL ? slot->creation.categoryCount : 0); }
+    int eigenValueCount() const {
+        return (slot != NULL && (slot->flags & BEAGLE_FLAG_EIGEN_COMPLEX) ? 2 : 1) * stateCount();
+    }
+
+    bool isActive() const { return active; }
+
+    void write(int returnValue) {
+        if (!active)
+            return;
+        header.returnValue = returnValue;
+        header.size = payload.size();
+        header.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        std::lock_guard<std::mutex> lock(traceMutex);
+        fwrite(&header, sizeof(header), 1, traceFile);
+        if (!payload.empty())
+            fwrite(&payload[0], 1, payload.size(), traceFile);
+    }
+
+private:
+    void putCount(const void* values, int count) {
+        putInt(values != NULL ? (count > 0 ? count : 0) : -1);
+    }
+
+    void append(const void* data, size_t size) {
+        if (active)
+            payload.insert(payload.end(), (const char*) data, (const char*) data + size);
+    }
+
+    bool active;
+    InstanceSlot* slot;
+    TraceRecordHeader header;
+    std::vector<char> payload;
+    std::chrono::steady_clock::time_point startTime;
+};
+
 }	// end namespace beagle
 
 
@@ -114,76 +635,179 @@ std::map<int, int> ResourceMap;
 int loaded = 0; // Indicates is the initial library constructors have been run
                 // This patches a bug with JVM under Linux that calls the finalizer twice
 
+/// guards plugin loading and the resource and factory lists built from the plugins
+static std::mutex libraryInitializationMutex;
+
 /** The list of plugins that provide implementations of likelihood calculators */
 std::list<beagle::plugin::Plugin*>* plugins;
 
-void beagleLoadPlugins(void) {
+/** Plugins in trial order; GPU plugins are only opened once an instance might run on them */
+static const struct {
+    const char* name;
+    bool cpu;
+} pluginCatalog[] = {
+    {"hmsbeagle-cpu",           true},
+    {"hmsbeagle-cuda",          false},
+    {"hmsbeagle-opencl",        false},
+    {"hmsbeagle-opencl-altera", false},
+    {"hmsbeagle-cpu-sse",       true},
+    {"hmsbeagle-cpu-avx",       true},
+    {"hmsbeagle-cpu-openmp",    true}
+};
+static const int kPluginCatalogSize = sizeof(pluginCatalog) / sizeof(pluginCatalog[0]);
+static bool pluginProbed[kPluginCatalogSize];
+
+static size_t listedPluginCount = 0;  // plugins whose resources are in rsrcList
+static size_t factoryPluginCount = 0; // plugins whose factories are in implFactory
+
+/// BEAGLE_PLUGINS may hold a comma-separated allow-list, e.g. "cpu,cpu-sse"; unset allows all
+static bool pluginAllowed(const char* name) {
+	const char* allowList = getenv("BEAGLE_PLUGINS");
+	if (allowList == NULL || *allowList == '\0')
+		return true;
+
+	const char* shortName = name + strlen("hmsbeagle-");
+	const char* entry = allowList + strspn(allowList, ", ");
+	while (*entry != '\0') {
+		size_t length = strcspn(entry, ", ");
+		if ((length == strlen(name) && strncmp(entry, name, length) == 0) ||
+		    (length == strlen(shortName) && strncmp(entry, shortName, length) == 0))
+			return true;
+		entry += length;
+		entry += strspn(entry, ", ");
+	}
+	return false;
+}
+
+/// opens the allowed plugins that have not been probed yet, skipping GPU plugins if cpuOnly
+void beagleLoadPlugins(bool cpuOnly) {
 	if(plugins==NULL){
 		plugins = new std::list<beagle::plugin::Plugin*>();
 	}
 
 	beagle::plugin::PluginManager& pm = beagle::plugin::PluginManager::instance();
 
-	try{
-		beagle::plugin::Plugin* cpuplug = pm.findPlugin("hmsbeagle-cpu");
-		plugins->push_back(cpuplug);
-	}catch(beagle::plugin::SharedLibraryException sle){
-		// this one should always work
-		std::cerr << "Unable to load CPU plugin!\n";
-		std::cerr << "Please check for proper libhmsbeagle installation.\n";
+	for (int i = 0; i < kPluginCatalogSize; i++) {
+		if (pluginProbed[i] || (cpuOnly && !pluginCatalog[i].cpu) || !pluginAllowed(pluginCatalog[i].name))
+			continue;
+		pluginProbed[i] = true;
+
+		try{
+			plugins->push_back(pm.findPlugin(pluginCatalog[i].name));
+		}catch(beagle::plugin::SharedLibraryException sle){
+			if (i == 0) {
+				// this one should always work
+				std::cerr << "Unable to load CPU plugin!\n";
+				std::cerr << "Please check for proper libhmsbeagle installation.\n";
+			}
+		}
 	}
-
-	try{
-		beagle::plugin::Plugin* cudaplug = pm.findPlugin("hmsbeagle-cuda");
-		plugins->push_back(cudaplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}
-
-	try{
-		beagle::plugin::Plugin* openclplug = pm.findPlugin("hmsbeagle-opencl");
-		plugins->push_back(openclplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}
-
-	try{
-		beagle::plugin::Plugin* openclalteraplug = pm.findPlugin("hmsbeagle-opencl-altera");
-		plugins->push_back(openclalteraplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}
-
-	try{
-		beagle::plugin::Plugin* sseplug = pm.findPlugin("hmsbeagle-cpu-sse");
-		plugins->push_back(sseplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}
-	
-	try{
-		beagle::plugin::Plugin* avxplug = pm.findPlugin("hmsbeagle-cpu-avx");
-		plugins->push_back(avxplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}	
-
-	try{
-		beagle::plugin::Plugin* openmpplug = pm.findPlugin("hmsbeagle-cpu-openmp");
-		plugins->push_back(openmpplug);
-	}catch(beagle::plugin::SharedLibraryException sle){}
 }
 
 std::list<beagle::BeagleImplFactory*>* beagleGetFactoryList(void) {
-	if (implFactory == NULL) {
+	if (implFactory == NULL)
 		implFactory = new std::list<beagle::BeagleImplFactory*>;
-		// Set-up a list of implementation factories in trial-order
-		std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins->begin();
-		for(; plugin_iter != plugins->end(); plugin_iter++ ){
-			std::list<beagle::BeagleImplFactory*> factories = (*plugin_iter)->getBeagleFactories();
-			implFactory->insert(implFactory->end(), factories.begin(), factories.end());
-		}				
+
+	// Append the factories of newly loaded plugins, keeping trial-order
+	std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins->begin();
+	std::advance(plugin_iter, factoryPluginCount);
+	for(; plugin_iter != plugins->end(); plugin_iter++ ){
+		std::list<beagle::BeagleImplFactory*> factories = (*plugin_iter)->getBeagleFactories();
+		implFactory->insert(implFactory->end(), factories.begin(), factories.end());
 	}
+	factoryPluginCount = plugins->size();
+
 	return implFactory;
 }
 
+/// appends the resources of newly loaded plugins; earlier resource numbers never change
+static void beagleListPluginResources(void) {
+    if (rsrcList == NULL) {
+        rsrcList = (BeagleResourceList*) malloc(sizeof(BeagleResourceList));
+        rsrcList->list = NULL;
+        rsrcList->length = 0;
+    }
+
+    // count the resources of the new plugins
+    std::list<beagle::plugin::Plugin*>::iterator first = plugins->begin();
+    std::advance(first, listedPluginCount);
+    int capacity = rsrcList->length;
+    std::list<beagle::plugin::Plugin*>::iterator plugin_iter;
+    for(plugin_iter = first; plugin_iter != plugins->end(); plugin_iter++ ){
+        capacity += (*plugin_iter)->getBeagleResources().size();
+    }
+
+    if (capacity > rsrcList->length) {
+        rsrcList->list = (BeagleResource*) realloc(rsrcList->list, sizeof(BeagleResource) * capacity);
+
+        // copy in resource lists from each plugin, merging resources with the same name
+        int rI = rsrcList->length;
+        for(plugin_iter = first; plugin_iter != plugins->end(); plugin_iter++ ){
+            std::list<BeagleResource> rList = (*plugin_iter)->getBeagleResources();
+            std::list<BeagleResource>::iterator r_iter = rList.begin();
+            int prev_rI = rI;
+            for(; r_iter != rList.end(); r_iter++){
+                bool rsrcExists = false;
+                for(int i=0; i<prev_rI; i++){
+                    if (strcmp(rsrcList->list[i].name, r_iter->name) == 0) {
+                        rsrcExists = true;
+                        rsrcList->list[i].supportFlags |= r_iter->supportFlags;
+                    }
+                }
+
+                if (!rsrcExists) {
+                    ResourceMap.insert(std::pair<int, int>(rI, (rI - prev_rI)));
+                    rsrcList->list[rI++] = *r_iter;
+                }
+            }
+        }
+        rsrcList->length = rI;
+    }
+    listedPluginCount = plugins->size();
+}
+
+/// loads plugins and extends the resource and factory lists; caller holds libraryInitializationMutex
+static void beagleLoadResources(bool cpuOnly) {
+    beagleLoadPlugins(cpuOnly);
+
+    if (rsrcList == NULL || listedPluginCount < plugins->size())
+        beagleListPluginResources();
+
+    if (implFactory == NULL || factoryPluginCount < plugins->size())
+        beagleGetFactoryList();
+}
+
+/// opens the trace file named by BEAGLE_TRACE, if any, see BeagleTrace.h
+static void beagleOpenTrace(void) {
+    const char* fileName = getenv("BEAGLE_TRACE");
+    if (fileName == NULL || *fileName == '\0' || traceFile != NULL)
+        return;
+
+    traceFile = fopen(fileName, "wb");
+    if (traceFile == NULL) {
+        fprintf(stderr, "BEAGLE: unable to open trace file %s\n", fileName);
+        return;
+    }
+    beagle::TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "BEAGLETR", sizeof(header.magic));
+    header.byteOrder = 0x01020304;
+    header.version = BEAGLE_TRACE_FILE_VERSION;
+    fwrite(&header, sizeof(header), 1, traceFile);
+}
+
 void beagle_library_initialize(void) {
+    beagleOpenTrace();
 //	beagleGetResourceList(); // Generate resource list at library initialization, causes Bus error on Mac
 //	beagleGetFactoryList(); // Generate factory list at library initialization, causes Bus error on Mac
 }
 
 void beagle_library_finalize(void) {
   DEBUG_FINALIZE_TIME();
+    if (traceFile != NULL) {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        fflush(traceFile);
+    }
 	// FIXME: need to destroy each plugin
 	// the following code segfaults
 /*	std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins.begin();
@@ -195,6 +819,11 @@ void beagle_library_finalize(void) {
 
 	if(plugins!=NULL && loaded){
 		delete plugins;
+		plugins = NULL;
+		for (int i = 0; i < kPluginCatalogSize; i++)
+			pluginProbed[i] = false;
+		listedPluginCount = 0;
+		factoryPluginCount = 0;
 	}
 	// Destroy implFactory.
 	// The contained factory pointers will be deleted by the plugins themselves
@@ -204,6 +833,7 @@ void beagle_library_finalize(void) {
 		} catch (...) {
 
 		}
+		implFactory = NULL;
 	}
 
 	// Destroy rsrcList
@@ -211,11 +841,17 @@ void beagle_library_finalize(void) {
 	if (rsrcList && loaded) {
 		free(rsrcList->list);
 		free(rsrcList);
+		rsrcList = NULL;
+		ResourceMap.clear();
+	}
+
+	// Release instance statistics; the slot table itself lives as long as the library
+	if (loaded) {
+		instanceTable.clear();
 	}
 
-	// Destroy instances
-	if (instances && loaded) {
-		delete instances;
+	if (loaded) {
+		commandBufferTable.clear();
 	}
 	loaded = 0;
 }
@@ -258,47 +894,10 @@ const char* beagleGetCitation() {
 }
 
 BeagleResourceList* beagleGetResourceList() {
-	// plugins must be loaded before resources
-	if (plugins==NULL)
-	    beagleLoadPlugins();
+    std::lock_guard<std::mutex> lock(libraryInitializationMutex);
 
-    if (rsrcList == NULL) {
-        // count the total resources across plugins
-        rsrcList = (BeagleResourceList*) malloc(sizeof(BeagleResourceList));
-        rsrcList->length = 0;
-        std::list<beagle::plugin::Plugin*>::iterator plugin_iter = plugins->begin();
-        for(; plugin_iter != plugins->end(); plugin_iter++ ){
-            rsrcList->length += (*plugin_iter)->getBeagleResources().size();
-        }
-        
-        // allocate space for a complete list of resources
-        rsrcList->list = (BeagleResource*) malloc(sizeof(BeagleResource) * rsrcList->length);
+    beagleLoadResources(false);
 
-        // copy in resource lists from each plugin
-        int rI=0;
-        for(plugin_iter = plugins->begin(); plugin_iter != plugins->end(); plugin_iter++ ){
-            std::list<BeagleResource> rList = (*plugin_iter)->getBeagleResources();
-            std::list<BeagleResource>::iterator r_iter = rList.begin();
-            int prev_rI = rI;
-            for(; r_iter != rList.end(); r_iter++){
-                bool rsrcExists = false;
-                for(int i=0; i<prev_rI; i++){         
-                    if (strcmp(rsrcList->list[i].name, r_iter->name) == 0) {
-                        if (!rsrcExists) {
-                            rsrcExists = true;
-                            rsrcList->length--;
-                        }
-                        rsrcList->list[i].supportFlags |= r_iter->supportFlags;
-                    }
-                }
-                
-                if (!rsrcExists) {
-                    ResourceMap.insert(std::pair<int, int>(rI, (rI - prev_rI)));
-                    rsrcList->list[rI++] = *r_iter;
-                }
-            }
-        }
-    }
     return rsrcList;
 }
 
@@ -314,6 +913,404 @@ int scoreFlags(long flags1, long flags2) {
     return -score;
 }
 
+/// maps a whole file read-only; data is NULL on failure
+static beagle::MappedFile mapFile(const char* fileName) {
+    beagle::MappedFile mapped = {NULL, 0};
+#ifdef _WIN32
+    HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return mapped;
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping != NULL) {
+            mapped.data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            mapped.size = (size_t) fileSize.QuadPart;
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    int file = open(fileName, O_RDONLY);
+    if (file < 0)
+        return mapped;
+    struct stat fileStatus;
+    if (fstat(file, &fileStatus) == 0 && fileStatus.st_size > 0) {
+        void* data = mmap(NULL, (size_t) fileStatus.st_size, PROT_READ, MAP_SHARED, file, 0);
+        if (data != MAP_FAILED) {
+            mapped.data = data;
+            mapped.size = (size_t) fileStatus.st_size;
+        }
+    }
+    close(file);
+#endif
+    if (mapped.data == NULL)
+        mapped.size = 0;
+    return mapped;
+}
+
+static void unmapFile(const beagle::MappedFile& mapped) {
+    if (mapped.data == NULL)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(mapped.data);
+#else
+    munmap(mapped.data, mapped.size);
+#endif
+}
+
+static size_t tipStatesFileStride(int patternCount) {
+    size_t stride = sizeof(unsigned char) * (size_t) patternCount;
+    return (stride + BEAGLE_TIP_STATES_FILE_ALIGNMENT - 1) /
+           BEAGLE_TIP_STATES_FILE_ALIGNMENT * BEAGLE_TIP_STATES_FILE_ALIGNMENT;
+}
+
+/// index of a resource within the plugin that provides it
+static int pluginResourceNumber(int resource) {
+    std::lock_guard<std::mutex> lock(libraryInitializationMutex);
+    return ResourceMap[resource];
+}
+
+/// name of a global resource
+static const char* resourceName(int resource) {
+    std::lock_guard<std::mutex> lock(libraryInitializationMutex);
+    return rsrcList->list[resource].name;
+}
+
+/// stores a new instance in the instance table and reports its details
+static int registerInstance(beagle::BeagleImpl* impl,
+                            const beagle::InstanceCreation& creation,
+                            BeagleInstanceDetails* returnInfo) {
+    beagle::InstanceDimensions dimensions;
+    dimensions.bufferCount = creation.partialsBufferCount + creation.compactBufferCount;
+    dimensions.eigenBufferCount = creation.eigenBufferCount;
+    dimensions.matrixBufferCount = creation.matrixBufferCount;
+    // automatic and always scaling keep one scale buffer per internal node
+    dimensions.scaleBufferCount = (creation.scaleBufferCount > dimensions.bufferCount + 1 ?
+                                   creation.scaleBufferCount : dimensions.bufferCount + 1);
+
+    // an instance that cannot describe itself is never published
+    int returnValue = impl->getInstanceDetails(returnInfo);
+    if (returnValue != BEAGLE_SUCCESS) {
+        delete impl;
+        return returnValue;
+    }
+
+    int instance = instanceTable.insert(impl, dimensions, creation);
+    if (instance < 0) {
+        delete impl;
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance);
+    if (slot != NULL)
+        slot->flags = returnInfo->flags;
+    returnInfo->resourceName = (char*) resourceName(returnInfo->resourceNumber);
+    // TODO: move implDescription to inside the implementation
+    returnInfo->implDescription = (char*) "none";
+
+    return instance;
+}
+
+/// benchmark-driven implementation selection, see beagleSetAutoselect
+static std::atomic<bool> autoselectEnabled(false);
+static std::mutex autoselectMutex;
+static std::string autoselectCacheFile;
+static bool autoselectCacheRead = false;
+/// shape key -> (resource name, implementation name)
+static std::map<std::string, std::pair<std::string, std::string> > autoselectDecisions;
+
+static const int kAutoselectTipCount = 8;
+static const int kAutoselectMaxPatternCount = 1 << 16;
+static const int kAutoselectRepeats = 3;
+
+static std::string autoselectHostName() {
+    char name[256] = "";
+#ifdef _WIN32
+    DWORD length = sizeof(name);
+    if (!GetComputerNameA(name, &length))
+        name[0] = '\0';
+#else
+    if (gethostname(name, sizeof(name)) != 0)
+        name[0] = '\0';
+    name[sizeof(name) - 1] = '\0';
+#endif
+    return name;
+}
+
+/// pattern counts are bucketed to the next power of two so that nearby shapes share a decision
+static int autoselectPatternBucket(int patternCount) {
+    int bucket = 1;
+    while (bucket < patternCount && bucket < kAutoselectMaxPatternCount)
+        bucket <<= 1;
+    return bucket;
+}
+
+static std::string autoselectKey(int stateCount,
+                                 int patternCount,
+                                 int categoryCount,
+                                 long preferenceFlags,
+                                 long requirementFlags) {
+    char shape[128];
+    snprintf(shape, sizeof(shape), "\t%d\t%d\t%d\t%ld\t%ld", stateCount,
+             autoselectPatternBucket(patternCount), categoryCount, preferenceFlags, requirementFlags);
+    return autoselectHostName() + shape;
+}
+
+static bool isAutoselectInteger(const std::string& field) {
+    char* end = NULL;
+    strtol(field.c_str(), &end, 10);
+    return !field.empty() && *end == '\0';
+}
+
+/// cache lines hold the library version, the six tab-separated key fields, the resource name and
+/// the implementation name; lines of other versions and lines that do not parse are skipped
+static void readAutoselectCache() {
+    if (autoselectCacheFile.empty())
+        return;
+
+    std::ifstream file(autoselectCacheFile.c_str());
+    std::string line;
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        size_t tab;
+        while ((tab = line.find('\t', start)) != std::string::npos) {
+            fields.push_back(line.substr(start, tab - start));
+            start = tab + 1;
+        }
+        fields.push_back(line.substr(start));
+        if (fields.size() != 9 || fields[0] != BEAGLE_VERSION || fields[7].empty() || fields[8].empty())
+            continue;
+
+        bool valid = true;
+        for (int i = 2; i < 7; i++)
+            valid = valid && isAutoselectInteger(fields[i]);
+        if (!valid)
+            continue;
+
+        std::string key = fields[1];
+        for (int i = 2; i < 7; i++)
+            key += "\t" + fields[i];
+        autoselectDecisions[key] = std::make_pair(fields[7], fields[8]);
+    }
+}
+
+/// rewrites the cache file with one line per key, merging the decisions other processes wrote
+/// since it was read, so that the file does not grow with repeated decisions
+static void writeAutoselectDecision(const std::string& key,
+                                    const std::pair<std::string, std::string>& decision) {
+    if (autoselectCacheFile.empty())
+        return;
+
+    readAutoselectCache();
+    autoselectDecisions[key] = decision;
+
+    std::ofstream file(autoselectCacheFile.c_str(), std::ios::trunc);
+    for (std::map<std::string, std::pair<std::string, std::string> >::const_iterator it =
+             autoselectDecisions.begin(); it != autoselectDecisions.end(); ++it) {
+        file << BEAGLE_VERSION << "\t" << it->first << "\t" << it->second.first << "\t"
+             << it->second.second << "\n";
+    }
+}
+
+/**
+ * Times a resource/implementation pair on a synthetic problem: a balanced tree of eight tips
+ * with compact states under a Jukes-Cantor model of the requested shape. Returns the best
+ * seconds per likelihood evaluation, or a negative value if the pair cannot run it.
+ */
+static double benchmarkImplementation(beagle::BeagleImplFactory* factory,
+                                      int resource,
+                                      int stateCount,
+                                      int patternCount,
+                                      int categoryCount,
+                                      long preferenceFlags,
+                                      long requirementFlags,
+                                      long* outFlags) {
+    const int tipCount = kAutoselectTipCount;
+    const int nodeCount = 2 * tipCount - 1;
+    const int edgeCount = nodeCount - 1;
+    patternCount = autoselectPatternBucket(patternCount);
+    if (stateCount < 2 || categoryCount < 1)
+        return -1.0;
+
+    int errorCode;
+    beagle::BeagleImpl* impl = factory->createImpl(tipCount, nodeCount - tipCount, tipCount,
+                                                   stateCount, patternCount, 1, edgeCount,
+                                                   categoryCount, 0, resource,
+                                                   pluginResourceNumber(resource),
+                                                   preferenceFlags, requirementFlags,
+                                                   &errorCode);
+    if (impl == NULL)
+        return -1.0;
+
+    BeagleInstanceDetails details;
+    impl->getInstanceDetails(&details);
+    *outFlags = details.flags;
+
+    // Jukes-Cantor: a symmetric Householder reflection mapping e_0 to the uniform vector
+    // diagonalizes the rate matrix and is its own inverse
+    std::vector<double> eigenVectors(stateCount * stateCount);
+    std::vector<double> eigenValues(stateCount, -stateCount / (stateCount - 1.0));
+    eigenValues[0] = 0.0;
+    std::vector<double> v(stateCount, -1.0 / sqrt((double) stateCount));
+    v[0] += 1.0;
+    double vv = 2.0 - 2.0 / sqrt((double) stateCount);
+    for (int i = 0; i < stateCount; i++)
+        for (int j = 0; j < stateCount; j++)
+            eigenVectors[i * stateCount + j] = (i == j ? 1.0 : 0.0) - 2.0 * v[i] * v[j] / vv;
+
+    std::vector<double> frequencies(stateCount, 1.0 / stateCount);
+    std::vector<double> weights(categoryCount, 1.0 / categoryCount);
+    std::vector<double> rates(categoryCount);
+    for (int c = 0; c < categoryCount; c++)
+        rates[c] = 2.0 * (c + 1) / (categoryCount + 1);
+    std::vector<double> patternWeights(patternCount, 1.0);
+
+    std::vector<int> states(patternCount);
+    unsigned int seed = 1;
+    int returnCode = BEAGLE_SUCCESS;
+    for (int t = 0; t < tipCount && returnCode == BEAGLE_SUCCESS; t++) {
+        for (int k = 0; k < patternCount; k++) {
+            seed = seed * 1103515245 + 12345;
+            states[k] = (seed >> 16) % stateCount;
+        }
+        returnCode = impl->setTipStates(t, &states[0]);
+    }
+
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = impl->setEigenDecomposition(0, &eigenVectors[0], &eigenVectors[0], &eigenValues[0]);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = impl->setStateFrequencies(0, &frequencies[0]);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = impl->setCategoryWeights(0, &weights[0]);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = impl->setCategoryRates(&rates[0]);
+    if (returnCode == BEAGLE_SUCCESS)
+        returnCode = impl->setPatternWeights(&patternWeights[0]);
+
+    // node n > tipCount - 1 joins the two nodes numbered 2 * (n - tipCount) and 2 * (n - tipCount) + 1
+    std::vector<int> operations;
+    for (int n = tipCount; n < nodeCount; n++) {
+        int child = 2 * (n - tipCount);
+        int operation[] = {n, BEAGLE_OP_NONE, BEAGLE_OP_NONE, child, child, child + 1, child + 1};
+        operations.insert(operations.end(), operation, operation + BEAGLE_OP_COUNT);
+    }
+    std::vector<int> edgeIndices(edgeCount);
+    std::vector<double> edgeLengths(edgeCount);
+    for (int e = 0; e < edgeCount; e++) {
+        edgeIndices[e] = e;
+        edgeLengths[e] = 0.05 + 0.01 * e;
+    }
+    int rootIndex = nodeCount - 1;
+    int zeroIndex = 0;
+    int scaleIndex = BEAGLE_OP_NONE;
+
+    double bestSeconds = -1.0;
+    for (int r = 0; r <= kAutoselectRepeats && returnCode == BEAGLE_SUCCESS; r++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        double logL;
+        returnCode = impl->updateTransitionMatrices(0, &edgeIndices[0], NULL, NULL,
+                                                    &edgeLengths[0], edgeCount);
+        if (returnCode == BEAGLE_SUCCESS)
+            returnCode = impl->updatePartials(&operations[0], nodeCount - tipCount, BEAGLE_OP_NONE);
+        if (returnCode == BEAGLE_SUCCESS)
+            returnCode = impl->calculateRootLogLikelihoods(&rootIndex, &zeroIndex, &zeroIndex,
+                                                           &scaleIndex, 1, &logL);
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        // the first pass only warms up caches and device kernels
+        if (r > 0 && (bestSeconds < 0.0 || seconds < bestSeconds))
+            bestSeconds = seconds;
+    }
+
+    delete impl;
+
+    return (returnCode == BEAGLE_SUCCESS ? bestSeconds : -1.0);
+}
+
+/**
+ * Moves the fastest candidate to the front of the ranked list. Only candidates of the
+ * precision that flag-based ranking would have produced are compared.
+ */
+static void autoselectImplementation(RsrcImplList* candidates,
+                                     int stateCount,
+                                     int patternCount,
+                                     int categoryCount,
+                                     long preferenceFlags,
+                                     long requirementFlags) {
+    std::lock_guard<std::mutex> lock(autoselectMutex);
+
+    if (!autoselectCacheRead) {
+        readAutoselectCache();
+        autoselectCacheRead = true;
+    }
+
+    std::string key = autoselectKey(stateCount, patternCount, categoryCount,
+                                    preferenceFlags, requirementFlags);
+    RsrcImplList::iterator chosen = candidates->end();
+
+    std::map<std::string, std::pair<std::string, std::string> >::iterator decision =
+        autoselectDecisions.find(key);
+    if (decision != autoselectDecisions.end()) {
+        for (RsrcImplList::iterator it = candidates->begin(); it != candidates->end(); ++it) {
+            if (decision->second.first == resourceName(it->second.first) &&
+                decision->second.second == it->second.second->getName()) {
+                chosen = it;
+                break;
+            }
+        }
+    }
+
+    if (chosen == candidates->end()) {
+        const long precisionFlags = BEAGLE_FLAG_PRECISION_SINGLE | BEAGLE_FLAG_PRECISION_DOUBLE;
+        long referencePrecision = 0;
+        double bestSeconds = -1.0;
+        for (RsrcImplList::iterator it = candidates->begin(); it != candidates->end(); ++it) {
+            long flags = 0;
+            double seconds = benchmarkImplementation(it->second.second, it->second.first,
+                                                     stateCount, patternCount, categoryCount,
+                                                     preferenceFlags, requirementFlags, &flags);
+#ifdef BEAGLE_DEBUG_FLOW
+            fprintf(stderr, "\tBenchmarked %s on %s: %g s\n", it->second.second->getName(),
+                    resourceName(it->second.first), seconds);
+#endif
+            if (seconds < 0.0)
+                continue;
+            if (referencePrecision == 0)
+                referencePrecision = flags & precisionFlags;
+            if ((flags & precisionFlags) == referencePrecision &&
+                (bestSeconds < 0.0 || seconds < bestSeconds)) {
+                bestSeconds = seconds;
+                chosen = it;
+            }
+        }
+        if (chosen == candidates->end())
+            return;
+
+        std::pair<std::string, std::string> fastest(resourceName(chosen->second.first),
+                                                    chosen->second.second->getName());
+        autoselectDecisions[key] = fastest;
+        writeAutoselectDecision(key, fastest);
+    }
+
+    candidates->splice(candidates->begin(), *candidates, chosen);
+}
+
+int beagleSetAutoselect(int enabled,
+                        const char* cacheFileName) {
+    std::lock_guard<std::mutex> lock(autoselectMutex);
+
+    autoselectCacheFile = (cacheFileName != NULL ? cacheFileName : "");
+    autoselectCacheRead = false;
+    autoselectDecisions.clear();
+    autoselectEnabled = (enabled != 0);
+
+    return BEAGLE_SUCCESS;
+}
+
 int beagleCreateInstance(int tipCount,
                          int partialsBufferCount,
                          int compactBufferCount,
@@ -329,16 +1326,17 @@ int beagleCreateInstance(int tipCount,
                          long requirementFlags,
                          BeagleInstanceDetails* returnInfo) {
     DEBUG_CREATE_TIME();
+    beagle::TraceRecord trace(-1, beagle::TRACE_CREATE_INSTANCE);
     try {
-        if (instances == NULL)
-            instances = new std::vector<beagle::BeagleImpl*>;
+        // plugin loading is not reentrant and may extend the resource list, so candidates are
+        // ranked under the lock; instances themselves are created without it
+        std::unique_lock<std::mutex> lock(libraryInitializationMutex);
+
+        // a CPU-only instance chosen from the whole resource list never needs the GPU plugins
+        bool cpuOnly = (requirementFlags & BEAGLE_FLAG_FRAMEWORK_CPU) &&
+                       (resourceList == NULL || resourceCount == 0);
+        beagleLoadResources(cpuOnly);
 
-        if (rsrcList == NULL)
-            beagleGetResourceList();
-        
-        if (implFactory == NULL)
-            beagleGetFactoryList();
-        
         loaded = 1;
         
         // First determine a list of possible resources
@@ -377,6 +1375,9 @@ int beagleCreateInstance(int tipCount,
         }
         
         beagle::BeagleImpl* bestBeagle = NULL;
+        beagle::InstanceCreation creation = {tipCount, partialsBufferCount, compactBufferCount, stateCount,
+                                             patternCount, eigenBufferCount, matrixBufferCount, categoryCount,
+                                             scaleBufferCount, -1, preferenceFlags, requirementFlags, NULL};
 
         possibleResources->sort(compareOnFirst); // Attempt in rank order, lowest score wins
 
@@ -430,6 +1431,12 @@ int beagleCreateInstance(int tipCount,
 #endif        
         
         possibleResourceImplementations->sort(compareRsrcImpl);
+
+        lock.unlock();
+
+        if (autoselectEnabled && possibleResourceImplementations->size() > 1)
+            autoselectImplementation(possibleResourceImplementations, stateCount, patternCount,
+                                     categoryCount, preferenceFlags, requirementFlags);
         
 #ifdef BEAGLE_DEBUG_FLOW
         fprintf(stderr,"\nSorted list of possible implementations:\n");
@@ -450,34 +1457,390 @@ int beagleCreateInstance(int tipCount,
                                                                 matrixBufferCount, categoryCount,
                                                                 scaleBufferCount,
                                                                 resource,
-                                                                ResourceMap[resource],
+                                                                pluginResourceNumber(resource),
                                                                 preferenceFlags,
                                                                 requirementFlags,
                                                                 &errorCode);
             
-            if (bestBeagle != NULL)
-                break; 
+            if (bestBeagle != NULL) {
+                creation.resource = resource;
+                creation.factory = factory;
+                break;
+            }
         }
         
         delete possibleResourceImplementations;
         
-        if (bestBeagle != NULL) {
-            int instance = instances->size();
-            instances->push_back(bestBeagle);
-            
-            int returnValue = bestBeagle->getInstanceDetails(returnInfo);
-            if (returnValue == BEAGLE_SUCCESS) {
-                returnInfo->resourceName = rsrcList->list[returnInfo->resourceNumber].name;
-                // TODO: move implDescription to inside the implementation
-                returnInfo->implDescription = (char*) "none";
-                
-                returnValue = instance;
-            }
-            return returnValue;
-        }   
-        
         // No implementations found or appropriate, return last error code
-        return errorCode;
+        int returnValue = errorCode;
+        if (bestBeagle != NULL)
+            returnValue = registerInstance(bestBeagle, creation, returnInfo);
+
+        if (trace.isActive()) {
+            trace.putInt(tipCount);
+            trace.putInt(partialsBufferCount);
+            trace.putInt(compactBufferCount);
+            trace.putInt(stateCount);
+            trace.putInt(patternCount);
+            trace.putInt(eigenBufferCount);
+            trace.putInt(matrixBufferCount);
+            trace.putInt(categoryCount);
+            trace.putInt(scaleBufferCount);
+            trace.putInts(resourceList, resourceCount);
+            trace.putInt(resourceCount);
+            trace.putLong(preferenceFlags);
+            trace.putLong(requirementFlags);
+            trace.putString(returnValue >= 0 ? returnInfo->implName : NULL);
+            trace.write(returnValue);
+        }
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+    loaded = 1;
+
+}
+
+int beagleCreateBatchedInstance(int batchCount,
+                                int tipCount,
+                                int partialsBufferCount,
+                                int compactBufferCount,
+                                int stateCount,
+                                int patternCount,
+                                int eigenBufferCount,
+                                int matrixBufferCount,
+                                int categoryCount,
+                                int scaleBufferCount,
+                                int* resourceList,
+                                int resourceCount,
+                                long preferenceFlags,
+                                long requirementFlags,
+                                BeagleInstanceDetails* returnInfo) {
+    if (batchCount < 1 || patternCount < 1)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    int instance = beagleCreateInstance(tipCount,
+                                        partialsBufferCount,
+                                        compactBufferCount,
+                                        stateCount,
+                                        patternCount * batchCount,
+                                        eigenBufferCount * batchCount,
+                                        matrixBufferCount * batchCount,
+                                        categoryCount,
+                                        scaleBufferCount,
+                                        resourceList,
+                                        resourceCount,
+                                        preferenceFlags,
+                                        requirementFlags,
+                                        returnInfo);
+    if (instance < 0)
+        return instance;
+
+    // the partitioned GPU kernels are only built for four states, and padding would let two
+    // and three states through
+    if (stateCount != 4 &&
+        (returnInfo->flags & (BEAGLE_FLAG_FRAMEWORK_CUDA | BEAGLE_FLAG_FRAMEWORK_OPENCL))) {
+        beagleFinalizeInstance(instance);
+        return BEAGLE_ERROR_NO_IMPLEMENTATION;
+    }
+
+    // one contiguous partition per problem, so no pattern reordering takes place
+    int* patternPartitions = (int*) malloc(sizeof(int) * patternCount * batchCount);
+    if (patternPartitions == NULL) {
+        beagleFinalizeInstance(instance);
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    for (int k = 0; k < batchCount; k++) {
+        for (int i = 0; i < patternCount; i++)
+            patternPartitions[k * patternCount + i] = k;
+    }
+
+    int returnValue = beagleSetPatternPartitions(instance, batchCount, patternPartitions);
+    free(patternPartitions);
+
+    if (returnValue != BEAGLE_SUCCESS) {
+        beagleFinalizeInstance(instance);
+        return returnValue;
+    }
+
+    return instance;
+}
+
+int beagleSetDeviceMemoryBudget(int instance,
+                                int budgetMegabytes) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_SET_DEVICE_MEMORY_BUDGET);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setDeviceMemoryBudget(budgetMegabytes);
+    trace.putInt(budgetMegabytes);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetTransitionMatrixCache(int instance,
+                                   int cacheSize) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_SET_TRANSITION_MATRIX_CACHE);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setTransitionMatrixCacheSize(cacheSize);
+    trace.putInt(cacheSize);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetInstanceStatistics(int instance,
+                                int enable) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_SET_INSTANCE_STATISTICS);
+    beagle::BeagleImpl* beagleInstance = NULL;
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance, &beagleInstance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::EntryPointStatistics* statistics = slot->statistics.load(std::memory_order_acquire);
+    if (enable) {
+        if (statistics == NULL) {
+            beagle::EntryPointStatistics* created = new (std::nothrow) beagle::EntryPointStatistics();
+            if (created == NULL)
+                return BEAGLE_ERROR_OUT_OF_MEMORY;
+            if (slot->statistics.compare_exchange_strong(statistics, created, std::memory_order_acq_rel))
+                statistics = created;
+            else
+                delete created;
+        }
+        statistics->reset();
+        statistics->enabled.store(true, std::memory_order_relaxed);
+    } else if (statistics != NULL) {
+        // timers still running may hold the counters, so they are kept until the slot is freed
+        statistics->enabled.store(false, std::memory_order_relaxed);
+    }
+    int returnValue = beagleInstance->setStatisticsEnabled(enable != 0);
+    trace.putInt(enable);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleGetInstanceStatistics(int instance,
+                                BeagleInstanceStatistics* outStatistics) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_GET_INSTANCE_STATISTICS);
+    beagle::BeagleImpl* beagleInstance = NULL;
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance, &beagleInstance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::EntryPointStatistics* statistics = slot->statistics.load(std::memory_order_acquire);
+    if (statistics == NULL || !statistics->enabled.load(std::memory_order_relaxed))
+        return BEAGLE_ERROR_GENERAL;
+    memset(outStatistics, 0, sizeof(BeagleInstanceStatistics));
+    for (int i = 0; i < BEAGLE_STATISTICS_ENTRY_POINT_COUNT; i++) {
+        outStatistics->callCount[i] = (long) statistics->callCount[i].load(std::memory_order_relaxed);
+        outStatistics->wallTime[i] = statistics->wallTime[i].load(std::memory_order_relaxed) * 1E-9;
+    }
+    int returnValue = beagleInstance->getStatistics(outStatistics);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleFinalizeInstance(int instance) {
+    DEBUG_FINALIZE_TIME();
+    TRACE_CALL(beagle::TRACE_FINALIZE_INSTANCE);
+    try {
+        beagle::MappedFile tipStatesFile;
+        beagle::BeagleImpl* beagleInstance = instanceTable.remove(instance, &tipStatesFile);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        delete beagleInstance;
+        unmapFile(tipStatesFile);
+        trace.write(BEAGLE_SUCCESS);
+        return BEAGLE_SUCCESS;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleCloneInstance(int instance,
+                        BeagleInstanceDetails* returnInfo) {
+    DEBUG_CREATE_TIME();
+    TRACE_CALL(beagle::TRACE_CLONE_INSTANCE);
+    try {
+        beagle::BeagleImpl* beagleInstance = NULL;
+        beagle::InstanceSlot* slot = instanceTable.lookup(instance, &beagleInstance);
+        if (slot == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        beagle::InstanceCreation creation = slot->creation;
+
+        int errorCode = BEAGLE_ERROR_NO_RESOURCE;
+        beagle::BeagleImpl* clone = creation.factory->createImpl(creation.tipCount,
+                                                                 creation.partialsBufferCount,
+                                                                 creation.compactBufferCount,
+                                                                 creation.stateCount,
+                                                                 creation.patternCount,
+                                                                 creation.eigenBufferCount,
+                                                                 creation.matrixBufferCount,
+                                                                 creation.categoryCount,
+                                                                 creation.scaleBufferCount,
+                                                                 creation.resource,
+                                                                 pluginResourceNumber(creation.resource),
+                                                                 creation.preferenceFlags,
+                                                                 creation.requirementFlags,
+                                                                 &errorCode);
+        if (clone == NULL)
+            return errorCode;
+
+        int returnValue = clone->copyInstance(beagleInstance);
+        if (returnValue != BEAGLE_SUCCESS) {
+            delete clone;
+            return returnValue;
+        }
+
+        returnValue = registerInstance(clone, creation, returnInfo);
+        trace.write(returnValue);
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSnapshotBuffers(int instance,
+                          int snapshotIndex,
+                          const int* partialsIndices,
+                          int partialsCount,
+                          const int* scaleIndices,
+                          int scaleCount,
+                          const int* matrixIndices,
+                          int matrixCount) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SNAPSHOT_BUFFERS);
+    TRACE_CALL(beagle::TRACE_SNAPSHOT_BUFFERS);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->snapshotBuffers(snapshotIndex, partialsIndices, partialsCount,
+                                                      scaleIndices, scaleCount, matrixIndices, matrixCount);
+    trace.putInt(snapshotIndex);
+    trace.putInts(partialsIndices, partialsCount);
+    trace.putInt(partialsCount);
+    trace.putInts(scaleIndices, scaleCount);
+    trace.putInt(scaleCount);
+    trace.putInts(matrixIndices, matrixCount);
+    trace.putInt(matrixCount);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleRestoreSnapshot(int instance,
+                          int snapshotIndex) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_RESTORE_SNAPSHOT);
+    TRACE_CALL(beagle::TRACE_RESTORE_SNAPSHOT);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->restoreSnapshot(snapshotIndex);
+    trace.putInt(snapshotIndex);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleReleaseSnapshot(int instance,
+                          int snapshotIndex) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_RELEASE_SNAPSHOT);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->releaseSnapshot(snapshotIndex);
+    trace.putInt(snapshotIndex);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSaveInstance(int instance,
+                       const char* fileName) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_SAVE_INSTANCE);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->saveInstance(fileName);
+    trace.putString(fileName);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleLoadInstance(int instance,
+                       const char* fileName) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_LOAD_INSTANCE);
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->loadInstance(fileName);
+        trace.putString(fileName);
+        trace.write(returnValue);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+    catch (std::bad_alloc &) {
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    catch (std::out_of_range &) {
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    catch (...) {
+        return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
+    }
+}
+
+int beagleSetTipStates(int instance,
+                 int tipIndex,
+                 const int* inStates) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_TIP_STATES);
+    TRACE_CALL(beagle::TRACE_SET_TIP_STATES);
+    try {
+        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+        if (beagleInstance == NULL)
+            return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+        int returnValue = beagleInstance->setTipStates(tipIndex, inStates);
+        trace.putInt(tipIndex);
+        trace.putInts(inStates, trace.patternCount());
+        trace.write(returnValue);
+        DEBUG_END_TIME();
+        return returnValue;
     }
     catch (std::bad_alloc &) {
         return BEAGLE_ERROR_OUT_OF_MEMORY;
@@ -488,19 +1851,24 @@ int beagleCreateInstance(int tipCount,
     catch (...) {
         return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
     }
-    loaded = 1;
-
 }
 
-int beagleFinalizeInstance(int instance) {
-    DEBUG_FINALIZE_TIME();
+int beagleSetTipStatesExternal(int instance,
+                               int tipIndex,
+                               const unsigned char* inStates) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_TIP_STATES);
+    TRACE_CALL(beagle::TRACE_SET_TIP_STATES_EXTERNAL);
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
-        delete beagleInstance;
-        (*instances)[instance] = NULL;
-        return BEAGLE_SUCCESS;
+        int returnValue = beagleInstance->setTipStatesExternal(tipIndex, inStates);
+        trace.putInt(tipIndex);
+        trace.putBytes(inStates, trace.patternCount());
+        trace.write(returnValue);
+        DEBUG_END_TIME();
+        return returnValue;
     }
     catch (std::bad_alloc &) {
         return BEAGLE_ERROR_OUT_OF_MEMORY;
@@ -513,25 +1881,107 @@ int beagleFinalizeInstance(int instance) {
     }
 }
 
-int beagleSetTipStates(int instance,
-                 int tipIndex,
-                 const int* inStates) {
+int beagleWriteTipStatesFile(const char* fileName,
+                             int tipCount,
+                             int patternCount,
+                             int stateCount,
+                             const int* inStates) {
+    if (tipCount < 1 || patternCount < 1 || stateCount < 1 || stateCount > 254)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::TipStatesFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "BEAGLETS", sizeof(header.magic));
+    header.byteOrder = 0x01020304;
+    header.version = BEAGLE_TIP_STATES_FILE_VERSION;
+    header.tipCount = tipCount;
+    header.patternCount = patternCount;
+    header.stateCount = stateCount;
+
+    size_t stride = tipStatesFileStride(patternCount);
+    unsigned char* tipStates = (unsigned char*) calloc(1, stride);
+    if (tipStates == NULL)
+        return BEAGLE_ERROR_OUT_OF_MEMORY;
+
+    FILE* file = fopen(fileName, "wb");
+    if (file == NULL) {
+        free(tipStates);
+        return BEAGLE_ERROR_GENERAL;
+    }
+
+    bool written = (fwrite(&header, sizeof(header), 1, file) == 1);
+    for (int tip = 0; tip < tipCount && written; tip++) {
+        const int* states = inStates + (size_t) tip * patternCount;
+        for (int i = 0; i < patternCount; i++)
+            tipStates[i] = (unsigned char) (states[i] >= 0 && states[i] < stateCount ? states[i] : stateCount);
+        written = (fwrite(tipStates, 1, stride, file) == stride);
+    }
+    free(tipStates);
+
+    if (fclose(file) != 0 || !written)
+        return BEAGLE_ERROR_GENERAL;
+
+    return BEAGLE_SUCCESS;
+}
+
+int beagleMapTipStatesFile(int instance,
+                           const char* fileName) {
     DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_MAP_TIP_STATES_FILE);
+    // owned here until the instance takes it, and released on every other way out
+    beagle::MappedFile mapped = {NULL, 0};
     try {
-        beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
-        if (beagleInstance == NULL)
+        beagle::BeagleImpl* beagleInstance = NULL;
+        beagle::InstanceSlot* slot = instanceTable.lookup(instance, &beagleInstance);
+        if (slot == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
-        int returnValue = beagleInstance->setTipStates(tipIndex, inStates);
+
+        mapped = mapFile(fileName);
+        if (mapped.data == NULL)
+            return BEAGLE_ERROR_GENERAL;
+
+        const beagle::TipStatesFileHeader* header = (const beagle::TipStatesFileHeader*) mapped.data;
+        const beagle::InstanceCreation& creation = slot->creation;
+        size_t stride = (mapped.size >= sizeof(beagle::TipStatesFileHeader) ?
+                         tipStatesFileStride(header->patternCount) : 0);
+        if (stride == 0 ||
+            memcmp(header->magic, "BEAGLETS", sizeof(header->magic)) != 0 ||
+            header->byteOrder != 0x01020304 ||
+            header->version != BEAGLE_TIP_STATES_FILE_VERSION ||
+            header->tipCount != creation.tipCount ||
+            header->patternCount != creation.patternCount ||
+            header->stateCount != creation.stateCount ||
+            mapped.size < sizeof(beagle::TipStatesFileHeader) + stride * header->tipCount) {
+            unmapFile(mapped);
+            return BEAGLE_ERROR_GENERAL;
+        }
+
+        const char* tipData = (const char*) mapped.data + sizeof(beagle::TipStatesFileHeader);
+        int returnValue = BEAGLE_SUCCESS;
+        for (int tip = 0; tip < header->tipCount && returnValue == BEAGLE_SUCCESS; tip++)
+            returnValue = beagleInstance->setTipStatesExternal(tip, (const unsigned char*) (tipData + stride * tip));
+
+        // a failed call may have set some of the tips, so the new mapping is kept either way
+        unmapFile(slot->tipStatesFile);
+        slot->tipStatesFile = mapped;
+
+        // the file itself is not copied into the trace; a replay maps it again by name
+        trace.putString(fileName);
+        trace.putLong((long) mapped.size);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
     }
     catch (std::bad_alloc &) {
+        unmapFile(mapped);
         return BEAGLE_ERROR_OUT_OF_MEMORY;
     }
     catch (std::out_of_range &) {
+        unmapFile(mapped);
         return BEAGLE_ERROR_OUT_OF_RANGE;
     }
     catch (...) {
+        unmapFile(mapped);
         return BEAGLE_ERROR_UNIDENTIFIED_EXCEPTION;
     }
 }
@@ -540,11 +1990,16 @@ int beagleSetTipPartials(int instance,
                    int tipIndex,
                    const double* inPartials) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_TIP_PARTIALS);
+    TRACE_CALL(beagle::TRACE_SET_TIP_PARTIALS);
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->setTipPartials(tipIndex, inPartials);
+        trace.putInt(tipIndex);
+        trace.putDoubles(inPartials, trace.patternCount() * trace.stateCount());
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
     }
@@ -563,11 +2018,16 @@ int beagleSetPartials(int instance,
                 int bufferIndex,
                 const double* inPartials) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_PARTIALS);
+    TRACE_CALL(beagle::TRACE_SET_PARTIALS);
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->setPartials(bufferIndex, inPartials);
+        trace.putInt(bufferIndex);
+        trace.putDoubles(inPartials, trace.patternCount() * trace.stateCount() * trace.categoryCount());
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
     }
@@ -584,11 +2044,16 @@ int beagleSetPartials(int instance,
 
 int beagleGetPartials(int instance, int bufferIndex, int scaleIndex, double* outPartials) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_GET_PARTIALS);
+    TRACE_CALL(beagle::TRACE_GET_PARTIALS);
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->getPartials(bufferIndex, scaleIndex, outPartials);
+        trace.putInt(bufferIndex);
+        trace.putInt(scaleIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
     }
@@ -609,12 +2074,19 @@ int beagleSetEigenDecomposition(int instance,
                           const double* inInverseEigenVectors,
                           const double* inEigenValues) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_EIGEN_DECOMPOSITION);
+    TRACE_CALL(beagle::TRACE_SET_EIGEN_DECOMPOSITION);
     try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->setEigenDecomposition(eigenIndex, inEigenVectors,
                                                      inInverseEigenVectors, inEigenValues);
+        trace.putInt(eigenIndex);
+        trace.putDoubles(inEigenVectors, trace.stateCount() * trace.stateCount());
+        trace.putDoubles(inInverseEigenVectors, trace.stateCount() * trace.stateCount());
+        trace.putDoubles(inEigenValues, trace.eigenValueCount());
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
     }
@@ -633,10 +2105,32 @@ int beagleSetStateFrequencies(int instance,
                               int stateFrequenciesIndex,
                               const double* inStateFrequencies) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_STATE_FREQUENCIES);
+    TRACE_CALL(beagle::TRACE_SET_STATE_FREQUENCIES);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setStateFrequencies(stateFrequenciesIndex, inStateFrequencies);
+    trace.putInt(stateFrequenciesIndex);
+    trace.putDoubles(inStateFrequencies, trace.stateCount());
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetInvariantSites(int instance,
+                            double proportionInvariant,
+                            int stateFrequenciesIndex) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_INVARIANT_SITES);
+    TRACE_CALL(beagle::TRACE_SET_INVARIANT_SITES);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setInvariantSites(proportionInvariant, stateFrequenciesIndex);
+    trace.putDouble(proportionInvariant);
+    trace.putInt(stateFrequenciesIndex);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -645,10 +2139,15 @@ int beagleSetCategoryWeights(int instance,
                              int categoryWeightsIndex,
                              const double* inCategoryWeights) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_CATEGORY_WEIGHTS);
+    TRACE_CALL(beagle::TRACE_SET_CATEGORY_WEIGHTS);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setCategoryWeights(categoryWeightsIndex, inCategoryWeights);
+    trace.putInt(categoryWeightsIndex);
+    trace.putDoubles(inCategoryWeights, trace.categoryCount());
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -656,10 +2155,14 @@ int beagleSetCategoryWeights(int instance,
 int beagleSetPatternWeights(int instance,
                             const double* inPatternWeights) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_PATTERN_WEIGHTS);
+    TRACE_CALL(beagle::TRACE_SET_PATTERN_WEIGHTS);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setPatternWeights(inPatternWeights);
+    trace.putDoubles(inPatternWeights, trace.patternCount());
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -668,10 +2171,15 @@ int beagleSetPatternPartitions(int instance,
                                int partitionCount,
                                const int* inPatternPartitions) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_PATTERN_PARTITIONS);
+    TRACE_CALL(beagle::TRACE_SET_PATTERN_PARTITIONS);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setPatternPartitions(partitionCount, inPatternPartitions);
+    trace.putInt(partitionCount);
+    trace.putInts(inPatternPartitions, trace.patternCount());
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -679,11 +2187,15 @@ int beagleSetPatternPartitions(int instance,
 int beagleSetCategoryRates(int instance,
                      const double* inCategoryRates) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_CATEGORY_RATES);
+    TRACE_CALL(beagle::TRACE_SET_CATEGORY_RATES);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->setCategoryRates(inCategoryRates);
+        trace.putDoubles(inCategoryRates, trace.categoryCount());
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -702,10 +2214,15 @@ int beagleSetCategoryRatesWithIndex(int instance,
                                     int categoryRatesIndex,
                                     const double* inCategoryRates) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_CATEGORY_RATES_WITH_INDEX);
+    TRACE_CALL(beagle::TRACE_SET_CATEGORY_RATES_WITH_INDEX);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setCategoryRatesWithIndex(categoryRatesIndex, inCategoryRates);
+    trace.putInt(categoryRatesIndex);
+    trace.putDoubles(inCategoryRates, trace.categoryCount());
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -715,11 +2232,17 @@ int beagleSetTransitionMatrix(int instance,
                         const double* inMatrix,
                         double paddedValue) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_TRANSITION_MATRIX);
+    TRACE_CALL(beagle::TRACE_SET_TRANSITION_MATRIX);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->setTransitionMatrix(matrixIndex, inMatrix, paddedValue);
+        trace.putInt(matrixIndex);
+        trace.putDoubles(inMatrix, trace.stateCount() * trace.stateCount() * trace.categoryCount());
+        trace.putDouble(paddedValue);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -740,11 +2263,18 @@ int beagleSetTransitionMatrices(int instance,
                               const double* paddedValues,
                               int count) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_TRANSITION_MATRICES);
+    TRACE_CALL(beagle::TRACE_SET_TRANSITION_MATRICES);
     //    try {
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->setTransitionMatrices(matrixIndices, inMatrices, paddedValues, count);
+    trace.putInts(matrixIndices, count);
+    trace.putDoubles(inMatrices, count * trace.stateCount() * trace.stateCount() * trace.categoryCount());
+    trace.putDoubles(paddedValues, count);
+    trace.putInt(count);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
     //    }
@@ -763,10 +2293,14 @@ int beagleGetTransitionMatrix(int instance,
 							  int matrixIndex,
 							  double* outMatrix) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_GET_TRANSITION_MATRIX);
+    TRACE_CALL(beagle::TRACE_GET_TRANSITION_MATRIX);
 	beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
 	if (beagleInstance == NULL)
 		return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->getTransitionMatrix(matrixIndex,outMatrix);
+    trace.putInt(matrixIndex);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -781,6 +2315,8 @@ int beagleConvolveTransitionMatrices(int instance,
 		                             const int* resultIndices,
 		                             const int matrixCount) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CONVOLVE_TRANSITION_MATRICES);
+    TRACE_CALL(beagle::TRACE_CONVOLVE_TRANSITION_MATRICES);
 	beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
 
 	if (beagleInstance == NULL) {
@@ -788,12 +2324,46 @@ int beagleConvolveTransitionMatrices(int instance,
 	} else {
         int returnValue = beagleInstance->convolveTransitionMatrices(firstIndices,
                                            secondIndices, resultIndices, matrixCount);
+        trace.putInts(firstIndices, matrixCount);
+        trace.putInts(secondIndices, matrixCount);
+        trace.putInts(resultIndices, matrixCount);
+        trace.putInt(matrixCount);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 	}
 
 }//END: beagleConvolveTransitionMatrices
 
+int beagleConvolveTransitionMatrixChains(int instance,
+                                         const int* matrixIndices,
+                                         const int* chainLengths,
+                                         const int* resultIndices,
+                                         int chainCount) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CONVOLVE_TRANSITION_MATRIX_CHAINS);
+    TRACE_CALL(beagle::TRACE_CONVOLVE_TRANSITION_MATRIX_CHAINS);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+
+    if (beagleInstance == NULL) {
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    } else {
+        int returnValue = beagleInstance->convolveTransitionMatrixChains(matrixIndices,
+                                           chainLengths, resultIndices, chainCount);
+        int chainedCount = 0;
+        for (int i = 0; chainLengths != NULL && i < chainCount; i++)
+            chainedCount += chainLengths[i];
+        trace.putInts(matrixIndices, chainedCount);
+        trace.putInts(chainLengths, chainCount);
+        trace.putInts(resultIndices, chainCount);
+        trace.putInt(chainCount);
+        trace.write(returnValue);
+        DEBUG_END_TIME();
+        return returnValue;
+    }
+
+}//END: beagleConvolveTransitionMatrixChains
+
 int beagleUpdateTransitionMatrices(int instance,
                              int eigenIndex,
                              const int* probabilityIndices,
@@ -802,6 +2372,8 @@ int beagleUpdateTransitionMatrices(int instance,
                              const double* edgeLengths,
                              int count) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES);
+    TRACE_CALL(beagle::TRACE_UPDATE_TRANSITION_MATRICES);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
@@ -809,6 +2381,13 @@ int beagleUpdateTransitionMatrices(int instance,
         int returnValue = beagleInstance->updateTransitionMatrices(eigenIndex, probabilityIndices,
                                                         firstDerivativeIndices,
                                                         secondDerivativeIndices, edgeLengths, count);
+        trace.putInt(eigenIndex);
+        trace.putInts(probabilityIndices, count);
+        trace.putInts(firstDerivativeIndices, count);
+        trace.putInts(secondDerivativeIndices, count);
+        trace.putDoubles(edgeLengths, count);
+        trace.putInt(count);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -832,12 +2411,62 @@ int beagleUpdateTransitionMatricesWithMultipleModels(int instance,
                                                      const double* edgeLengths,
                                                      int count) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS);
+    TRACE_CALL(beagle::TRACE_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->updateTransitionMatricesWithMultipleModels(eigenIndices, categoryRateIndices,
                                                                                  probabilityIndices, firstDerivativeIndices,
                                                                                  secondDerivativeIndices, edgeLengths, count);
+    trace.putInts(eigenIndices, count);
+    trace.putInts(categoryRateIndices, count);
+    trace.putInts(probabilityIndices, count);
+    trace.putInts(firstDerivativeIndices, count);
+    trace.putInts(secondDerivativeIndices, count);
+    trace.putDoubles(edgeLengths, count);
+    trace.putInt(count);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleSetRateMatrix(int instance,
+                        int rateMatrixIndex,
+                        const double* inRateMatrix) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_SET_RATE_MATRIX);
+    TRACE_CALL(beagle::TRACE_SET_RATE_MATRIX);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->setRateMatrix(rateMatrixIndex, inRateMatrix);
+    trace.putInt(rateMatrixIndex);
+    trace.putDoubles(inRateMatrix, trace.stateCount() * trace.stateCount());
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleUpdateTransitionMatricesFromRateMatrix(int instance,
+                                                 int rateMatrixIndex,
+                                                 const int* probabilityIndices,
+                                                 const double* edgeLengths,
+                                                 int count) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES_FROM_RATE_MATRIX);
+    TRACE_CALL(beagle::TRACE_UPDATE_TRANSITION_MATRICES_FROM_RATE_MATRIX);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->updateTransitionMatricesFromRateMatrix(rateMatrixIndex,
+                                                                             probabilityIndices,
+                                                                             edgeLengths, count);
+    trace.putInt(rateMatrixIndex);
+    trace.putInts(probabilityIndices, count);
+    trace.putDoubles(edgeLengths, count);
+    trace.putInt(count);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -848,11 +2477,17 @@ int beagleUpdatePartials(const int instance,
                    int operationCount,
                    int cumulativeScalingIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_UPDATE_PARTIALS);
+    TRACE_CALL(beagle::TRACE_UPDATE_PARTIALS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->updatePartials((const int*)operations, operationCount, cumulativeScalingIndex);
+        trace.putInts((const int*) operations, operationCount * BEAGLE_OP_COUNT);
+        trace.putInt(operationCount);
+        trace.putInt(cumulativeScalingIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -871,10 +2506,15 @@ int beagleUpdatePartialsByPartition(const int instance,
                                     const BeagleOperationByPartition* operations,
                                     int operationCount) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_UPDATE_PARTIALS_BY_PARTITION);
+    TRACE_CALL(beagle::TRACE_UPDATE_PARTIALS_BY_PARTITION);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->updatePartialsByPartition((const int*)operations, operationCount);
+    trace.putInts((const int*) operations, operationCount * BEAGLE_PARTITION_OP_COUNT);
+    trace.putInt(operationCount);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -883,12 +2523,17 @@ int beagleWaitForPartials(const int instance,
                     const int* destinationPartials,
                     int destinationPartialsCount) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_WAIT_FOR_PARTIALS);
+    TRACE_CALL(beagle::TRACE_WAIT_FOR_PARTIALS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->waitForPartials(destinationPartials,
                                                   destinationPartialsCount);
+        trace.putInts(destinationPartials, destinationPartialsCount);
+        trace.putInt(destinationPartialsCount);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -908,11 +2553,17 @@ int beagleAccumulateScaleFactors(int instance,
 						   int count,
 						   int cumulativeScalingIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_ACCUMULATE_SCALE_FACTORS);
+    TRACE_CALL(beagle::TRACE_ACCUMULATE_SCALE_FACTORS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
          return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->accumulateScaleFactors(scalingIndices, count, cumulativeScalingIndex);
+        trace.putInts(scalingIndices, count);
+        trace.putInt(count);
+        trace.putInt(cumulativeScalingIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -933,11 +2584,18 @@ int beagleAccumulateScaleFactorsByPartition(int instance,
                                             int cumulativeScalingIndex,
                                             int partitionIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_ACCUMULATE_SCALE_FACTORS_BY_PARTITION);
+    TRACE_CALL(beagle::TRACE_ACCUMULATE_SCALE_FACTORS_BY_PARTITION);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
          return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->accumulateScaleFactorsByPartition(scalingIndices, count, cumulativeScalingIndex, partitionIndex);
+        trace.putInts(scalingIndices, count);
+        trace.putInt(count);
+        trace.putInt(cumulativeScalingIndex);
+        trace.putInt(partitionIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -957,11 +2615,17 @@ int beagleRemoveScaleFactors(int instance,
 						   int count,
 						   int cumulativeScalingIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_REMOVE_SCALE_FACTORS);
+    TRACE_CALL(beagle::TRACE_REMOVE_SCALE_FACTORS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->removeScaleFactors(scalingIndices, count, cumulativeScalingIndex);
+        trace.putInts(scalingIndices, count);
+        trace.putInt(count);
+        trace.putInt(cumulativeScalingIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -982,11 +2646,18 @@ int beagleRemoveScaleFactorsByPartition(int instance,
                                         int cumulativeScalingIndex,
                                         int partitionIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_REMOVE_SCALE_FACTORS_BY_PARTITION);
+    TRACE_CALL(beagle::TRACE_REMOVE_SCALE_FACTORS_BY_PARTITION);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->removeScaleFactorsByPartition(scalingIndices, count, cumulativeScalingIndex, partitionIndex);
+        trace.putInts(scalingIndices, count);
+        trace.putInt(count);
+        trace.putInt(cumulativeScalingIndex);
+        trace.putInt(partitionIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1004,11 +2675,15 @@ int beagleRemoveScaleFactorsByPartition(int instance,
 int beagleResetScaleFactors(int instance,
                       int cumulativeScalingIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_RESET_SCALE_FACTORS);
+    TRACE_CALL(beagle::TRACE_RESET_SCALE_FACTORS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->resetScaleFactors(cumulativeScalingIndex);
+        trace.putInt(cumulativeScalingIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1027,11 +2702,16 @@ int beagleResetScaleFactorsByPartition(int instance,
                                        int cumulativeScalingIndex,
                                        int partitionIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_RESET_SCALE_FACTORS_BY_PARTITION);
+    TRACE_CALL(beagle::TRACE_RESET_SCALE_FACTORS_BY_PARTITION);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
             return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
         int returnValue = beagleInstance->resetScaleFactorsByPartition(cumulativeScalingIndex, partitionIndex);
+        trace.putInt(cumulativeScalingIndex);
+        trace.putInt(partitionIndex);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1050,11 +2730,16 @@ int beagleCopyScaleFactors(int instance,
                            int destScalingIndex,
                            int srcScalingIndex) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_COPY_SCALE_FACTORS);
+    TRACE_CALL(beagle::TRACE_COPY_SCALE_FACTORS);
     //    try {
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->copyScaleFactors(destScalingIndex, srcScalingIndex);
+    trace.putInt(destScalingIndex);
+    trace.putInt(srcScalingIndex);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
     //    }
@@ -1073,11 +2758,15 @@ int beagleGetScaleFactors(int instance,
                            int srcScalingIndex,
                            double* scaleFactors) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_GET_SCALE_FACTORS);
+    TRACE_CALL(beagle::TRACE_GET_SCALE_FACTORS);
     //    try {
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->getScaleFactors(srcScalingIndex, scaleFactors);
+    trace.putInt(srcScalingIndex);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
     //    }
@@ -1100,6 +2789,8 @@ int beagleCalculateRootLogLikelihoods(int instance,
                                       int count,
                                       double* outSumLogLikelihood) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS);
+    TRACE_CALL(beagle::TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
@@ -1109,6 +2800,13 @@ int beagleCalculateRootLogLikelihoods(int instance,
                                                            cumulativeScaleIndices,
                                                            count,
                                                            outSumLogLikelihood);
+        trace.putInts(bufferIndices, count);
+        trace.putInts(categoryWeightsIndices, count);
+        trace.putInts(stateFrequenciesIndices, count);
+        trace.putInts(cumulativeScaleIndices, count);
+        trace.putInt(count);
+        trace.putDoubles(outSumLogLikelihood, 1);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1136,6 +2834,8 @@ int beagleCalculateRootLogLikelihoodsByPartition(int instance,
                                                  double* outSumLogLikelihoodByPartition,
                                                  double* outSumLogLikelihood) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS_BY_PARTITION);
+    TRACE_CALL(beagle::TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS_BY_PARTITION);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
@@ -1149,6 +2849,17 @@ int beagleCalculateRootLogLikelihoodsByPartition(int instance,
                                                                                  count,
                                                                                  outSumLogLikelihoodByPartition,
                                                                                  outSumLogLikelihood);
+        const int indexCount = count * partitionCount;
+        trace.putInts(bufferIndices, indexCount);
+        trace.putInts(categoryWeightsIndices, indexCount);
+        trace.putInts(stateFrequenciesIndices, indexCount);
+        trace.putInts(cumulativeScaleIndices, indexCount);
+        trace.putInts(partitionIndices, indexCount);
+        trace.putInt(partitionCount);
+        trace.putInt(count);
+        trace.putDoubles(outSumLogLikelihoodByPartition, partitionCount);
+        trace.putDoubles(outSumLogLikelihood, 1);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1165,6 +2876,56 @@ int beagleCalculateRootLogLikelihoodsByPartition(int instance,
 
 }
 
+int beagleCalculateRootLogLikelihoodsAsync(int instance,
+                                           const int* bufferIndices,
+                                           const int* categoryWeightsIndices,
+                                           const int* stateFrequenciesIndices,
+                                           const int* cumulativeScaleIndices,
+                                           const int* partitionIndices,
+                                           int partitionCount) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS_ASYNC);
+    TRACE_CALL(beagle::TRACE_CALCULATE_ROOT_LOG_LIKELIHOODS_ASYNC);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->calculateRootLogLikelihoodsAsync(bufferIndices,
+                                                                       categoryWeightsIndices,
+                                                                       stateFrequenciesIndices,
+                                                                       cumulativeScaleIndices,
+                                                                       partitionIndices,
+                                                                       partitionCount);
+    trace.putInts(bufferIndices, partitionCount);
+    trace.putInts(categoryWeightsIndices, partitionCount);
+    trace.putInts(stateFrequenciesIndices, partitionCount);
+    trace.putInts(cumulativeScaleIndices, partitionCount);
+    trace.putInts(partitionIndices, partitionCount);
+    trace.putInt(partitionCount);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleGetRootLogLikelihoodsAsync(int instance,
+                                     int blocking,
+                                     double* outSumLogLikelihoodByPartition,
+                                     double* outSumLogLikelihood) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_GET_ROOT_LOG_LIKELIHOODS_ASYNC);
+    TRACE_CALL(beagle::TRACE_GET_ROOT_LOG_LIKELIHOODS_ASYNC);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->getRootLogLikelihoodsAsync(blocking,
+                                                                 outSumLogLikelihoodByPartition,
+                                                                 outSumLogLikelihood);
+    trace.putInt(blocking);
+    trace.putDoubles(outSumLogLikelihood, 1);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleCalculateEdgeLogLikelihoods(int instance,
                                       const int* parentBufferIndices,
                                       const int* childBufferIndices,
@@ -1179,6 +2940,8 @@ int beagleCalculateEdgeLogLikelihoods(int instance,
                                       double* outSumFirstDerivative,
                                       double* outSumSecondDerivative) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CALCULATE_EDGE_LOG_LIKELIHOODS);
+    TRACE_CALL(beagle::TRACE_CALCULATE_EDGE_LOG_LIKELIHOODS);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
@@ -1191,6 +2954,19 @@ int beagleCalculateEdgeLogLikelihoods(int instance,
                                                            count,
                                                            outSumLogLikelihood, outSumFirstDerivative,
                                                            outSumSecondDerivative);
+        trace.putInts(parentBufferIndices, count);
+        trace.putInts(childBufferIndices, count);
+        trace.putInts(probabilityIndices, count);
+        trace.putInts(firstDerivativeIndices, count);
+        trace.putInts(secondDerivativeIndices, count);
+        trace.putInts(categoryWeightsIndices, count);
+        trace.putInts(stateFrequenciesIndices, count);
+        trace.putInts(cumulativeScaleIndices, count);
+        trace.putInt(count);
+        trace.putDoubles(outSumLogLikelihood, 1);
+        trace.putDoubles(outSumFirstDerivative, 1);
+        trace.putDoubles(outSumSecondDerivative, 1);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1224,6 +3000,8 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
                                                  double* outSumSecondDerivativeByPartition,
                                                  double* outSumSecondDerivative) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CALCULATE_EDGE_LOG_LIKELIHOODS_BY_PARTITION);
+    TRACE_CALL(beagle::TRACE_CALCULATE_EDGE_LOG_LIKELIHOODS_BY_PARTITION);
 //    try {
         beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
         if (beagleInstance == NULL)
@@ -1246,6 +3024,25 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
                                                         outSumFirstDerivative,
                                                         outSumSecondDerivativeByPartition,
                                                         outSumSecondDerivative);
+        const int indexCount = count * partitionCount;
+        trace.putInts(parentBufferIndices, indexCount);
+        trace.putInts(childBufferIndices, indexCount);
+        trace.putInts(probabilityIndices, indexCount);
+        trace.putInts(firstDerivativeIndices, indexCount);
+        trace.putInts(secondDerivativeIndices, indexCount);
+        trace.putInts(categoryWeightsIndices, indexCount);
+        trace.putInts(stateFrequenciesIndices, indexCount);
+        trace.putInts(cumulativeScaleIndices, indexCount);
+        trace.putInts(partitionIndices, indexCount);
+        trace.putInt(partitionCount);
+        trace.putInt(count);
+        trace.putDoubles(outSumLogLikelihoodByPartition, partitionCount);
+        trace.putDoubles(outSumLogLikelihood, 1);
+        trace.putDoubles(outSumFirstDerivativeByPartition, partitionCount);
+        trace.putDoubles(outSumFirstDerivative, 1);
+        trace.putDoubles(outSumSecondDerivativeByPartition, partitionCount);
+        trace.putDoubles(outSumSecondDerivative, 1);
+        trace.write(returnValue);
         DEBUG_END_TIME();
         return returnValue;
 //    }
@@ -1260,13 +3057,70 @@ int beagleCalculateEdgeLogLikelihoodsByPartition(int instance,
 //    }
 }
 
+int beaglePrepareEdgeProjection(int instance,
+                                int parentBufferIndex,
+                                int childBufferIndex,
+                                int eigenIndex,
+                                int categoryWeightsIndex,
+                                int stateFrequenciesIndex,
+                                int cumulativeScaleIndex) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_PREPARE_EDGE_PROJECTION);
+    TRACE_CALL(beagle::TRACE_PREPARE_EDGE_PROJECTION);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->prepareEdgeProjection(parentBufferIndex,
+                                                            childBufferIndex,
+                                                            eigenIndex,
+                                                            categoryWeightsIndex,
+                                                            stateFrequenciesIndex,
+                                                            cumulativeScaleIndex);
+    trace.putInt(parentBufferIndex);
+    trace.putInt(childBufferIndex);
+    trace.putInt(eigenIndex);
+    trace.putInt(categoryWeightsIndex);
+    trace.putInt(stateFrequenciesIndex);
+    trace.putInt(cumulativeScaleIndex);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+int beagleCalculateEdgeProjectionLogLikelihoods(int instance,
+                                                double edgeLength,
+                                                double* outSumLogLikelihood,
+                                                double* outSumFirstDerivative,
+                                                double* outSumSecondDerivative) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_CALCULATE_EDGE_PROJECTION_LOG_LIKELIHOODS);
+    TRACE_CALL(beagle::TRACE_CALCULATE_EDGE_PROJECTION_LOG_LIKELIHOODS);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int returnValue = beagleInstance->calculateEdgeProjectionLogLikelihoods(edgeLength,
+                                                                            outSumLogLikelihood,
+                                                                            outSumFirstDerivative,
+                                                                            outSumSecondDerivative);
+    trace.putDouble(edgeLength);
+    trace.putDoubles(outSumLogLikelihood, 1);
+    trace.putDoubles(outSumFirstDerivative, 1);
+    trace.putDoubles(outSumSecondDerivative, 1);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
 int beagleGetSiteLogLikelihoods(int instance,
                                 double* outLogLikelihoods) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_GET_SITE_LOG_LIKELIHOODS);
+    TRACE_CALL(beagle::TRACE_GET_SITE_LOG_LIKELIHOODS);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->getSiteLogLikelihoods(outLogLikelihoods);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
@@ -1275,11 +3129,626 @@ int beagleGetSiteDerivatives(int instance,
                              double* outFirstDerivatives,
                              double* outSecondDerivatives) {
     DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_GET_SITE_DERIVATIVES);
+    TRACE_CALL(beagle::TRACE_GET_SITE_DERIVATIVES);
     beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
     if (beagleInstance == NULL)
         return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
     int returnValue = beagleInstance->getSiteDerivatives(outFirstDerivatives, outSecondDerivatives);
+    trace.putInt(outFirstDerivatives != NULL);
+    trace.putInt(outSecondDerivatives != NULL);
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
+
+namespace beagle {
+
+/// returns the command buffer for an index or NULL if the index is invalid or finalized
+CommandBuffer* getCommandBuffer(int commandBufferIndex) {
+    return commandBufferTable.lookup(commandBufferIndex);
+}
+
+/// copies an index list into a recorded command, checking each entry against [0, bound)
+int recordIndices(std::vector<int>& destination,
+                  const int* indices,
+                  int count,
+                  int bound,
+                  bool allowNegative) {
+    if (indices == NULL)
+        return BEAGLE_SUCCESS;
+    for (int i = 0; i < count; i++) {
+        if (indices[i] >= bound || (indices[i] < 0 && !(allowNegative && indices[i] == BEAGLE_OP_NONE)))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    destination.assign(indices, indices + count);
+    return BEAGLE_SUCCESS;
+}
+
+const int* recordedIndices(const std::vector<int>& indices) {
+    return (indices.empty() ? NULL : &indices[0]);
+}
+
+}	// end namespace beagle
+
+int beagleCreateCommandBuffer(int instance) {
+    DEBUG_START_TIME();
+    TRACE_CALL(beagle::TRACE_CREATE_COMMAND_BUFFER);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::CommandBuffer* buffer = new beagle::CommandBuffer;
+    buffer->instance = instance;
+    buffer->edgeLengthCount = 0;
+    buffer->logLikelihoodCount = 0;
+    int commandBuffer = commandBufferTable.insert(buffer);
+    if (commandBuffer < 0) {
+        delete buffer;
+        commandBuffer = BEAGLE_ERROR_OUT_OF_MEMORY;
+    }
+    trace.write(commandBuffer);
+    DEBUG_END_TIME();
+    return commandBuffer;
+}
+
+int beagleRecordUpdateTransitionMatrices(int commandBuffer,
+                                         int eigenIndex,
+                                         const int* probabilityIndices,
+                                         const int* firstDerivativeIndices,
+                                         const int* secondDerivativeIndices,
+                                         int count) {
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_RECORD_UPDATE_TRANSITION_MATRICES);
+    beagle::CommandBuffer* buffer = beagle::getCommandBuffer(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::InstanceSlot* slot = instanceTable.lookup(buffer->instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    const beagle::InstanceDimensions& dimensions = slot->dimensions;
+    if (eigenIndex < 0 || eigenIndex >= dimensions.eigenBufferCount || count < 0 ||
+        probabilityIndices == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::RecordedCommand command;
+    command.code = beagle::COMMAND_UPDATE_TRANSITION_MATRICES;
+    command.count = count;
+    command.index = eigenIndex;
+    if (beagle::recordIndices(command.indices0, probabilityIndices, count,
+                              dimensions.matrixBufferCount, false) != BEAGLE_SUCCESS ||
+        beagle::recordIndices(command.indices1, firstDerivativeIndices, count,
+                              dimensions.matrixBufferCount, false) != BEAGLE_SUCCESS ||
+        beagle::recordIndices(command.indices2, secondDerivativeIndices, count,
+                              dimensions.matrixBufferCount, false) != BEAGLE_SUCCESS)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    buffer->commands.push_back(command);
+    buffer->edgeLengthCount += count;
+    trace.putInt(eigenIndex);
+    trace.putInts(probabilityIndices, count);
+    trace.putInts(firstDerivativeIndices, count);
+    trace.putInts(secondDerivativeIndices, count);
+    trace.putInt(count);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleRecordUpdatePartials(int commandBuffer,
+                               const BeagleOperation* operations,
+                               int operationCount,
+                               int cumulativeScaleIndex) {
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_RECORD_UPDATE_PARTIALS);
+    beagle::CommandBuffer* buffer = beagle::getCommandBuffer(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::InstanceSlot* slot = instanceTable.lookup(buffer->instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    const beagle::InstanceDimensions& dimensions = slot->dimensions;
+    if (operationCount < 0 || operations == NULL ||
+        cumulativeScaleIndex < BEAGLE_OP_NONE || cumulativeScaleIndex >= dimensions.scaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    for (int i = 0; i < operationCount; i++) {
+        const BeagleOperation& op = operations[i];
+        if (op.destinationPartials < 0 || op.destinationPartials >= dimensions.bufferCount ||
+            op.child1Partials < 0 || op.child1Partials >= dimensions.bufferCount ||
+            op.child2Partials < 0 || op.child2Partials >= dimensions.bufferCount ||
+            op.child1TransitionMatrix < 0 || op.child1TransitionMatrix >= dimensions.matrixBufferCount ||
+            op.child2TransitionMatrix < 0 || op.child2TransitionMatrix >= dimensions.matrixBufferCount ||
+            op.destinationScaleWrite < BEAGLE_OP_NONE || op.destinationScaleWrite >= dimensions.scaleBufferCount ||
+            op.destinationScaleRead < BEAGLE_OP_NONE || op.destinationScaleRead >= dimensions.scaleBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    const int* opList = (const int*) operations;
+    beagle::RecordedCommand command;
+    command.code = beagle::COMMAND_UPDATE_PARTIALS;
+    command.count = operationCount;
+    command.index = cumulativeScaleIndex;
+    command.indices0.assign(opList, opList + operationCount * BEAGLE_OP_COUNT);
+
+    buffer->commands.push_back(command);
+    trace.putInts(opList, operationCount * BEAGLE_OP_COUNT);
+    trace.putInt(operationCount);
+    trace.putInt(cumulativeScaleIndex);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleRecordAccumulateScaleFactors(int commandBuffer,
+                                       const int* scaleIndices,
+                                       int count,
+                                       int cumulativeScaleIndex) {
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_RECORD_ACCUMULATE_SCALE_FACTORS);
+    beagle::CommandBuffer* buffer = beagle::getCommandBuffer(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::InstanceSlot* slot = instanceTable.lookup(buffer->instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    const beagle::InstanceDimensions& dimensions = slot->dimensions;
+    if (count < 0 || scaleIndices == NULL ||
+        cumulativeScaleIndex < 0 || cumulativeScaleIndex >= dimensions.scaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::RecordedCommand command;
+    command.code = beagle::COMMAND_ACCUMULATE_SCALE_FACTORS;
+    command.count = count;
+    command.index = cumulativeScaleIndex;
+    if (beagle::recordIndices(command.indices0, scaleIndices, count,
+                              dimensions.scaleBufferCount, false) != BEAGLE_SUCCESS)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    buffer->commands.push_back(command);
+    trace.putInts(scaleIndices, count);
+    trace.putInt(count);
+    trace.putInt(cumulativeScaleIndex);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleRecordResetScaleFactors(int commandBuffer,
+                                  int cumulativeScaleIndex) {
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_RECORD_RESET_SCALE_FACTORS);
+    beagle::CommandBuffer* buffer = beagle::getCommandBuffer(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::InstanceSlot* slot = instanceTable.lookup(buffer->instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    const beagle::InstanceDimensions& dimensions = slot->dimensions;
+    if (cumulativeScaleIndex < 0 || cumulativeScaleIndex >= dimensions.scaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::RecordedCommand command;
+    command.code = beagle::COMMAND_RESET_SCALE_FACTORS;
+    command.count = 0;
+    command.index = cumulativeScaleIndex;
+
+    buffer->commands.push_back(command);
+    trace.putInt(cumulativeScaleIndex);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleRecordCalculateRootLogLikelihoods(int commandBuffer,
+                                            const int* bufferIndices,
+                                            const int* categoryWeightsIndices,
+                                            const int* stateFrequenciesIndices,
+                                            const int* cumulativeScaleIndices,
+                                            int count) {
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_RECORD_CALCULATE_ROOT_LOG_LIKELIHOODS);
+    beagle::CommandBuffer* buffer = beagle::getCommandBuffer(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::InstanceSlot* slot = instanceTable.lookup(buffer->instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    const beagle::InstanceDimensions& dimensions = slot->dimensions;
+    if (count < 1 || bufferIndices == NULL || categoryWeightsIndices == NULL ||
+        stateFrequenciesIndices == NULL || cumulativeScaleIndices == NULL)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::RecordedCommand command;
+    command.code = beagle::COMMAND_CALCULATE_ROOT_LOG_LIKELIHOODS;
+    command.count = count;
+    command.index = 0;
+    if (beagle::recordIndices(command.indices0, bufferIndices, count,
+                              dimensions.bufferCount, false) != BEAGLE_SUCCESS ||
+        beagle::recordIndices(command.indices1, categoryWeightsIndices, count,
+                              dimensions.eigenBufferCount, false) != BEAGLE_SUCCESS ||
+        beagle::recordIndices(command.indices2, stateFrequenciesIndices, count,
+                              dimensions.eigenBufferCount, false) != BEAGLE_SUCCESS ||
+        beagle::recordIndices(command.indices3, cumulativeScaleIndices, count,
+                              dimensions.scaleBufferCount, true) != BEAGLE_SUCCESS)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    buffer->commands.push_back(command);
+    buffer->logLikelihoodCount++;
+    trace.putInts(bufferIndices, count);
+    trace.putInts(categoryWeightsIndices, count);
+    trace.putInts(stateFrequenciesIndices, count);
+    trace.putInts(cumulativeScaleIndices, count);
+    trace.putInt(count);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleExecuteCommandBuffer(int commandBuffer,
+                               const double* edgeLengths,
+                               double* outSumLogLikelihoods) {
+    DEBUG_START_TIME();
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_EXECUTE_COMMAND_BUFFER);
+    beagle::CommandBuffer* buffer = beagle::getCommandBuffer(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    int instance = buffer->instance;
+    STATISTICS_TIME(BEAGLE_STATISTICS_EXECUTE_COMMAND_BUFFER);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    if ((edgeLengths == NULL && buffer->edgeLengthCount > 0) ||
+        (outSumLogLikelihoods == NULL && buffer->logLikelihoodCount > 0))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    int returnValue = BEAGLE_SUCCESS;
+    int edgeLengthOffset = 0;
+    int logLikelihoodIndex = 0;
+    for (size_t i = 0; i < buffer->commands.size() && returnValue == BEAGLE_SUCCESS; i++) {
+        const beagle::RecordedCommand& command = buffer->commands[i];
+        switch (command.code) {
+            case beagle::COMMAND_UPDATE_TRANSITION_MATRICES:
+                returnValue = beagleInstance->updateTransitionMatrices(command.index,
+                                                    beagle::recordedIndices(command.indices0),
+                                                    beagle::recordedIndices(command.indices1),
+                                                    beagle::recordedIndices(command.indices2),
+                                                    edgeLengths + edgeLengthOffset,
+                                                    command.count);
+                edgeLengthOffset += command.count;
+                break;
+            case beagle::COMMAND_UPDATE_PARTIALS:
+                returnValue = beagleInstance->updatePartials(beagle::recordedIndices(command.indices0),
+                                                             command.count,
+                                                             command.index);
+                break;
+            case beagle::COMMAND_ACCUMULATE_SCALE_FACTORS:
+                returnValue = beagleInstance->accumulateScaleFactors(beagle::recordedIndices(command.indices0),
+                                                                     command.count,
+                                                                     command.index);
+                break;
+            case beagle::COMMAND_RESET_SCALE_FACTORS:
+                returnValue = beagleInstance->resetScaleFactors(command.index);
+                break;
+            case beagle::COMMAND_CALCULATE_ROOT_LOG_LIKELIHOODS:
+                returnValue = beagleInstance->calculateRootLogLikelihoods(beagle::recordedIndices(command.indices0),
+                                                    beagle::recordedIndices(command.indices1),
+                                                    beagle::recordedIndices(command.indices2),
+                                                    beagle::recordedIndices(command.indices3),
+                                                    command.count,
+                                                    outSumLogLikelihoods + logLikelihoodIndex);
+                logLikelihoodIndex++;
+                break;
+        }
+    }
+    trace.putDoubles(edgeLengths, buffer->edgeLengthCount);
+    trace.putDoubles(outSumLogLikelihoods, buffer->logLikelihoodCount);
+    trace.write(returnValue);
     DEBUG_END_TIME();
     return returnValue;
 }
 
+int beagleFinalizeCommandBuffer(int commandBuffer) {
+    beagle::TraceRecord trace(commandBuffer, beagle::TRACE_FINALIZE_COMMAND_BUFFER);
+    beagle::CommandBuffer* buffer = commandBufferTable.remove(commandBuffer);
+    if (buffer == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    delete buffer;
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+namespace beagle {
+
+/// marks a node and its ancestors as dirty, stopping at the first ancestor that already is
+void markTreeNodeDirty(TreeState* tree, int node) {
+    while (node != BEAGLE_OP_NONE && !tree->dirty[node]) {
+        tree->dirty[node] = 1;
+        node = tree->parents[node];
+    }
+}
+
+bool isTreeNodeInternal(const TreeState* tree, int node) {
+    return tree->children[2 * node] != BEAGLE_OP_NONE;
+}
+
+/// true if a node has the same two children, below the same matrices, in both trees
+bool sameTreeChildren(const TreeState* previous, const TreeState* tree, int node) {
+    int a = tree->children[2 * node];
+    int b = tree->children[2 * node + 1];
+    int previousA = previous->children[2 * node];
+    int previousB = previous->children[2 * node + 1];
+    if (!((a == previousA && b == previousB) || (a == previousB && b == previousA)))
+        return false;
+    return (tree->matrices[a] == previous->matrices[a] && tree->matrices[b] == previous->matrices[b]);
+}
+
+}	// end namespace beagle
+
+int beagleSetTreeTopology(int instance,
+                          int nodeCount,
+                          const int* parentIndices,
+                          const int* matrixIndices,
+                          const int* scaleIndices,
+                          int cumulativeScaleIndex) {
+    TRACE_CALL(beagle::TRACE_SET_TREE_TOPOLOGY);
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    const beagle::InstanceDimensions& dimensions = slot->dimensions;
+    const int tipCount = slot->creation.tipCount;
+    if (nodeCount < 1 || nodeCount > dimensions.bufferCount ||
+        parentIndices == NULL || matrixIndices == NULL ||
+        cumulativeScaleIndex < BEAGLE_OP_NONE || cumulativeScaleIndex >= dimensions.scaleBufferCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    beagle::TreeState tree;
+    tree.parents.assign(parentIndices, parentIndices + nodeCount);
+    tree.matrices.assign(matrixIndices, matrixIndices + nodeCount);
+    tree.children.assign(2 * nodeCount, BEAGLE_OP_NONE);
+    tree.scaleIndices.assign(nodeCount, BEAGLE_OP_NONE);
+    tree.accumulated.assign(nodeCount, BEAGLE_OP_NONE);
+    tree.dirty.assign(nodeCount, 0);
+    tree.root = BEAGLE_OP_NONE;
+    tree.cumulativeScaleIndex = cumulativeScaleIndex;
+
+    for (int node = 0; node < nodeCount; node++) {
+        int parent = tree.parents[node];
+        if (parent == BEAGLE_OP_NONE) {
+            if (tree.root != BEAGLE_OP_NONE)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            tree.root = node;
+            continue;
+        }
+        if (parent < 0 || parent >= nodeCount || parent == node ||
+            tree.matrices[node] < 0 || tree.matrices[node] >= dimensions.matrixBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (tree.children[2 * parent] == BEAGLE_OP_NONE)
+            tree.children[2 * parent] = node;
+        else if (tree.children[2 * parent + 1] == BEAGLE_OP_NONE)
+            tree.children[2 * parent + 1] = node;
+        else
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+    if (tree.root == BEAGLE_OP_NONE)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // tips hold data and are never written; internal nodes have exactly two children
+    for (int node = 0; node < nodeCount; node++) {
+        bool internal = beagle::isTreeNodeInternal(&tree, node);
+        if (internal != (node >= tipCount) ||
+            (internal && tree.children[2 * node + 1] == BEAGLE_OP_NONE))
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        if (internal && scaleIndices != NULL) {
+            if (scaleIndices[node] < BEAGLE_OP_NONE || scaleIndices[node] >= dimensions.scaleBufferCount)
+                return BEAGLE_ERROR_OUT_OF_RANGE;
+            tree.scaleIndices[node] = scaleIndices[node];
+        }
+    }
+
+    // every node must hang from the root, which also rules out cycles
+    std::vector<int> stack(1, tree.root);
+    int reached = 0;
+    while (!stack.empty()) {
+        int node = stack.back();
+        stack.pop_back();
+        reached++;
+        if (beagle::isTreeNodeInternal(&tree, node)) {
+            stack.push_back(tree.children[2 * node]);
+            stack.push_back(tree.children[2 * node + 1]);
+        }
+    }
+    if (reached != nodeCount)
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    // partials computed for the previous topology stay valid where a node kept its subtree
+    const beagle::TreeState* previous = slot->tree;
+    bool compatible = (previous != NULL && (int) previous->parents.size() == nodeCount &&
+                       previous->cumulativeScaleIndex == cumulativeScaleIndex &&
+                       !previous->resetCumulative);
+    tree.resetCumulative = !compatible;
+    for (int node = tipCount; node < nodeCount; node++) {
+        bool stale = true;
+        if (compatible) {
+            stale = (previous->dirty[node] ||
+                     previous->scaleIndices[node] != tree.scaleIndices[node] ||
+                     !beagle::sameTreeChildren(previous, &tree, node));
+            tree.accumulated[node] = previous->accumulated[node];
+        }
+        if (stale)
+            beagle::markTreeNodeDirty(&tree, node);
+    }
+
+    delete slot->tree;
+    slot->tree = new beagle::TreeState(tree);
+    trace.putInt(nodeCount);
+    trace.putInts(parentIndices, nodeCount);
+    trace.putInts(matrixIndices, nodeCount);
+    trace.putInts(scaleIndices, nodeCount);
+    trace.putInt(cumulativeScaleIndex);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleInvalidateTransitionMatrices(int instance,
+                                       const int* matrixIndices,
+                                       int count) {
+    TRACE_CALL(beagle::TRACE_INVALIDATE_TRANSITION_MATRICES);
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::TreeState* tree = slot->tree;
+    if (tree == NULL)
+        return BEAGLE_ERROR_GENERAL;
+    const int matrixBufferCount = slot->dimensions.matrixBufferCount;
+    if (count < 0 || (matrixIndices == NULL && count > 0))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+
+    std::vector<char> changed(matrixBufferCount, 0);
+    for (int i = 0; i < count; i++) {
+        if (matrixIndices[i] < 0 || matrixIndices[i] >= matrixBufferCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+        changed[matrixIndices[i]] = 1;
+    }
+
+    for (int node = 0; node < (int) tree->parents.size(); node++) {
+        if (tree->parents[node] != BEAGLE_OP_NONE && changed[tree->matrices[node]])
+            beagle::markTreeNodeDirty(tree, tree->parents[node]);
+    }
+    trace.putInts(matrixIndices, count);
+    trace.putInt(count);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleInvalidatePartials(int instance,
+                             const int* bufferIndices,
+                             int count) {
+    TRACE_CALL(beagle::TRACE_INVALIDATE_PARTIALS);
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance);
+    if (slot == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::TreeState* tree = slot->tree;
+    if (tree == NULL)
+        return BEAGLE_ERROR_GENERAL;
+    const int nodeCount = tree->parents.size();
+    if (count < 0 || (bufferIndices == NULL && count > 0))
+        return BEAGLE_ERROR_OUT_OF_RANGE;
+    for (int i = 0; i < count; i++) {
+        if (bufferIndices[i] < 0 || bufferIndices[i] >= nodeCount)
+            return BEAGLE_ERROR_OUT_OF_RANGE;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int node = bufferIndices[i];
+        if (beagle::isTreeNodeInternal(tree, node))
+            beagle::markTreeNodeDirty(tree, node);
+        else if (tree->parents[node] != BEAGLE_OP_NONE)
+            beagle::markTreeNodeDirty(tree, tree->parents[node]);
+    }
+    trace.putInts(bufferIndices, count);
+    trace.putInt(count);
+    trace.write(BEAGLE_SUCCESS);
+    return BEAGLE_SUCCESS;
+}
+
+int beagleUpdateTreePartials(int instance,
+                             int* outOperationCount) {
+    DEBUG_START_TIME();
+    STATISTICS_TIME(BEAGLE_STATISTICS_UPDATE_TREE_PARTIALS);
+    TRACE_CALL(beagle::TRACE_UPDATE_TREE_PARTIALS);
+    beagle::InstanceSlot* slot = instanceTable.lookup(instance);
+    beagle::BeagleImpl* beagleInstance = beagle::getBeagleInstance(instance);
+    if (slot == NULL || beagleInstance == NULL)
+        return BEAGLE_ERROR_UNINITIALIZED_INSTANCE;
+    beagle::TreeState* tree = slot->tree;
+    if (tree == NULL)
+        return BEAGLE_ERROR_GENERAL;
+    const int nodeCount = tree->parents.size();
+
+    // dirty nodes form a subtree at the root; reversed pre-order puts children before parents
+    std::vector<int> order;
+    std::vector<int> stack;
+    if (tree->dirty[tree->root])
+        stack.push_back(tree->root);
+    while (!stack.empty()) {
+        int node = stack.back();
+        stack.pop_back();
+        order.push_back(node);
+        for (int c = 0; c < 2; c++) {
+            int child = tree->children[2 * node + c];
+            if (child != BEAGLE_OP_NONE && tree->dirty[child])
+                stack.push_back(child);
+        }
+    }
+    std::reverse(order.begin(), order.end());
+
+    std::vector<BeagleOperation> operations(order.size());
+    for (size_t i = 0; i < order.size(); i++) {
+        int node = order[i];
+        int child1 = tree->children[2 * node];
+        int child2 = tree->children[2 * node + 1];
+        BeagleOperation& op = operations[i];
+        op.destinationPartials = node;
+        op.destinationScaleWrite = tree->scaleIndices[node];
+        op.destinationScaleRead = BEAGLE_OP_NONE;
+        op.child1Partials = child1;
+        op.child1TransitionMatrix = tree->matrices[child1];
+        op.child2Partials = child2;
+        op.child2TransitionMatrix = tree->matrices[child2];
+    }
+
+    // scale factors of recomputed nodes are taken out of the cumulative buffer before they are
+    // overwritten and added back afterwards; a reset rebuilds it from every internal node
+    const int cumulativeScaleIndex = tree->cumulativeScaleIndex;
+    const bool reset = tree->resetCumulative;
+    int returnValue = BEAGLE_SUCCESS;
+    if (cumulativeScaleIndex != BEAGLE_OP_NONE) {
+        if (reset) {
+            returnValue = beagleInstance->resetScaleFactors(cumulativeScaleIndex);
+        } else {
+            std::vector<int> removed;
+            for (size_t i = 0; i < order.size(); i++) {
+                if (tree->accumulated[order[i]] != BEAGLE_OP_NONE)
+                    removed.push_back(tree->accumulated[order[i]]);
+            }
+            if (!removed.empty())
+                returnValue = beagleInstance->removeScaleFactors(&removed[0], removed.size(),
+                                                                 cumulativeScaleIndex);
+        }
+    }
+
+    if (returnValue == BEAGLE_SUCCESS && !operations.empty())
+        returnValue = beagleInstance->updatePartials((const int*) &operations[0], operations.size(),
+                                                     BEAGLE_OP_NONE);
+
+    if (returnValue == BEAGLE_SUCCESS && cumulativeScaleIndex != BEAGLE_OP_NONE) {
+        std::vector<int> added;
+        if (reset) {
+            for (int node = 0; node < nodeCount; node++) {
+                tree->accumulated[node] = tree->scaleIndices[node];
+                if (tree->scaleIndices[node] != BEAGLE_OP_NONE)
+                    added.push_back(tree->scaleIndices[node]);
+            }
+        } else {
+            for (size_t i = 0; i < order.size(); i++) {
+                int node = order[i];
+                tree->accumulated[node] = tree->scaleIndices[node];
+                if (tree->scaleIndices[node] != BEAGLE_OP_NONE)
+                    added.push_back(tree->scaleIndices[node]);
+            }
+        }
+        if (!added.empty())
+            returnValue = beagleInstance->accumulateScaleFactors(&added[0], added.size(),
+                                                                 cumulativeScaleIndex);
+    }
+
+    if (returnValue == BEAGLE_SUCCESS) {
+        for (size_t i = 0; i < order.size(); i++)
+            tree->dirty[order[i]] = 0;
+        tree->resetCumulative = false;
+    } else {
+        // the state of the buffers is unknown, start again from scratch on the next call
+        for (int node = 0; node < nodeCount; node++) {
+            if (beagle::isTreeNodeInternal(tree, node))
+                tree->dirty[node] = 1;
+        }
+        tree->resetCumulative = true;
+    }
+
+    if (outOperationCount != NULL)
+        *outOperationCount = operations.size();
+    trace.putInt(operations.size());
+    trace.write(returnValue);
+    DEBUG_END_TIME();
+    return returnValue;
+}
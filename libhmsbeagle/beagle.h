@@ -87,6 +87,18 @@
  * recomputing the entire likelihood every time a new phylogenetic model is
  * evaluated.
  *
+ * TRACING
+ *
+ * If the BEAGLE_TRACE environment variable names a file when the library is
+ * loaded, every call that acts on an instance or command buffer is appended
+ * to that file together with its arguments, return value and wall time.
+ * Calls that only query the library (version, citation, resource list) or
+ * set library-wide options are not recorded; beagleCreateBatchedInstance
+ * and beagleWriteTipStatesFile appear through the calls they make or
+ * enable. The tracereplay example re-executes such a trace on any resource
+ * and reports the time spent in each function, so realistic call sequences
+ * captured from client programs can be used as benchmarks.
+ *
  * @author Likelihood API Working Group
  *
  * @author Daniel Ayres
@@ -128,7 +140,8 @@ enum BeagleReturnCodes {
                                                 *   array */
     BEAGLE_ERROR_NO_RESOURCE            = -6,  /**< No resource matches requirements */
     BEAGLE_ERROR_NO_IMPLEMENTATION      = -7,  /**< No implementation matches requirements */
-    BEAGLE_ERROR_FLOATING_POINT         = -8   /**< Floating-point range exceeded */
+    BEAGLE_ERROR_FLOATING_POINT         = -8,  /**< Floating-point range exceeded */
+    BEAGLE_ERROR_NOT_READY              = -9   /**< An asynchronous computation has not completed yet */
 };
 
 /**
@@ -228,6 +241,77 @@ typedef struct {
     int length;     /**< Length of list */
 } BeagleResourceList;
 
+/**
+ * @brief Entry points timed by instance statistics
+ *
+ * Indices into the per-entry-point arrays of BeagleInstanceStatistics.
+ */
+enum BeagleStatisticsEntryPoints {
+    BEAGLE_STATISTICS_SET_TIP_STATES                                  = 0,  /**< beagleSetTipStates */
+    BEAGLE_STATISTICS_SET_TIP_PARTIALS                                = 1,  /**< beagleSetTipPartials */
+    BEAGLE_STATISTICS_SET_PARTIALS                                    = 2,  /**< beagleSetPartials */
+    BEAGLE_STATISTICS_GET_PARTIALS                                    = 3,  /**< beagleGetPartials */
+    BEAGLE_STATISTICS_SET_EIGEN_DECOMPOSITION                         = 4,  /**< beagleSetEigenDecomposition */
+    BEAGLE_STATISTICS_SET_STATE_FREQUENCIES                           = 5,  /**< beagleSetStateFrequencies */
+    BEAGLE_STATISTICS_SET_CATEGORY_WEIGHTS                            = 6,  /**< beagleSetCategoryWeights */
+    BEAGLE_STATISTICS_SET_PATTERN_WEIGHTS                             = 7,  /**< beagleSetPatternWeights */
+    BEAGLE_STATISTICS_SET_PATTERN_PARTITIONS                          = 8,  /**< beagleSetPatternPartitions */
+    BEAGLE_STATISTICS_SET_CATEGORY_RATES                              = 9,  /**< beagleSetCategoryRates */
+    BEAGLE_STATISTICS_SET_CATEGORY_RATES_WITH_INDEX                   = 10, /**< beagleSetCategoryRatesWithIndex */
+    BEAGLE_STATISTICS_SET_TRANSITION_MATRIX                           = 11, /**< beagleSetTransitionMatrix */
+    BEAGLE_STATISTICS_SET_TRANSITION_MATRICES                         = 12, /**< beagleSetTransitionMatrices */
+    BEAGLE_STATISTICS_GET_TRANSITION_MATRIX                           = 13, /**< beagleGetTransitionMatrix */
+    BEAGLE_STATISTICS_CONVOLVE_TRANSITION_MATRICES                    = 14, /**< beagleConvolveTransitionMatrices */
+    BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES                      = 15, /**< beagleUpdateTransitionMatrices */
+    BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES_WITH_MULTIPLE_MODELS = 16, /**< beagleUpdateTransitionMatricesWithMultipleModels */
+    BEAGLE_STATISTICS_UPDATE_PARTIALS                                 = 17, /**< beagleUpdatePartials */
+    BEAGLE_STATISTICS_UPDATE_PARTIALS_BY_PARTITION                    = 18, /**< beagleUpdatePartialsByPartition */
+    BEAGLE_STATISTICS_WAIT_FOR_PARTIALS                               = 19, /**< beagleWaitForPartials */
+    BEAGLE_STATISTICS_ACCUMULATE_SCALE_FACTORS                        = 20, /**< beagleAccumulateScaleFactors */
+    BEAGLE_STATISTICS_ACCUMULATE_SCALE_FACTORS_BY_PARTITION           = 21, /**< beagleAccumulateScaleFactorsByPartition */
+    BEAGLE_STATISTICS_REMOVE_SCALE_FACTORS                            = 22, /**< beagleRemoveScaleFactors */
+    BEAGLE_STATISTICS_REMOVE_SCALE_FACTORS_BY_PARTITION               = 23, /**< beagleRemoveScaleFactorsByPartition */
+    BEAGLE_STATISTICS_RESET_SCALE_FACTORS                             = 24, /**< beagleResetScaleFactors */
+    BEAGLE_STATISTICS_RESET_SCALE_FACTORS_BY_PARTITION                = 25, /**< beagleResetScaleFactorsByPartition */
+    BEAGLE_STATISTICS_COPY_SCALE_FACTORS                              = 26, /**< beagleCopyScaleFactors */
+    BEAGLE_STATISTICS_GET_SCALE_FACTORS                               = 27, /**< beagleGetScaleFactors */
+    BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS                  = 28, /**< beagleCalculateRootLogLikelihoods */
+    BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS_BY_PARTITION     = 29, /**< beagleCalculateRootLogLikelihoodsByPartition */
+    BEAGLE_STATISTICS_CALCULATE_ROOT_LOG_LIKELIHOODS_ASYNC            = 30, /**< beagleCalculateRootLogLikelihoodsAsync */
+    BEAGLE_STATISTICS_GET_ROOT_LOG_LIKELIHOODS_ASYNC                  = 31, /**< beagleGetRootLogLikelihoodsAsync */
+    BEAGLE_STATISTICS_CALCULATE_EDGE_LOG_LIKELIHOODS                  = 32, /**< beagleCalculateEdgeLogLikelihoods */
+    BEAGLE_STATISTICS_CALCULATE_EDGE_LOG_LIKELIHOODS_BY_PARTITION     = 33, /**< beagleCalculateEdgeLogLikelihoodsByPartition */
+    BEAGLE_STATISTICS_GET_SITE_LOG_LIKELIHOODS                        = 34, /**< beagleGetSiteLogLikelihoods */
+    BEAGLE_STATISTICS_GET_SITE_DERIVATIVES                            = 35, /**< beagleGetSiteDerivatives */
+    BEAGLE_STATISTICS_EXECUTE_COMMAND_BUFFER                          = 36, /**< beagleExecuteCommandBuffer */
+    BEAGLE_STATISTICS_SNAPSHOT_BUFFERS                                = 37, /**< beagleSnapshotBuffers */
+    BEAGLE_STATISTICS_RESTORE_SNAPSHOT                                = 38, /**< beagleRestoreSnapshot */
+    BEAGLE_STATISTICS_PREPARE_EDGE_PROJECTION                         = 39, /**< beaglePrepareEdgeProjection */
+    BEAGLE_STATISTICS_CALCULATE_EDGE_PROJECTION_LOG_LIKELIHOODS       = 40, /**< beagleCalculateEdgeProjectionLogLikelihoods */
+    BEAGLE_STATISTICS_UPDATE_TREE_PARTIALS                            = 41, /**< beagleUpdateTreePartials */
+    BEAGLE_STATISTICS_CONVOLVE_TRANSITION_MATRIX_CHAINS               = 42, /**< beagleConvolveTransitionMatrixChains */
+    BEAGLE_STATISTICS_SET_RATE_MATRIX                                 = 43, /**< beagleSetRateMatrix */
+    BEAGLE_STATISTICS_UPDATE_TRANSITION_MATRICES_FROM_RATE_MATRIX     = 44, /**< beagleUpdateTransitionMatricesFromRateMatrix */
+    BEAGLE_STATISTICS_SET_INVARIANT_SITES                             = 45, /**< beagleSetInvariantSites */
+    BEAGLE_STATISTICS_ENTRY_POINT_COUNT                               = 46  /**< Number of timed entry points */
+};
+
+/**
+ * @brief Runtime statistics of an instance
+ *
+ * Filled by beagleGetInstanceStatistics for an instance on which collection was enabled with
+ * beagleSetInstanceStatistics. Counters that do not apply to an implementation are zero.
+ */
+typedef struct {
+    long   callCount[BEAGLE_STATISTICS_ENTRY_POINT_COUNT]; /**< Calls made to each entry point */
+    double wallTime[BEAGLE_STATISTICS_ENTRY_POINT_COUNT];  /**< Wall time spent in each entry point, in seconds */
+    double patternOperations; /**< Partials operations weighted by the number of patterns each one covers */
+    long   rescaleCount;      /**< Partials operations that computed new scale factors */
+    double bytesTransferred;  /**< Bytes copied between host and device memory */
+    double deviceWaitTime;    /**< Seconds the host spent blocked waiting on the device */
+    double threadIdleTime;    /**< Seconds worker threads spent idle within threaded calls */
+} BeagleInstanceStatistics;
+
 /* using C calling conventions so that C programs can successfully link the beagle library
  * (brace is closed at the end of this file)
  */
@@ -260,16 +344,43 @@ BEAGLE_DLLEXPORT const char* beagleGetCitation(void);
  * This function returns a pointer to a BeagleResourceList struct, which includes
  * a BeagleResource array describing the available hardware resources.
  *
+ * Plugins are loaded on first use. The BEAGLE_PLUGINS environment variable may name a
+ * comma-separated allow-list of plugins (e.g. "cpu,cpu-sse"); others are never opened.
+ * Resources of plugins loaded later are appended, so resource numbers stay valid.
+ *
  * @return A list of hardware resources available to the library as a BeagleResourceList
  */
 BEAGLE_DLLEXPORT BeagleResourceList* beagleGetResourceList(void);
 
+/**
+ * @brief Select implementations by benchmark
+ *
+ * When enabled, beagleCreateInstance times each resource and implementation pair that meets
+ * the requirement flags on a small synthetic problem with the requested state count, pattern
+ * count and category count, and creates the fastest one instead of the best-scoring one.
+ * Only implementations of the precision that flag scoring would have chosen are compared.
+ * Decisions are kept per host and shape, with pattern counts rounded up to a power of two.
+ * They last for the process and, if cacheFileName is given, are kept in that file, one line
+ * per host and shape, and reused by later processes. Lines written by other library versions
+ * or that cannot be parsed are ignored and dropped when the file is next written.
+ *
+ * @param enabled           Non-zero to benchmark candidates, zero to rank by flags only (input)
+ * @param cacheFileName     File to read and record decisions, or NULL to keep them in memory (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetAutoselect(int enabled,
+                                         const char* cacheFileName);
+
 /**
  * @brief Create a single instance
  *
  * This function creates a single instance of the BEAGLE library and can be called
  * multiple times to create multiple data partition instances each returning a unique
- * identifier.
+ * identifier. Instances may be created and finalized concurrently from several threads;
+ * identifiers of finalized instances are never handed out again, although their storage is
+ * reused. If requirementFlags include BEAGLE_FLAG_FRAMEWORK_CPU and no resourceList is given,
+ * only the CPU plugins are loaded.
  *
  * @param tipCount              Number of tip data elements (input)
  * @param partialsBufferCount   Number of partials buffers to create (input)
@@ -310,6 +421,128 @@ BEAGLE_DLLEXPORT int beagleCreateInstance(int tipCount,
                          long requirementFlags,
                          BeagleInstanceDetails* returnInfo);
 
+/**
+ * @brief Create a batch of identically-sized problems as one instance
+ *
+ * This function packs batchCount independent problems with identical dimensions (e.g.
+ * bootstrap replicates or per-gene partitions) into a single instance, so that they share
+ * one device allocation and are evaluated by fused kernel launches. Each problem occupies
+ * its own pattern partition: problem k owns patterns [k * patternCount, (k + 1) * patternCount)
+ * of every tip, partials and pattern weights array, and eigen/matrix buffers
+ * [k * eigenBufferCount, (k + 1) * eigenBufferCount) and [k * matrixBufferCount,
+ * (k + 1) * matrixBufferCount). Problems are then updated with beagleUpdatePartialsByPartition,
+ * beagleCalculateRootLogLikelihoodsByPartition and the other *ByPartition functions using k as
+ * the partition index. Listing all batchCount partitions in order reduces every problem's site
+ * likelihoods in a single launch. The CUDA and OpenCL implementations require stateCount 4
+ * and return BEAGLE_ERROR_NO_IMPLEMENTATION for any other.
+ *
+ * @param batchCount            Number of problems to pack into the instance (input)
+ * @param tipCount              Number of tip data elements per problem (input)
+ * @param partialsBufferCount   Number of partials buffers per problem (input)
+ * @param compactBufferCount    Number of compact state representation buffers per problem (input)
+ * @param stateCount            Number of states in the continuous-time Markov chain (input)
+ * @param patternCount          Number of site patterns per problem (input)
+ * @param eigenBufferCount      Number of rate matrix eigen-decomposition, category weight,
+ *                               category rates, and state frequency buffers per problem (input)
+ * @param matrixBufferCount     Number of transition probability matrix buffers per problem (input)
+ * @param categoryCount         Number of rate categories (input)
+ * @param scaleBufferCount      Number of scale buffers to create, ignored for auto scale or always scale (input)
+ * @param resourceList          List of potential resources on which this instance is allowed
+ *                               (input, NULL implies no restriction)
+ * @param resourceCount         Length of resourceList list (input)
+ * @param preferenceFlags       Bit-flags indicating preferred implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param requirementFlags      Bit-flags indicating required implementation characteristics,
+ *                               see BeagleFlags (input)
+ * @param returnInfo            Pointer to return implementation and resource details
+ *
+ * @return the unique instance identifier (<0 if failed, see @ref BEAGLE_RETURN_CODES
+ * "BeagleReturnCodes")
+ */
+BEAGLE_DLLEXPORT int beagleCreateBatchedInstance(int batchCount,
+                                                 int tipCount,
+                                                 int partialsBufferCount,
+                                                 int compactBufferCount,
+                                                 int stateCount,
+                                                 int patternCount,
+                                                 int eigenBufferCount,
+                                                 int matrixBufferCount,
+                                                 int categoryCount,
+                                                 int scaleBufferCount,
+                                                 int* resourceList,
+                                                 int resourceCount,
+                                                 long preferenceFlags,
+                                                 long requirementFlags,
+                                                 BeagleInstanceDetails* returnInfo);
+
+/**
+ * @brief Limit the device memory used for partials buffers
+ *
+ * This function sets an upper bound on the device memory an instance may use for its
+ * partials buffers. Device partials are allocated on first use rather than in
+ * beagleCreateInstance, so this function must be called before any partials are set or
+ * computed. When more internal-node partials buffers are live than the budget allows, the
+ * least recently used buffers are spilled to host memory and copied back on their next use;
+ * operations are then issued one at a time. Pattern partitions that require reordering are
+ * not supported under a budget. Implementations without device memory return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance          Instance number (input)
+ * @param budgetMegabytes   Device memory available to partials buffers, in megabytes (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetDeviceMemoryBudget(int instance,
+                                                 int budgetMegabytes);
+
+/**
+ * @brief Set the size of the transition matrix cache of an instance
+ *
+ * This function lets beagleUpdateTransitionMatrices reuse matrices it has computed before.
+ * Each cached entry holds the matrix of one rate category and is found again by an exact match
+ * of the eigen-decomposition index and of the category rate times the edge length, for example
+ * when a rejected proposal restores an old edge length or when many edges share a length.
+ * Entries of an eigen-decomposition are dropped when it is set again. Matrices computed together
+ * with derivatives are not cached. Setting a new size empties the cache; zero, the default,
+ * disables it. Implementations without a cache return BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance      Instance number (input)
+ * @param cacheSize     Maximum number of cached single-category matrices (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTransitionMatrixCache(int instance,
+                                                    int cacheSize);
+
+/**
+ * @brief Enable or disable the collection of instance statistics
+ *
+ * This function turns on run-time statistics for an instance, or turns them off again.
+ * Enabling collection resets all counters to zero. While collection is disabled, the only
+ * cost to each call is a single check.
+ *
+ * @param instance  Instance number (input)
+ * @param enable    Non-zero to collect statistics, zero to stop (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetInstanceStatistics(int instance,
+                                                 int enable);
+
+/**
+ * @brief Get instance statistics
+ *
+ * This function returns the statistics collected since they were last enabled on this
+ * instance. It returns BEAGLE_ERROR_GENERAL if collection is not enabled.
+ *
+ * @param instance          Instance number (input)
+ * @param outStatistics     Pointer to a statistics structure to fill (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleGetInstanceStatistics(int instance,
+                                                 BeagleInstanceStatistics* outStatistics);
+
 /**
  * @brief Finalize this instance
  *
@@ -321,6 +554,114 @@ BEAGLE_DLLEXPORT int beagleCreateInstance(int tipCount,
  */
 BEAGLE_DLLEXPORT int beagleFinalizeInstance(int instance);
 
+/**
+ * @brief Clone an instance
+ *
+ * This function creates a new instance with the same dimensions, resource and implementation
+ * as an existing instance and copies its complete state (tip data, partials, scale buffers,
+ * eigen-decompositions, category rates and weights, state frequencies, pattern weights and
+ * partitions, and transition matrices) into it without converting through host doubles.
+ * Cloning is currently only implemented for CPU instances; GPU instances return
+ * BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance      Instance number to clone (input)
+ * @param returnInfo    Pointer to return implementation and resource details of the clone
+ *
+ * @return the instance identifier of the clone (<0 if failed, see @ref BEAGLE_RETURN_CODES
+ * "BeagleReturnCodes")
+ */
+BEAGLE_DLLEXPORT int beagleCloneInstance(int instance,
+                                         BeagleInstanceDetails* returnInfo);
+
+/**
+ * @brief Take a snapshot of selected buffers
+ *
+ * This function copies a set of partials, scale and transition matrix buffers into storage
+ * owned by the instance, so that they can be put back with beagleRestoreSnapshot, e.g. when
+ * an MCMC proposal is rejected. Copies stay in device memory for GPU instances. Taking a new
+ * snapshot under an existing snapshot index replaces it and reuses its storage. Snapshots are
+ * not available with BEAGLE_FLAG_SCALING_AUTO.
+ *
+ * @param instance          Instance number (input)
+ * @param snapshotIndex     Index of the snapshot, any non-negative number (input)
+ * @param partialsIndices   List of partials buffer indices to copy (input)
+ * @param partialsCount     Number of partials buffers (input)
+ * @param scaleIndices      List of scale buffer indices to copy (input)
+ * @param scaleCount        Number of scale buffers (input)
+ * @param matrixIndices     List of transition matrix buffer indices to copy (input)
+ * @param matrixCount       Number of transition matrix buffers (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSnapshotBuffers(int instance,
+                                           int snapshotIndex,
+                                           const int* partialsIndices,
+                                           int partialsCount,
+                                           const int* scaleIndices,
+                                           int scaleCount,
+                                           const int* matrixIndices,
+                                           int matrixCount);
+
+/**
+ * @brief Restore a snapshot
+ *
+ * This function copies the buffers saved by beagleSnapshotBuffers back to where they were
+ * taken from. The snapshot stays valid and can be restored again.
+ *
+ * @param instance          Instance number (input)
+ * @param snapshotIndex     Index of the snapshot (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRestoreSnapshot(int instance,
+                                           int snapshotIndex);
+
+/**
+ * @brief Release a snapshot
+ *
+ * This function frees the storage held by a snapshot.
+ *
+ * @param instance          Instance number (input)
+ * @param snapshotIndex     Index of the snapshot (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleReleaseSnapshot(int instance,
+                                           int snapshotIndex);
+
+/**
+ * @brief Save the state of an instance to a file
+ *
+ * This function writes the raw, padded buffers of an instance (partials, tip states, scale
+ * buffers, eigen-decompositions, transition matrices, category rates and weights, state
+ * frequencies, pattern weights and pattern partitions) to a binary file. The file starts with
+ * a versioned header and section table, and every section starts on a 64-byte boundary so that
+ * it can be memory-mapped. Files are only portable between instances of the same precision,
+ * padding and byte order.
+ *
+ * @param instance          Instance number (input)
+ * @param fileName          Path of the file to write (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSaveInstance(int instance,
+                                        const char* fileName);
+
+/**
+ * @brief Load the state of an instance from a file
+ *
+ * This function reads a file written by beagleSaveInstance into an instance. The instance must
+ * have been created with the same arguments as the saved instance and on an implementation with
+ * the same precision and padding; otherwise BEAGLE_ERROR_GENERAL is returned.
+ *
+ * @param instance          Instance number (input)
+ * @param fileName          Path of the file to read (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleLoadInstance(int instance,
+                                        const char* fileName);
+
 /**
  * @brief Finalize the library
  *
@@ -349,6 +690,66 @@ BEAGLE_DLLEXPORT int beagleSetTipStates(int instance,
                        int tipIndex,
                        const int* inStates);
 
+/**
+ * @brief Set the compact state representation for tip node from caller-owned memory
+ *
+ * This function is like beagleSetTipStates, but takes one-byte state codes and, where the
+ * implementation allows it, uses inStates directly instead of copying it. CPU implementations
+ * store tip states as one-byte codes and use inStates directly when the pattern count needs no
+ * padding and every code lies in 0 to stateCount (missing = stateCount); otherwise the states are
+ * copied as by beagleSetTipStates. The caller must keep inStates unchanged and allocated until the
+ * tip is set again or the instance is finalized.
+ *
+ * @param instance  Instance number (input)
+ * @param tipIndex  Index of destination compactBuffer (input)
+ * @param inStates  Pointer to one-byte compact states, patternCount in length (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTipStatesExternal(int instance,
+                                                int tipIndex,
+                                                const unsigned char* inStates);
+
+/**
+ * @brief Write compact tip states to a file that beagleMapTipStatesFile can map
+ *
+ * The file starts with a 64-byte header (the characters "BEAGLETS", a byte-order marker
+ * 0x01020304, the format version, tipCount, patternCount and stateCount, each as a 32-bit integer)
+ * followed by the states of each tip as one-byte codes. The states of every tip start on a
+ * 64-byte boundary. States of stateCount or greater are stored as stateCount (missing), so
+ * stateCount must be less than 255.
+ *
+ * @param fileName      Path of the file to write (input)
+ * @param tipCount      Number of tips (input)
+ * @param patternCount  Number of site patterns (input)
+ * @param stateCount    Number of states (input)
+ * @param inStates      Compact states of all tips, patternCount per tip (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleWriteTipStatesFile(const char* fileName,
+                                              int tipCount,
+                                              int patternCount,
+                                              int stateCount,
+                                              const int* inStates);
+
+/**
+ * @brief Set the compact states of all tips from a memory-mapped file
+ *
+ * This function maps a file written by beagleWriteTipStatesFile read-only and sets the tips
+ * 0 to tipCount - 1 from it as by beagleSetTipStatesExternal, so that the states are shared with
+ * the page cache rather than copied where the implementation allows it. The mapping is released
+ * when the instance is finalized or another file is mapped. The tip, pattern and state counts of
+ * the file must match the instance.
+ *
+ * @param instance  Instance number (input)
+ * @param fileName  Path of the file to map (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleMapTipStatesFile(int instance,
+                                            const char* fileName);
+
 /**
  * @brief Set an instance partials buffer for tip node
  *
@@ -435,6 +836,29 @@ BEAGLE_DLLEXPORT int beagleSetEigenDecomposition(int instance,
 BEAGLE_DLLEXPORT int beagleSetStateFrequencies(int instance,
                                          int stateFrequenciesIndex,
                                          const double* inStateFrequencies);    
+
+/**
+ * @brief Set a proportion of invariable sites
+ *
+ * This function adds an invariable-sites component to every site likelihood computed by the
+ * instance, in place of an extra rate category with rate zero. Site likelihoods become
+ * L = L_v + p * sum_s pi_s c_s, where L_v is the likelihood over the category weights as
+ * passed (which should sum to 1 - p), pi are the given state frequencies and c_s is the
+ * product over tips of the likelihood of each tip being in state s. Patterns that cannot be
+ * constant are detected once from the tip data and skip the component. The tip products are
+ * recomputed after tip data is set; tip states given with beagleSetTipStatesExternal and
+ * modified in place require another call to this function. A proportion of zero removes the
+ * component. Implementations without this option return BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance              Instance number (input)
+ * @param proportionInvariant   Proportion of invariable sites, in [0, 1) (input)
+ * @param stateFrequenciesIndex Index of state frequencies buffer of the invariable sites (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetInvariantSites(int instance,
+                                             double proportionInvariant,
+                                             int stateFrequenciesIndex);
     
 /**
  * @brief Set a category weights buffer
@@ -531,7 +955,9 @@ BEAGLE_DLLEXPORT int beagleSetPatternPartitions(int instance,
 /**
  * @brief Convolve lists of transition probability matrices
  *
- * This function convolves two lists of transition probability matrices.
+ * This function convolves two lists of transition probability matrices. Each result is the
+ * matrix product of the first and second matrix for every rate category. On CPU a result index
+ * may equal its own first or second index; GPU implementations do not allow this.
  *
  * @param instance                  Instance number (input)
  * @param firstIndices              List of indices of the first transition probability matrices 
@@ -548,6 +974,31 @@ BEAGLE_DLLEXPORT int beagleConvolveTransitionMatrices(int instance,
                                     const int* resultIndices,
                                     int matrixCount);
 
+/**
+ * @brief Convolve chains of transition probability matrices
+ *
+ * This function multiplies each chain of transition probability matrices, left to right, into
+ * one result matrix for every rate category, as needed for an edge crossing several epochs. A
+ * chain of length one copies its matrix. The matrices of all chains are listed back to back in
+ * matrixIndices. A result may overwrite a matrix of its own chain, but must not be read by
+ * another chain in the same call. GPU implementations only support chains of length two.
+ *
+ * @param instance                  Instance number (input)
+ * @param matrixIndices             Indices of the transition probability matrices of all chains
+ *                                   in order (input)
+ * @param chainLengths              Number of matrices in each chain (input)
+ * @param resultIndices             List of indices of resulting transition probability matrices
+ *                                   (input)
+ * @param chainCount                Number of chains
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleConvolveTransitionMatrixChains(int instance,
+                                                          const int* matrixIndices,
+                                                          const int* chainLengths,
+                                                          const int* resultIndices,
+                                                          int chainCount);
+
 /**
  * @brief Calculate a list of transition probability matrices
  *
@@ -604,6 +1055,49 @@ BEAGLE_DLLEXPORT int beagleUpdateTransitionMatricesWithMultipleModels(int instan
                                                                       const double* edgeLengths,
                                                                       int count);
 
+/**
+ * @brief Set an instantaneous rate matrix
+ *
+ * This function copies a rate matrix Q into an instance, as an alternative to an
+ * eigen-decomposition for models whose Q is not symmetrizable or not diagonalizable, such as
+ * irreversible codon or epoch models. Off-diagonal rates must be non-negative and each diagonal
+ * entry is normally minus the sum of its row. Rate matrices share their index range with
+ * eigen-decomposition buffers but are stored separately. Implementations without this backend
+ * return BEAGLE_ERROR_NO_IMPLEMENTATION.
+ *
+ * @param instance          Instance number (input)
+ * @param rateMatrixIndex   Index of rate matrix buffer (input)
+ * @param inRateMatrix      Rate matrix, stateCount x stateCount in row-major order (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetRateMatrix(int instance,
+                                         int rateMatrixIndex,
+                                         const double* inRateMatrix);
+
+/**
+ * @brief Calculate a list of transition probability matrices from a rate matrix
+ *
+ * This function computes P(t r) = exp(Q t r) for each edge length t and each category rate r
+ * by uniformization, without an eigen-decomposition. Powers of the uniformized matrix are
+ * computed once and shared by all matrices of the call and of later calls; rate matrices with
+ * few non-zero rates are multiplied sparsely. Derivatives are not computed.
+ *
+ * @param instance                  Instance number (input)
+ * @param rateMatrixIndex           Index of rate matrix buffer (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param edgeLengths               List of edge lengths with which to perform calculations (input)
+ * @param count                     Length of lists
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTransitionMatricesFromRateMatrix(int instance,
+                                                                  int rateMatrixIndex,
+                                                                  const int* probabilityIndices,
+                                                                  const double* edgeLengths,
+                                                                  int count);
+
 /**
  * @brief Set a finite-time transition probability matrix
  *
@@ -938,6 +1432,67 @@ BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsByPartition(int instance,
                                                                   double* outSumLogLikelihoodByPartition,
                                                                   double* outSumLogLikelihood);
 
+/**
+ * @brief Start calculating the log likelihood at a root node without waiting for the result
+ *
+ * This function queues the same integration as beagleCalculateRootLogLikelihoods (when
+ * partitionIndices is NULL) or beagleCalculateRootLogLikelihoodsByPartition, but returns
+ * as soon as the work has been submitted. The site log likelihoods are reduced on the
+ * device to one scalar per partition, so only partitionCount values are read back. The
+ * result is collected with beagleGetRootLogLikelihoodsAsync, and the caller may queue
+ * further work (e.g. transition matrix updates) in the meantime. Synchronous likelihood
+ * calls made before the result is collected do not overwrite it.
+ *
+ * CPU implementations compute the log likelihoods before this function returns and only
+ * store them for beagleGetRootLogLikelihoodsAsync.
+ *
+ * @param instance                 Instance number (input)
+ * @param bufferIndices            List of partialsBuffer indices to integrate (input). There
+ *                                  should be one index for each of partitionIndices
+ * @param categoryWeightsIndices   List of weights to apply to each partialsBuffer (input)
+ * @param stateFrequenciesIndices  List of state frequencies for each partialsBuffer (input)
+ * @param cumulativeScaleIndices   List of scaleBuffers containing accumulated factors to apply to
+ *                                  each partialsBuffer (input)
+ * @param partitionIndices         List of partition indices, or NULL to integrate over all
+ *                                  patterns (input)
+ * @param partitionCount           Number of partitionIndices, must be 1 if partitionIndices is
+ *                                  NULL (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateRootLogLikelihoodsAsync(int instance,
+                                                            const int* bufferIndices,
+                                                            const int* categoryWeightsIndices,
+                                                            const int* stateFrequenciesIndices,
+                                                            const int* cumulativeScaleIndices,
+                                                            const int* partitionIndices,
+                                                            int partitionCount);
+
+/**
+ * @brief Retrieve the result of the last root log likelihood calculation
+ *
+ * This function returns the log likelihoods queued by the most recent call to
+ * beagleCalculateRootLogLikelihoodsAsync. If blocking is zero and the calculation
+ * has not finished, the function returns BEAGLE_ERROR_NOT_READY immediately and
+ * can be polled again later. The result stays available until the next call to
+ * beagleCalculateRootLogLikelihoodsAsync; if nothing has been queued the function
+ * returns BEAGLE_ERROR_GENERAL. On CPU implementations the result is always ready,
+ * so blocking has no effect.
+ *
+ * @param instance                         Instance number (input)
+ * @param blocking                         Wait for the calculation to finish if non-zero (input)
+ * @param outSumLogLikelihoodByPartition   Pointer to destination for resulting log likelihoods
+ *                                          for each partition, may be NULL (output)
+ * @param outSumLogLikelihood              Pointer to destination for resulting log likelihood
+ *                                          (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleGetRootLogLikelihoodsAsync(int instance,
+                                                      int blocking,
+                                                      double* outSumLogLikelihoodByPartition,
+                                                      double* outSumLogLikelihood);
+
 /**
  * @brief Calculate site log likelihoods and derivatives along an edge
  *
@@ -1034,6 +1589,64 @@ BEAGLE_DLLEXPORT int beagleCalculateEdgeLogLikelihoodsByPartition(
                                                     double* outSumSecondDerivativeByPartition,
                                                     double* outSumSecondDerivative);
 
+/**
+ * @brief Project an edge onto the eigenvectors of a substitution model
+ *
+ * This function prepares fast repeated evaluation of one edge at different branch lengths,
+ * as done by branch-length optimizers. The parent and child partials are combined with the
+ * category weights, state frequencies and the eigenvectors, so that each site likelihood
+ * becomes a sum of categoryCount * stateCount terms of the form c * exp(lambda * rate * t).
+ * The category rates in effect when this function is called are used. The projection is
+ * kept until the next call to this function; changes to the partials, eigen-decomposition,
+ * weights, frequencies or scale factors afterwards require a new call.
+ *
+ * Models with complex eigenvalues and instances created with BEAGLE_FLAG_SCALING_AUTO or
+ * BEAGLE_FLAG_SCALING_ALWAYS return BEAGLE_ERROR_NO_IMPLEMENTATION, as do implementations
+ * without support for projections.
+ *
+ * @param instance                  Instance number (input)
+ * @param parentBufferIndex         Index of parent partialsBuffer (input)
+ * @param childBufferIndex          Index of child partialsBuffer or tip states (input)
+ * @param eigenIndex                Index of eigen-decomposition buffer (input)
+ * @param categoryWeightsIndex      Index of category weights buffer (input)
+ * @param stateFrequenciesIndex     Index of state frequencies buffer (input)
+ * @param cumulativeScaleIndex      Index of scaleBuffer containing accumulated factors to apply,
+ *                                   or BEAGLE_OP_NONE (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beaglePrepareEdgeProjection(int instance,
+                                                 int parentBufferIndex,
+                                                 int childBufferIndex,
+                                                 int eigenIndex,
+                                                 int categoryWeightsIndex,
+                                                 int stateFrequenciesIndex,
+                                                 int cumulativeScaleIndex);
+
+/**
+ * @brief Calculate the log likelihood and derivatives of a projected edge
+ *
+ * This function evaluates the edge last prepared with beaglePrepareEdgeProjection at a
+ * given branch length. Each call computes only categoryCount * stateCount exponentials, and
+ * no transition matrices. Results are also available through beagleGetSiteLogLikelihoods and
+ * beagleGetSiteDerivatives. BEAGLE_ERROR_GENERAL is returned if no edge has been prepared.
+ *
+ * @param instance                  Instance number (input)
+ * @param edgeLength                Length of the edge in expected substitutions per site (input)
+ * @param outSumLogLikelihood       Pointer to destination for resulting log likelihood (output)
+ * @param outSumFirstDerivative     Pointer to destination for resulting first derivative, or
+ *                                   NULL (output)
+ * @param outSumSecondDerivative    Pointer to destination for resulting second derivative, or
+ *                                   NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleCalculateEdgeProjectionLogLikelihoods(int instance,
+                                                                 double edgeLength,
+                                                                 double* outSumLogLikelihood,
+                                                                 double* outSumFirstDerivative,
+                                                                 double* outSumSecondDerivative);
+
 /**
  * @brief Get site log likelihoods for last beagleCalculateRootLogLikelihoods or
  *         beagleCalculateEdgeLogLikelihoods call
@@ -1062,6 +1675,225 @@ BEAGLE_DLLEXPORT int beagleGetSiteLogLikelihoods(int instance,
 BEAGLE_DLLEXPORT int beagleGetSiteDerivatives(int instance,
                                     double* outFirstDerivatives,
                                     double* outSecondDerivatives);    
+
+/**
+ * @brief Create a command buffer
+ *
+ * This function creates an empty command buffer for an instance. Commands recorded into the
+ * buffer are checked against the dimensions of the instance once, when they are recorded, and
+ * can then be replayed any number of times with beagleExecuteCommandBuffer. Model parameters
+ * such as eigen-decompositions, category rates or state frequencies are read from the instance
+ * at replay time and can be changed between replays with the usual functions.
+ *
+ * @param instance  Instance number (input)
+ *
+ * @return the command buffer number (>= 0) or an error code (< 0)
+ */
+BEAGLE_DLLEXPORT int beagleCreateCommandBuffer(int instance);
+
+/**
+ * @brief Record a transition probability matrix update
+ *
+ * Records a beagleUpdateTransitionMatrices call. Its edge lengths are not recorded; they are
+ * taken from the edge length list passed to beagleExecuteCommandBuffer, in recording order.
+ *
+ * @param commandBuffer             Command buffer number (input)
+ * @param eigenIndex                Index of eigen-decomposition buffer (input)
+ * @param probabilityIndices        List of indices of transition probability matrices to update
+ *                                   (input)
+ * @param firstDerivativeIndices    List of indices of first derivative matrices to update
+ *                                   (input, NULL implies no calculation)
+ * @param secondDerivativeIndices   List of indices of second derivative matrices to update
+ *                                   (input, NULL implies no calculation)
+ * @param count                     Length of lists
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRecordUpdateTransitionMatrices(int commandBuffer,
+                                                          int eigenIndex,
+                                                          const int* probabilityIndices,
+                                                          const int* firstDerivativeIndices,
+                                                          const int* secondDerivativeIndices,
+                                                          int count);
+
+/**
+ * @brief Record a partials update
+ *
+ * Records a beagleUpdatePartials call.
+ *
+ * @param commandBuffer             Command buffer number (input)
+ * @param operations                List of 7-tuples specifying operations (input)
+ * @param operationCount            Number of operations (input)
+ * @param cumulativeScaleIndex      Index number of scaleBuffer to store accumulated factors (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRecordUpdatePartials(int commandBuffer,
+                                                const BeagleOperation* operations,
+                                                int operationCount,
+                                                int cumulativeScaleIndex);
+
+/**
+ * @brief Record a scale factor accumulation
+ *
+ * Records a beagleAccumulateScaleFactors call.
+ *
+ * @param commandBuffer     Command buffer number (input)
+ * @param scaleIndices      List of scaleBuffers to add (input)
+ * @param count             Number of scaleBuffers in list (input)
+ * @param cumulativeScaleIndex  Index number of scaleBuffer to accumulate factors into (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRecordAccumulateScaleFactors(int commandBuffer,
+                                                        const int* scaleIndices,
+                                                        int count,
+                                                        int cumulativeScaleIndex);
+
+/**
+ * @brief Record a scale factor reset
+ *
+ * Records a beagleResetScaleFactors call.
+ *
+ * @param commandBuffer         Command buffer number (input)
+ * @param cumulativeScaleIndex  Index number of cumulative scaleBuffer (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRecordResetScaleFactors(int commandBuffer,
+                                                   int cumulativeScaleIndex);
+
+/**
+ * @brief Record a root log likelihood calculation
+ *
+ * Records a beagleCalculateRootLogLikelihoods call. Each recorded calculation writes one
+ * value to the log likelihood list passed to beagleExecuteCommandBuffer, in recording order.
+ *
+ * @param commandBuffer             Command buffer number (input)
+ * @param bufferIndices             List of partialsBuffer indices (input)
+ * @param categoryWeightsIndices    List of weights to apply to each partialsBuffer (input)
+ * @param stateFrequenciesIndices   List of state frequencies for each partialsBuffer (input)
+ * @param cumulativeScaleIndices    List of scaleBuffers containing accumulated factors to apply to
+ *                                   each partialsBuffer (input)
+ * @param count                     Number of partialsBuffer to integrate (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleRecordCalculateRootLogLikelihoods(int commandBuffer,
+                                                             const int* bufferIndices,
+                                                             const int* categoryWeightsIndices,
+                                                             const int* stateFrequenciesIndices,
+                                                             const int* cumulativeScaleIndices,
+                                                             int count);
+
+/**
+ * @brief Replay a command buffer
+ *
+ * This function executes the recorded commands in order, stopping at the first error.
+ *
+ * @param commandBuffer         Command buffer number (input)
+ * @param edgeLengths           Edge lengths for all recorded transition probability matrix
+ *                               updates, concatenated in recording order (input)
+ * @param outSumLogLikelihoods  One log likelihood per recorded root log likelihood calculation
+ *                               (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleExecuteCommandBuffer(int commandBuffer,
+                                                const double* edgeLengths,
+                                                double* outSumLogLikelihoods);
+
+/**
+ * @brief Finalize a command buffer
+ *
+ * This function releases a command buffer. Finalizing an instance does not release its
+ * command buffers.
+ *
+ * @param commandBuffer     Command buffer number (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleFinalizeCommandBuffer(int commandBuffer);
+
+/**
+ * @brief Register a rooted binary tree with an instance
+ *
+ * This function describes the tree whose partials the instance holds, so that
+ * beagleUpdateTreePartials can derive the operations needed after a change by itself. Node i is
+ * partials buffer i; nodes below tipCount are the tips and all other nodes must have exactly two
+ * children. Calling this function again after a topology change keeps the partials of every node
+ * whose subtree is unchanged and marks the others for recomputation. An instance holds one tree;
+ * clones do not inherit it.
+ *
+ * @param instance              Instance number (input)
+ * @param nodeCount             Number of nodes, at most the number of partials buffers (input)
+ * @param parentIndices         Parent of each node, BEAGLE_OP_NONE for the root (input)
+ * @param matrixIndices         Transition matrix of the edge above each node; the entry of the
+ *                               root is ignored (input)
+ * @param scaleIndices          Scale buffer written when each internal node is updated, or
+ *                               BEAGLE_OP_NONE; NULL disables scaling (input)
+ * @param cumulativeScaleIndex  Scale buffer kept equal to the sum of the scale factors of all
+ *                               internal nodes, or BEAGLE_OP_NONE (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleSetTreeTopology(int instance,
+                                           int nodeCount,
+                                           const int* parentIndices,
+                                           const int* matrixIndices,
+                                           const int* scaleIndices,
+                                           int cumulativeScaleIndex);
+
+/**
+ * @brief Mark transition matrices of the registered tree as changed
+ *
+ * The parents of all edges that use one of the matrices, and their ancestors, are recomputed by
+ * the next beagleUpdateTreePartials call. BEAGLE_ERROR_GENERAL is returned if no tree has been
+ * registered.
+ *
+ * @param instance          Instance number (input)
+ * @param matrixIndices     List of changed transition matrices (input)
+ * @param count             Length of matrixIndices (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleInvalidateTransitionMatrices(int instance,
+                                                        const int* matrixIndices,
+                                                        int count);
+
+/**
+ * @brief Mark nodes of the registered tree as changed
+ *
+ * An internal node is recomputed by the next beagleUpdateTreePartials call, a tip whose data has
+ * been replaced causes its parent to be recomputed; ancestors follow in both cases.
+ * BEAGLE_ERROR_GENERAL is returned if no tree has been registered.
+ *
+ * @param instance          Instance number (input)
+ * @param bufferIndices     List of changed nodes (input)
+ * @param count             Length of bufferIndices (input)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleInvalidatePartials(int instance,
+                                              const int* bufferIndices,
+                                              int count);
+
+/**
+ * @brief Recompute the partials of the registered tree that are out of date
+ *
+ * This function issues one beagleUpdatePartials call with the changed nodes in post-order and
+ * no other node. When a cumulative scale buffer was registered, the old scale factors of these
+ * nodes are removed from it before the update and the new ones added afterwards. The root
+ * partials can then be integrated with beagleCalculateRootLogLikelihoods.
+ * BEAGLE_ERROR_GENERAL is returned if no tree has been registered.
+ *
+ * @param instance              Instance number (input)
+ * @param outOperationCount     Number of operations that were issued, or NULL (output)
+ *
+ * @return error code
+ */
+BEAGLE_DLLEXPORT int beagleUpdateTreePartials(int instance,
+                                              int* outOperationCount);
     
 /* using C calling conventions so that C programs can successfully link the beagle library
  * (closing brace)
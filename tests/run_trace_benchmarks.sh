@@ -0,0 +1,51 @@
+#!/bin/bash
+
+# Replays recorded call traces on a resource and appends the timings to trace_benchmark_results.csv.
+#
+# Traces are recorded by running a BEAGLE client with BEAGLE_TRACE set, e.g. for the MrBayes
+# analysis in app-benchmarks/v3-app-note:
+#     BEAGLE_TRACE=mcmc-dengue.trace mb mcmc-dengue.nex
+#
+# Usage: run_trace_benchmarks.sh resource_number trace_file [trace_file ...]
+
+function replay_trace {
+    (time ../examples/tracereplay/tracereplay $1 --rsrc $R --$2 --reps 3) &> screen_output
+
+    RSRC_NAME=`grep "Rsrc" screen_output | head -1 | cut -f 2 -d ":"`
+    RSRC_NAME=`echo $RSRC_NAME`
+    IMPL_NAME=`grep "Impl" screen_output | head -1 | cut -f 2 -d ":" | cut -f 1 -d "("`
+    IMPL_NAME=`echo $IMPL_NAME`
+    CALLS=`grep "^total" screen_output | awk '{print $2}'`
+    RECORDED=`grep "^total" screen_output | awk '{print $3}'`
+    BEST_RUN=`grep "best" screen_output | cut -f 3 -d " " | grep -o [0-9.]*`
+    LNL=`grep "logL" screen_output | cut -f 3 -d " "`
+    LNL_DIFF=`grep "logL" screen_output | grep -o "recording [-0-9.e+a-z]*" | cut -f 2 -d " "`
+    TIME_REAL=`grep "real" screen_output | cut -f 2`
+
+    echo -n "$1,$R,$2,$RSRC_NAME,$IMPL_NAME,$CALLS,$LNL,$LNL_DIFF,$RECORDED,$BEST_RUN,$TIME_REAL," >> trace_benchmark_results.csv
+    echo "`date`" >> trace_benchmark_results.csv
+}
+
+if [ -z "${2}" ];
+then
+    echo "Usage: run_trace_benchmarks.sh resource_number trace_file [trace_file ...]"
+    echo
+    ../examples/tracereplay/tracereplay --resourcelist
+    exit 1
+fi
+
+R=${1}
+shift
+
+if [ ! -f trace_benchmark_results.csv ]
+then
+echo "trace,rsrc,precision,rsrc_name,impl_name,calls,lnl,lnl_diff,recorded_time,best_run,time_real,date" >> trace_benchmark_results.csv
+fi
+
+for TRACE in "$@"
+do
+    echo "   replaying $TRACE on resource=$R precision=SINGLE" 1>&2;
+    replay_trace $TRACE "singleprecision"
+    echo "   replaying $TRACE on resource=$R precision=DOUBLE" 1>&2;
+    replay_trace $TRACE "doubleprecision"
+done